@@ -44,6 +44,9 @@ ABSL_FLAG(int32_t, s3client_max_connections, 1,
 ABSL_FLAG(int32_t, s3client_max_range_bytes, 1,
           "S3Client max range bytes for reading data files.");
 ABSL_FLAG(int32_t, num_shards, 1, "Total number of shards.");
+ABSL_FLAG(int32_t, sharding_function_version, 0,
+          "Version of the function that assigns keys to shards, 0 for SHA256 "
+          "and 1 for SipHash.");
 ABSL_FLAG(int32_t, udf_num_workers, 2, "Number of workers for UDF execution.");
 ABSL_FLAG(bool, route_v1_to_v2, false,
           "Whether to route V1 requests through V2.");
@@ -110,6 +113,9 @@ class LocalParameterClient : public ParameterClient {
          absl::GetFlag(FLAGS_s3client_max_range_bytes)});
     int32_t_flag_values_.insert(
         {"kv-server-local-num-shards", absl::GetFlag(FLAGS_num_shards)});
+    int32_t_flag_values_.insert(
+        {"kv-server-local-sharding-function-version",
+         absl::GetFlag(FLAGS_sharding_function_version)});
     int32_t_flag_values_.insert({"kv-server-local-udf-num-workers",
                                  absl::GetFlag(FLAGS_udf_num_workers)});
     // Insert more int32 flag values here.
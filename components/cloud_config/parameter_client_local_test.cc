@@ -92,6 +92,12 @@ TEST(ParameterClientLocal, ExpectedFlagDefaultsArePresent) {
     ASSERT_TRUE(statusor.ok());
     EXPECT_EQ(1, *statusor);
   }
+  {
+    const auto statusor =
+        client->GetInt32Parameter("kv-server-local-sharding-function-version");
+    ASSERT_TRUE(statusor.ok());
+    EXPECT_EQ(0, *statusor);
+  }
   {
     const auto statusor =
         client->GetInt32Parameter("kv-server-local-udf-num-workers");
@@ -17,6 +17,7 @@
 #ifndef COMPONENTS_DATA_SERVER_CACHE_CACHE_H_
 #define COMPONENTS_DATA_SERVER_CACHE_CACHE_H_
 
+#include <cstdint>
 #include <iostream>
 #include <memory>
 #include <string>
@@ -26,7 +27,11 @@
 
 #include "absl/container/flat_hash_map.h"
 #include "absl/container/flat_hash_set.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/types/span.h"
 #include "components/data_server/cache/get_key_value_set_result.h"
+#include "components/query/set_sketch.h"
 
 namespace kv_server {
 
@@ -44,6 +49,26 @@ class Cache {
   virtual std::unique_ptr<GetKeyValueSetResult> GetKeyValueSet(
       const absl::flat_hash_set<std::string_view>& key_set) const = 0;
 
+  // Returns whether each of `candidates` is in the set of `key`, in order,
+  // without reading the rest of the set. A missing set contains nothing.
+  virtual std::vector<bool> GetKeyValueSetMembership(
+      std::string_view key,
+      absl::Span<const std::string_view> candidates) const = 0;
+
+  // Returns the version of the sets of the given keys. The version changes
+  // whenever any of the sets is updated or has values deleted, so a result
+  // computed from the sets is still valid as long as the version read before
+  // computing it is unchanged.
+  virtual int64_t GetKeyValueSetVersion(
+      const absl::flat_hash_set<std::string_view>& key_set) const = 0;
+
+  // Returns the sketches of the sets of the given keys, which estimate the
+  // size of query results without reading the sets. Keys without a set are
+  // missing from the result. Fails if the cache does not maintain sketches.
+  virtual absl::StatusOr<absl::flat_hash_map<std::string, ThetaSketch>>
+  GetKeyValueSetSketches(
+      const absl::flat_hash_set<std::string_view>& key_set) const = 0;
+
   // Inserts or updates the key with the new value.
   virtual void UpdateKeyValue(std::string_view key, std::string_view value,
                               int64_t logical_commit_time) = 0;
@@ -54,6 +79,17 @@ class Cache {
                                  absl::Span<std::string_view> value_set,
                                  int64_t logical_commit_time) = 0;
 
+  // Same as `UpdateKeyValueSet`, for sets of unsigned integers. Their
+  // elements are kept sorted, so that queries over them use integer set
+  // operations. The set of a key holds either strings or integers of one
+  // width, and updates or deletions of another type are ignored.
+  virtual void UpdateKeyValueUInt32Set(std::string_view key,
+                                       absl::Span<const uint32_t> value_set,
+                                       int64_t logical_commit_time) = 0;
+  virtual void UpdateKeyValueUInt64Set(std::string_view key,
+                                       absl::Span<const uint64_t> value_set,
+                                       int64_t logical_commit_time) = 0;
+
   // Deletes a particular (key, value) pair.
   virtual void DeleteKey(std::string_view key, int64_t logical_commit_time) = 0;
 
@@ -64,9 +100,24 @@ class Cache {
                                  absl::Span<std::string_view> value_set,
                                  int64_t logical_commit_time) = 0;
 
+  // Same as `DeleteValuesInSet`, for sets of unsigned integers.
+  virtual void DeleteValuesInUInt32Set(std::string_view key,
+                                       absl::Span<const uint32_t> value_set,
+                                       int64_t logical_commit_time) = 0;
+  virtual void DeleteValuesInUInt64Set(std::string_view key,
+                                       absl::Span<const uint64_t> value_set,
+                                       int64_t logical_commit_time) = 0;
+
   // Removes the values that were deleted before the specified
   // logical_commit_time.
   virtual void RemoveDeletedKeys(int64_t logical_commit_time) = 0;
+
+  // Registers `name` as a set that always holds the result of the set query
+  // `query`, for example `(premium | gold) - blocked`. The set is kept up to
+  // date as the sets it depends on are updated, and is read like any other
+  // set, including from other queries.
+  virtual absl::Status AddMaterializedView(std::string_view name,
+                                           std::string_view query) = 0;
 };
 
 }  // namespace kv_server
@@ -17,11 +17,15 @@
 #ifndef COMPONENTS_DATA_SERVER_CACHE_GET_KEY_VALUE_SET_RESULT_H_
 #define COMPONENTS_DATA_SERVER_CACHE_GET_KEY_VALUE_SET_RESULT_H_
 
+#include <cstdint>
 #include <memory>
+#include <optional>
 #include <utility>
 #include <vector>
 
 #include "absl/container/flat_hash_set.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/span.h"
 
 namespace kv_server {
 // Class that holds the data retrieved from cache lookup and read locks for
@@ -30,8 +34,18 @@ class GetKeyValueSetResult {
  public:
   virtual ~GetKeyValueSetResult() = default;
 
-  // Looks up and returns key-value set result for the given key set.
-  virtual absl::flat_hash_set<std::string_view> GetValueSet(
+  // Looks up and returns key-value set result for the given key set. The set
+  // is valid as long as this object. The elements of a set of unsigned
+  // integers are returned as decimal strings, converted on first use.
+  virtual const absl::flat_hash_set<std::string_view>& GetValueSet(
+      std::string_view key) const = 0;
+
+  // Returns the sorted elements of the set of unsigned integers of `key`,
+  // valid as long as this object. Returns an empty set if `key` has no set,
+  // and nullopt if its set has elements of another type.
+  virtual std::optional<absl::Span<const uint32_t>> GetUInt32ValueSet(
+      std::string_view key) const = 0;
+  virtual std::optional<absl::Span<const uint64_t>> GetUInt64ValueSet(
       std::string_view key) const = 0;
 
  private:
@@ -41,6 +55,15 @@ class GetKeyValueSetResult {
       std::string_view key, absl::flat_hash_set<std::string_view> value_set,
       std::unique_ptr<absl::ReaderMutexLock> key_lock) = 0;
 
+  // Same as `AddKeyValueSet`, for sets of unsigned integers, which are
+  // borrowed as they are.
+  virtual void AddUInt32ValueSet(
+      std::string_view key, absl::Span<const uint32_t> value_set,
+      std::unique_ptr<absl::ReaderMutexLock> key_lock) = 0;
+  virtual void AddUInt64ValueSet(
+      std::string_view key, absl::Span<const uint64_t> value_set,
+      std::unique_ptr<absl::ReaderMutexLock> key_lock) = 0;
+
   static std::unique_ptr<GetKeyValueSetResult> Create();
 
   friend class KeyValueCache;
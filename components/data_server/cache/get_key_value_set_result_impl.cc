@@ -14,12 +14,18 @@
  * limitations under the License.
  */
 
+#include <cstdint>
 #include <memory>
+#include <optional>
+#include <string>
 #include <utility>
 #include <vector>
 
 #include "absl/container/flat_hash_map.h"
 #include "absl/container/flat_hash_set.h"
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/span.h"
 #include "components/data_server/cache/get_key_value_set_result.h"
 
 namespace kv_server {
@@ -33,24 +39,89 @@ class GetKeyValueSetResultImpl : public GetKeyValueSetResult {
 
   // Looks up the key in the data map and returns value set. If the value_set
   // for the key is missing, returns empty set.
-  absl::flat_hash_set<std::string_view> GetValueSet(
+  const absl::flat_hash_set<std::string_view>& GetValueSet(
       std::string_view key) const override {
     static const absl::flat_hash_set<std::string_view>* kEmptySet =
         new absl::flat_hash_set<std::string_view>();
-    auto key_itr = data_map_.find(key);
-    return key_itr == data_map_.end() ? *kEmptySet : key_itr->second;
+    if (const auto key_itr = data_map_.find(key); key_itr != data_map_.end()) {
+      return key_itr->second;
+    }
+    if (const auto key_itr = uint32_sets_.find(key);
+        key_itr != uint32_sets_.end()) {
+      return ToStringValueSet(key, key_itr->second);
+    }
+    if (const auto key_itr = uint64_sets_.find(key);
+        key_itr != uint64_sets_.end()) {
+      return ToStringValueSet(key, key_itr->second);
+    }
+    return *kEmptySet;
+  }
+
+  std::optional<absl::Span<const uint32_t>> GetUInt32ValueSet(
+      std::string_view key) const override {
+    if (const auto key_itr = uint32_sets_.find(key);
+        key_itr != uint32_sets_.end()) {
+      return key_itr->second;
+    }
+    if (data_map_.contains(key) || uint64_sets_.contains(key)) {
+      return std::nullopt;
+    }
+    return absl::Span<const uint32_t>();
+  }
+
+  std::optional<absl::Span<const uint64_t>> GetUInt64ValueSet(
+      std::string_view key) const override {
+    if (const auto key_itr = uint64_sets_.find(key);
+        key_itr != uint64_sets_.end()) {
+      return key_itr->second;
+    }
+    if (data_map_.contains(key) || uint32_sets_.contains(key)) {
+      return std::nullopt;
+    }
+    return absl::Span<const uint64_t>();
   }
 
   GetKeyValueSetResultImpl(const GetKeyValueSetResultImpl&) = delete;
   GetKeyValueSetResultImpl& operator=(const GetKeyValueSetResultImpl&) = delete;
-  GetKeyValueSetResultImpl(GetKeyValueSetResultImpl&& other) = default;
-  GetKeyValueSetResultImpl& operator=(GetKeyValueSetResultImpl&& other) =
-      default;
 
  private:
+  // The decimal strings of the elements of a set of unsigned integers, and
+  // the set of views of them that `GetValueSet` returns.
+  struct StringValueSet {
+    std::vector<std::string> values;
+    absl::flat_hash_set<std::string_view> value_set;
+  };
+
   std::vector<std::unique_ptr<absl::ReaderMutexLock>> read_locks_;
   absl::flat_hash_map<std::string_view, absl::flat_hash_set<std::string_view>>
       data_map_;
+  absl::flat_hash_map<std::string_view, absl::Span<const uint32_t>>
+      uint32_sets_;
+  absl::flat_hash_map<std::string_view, absl::Span<const uint64_t>>
+      uint64_sets_;
+  // The sets of unsigned integers converted by `GetValueSet`. Each is
+  // allocated once, so that returned sets stay valid.
+  mutable absl::Mutex string_value_sets_mutex_;
+  mutable absl::flat_hash_map<std::string_view,
+                              std::unique_ptr<StringValueSet>>
+      string_value_sets_ ABSL_GUARDED_BY(string_value_sets_mutex_);
+
+  template <typename T>
+  const absl::flat_hash_set<std::string_view>& ToStringValueSet(
+      std::string_view key, absl::Span<const T> values) const {
+    absl::MutexLock lock(&string_value_sets_mutex_);
+    auto& string_value_set = string_value_sets_[key];
+    if (string_value_set == nullptr) {
+      string_value_set = std::make_unique<StringValueSet>();
+      string_value_set->values.reserve(values.size());
+      for (const T value : values) {
+        string_value_set->values.push_back(absl::StrCat(value));
+      }
+      string_value_set->value_set.insert(string_value_set->values.begin(),
+                                         string_value_set->values.end());
+    }
+    return string_value_set->value_set;
+  }
 
   // Adds key, value_set to the result data map, creates a read lock for
   // the key mutex
@@ -60,6 +131,20 @@ class GetKeyValueSetResultImpl : public GetKeyValueSetResult {
     read_locks_.push_back(std::move(key_lock));
     data_map_.emplace(key, std::move(value_set));
   }
+
+  void AddUInt32ValueSet(
+      std::string_view key, absl::Span<const uint32_t> value_set,
+      std::unique_ptr<absl::ReaderMutexLock> key_lock) override {
+    read_locks_.push_back(std::move(key_lock));
+    uint32_sets_.emplace(key, value_set);
+  }
+
+  void AddUInt64ValueSet(
+      std::string_view key, absl::Span<const uint64_t> value_set,
+      std::unique_ptr<absl::ReaderMutexLock> key_lock) override {
+    read_locks_.push_back(std::move(key_lock));
+    uint64_sets_.emplace(key, value_set);
+  }
 };
 }  // namespace
 
@@ -14,15 +14,22 @@
 #include "components/data_server/cache/key_value_cache.h"
 
 #include <algorithm>
+#include <cstdint>
 #include <memory>
+#include <string>
 #include <string_view>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include "absl/container/flat_hash_map.h"
 #include "absl/memory/memory.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
 #include "absl/synchronization/mutex.h"
 #include "components/data_server/cache/cache.h"
 #include "components/data_server/cache/get_key_value_set_result.h"
+#include "components/query/parse_query.h"
 #include "glog/logging.h"
 #include "src/cpp/telemetry/metrics_recorder.h"
 
@@ -33,6 +40,7 @@ using privacy_sandbox::server_common::ScopeLatencyRecorder;
 
 constexpr char kGetKeyValuePairsEvent[] = "GetKeyValuePairs";
 constexpr char kGetKeyValueSetEvent[] = "GetKeyValueSet";
+constexpr char kGetKeyValueSetMembershipEvent[] = "GetKeyValueSetMembership";
 constexpr char kUpdateKeyValueEvent[] = "UpdateKeyValue";
 constexpr char kUpdateKeyValueSetEvent[] = "UpdateKeyValueSet";
 constexpr char kDeleteKeyEvent[] = "DeleteKey";
@@ -40,6 +48,42 @@ constexpr char kDeleteValuesInSetEvent[] = "DeleteValuesInSet";
 constexpr char kRemoveDeletedKeysEvent[] = "RemoveDeletedKeys";
 constexpr char kCleanUpKeyValueMapEvent[] = "CleanUpKeyValueMap";
 constexpr char kCleanUpKeyValueSetMapEvent[] = "CleanUpKeyValueSetMap";
+constexpr char kUpdateMaterializedViewEvent[] = "UpdateMaterializedView";
+
+namespace {
+
+// Returns whether `value` is the decimal form of an element of
+// `sorted_values`. Other forms of the same number, e.g. with leading zeros,
+// are not, like for a set of strings.
+template <typename T>
+bool ContainsDecimal(absl::Span<const T> sorted_values,
+                     std::string_view value) {
+  T parsed;
+  return absl::SimpleAtoi(value, &parsed) &&
+         absl::AlphaNum(parsed).Piece() == value &&
+         std::binary_search(sorted_values.begin(), sorted_values.end(),
+                            parsed);
+}
+
+template <typename T>
+std::vector<T> SortedUnique(absl::Span<const T> values) {
+  std::vector<T> sorted(values.begin(), values.end());
+  std::sort(sorted.begin(), sorted.end());
+  sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+  return sorted;
+}
+
+template <typename T>
+std::vector<std::string> ToDecimals(absl::Span<const T> values) {
+  std::vector<std::string> decimals;
+  decimals.reserve(values.size());
+  for (const T value : values) {
+    decimals.push_back(absl::StrCat(value));
+  }
+  return decimals;
+}
+
+}  // namespace
 
 absl::flat_hash_map<std::string, std::string> KeyValueCache::GetKeyValuePairs(
     const absl::flat_hash_set<std::string_view>& key_set) const {
@@ -69,6 +113,22 @@ std::unique_ptr<GetKeyValueSetResult> KeyValueCache::GetKeyValueSet(
   auto result = GetKeyValueSetResult::Create();
   for (const auto& key : key_set) {
     VLOG(8) << "Getting key: " << key;
+    if (const auto key_itr = key_to_uint32_set_map_.find(key);
+        key_itr != key_to_uint32_set_map_.end()) {
+      auto set_lock =
+          std::make_unique<absl::ReaderMutexLock>(&key_itr->second->first);
+      result->AddUInt32ValueSet(key, key_itr->second->second.values,
+                                std::move(set_lock));
+      continue;
+    }
+    if (const auto key_itr = key_to_uint64_set_map_.find(key);
+        key_itr != key_to_uint64_set_map_.end()) {
+      auto set_lock =
+          std::make_unique<absl::ReaderMutexLock>(&key_itr->second->first);
+      result->AddUInt64ValueSet(key, key_itr->second->second.values,
+                                std::move(set_lock));
+      continue;
+    }
     const auto key_itr = key_to_value_set_map_.find(key);
     if (key_itr != key_to_value_set_map_.end()) {
       absl::flat_hash_set<std::string_view> value_set;
@@ -86,6 +146,74 @@ std::unique_ptr<GetKeyValueSetResult> KeyValueCache::GetKeyValueSet(
   return result;
 }
 
+std::vector<bool> KeyValueCache::GetKeyValueSetMembership(
+    std::string_view key, absl::Span<const std::string_view> candidates) const {
+  ScopeLatencyRecorder latency_recorder(kGetKeyValueSetMembershipEvent,
+                                        metrics_recorder_);
+  std::vector<bool> is_member(candidates.size(), false);
+  absl::ReaderMutexLock lock(&set_map_mutex_);
+  if (const auto key_itr = key_to_uint32_set_map_.find(key);
+      key_itr != key_to_uint32_set_map_.end()) {
+    absl::ReaderMutexLock set_lock(&key_itr->second->first);
+    for (size_t i = 0; i < candidates.size(); ++i) {
+      is_member[i] = ContainsDecimal<uint32_t>(key_itr->second->second.values,
+                                               candidates[i]);
+    }
+    return is_member;
+  }
+  if (const auto key_itr = key_to_uint64_set_map_.find(key);
+      key_itr != key_to_uint64_set_map_.end()) {
+    absl::ReaderMutexLock set_lock(&key_itr->second->first);
+    for (size_t i = 0; i < candidates.size(); ++i) {
+      is_member[i] = ContainsDecimal<uint64_t>(key_itr->second->second.values,
+                                               candidates[i]);
+    }
+    return is_member;
+  }
+  const auto key_itr = key_to_value_set_map_.find(key);
+  if (key_itr == key_to_value_set_map_.end()) {
+    return is_member;
+  }
+  absl::ReaderMutexLock set_lock(&key_itr->second->first);
+  const auto& values = key_itr->second->second;
+  for (size_t i = 0; i < candidates.size(); ++i) {
+    const auto value_itr = values.find(candidates[i]);
+    is_member[i] = value_itr != values.end() && !value_itr->second.is_deleted;
+  }
+  return is_member;
+}
+
+int64_t KeyValueCache::GetKeyValueSetVersion(
+    const absl::flat_hash_set<std::string_view>& key_set) const {
+  absl::ReaderMutexLock lock(&set_map_mutex_);
+  int64_t version = 0;
+  for (const auto& key : key_set) {
+    const auto version_itr = set_versions_.find(key);
+    version = std::max(version, version_itr == set_versions_.end()
+                                    ? pruned_set_version_
+                                    : version_itr->second);
+  }
+  return version;
+}
+
+absl::StatusOr<absl::flat_hash_map<std::string, ThetaSketch>>
+KeyValueCache::GetKeyValueSetSketches(
+    const absl::flat_hash_set<std::string_view>& key_set) const {
+  if (!maintain_set_sketches_) {
+    return absl::FailedPreconditionError("Set sketches are not maintained.");
+  }
+  absl::flat_hash_map<std::string, ThetaSketch> sketches;
+  absl::ReaderMutexLock lock(&set_map_mutex_);
+  for (const auto& key : key_set) {
+    const auto sketch_itr = set_sketches_.find(key);
+    if (sketch_itr != set_sketches_.end()) {
+      absl::ReaderMutexLock sketch_lock(&sketch_itr->second->first);
+      sketches.emplace(key, sketch_itr->second->second);
+    }
+  }
+  return sketches;
+}
+
 // Replaces the current key-value entry with the new key-value entry.
 void KeyValueCache::UpdateKeyValue(std::string_view key, std::string_view value,
                                    int64_t logical_commit_time) {
@@ -136,6 +264,8 @@ void KeyValueCache::UpdateKeyValueSet(
   VLOG(9) << "Received update for [" << key << "] at " << logical_commit_time;
   std::unique_ptr<absl::MutexLock> key_lock;
   absl::flat_hash_map<std::string, SetValueMeta>* existing_value_set;
+  bool has_views;
+  std::pair<absl::Mutex, ThetaSketch>* sketch = nullptr;
   // The max cleanup time needs to be locked before doing this comparison
   {
     absl::MutexLock lock_map(&set_map_mutex_);
@@ -149,7 +279,18 @@ void KeyValueCache::UpdateKeyValueSet(
     } else if (input_value_set.empty()) {
       VLOG(1) << "Skipping the update as it has no value in the set.";
       return;
+    } else if (views_.contains(key)) {
+      VLOG(1) << "Skipping the update as " << key
+              << " is a materialized view.";
+      return;
+    } else if (HasOtherSetType<std::string>(key)) {
+      VLOG(1) << "Skipping the update as " << key
+              << " has a set of unsigned integers.";
+      return;
     }
+    has_views = views_by_key_.contains(key);
+    IncrementSetVersion(key);
+    sketch = GetOrCreateSetSketch(key);
     auto key_itr = key_to_value_set_map_.find(key);
     if (key_itr == key_to_value_set_map_.end()) {
       VLOG(9) << key << " is a new key. Adding it";
@@ -163,17 +304,31 @@ void KeyValueCache::UpdateKeyValueSet(
         mutex_value_map_pair->second.emplace(
             value, SetValueMeta{logical_commit_time, /*is_deleted=*/false});
       }
+      if (sketch != nullptr) {
+        UpdateSetSketch(*sketch, input_value_set, {},
+                        mutex_value_map_pair->second);
+      }
       key_to_value_set_map_.emplace(key, std::move(mutex_value_map_pair));
-      return;
+    } else {
+      // The given key has an existing value set, then
+      // update the existing value if update is suggested by the comparison
+      // result on the logical commit times.
+      // Lock the key
+      key_lock = std::make_unique<absl::MutexLock>(&key_itr->second->first);
+      existing_value_set = &key_itr->second->second;
     }
-    // The given key has an existing value set, then
-    // update the existing value if update is suggested by the comparison result
-    // on the logical commit times.
-    // Lock the key
-    key_lock = std::make_unique<absl::MutexLock>(&key_itr->second->first);
-    existing_value_set = &key_itr->second->second;
   }  // end locking map;
+  if (key_lock == nullptr) {
+    // The key was added with all of its values
+    if (has_views) {
+      UpdateMaterializedViews(key, input_value_set, logical_commit_time);
+    }
+    return;
+  }
 
+  // Keep track of the values to re-evaluate in materialized views and to add
+  // to the sketch
+  std::vector<std::string_view> updated_values;
   for (const auto& value : input_value_set) {
     auto& current_value_state = (*existing_value_set)[value];
     if (current_value_state.last_logical_commit_time >= logical_commit_time) {
@@ -185,6 +340,17 @@ void KeyValueCache::UpdateKeyValueSet(
     // deleted, update is_deleted boolean to false
     current_value_state.is_deleted = false;
     current_value_state.last_logical_commit_time = logical_commit_time;
+    if (has_views || sketch != nullptr) {
+      updated_values.push_back(value);
+    }
+  }
+  if (sketch != nullptr && !updated_values.empty()) {
+    UpdateSetSketch(*sketch, updated_values, {}, *existing_value_set);
+  }
+  if (has_views && !updated_values.empty()) {
+    // Release key lock before evaluating the views, they read this key
+    key_lock.reset();
+    UpdateMaterializedViews(key, updated_values, logical_commit_time);
   }
   // end locking key
 }
@@ -218,14 +384,19 @@ void KeyValueCache::DeleteValuesInSet(std::string_view key,
                                         metrics_recorder_);
   std::unique_ptr<absl::MutexLock> key_lock;
   absl::flat_hash_map<std::string, SetValueMeta>* existing_value_set;
+  bool has_views;
+  std::pair<absl::Mutex, ThetaSketch>* sketch = nullptr;
   // The max cleanup time needs to be locked before doing this comparison
   {
     absl::MutexLock lock_map(&set_map_mutex_);
 
     if (logical_commit_time <= max_cleanup_logical_commit_time_for_set_cache_ ||
-        value_set.empty()) {
+        value_set.empty() || views_.contains(key) ||
+        HasOtherSetType<std::string>(key)) {
       return;
     }
+    has_views = views_by_key_.contains(key);
+    IncrementSetVersion(key);
     auto key_itr = key_to_value_set_map_.find(key);
     if (key_itr == key_to_value_set_map_.end()) {
       // If the key is missing, still need to add all the deleted values to the
@@ -245,6 +416,7 @@ void KeyValueCache::DeleteValuesInSet(std::string_view key,
       }
       return;
     }
+    sketch = GetOrCreateSetSketch(key);
     // Lock the key
     key_lock = std::make_unique<absl::MutexLock>(&key_itr->second->first);
     existing_value_set = &key_itr->second->second;
@@ -265,14 +437,569 @@ void KeyValueCache::DeleteValuesInSet(std::string_view key,
     current_value_state.is_deleted = true;
     values_to_delete.push_back(value);
   }
+  if (sketch != nullptr && !values_to_delete.empty()) {
+    UpdateSetSketch(*sketch, {}, values_to_delete, *existing_value_set);
+  }
   if (!values_to_delete.empty()) {
     // Release key lock before locking the map to avoid potential deadlock
     // caused by cycle in the ordering of lock acquisitions
     key_lock.reset();
+    {
+      absl::MutexLock lock_map(&set_map_mutex_);
+      for (const std::string_view value : values_to_delete) {
+        deleted_set_nodes_[logical_commit_time][key].emplace(value);
+      }
+    }
+    if (has_views) {
+      UpdateMaterializedViews(key, values_to_delete, logical_commit_time);
+    }
+  }
+}
+
+void KeyValueCache::UpdateKeyValueUInt32Set(
+    std::string_view key, absl::Span<const uint32_t> value_set,
+    int64_t logical_commit_time) {
+  UpdateSortedValueSet(key, value_set, logical_commit_time);
+}
+
+void KeyValueCache::UpdateKeyValueUInt64Set(
+    std::string_view key, absl::Span<const uint64_t> value_set,
+    int64_t logical_commit_time) {
+  UpdateSortedValueSet(key, value_set, logical_commit_time);
+}
+
+void KeyValueCache::DeleteValuesInUInt32Set(
+    std::string_view key, absl::Span<const uint32_t> value_set,
+    int64_t logical_commit_time) {
+  DeleteValuesInSortedValueSet(key, value_set, logical_commit_time);
+}
+
+void KeyValueCache::DeleteValuesInUInt64Set(
+    std::string_view key, absl::Span<const uint64_t> value_set,
+    int64_t logical_commit_time) {
+  DeleteValuesInSortedValueSet(key, value_set, logical_commit_time);
+}
+
+template <typename T>
+void KeyValueCache::UpdateSortedValueSet(std::string_view key,
+                                         absl::Span<const T> input_value_set,
+                                         int64_t logical_commit_time) {
+  ScopeLatencyRecorder latency_recorder(kUpdateKeyValueSetEvent,
+                                        metrics_recorder_);
+  VLOG(9) << "Received update for [" << key << "] at " << logical_commit_time;
+  const std::vector<T> sorted_values = SortedUnique(input_value_set);
+  std::unique_ptr<absl::MutexLock> key_lock;
+  SortedValueSet<T>* existing_value_set;
+  bool has_views;
+  std::pair<absl::Mutex, ThetaSketch>* sketch = nullptr;
+  {
+    absl::MutexLock lock_map(&set_map_mutex_);
+    if (logical_commit_time <= max_cleanup_logical_commit_time_for_set_cache_) {
+      VLOG(1) << "Skipping the update as its logical_commit_time: "
+              << logical_commit_time
+              << " is older than the current cutoff time:"
+              << max_cleanup_logical_commit_time_for_set_cache_;
+      return;
+    } else if (sorted_values.empty()) {
+      VLOG(1) << "Skipping the update as it has no value in the set.";
+      return;
+    } else if (views_.contains(key)) {
+      VLOG(1) << "Skipping the update as " << key
+              << " is a materialized view.";
+      return;
+    } else if (HasOtherSetType<T>(key)) {
+      VLOG(1) << "Skipping the update as " << key
+              << " has a set of another type.";
+      return;
+    }
+    has_views = views_by_key_.contains(key);
+    IncrementSetVersion(key);
+    sketch = GetOrCreateSetSketch(key);
+    auto& mutex_value_set_pair = GetSortedValueSetMap<T>()[key];
+    if (mutex_value_set_pair == nullptr) {
+      mutex_value_set_pair =
+          std::make_unique<std::pair<absl::Mutex, SortedValueSet<T>>>();
+    }
+    key_lock = std::make_unique<absl::MutexLock>(&mutex_value_set_pair->first);
+    existing_value_set = &mutex_value_set_pair->second;
+  }  // end locking map
+  const std::vector<T> added_values =
+      existing_value_set->Add(sorted_values, logical_commit_time);
+  if (sketch != nullptr && !added_values.empty()) {
+    UpdateSortedSetSketch<T>(*sketch, added_values, {}, *existing_value_set);
+  }
+  // Release key lock before evaluating the views, they read this key
+  key_lock.reset();
+  if (has_views && !added_values.empty()) {
+    const std::vector<std::string> decimals = ToDecimals<T>(added_values);
+    UpdateMaterializedViews(
+        key, std::vector<std::string_view>(decimals.begin(), decimals.end()),
+        logical_commit_time);
+  }
+}
+
+template <typename T>
+void KeyValueCache::DeleteValuesInSortedValueSet(
+    std::string_view key, absl::Span<const T> value_set,
+    int64_t logical_commit_time) {
+  ScopeLatencyRecorder latency_recorder(kDeleteValuesInSetEvent,
+                                        metrics_recorder_);
+  const std::vector<T> sorted_values = SortedUnique(value_set);
+  std::unique_ptr<absl::MutexLock> key_lock;
+  SortedValueSet<T>* existing_value_set;
+  bool has_views;
+  std::pair<absl::Mutex, ThetaSketch>* sketch = nullptr;
+  {
     absl::MutexLock lock_map(&set_map_mutex_);
-    for (const std::string_view value : values_to_delete) {
-      deleted_set_nodes_[logical_commit_time][key].emplace(value);
+    if (logical_commit_time <= max_cleanup_logical_commit_time_for_set_cache_ ||
+        sorted_values.empty() || views_.contains(key) ||
+        HasOtherSetType<T>(key)) {
+      return;
     }
+    has_views = views_by_key_.contains(key);
+    IncrementSetVersion(key);
+    auto& mutex_value_set_pair = GetSortedValueSetMap<T>()[key];
+    if (mutex_value_set_pair == nullptr) {
+      // If the key is missing, still need to keep the deleted values to avoid
+      // late arriving update with smaller logical commit time inserting them
+      mutex_value_set_pair =
+          std::make_unique<std::pair<absl::Mutex, SortedValueSet<T>>>();
+    } else {
+      sketch = GetOrCreateSetSketch(key);
+    }
+    // The deleted values are found in the set by the cleanup
+    deleted_set_nodes_[logical_commit_time][key];
+    key_lock = std::make_unique<absl::MutexLock>(&mutex_value_set_pair->first);
+    existing_value_set = &mutex_value_set_pair->second;
+  }  // end locking map
+  const std::vector<T> removed_values =
+      existing_value_set->Delete(sorted_values, logical_commit_time);
+  if (sketch != nullptr && !removed_values.empty()) {
+    UpdateSortedSetSketch<T>(*sketch, {}, removed_values, *existing_value_set);
+  }
+  key_lock.reset();
+  if (has_views && !removed_values.empty()) {
+    const std::vector<std::string> decimals = ToDecimals<T>(removed_values);
+    UpdateMaterializedViews(
+        key, std::vector<std::string_view>(decimals.begin(), decimals.end()),
+        logical_commit_time);
+  }
+}
+
+template <typename T>
+std::vector<T> KeyValueCache::SortedValueSet<T>::Add(
+    absl::Span<const T> sorted_values, int64_t logical_commit_time) {
+  std::vector<T> added_values;
+  // Indices of the deleted values that are added back
+  std::vector<size_t> undeleted;
+  auto values_itr = values.begin();
+  auto deleted_itr = deleted_values.begin();
+  for (const T value : sorted_values) {
+    values_itr = std::lower_bound(values_itr, values.end(), value);
+    if (values_itr != values.end() && *values_itr == value) {
+      int64_t& commit_time = commit_times[values_itr - values.begin()];
+      commit_time = std::max(commit_time, logical_commit_time);
+      continue;
+    }
+    deleted_itr = std::lower_bound(deleted_itr, deleted_values.end(), value);
+    if (deleted_itr != deleted_values.end() && *deleted_itr == value) {
+      const size_t index = deleted_itr - deleted_values.begin();
+      if (deleted_commit_times[index] >= logical_commit_time) {
+        continue;
+      }
+      undeleted.push_back(index);
+    }
+    added_values.push_back(value);
+  }
+  if (added_values.empty()) {
+    return added_values;
+  }
+  // Compact the deleted values that stay deleted.
+  size_t kept = 0;
+  for (size_t i = 0, next = 0; i < deleted_values.size(); ++i) {
+    if (next < undeleted.size() && undeleted[next] == i) {
+      ++next;
+      continue;
+    }
+    deleted_values[kept] = deleted_values[i];
+    deleted_commit_times[kept] = deleted_commit_times[i];
+    ++kept;
+  }
+  deleted_values.resize(kept);
+  deleted_commit_times.resize(kept);
+  // Merge the added values from the back, so that only the values after the
+  // first added one are moved.
+  size_t old_size = values.size();
+  size_t remaining = added_values.size();
+  values.resize(old_size + remaining);
+  commit_times.resize(old_size + remaining);
+  for (size_t out = values.size(); remaining > 0;) {
+    --out;
+    if (old_size > 0 && values[old_size - 1] > added_values[remaining - 1]) {
+      --old_size;
+      values[out] = values[old_size];
+      commit_times[out] = commit_times[old_size];
+    } else {
+      --remaining;
+      values[out] = added_values[remaining];
+      commit_times[out] = logical_commit_time;
+    }
+  }
+  return added_values;
+}
+
+template <typename T>
+std::vector<T> KeyValueCache::SortedValueSet<T>::Delete(
+    absl::Span<const T> sorted_values, int64_t logical_commit_time) {
+  std::vector<T> removed_values;
+  // Indices of the values that are deleted, and the values to add to the
+  // deleted ones.
+  std::vector<size_t> removed;
+  std::vector<T> new_deleted_values;
+  auto values_itr = values.begin();
+  auto deleted_itr = deleted_values.begin();
+  for (const T value : sorted_values) {
+    values_itr = std::lower_bound(values_itr, values.end(), value);
+    if (values_itr != values.end() && *values_itr == value) {
+      const size_t index = values_itr - values.begin();
+      if (commit_times[index] >= logical_commit_time) {
+        continue;
+      }
+      removed.push_back(index);
+      removed_values.push_back(value);
+      new_deleted_values.push_back(value);
+      continue;
+    }
+    deleted_itr = std::lower_bound(deleted_itr, deleted_values.end(), value);
+    if (deleted_itr != deleted_values.end() && *deleted_itr == value) {
+      int64_t& commit_time =
+          deleted_commit_times[deleted_itr - deleted_values.begin()];
+      commit_time = std::max(commit_time, logical_commit_time);
+      continue;
+    }
+    new_deleted_values.push_back(value);
+  }
+  if (!removed.empty()) {
+    size_t kept = 0;
+    for (size_t i = 0, next = 0; i < values.size(); ++i) {
+      if (next < removed.size() && removed[next] == i) {
+        ++next;
+        continue;
+      }
+      values[kept] = values[i];
+      commit_times[kept] = commit_times[i];
+      ++kept;
+    }
+    values.resize(kept);
+    commit_times.resize(kept);
+  }
+  size_t old_size = deleted_values.size();
+  size_t remaining = new_deleted_values.size();
+  deleted_values.resize(old_size + remaining);
+  deleted_commit_times.resize(old_size + remaining);
+  for (size_t out = deleted_values.size(); remaining > 0;) {
+    --out;
+    if (old_size > 0 &&
+        deleted_values[old_size - 1] > new_deleted_values[remaining - 1]) {
+      --old_size;
+      deleted_values[out] = deleted_values[old_size];
+      deleted_commit_times[out] = deleted_commit_times[old_size];
+    } else {
+      --remaining;
+      deleted_values[out] = new_deleted_values[remaining];
+      deleted_commit_times[out] = logical_commit_time;
+    }
+  }
+  return removed_values;
+}
+
+template <typename T>
+void KeyValueCache::SortedValueSet<T>::CleanUp(int64_t logical_commit_time) {
+  size_t kept = 0;
+  for (size_t i = 0; i < deleted_values.size(); ++i) {
+    if (deleted_commit_times[i] <= logical_commit_time) {
+      continue;
+    }
+    deleted_values[kept] = deleted_values[i];
+    deleted_commit_times[kept] = deleted_commit_times[i];
+    ++kept;
+  }
+  deleted_values.resize(kept);
+  deleted_commit_times.resize(kept);
+}
+
+template <typename T>
+KeyValueCache::SortedValueSetMap<T>& KeyValueCache::GetSortedValueSetMap() {
+  if constexpr (std::is_same_v<T, uint32_t>) {
+    return key_to_uint32_set_map_;
+  } else {
+    return key_to_uint64_set_map_;
+  }
+}
+
+template <typename T>
+bool KeyValueCache::HasOtherSetType(std::string_view key) const {
+  return (!std::is_same_v<T, std::string> &&
+          key_to_value_set_map_.contains(key)) ||
+         (!std::is_same_v<T, uint32_t> &&
+          key_to_uint32_set_map_.contains(key)) ||
+         (!std::is_same_v<T, uint64_t> && key_to_uint64_set_map_.contains(key));
+}
+
+absl::Status KeyValueCache::AddMaterializedView(std::string_view name,
+                                                std::string_view query) {
+  auto view = std::make_unique<MaterializedView>();
+  view->name = std::string(name);
+  view->driver = std::make_unique<Driver>(
+      [this, view = view.get()](std::string_view key)
+          -> const absl::flat_hash_set<std::string_view>& {
+        static const auto* kEmptySet =
+            new absl::flat_hash_set<std::string_view>();
+        return IsInValueSet(key, view->probe) ? view->probe_set : *kEmptySet;
+      });
+  if (ParseQuery(*view->driver, query) != 0) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Invalid query for materialized view ", name, ": ",
+                     view->driver->GetResult().status().message()));
+  }
+  if (view->driver->GetRootNode() == nullptr) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Empty query for materialized view ", name));
+  }
+  const auto keys = view->driver->GetRootNode()->Keys();
+
+  // Hold the view until it is populated, so that updates of its keys that
+  // follow its registration are applied after the initial values.
+  MaterializedView& added_view = *view;
+  absl::MutexLock update_lock(&added_view.update_mutex);
+  // Any value of the view is a value of one of its keys.
+  absl::flat_hash_set<std::string> candidates;
+  {
+    absl::MutexLock lock_map(&set_map_mutex_);
+    if (views_.contains(name) || views_by_key_.contains(name) ||
+        HasOtherSetType<void>(name)) {
+      return absl::AlreadyExistsError(
+          absl::StrCat("Set ", name, " already exists or is used by a view"));
+    }
+    for (const auto key : keys) {
+      if (key == name || views_.contains(key)) {
+        return absl::InvalidArgumentError(absl::StrCat(
+            "Materialized view ", name, " can not depend on view ", key));
+      }
+      if (const auto key_itr = key_to_uint32_set_map_.find(key);
+          key_itr != key_to_uint32_set_map_.end()) {
+        absl::ReaderMutexLock key_lock(&key_itr->second->first);
+        for (const uint32_t value : key_itr->second->second.values) {
+          candidates.insert(absl::StrCat(value));
+        }
+        continue;
+      }
+      if (const auto key_itr = key_to_uint64_set_map_.find(key);
+          key_itr != key_to_uint64_set_map_.end()) {
+        absl::ReaderMutexLock key_lock(&key_itr->second->first);
+        for (const uint64_t value : key_itr->second->second.values) {
+          candidates.insert(absl::StrCat(value));
+        }
+        continue;
+      }
+      const auto key_itr = key_to_value_set_map_.find(key);
+      if (key_itr == key_to_value_set_map_.end()) {
+        continue;
+      }
+      absl::ReaderMutexLock key_lock(&key_itr->second->first);
+      for (const auto& [value, meta] : key_itr->second->second) {
+        if (!meta.is_deleted) {
+          candidates.insert(value);
+        }
+      }
+    }
+    for (const auto key : keys) {
+      views_by_key_[key].push_back(&added_view);
+    }
+    views_.emplace(name, std::move(view));
+    key_to_value_set_map_.emplace(
+        name,
+        std::make_unique<std::pair<
+            absl::Mutex, absl::flat_hash_map<std::string, SetValueMeta>>>());
+  }  // end locking map
+  const std::vector<std::string_view> values(candidates.begin(),
+                                             candidates.end());
+  UpdateMaterializedView(added_view, values, /*logical_commit_time=*/0);
+  return absl::OkStatus();
+}
+
+bool KeyValueCache::IsInValueSet(std::string_view key,
+                                 std::string_view value) const {
+  if (const auto key_itr = key_to_uint32_set_map_.find(key);
+      key_itr != key_to_uint32_set_map_.end()) {
+    absl::ReaderMutexLock key_lock(&key_itr->second->first);
+    return ContainsDecimal<uint32_t>(key_itr->second->second.values, value);
+  }
+  if (const auto key_itr = key_to_uint64_set_map_.find(key);
+      key_itr != key_to_uint64_set_map_.end()) {
+    absl::ReaderMutexLock key_lock(&key_itr->second->first);
+    return ContainsDecimal<uint64_t>(key_itr->second->second.values, value);
+  }
+  const auto key_itr = key_to_value_set_map_.find(key);
+  if (key_itr == key_to_value_set_map_.end()) {
+    return false;
+  }
+  absl::ReaderMutexLock key_lock(&key_itr->second->first);
+  const auto value_itr = key_itr->second->second.find(value);
+  return value_itr != key_itr->second->second.end() &&
+         !value_itr->second.is_deleted;
+}
+
+void KeyValueCache::IncrementSetVersion(std::string_view key) {
+  if (!maintain_set_versions_) {
+    return;
+  }
+  set_versions_.insert_or_assign(key, ++last_set_version_);
+}
+
+std::pair<absl::Mutex, ThetaSketch>* KeyValueCache::GetOrCreateSetSketch(
+    std::string_view key) {
+  if (!maintain_set_sketches_) {
+    return nullptr;
+  }
+  auto& sketch = set_sketches_[key];
+  if (sketch == nullptr) {
+    sketch = std::make_unique<std::pair<absl::Mutex, ThetaSketch>>();
+  }
+  return sketch.get();
+}
+
+void KeyValueCache::UpdateSetSketch(
+    std::pair<absl::Mutex, ThetaSketch>& sketch,
+    absl::Span<const std::string_view> added,
+    absl::Span<const std::string_view> removed,
+    const absl::flat_hash_map<std::string, SetValueMeta>& values) {
+  absl::MutexLock sketch_lock(&sketch.first);
+  for (const std::string_view value : added) {
+    sketch.second.Update(value);
+  }
+  for (const std::string_view value : removed) {
+    if (sketch.second.Remove(value)) {
+      continue;
+    }
+    ThetaSketch rebuilt(sketch.second.nominal_entries());
+    for (const auto& [existing_value, meta] : values) {
+      if (!meta.is_deleted) {
+        rebuilt.Update(existing_value);
+      }
+    }
+    sketch.second = std::move(rebuilt);
+    return;
+  }
+}
+
+template <typename T>
+void KeyValueCache::UpdateSortedSetSketch(
+    std::pair<absl::Mutex, ThetaSketch>& sketch, absl::Span<const T> added,
+    absl::Span<const T> removed, const SortedValueSet<T>& values) {
+  absl::MutexLock sketch_lock(&sketch.first);
+  for (const T value : added) {
+    sketch.second.Update(absl::AlphaNum(value).Piece());
+  }
+  for (const T value : removed) {
+    if (sketch.second.Remove(absl::AlphaNum(value).Piece())) {
+      continue;
+    }
+    ThetaSketch rebuilt(sketch.second.nominal_entries());
+    for (const T existing_value : values.values) {
+      rebuilt.Update(absl::AlphaNum(existing_value).Piece());
+    }
+    sketch.second = std::move(rebuilt);
+    return;
+  }
+}
+
+void KeyValueCache::UpdateMaterializedView(
+    MaterializedView& view, absl::Span<const std::string_view> values,
+    int64_t logical_commit_time) {
+  ScopeLatencyRecorder latency_recorder(kUpdateMaterializedViewEvent,
+                                        metrics_recorder_);
+  // Evaluate under the reader lock, so that lookups are not blocked by it.
+  // The driver locks the sets it reads.
+  std::vector<bool> is_member;
+  is_member.reserve(values.size());
+  {
+    absl::ReaderMutexLock lock_map(&set_map_mutex_);
+    for (const std::string_view value : values) {
+      view.probe = value;
+      view.probe_set.clear();
+      view.probe_set.insert(value);
+      const auto result = view.driver->GetResult();
+      is_member.push_back(result.ok() && !result->empty());
+    }
+    view.probe = {};
+    view.probe_set.clear();
+  }
+  absl::MutexLock lock_map(&set_map_mutex_);
+  IncrementSetVersion(view.name);
+  auto view_itr = key_to_value_set_map_.find(view.name);
+  if (view_itr == key_to_value_set_map_.end()) {
+    // The view was emptied and erased by a cleanup.
+    view_itr =
+        key_to_value_set_map_
+            .emplace(view.name,
+                     std::make_unique<std::pair<
+                         absl::Mutex,
+                         absl::flat_hash_map<std::string, SetValueMeta>>>())
+            .first;
+  }
+  auto* sketch = GetOrCreateSetSketch(view.name);
+  // The values added to and removed from the view, for its sketch
+  std::vector<std::string_view> added_values;
+  std::vector<std::string_view> removed_values;
+  absl::MutexLock view_lock(&view_itr->second->first);
+  auto& view_values = view_itr->second->second;
+  for (size_t i = 0; i < values.size(); i++) {
+    if (is_member[i]) {
+      auto& value_state = view_values[values[i]];
+      if (sketch != nullptr) {
+        added_values.push_back(values[i]);
+      }
+      value_state.is_deleted = false;
+      value_state.last_logical_commit_time = std::max(
+          value_state.last_logical_commit_time, logical_commit_time);
+      continue;
+    }
+    const auto value_itr = view_values.find(values[i]);
+    if (value_itr == view_values.end() || value_itr->second.is_deleted) {
+      continue;
+    }
+    // Mark the value deleted so that it is cleaned up like any other.
+    if (sketch != nullptr) {
+      removed_values.push_back(values[i]);
+    }
+    value_itr->second.is_deleted = true;
+    value_itr->second.last_logical_commit_time = std::max(
+        value_itr->second.last_logical_commit_time, logical_commit_time);
+    deleted_set_nodes_[value_itr->second.last_logical_commit_time][view.name]
+        .emplace(values[i]);
+  }
+  if (sketch != nullptr) {
+    UpdateSetSketch(*sketch, added_values, removed_values, view_values);
+  }
+}
+
+void KeyValueCache::UpdateMaterializedViews(
+    std::string_view key, absl::Span<const std::string_view> values,
+    int64_t logical_commit_time) {
+  // Views are never removed, so they outlive the map lock.
+  std::vector<MaterializedView*> views;
+  {
+    absl::ReaderMutexLock lock_map(&set_map_mutex_);
+    const auto views_itr = views_by_key_.find(key);
+    if (views_itr == views_by_key_.end()) {
+      return;
+    }
+    views = views_itr->second;
+  }
+  for (MaterializedView* view : views) {
+    absl::MutexLock update_lock(&view->update_mutex);
+    UpdateMaterializedView(*view, values, logical_commit_time);
   }
 }
 
@@ -318,22 +1045,33 @@ void KeyValueCache::CleanUpKeyValueSetMap(int64_t logical_commit_time) {
       break;
     }
     for (const auto& [key, values] : delete_itr->second) {
+      if (CleanUpSortedValueSet<uint32_t>(key, logical_commit_time) ||
+          CleanUpSortedValueSet<uint64_t>(key, logical_commit_time)) {
+        continue;
+      }
       if (auto key_itr = key_to_value_set_map_.find(key);
           key_itr != key_to_value_set_map_.end()) {
-        absl::MutexLock(&key_itr->second->first);
-        for (const auto& v_to_delete : values) {
-          auto existing_value_itr = key_itr->second->second.find(v_to_delete);
-          if (existing_value_itr != key_itr->second->second.end() &&
-              existing_value_itr->second.is_deleted &&
-              existing_value_itr->second.last_logical_commit_time <=
-                  logical_commit_time) {
-            // Delete the existing value that is marked deleted from set
-            key_itr->second->second.erase(existing_value_itr);
+        bool is_empty;
+        {
+          // Wait for updates that hold the set or its sketch
+          absl::MutexLock key_lock(&key_itr->second->first);
+          for (const auto& v_to_delete : values) {
+            auto existing_value_itr =
+                key_itr->second->second.find(v_to_delete);
+            if (existing_value_itr != key_itr->second->second.end() &&
+                existing_value_itr->second.is_deleted &&
+                existing_value_itr->second.last_logical_commit_time <=
+                    logical_commit_time) {
+              // Delete the existing value that is marked deleted from set
+              key_itr->second->second.erase(existing_value_itr);
+            }
           }
+          is_empty = key_itr->second->second.empty();
         }
-        if (key_itr->second->second.empty()) {
+        if (is_empty) {
           // If the value set is empty, erase the key-value_set from cache map
           key_to_value_set_map_.erase(key);
+          EraseSetMetadata(key);
         }
       }
     }
@@ -344,8 +1082,41 @@ void KeyValueCache::CleanUpKeyValueSetMap(int64_t logical_commit_time) {
       max_cleanup_logical_commit_time_for_set_cache_, logical_commit_time);
 }
 
-std::unique_ptr<Cache> KeyValueCache::Create(
-    MetricsRecorder& metrics_recorder) {
-  return absl::WrapUnique(new KeyValueCache(metrics_recorder));
+template <typename T>
+bool KeyValueCache::CleanUpSortedValueSet(std::string_view key,
+                                          int64_t logical_commit_time) {
+  auto& set_map = GetSortedValueSetMap<T>();
+  const auto key_itr = set_map.find(key);
+  if (key_itr == set_map.end()) {
+    return false;
+  }
+  {
+    // Wait for updates that hold the set or its sketch
+    absl::MutexLock key_lock(&key_itr->second->first);
+    SortedValueSet<T>& value_set = key_itr->second->second;
+    value_set.CleanUp(logical_commit_time);
+    if (!value_set.values.empty() || !value_set.deleted_values.empty()) {
+      return false;
+    }
+  }
+  set_map.erase(key_itr);
+  EraseSetMetadata(key);
+  return true;
+}
+
+void KeyValueCache::EraseSetMetadata(std::string_view key) {
+  set_sketches_.erase(key);
+  if (const auto version_itr = set_versions_.find(key);
+      version_itr != set_versions_.end()) {
+    pruned_set_version_ = std::max(pruned_set_version_, version_itr->second);
+    set_versions_.erase(version_itr);
+  }
+}
+
+std::unique_ptr<Cache> KeyValueCache::Create(MetricsRecorder& metrics_recorder,
+                                             bool maintain_set_sketches,
+                                             bool maintain_set_versions) {
+  return absl::WrapUnique(new KeyValueCache(
+      metrics_recorder, maintain_set_sketches, maintain_set_versions));
 }
 }  // namespace kv_server
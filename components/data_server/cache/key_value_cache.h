@@ -17,6 +17,7 @@
 #ifndef COMPONENTS_DATA_SERVER_CACHE_KEY_VALUE_CACHE_H_
 #define COMPONENTS_DATA_SERVER_CACHE_KEY_VALUE_CACHE_H_
 
+#include <cstdint>
 #include <iostream>
 #include <map>
 #include <memory>
@@ -29,8 +30,13 @@
 #include "absl/container/btree_map.h"
 #include "absl/container/flat_hash_map.h"
 #include "absl/container/flat_hash_set.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/types/span.h"
 #include "components/data_server/cache/cache.h"
 #include "components/data_server/cache/get_key_value_set_result.h"
+#include "components/query/driver.h"
+#include "components/query/set_sketch.h"
 #include "public/base_types.pb.h"
 #include "src/cpp/telemetry/metrics_recorder.h"
 
@@ -39,9 +45,15 @@ namespace kv_server {
 // One cache object is only for keys in one namespace.
 class KeyValueCache : public Cache {
  public:
+  // Maintains a sketch of every set if `maintain_set_sketches` is set, and
+  // the versions returned by GetKeyValueSetVersion if
+  // `maintain_set_versions` is set. Otherwise, the version is always 0.
   KeyValueCache(
-      privacy_sandbox::server_common::MetricsRecorder& metrics_recorder)
-      : metrics_recorder_(metrics_recorder) {}
+      privacy_sandbox::server_common::MetricsRecorder& metrics_recorder,
+      bool maintain_set_sketches = false, bool maintain_set_versions = false)
+      : maintain_set_sketches_(maintain_set_sketches),
+        maintain_set_versions_(maintain_set_versions),
+        metrics_recorder_(metrics_recorder) {}
 
   // Looks up and returns key-value pairs for the given keys.
   absl::flat_hash_map<std::string, std::string> GetKeyValuePairs(
@@ -51,6 +63,25 @@ class KeyValueCache : public Cache {
   std::unique_ptr<GetKeyValueSetResult> GetKeyValueSet(
       const absl::flat_hash_set<std::string_view>& key_set) const override;
 
+  // Returns whether each of `candidates` is in the set of `key`. Each
+  // candidate is looked up in the set under its reader lock, so the cost
+  // does not depend on the size of the set.
+  std::vector<bool> GetKeyValueSetMembership(
+      std::string_view key,
+      absl::Span<const std::string_view> candidates) const override;
+
+  // Returns the largest version of the sets of the given keys. Every update
+  // or deletion of a set assigns it a version larger than all previous ones.
+  int64_t GetKeyValueSetVersion(
+      const absl::flat_hash_set<std::string_view>& key_set) const override;
+
+  // Returns the sketches of the sets of the given keys. Sketches are updated
+  // along with the sets, and rebuilt from the remaining values when a value
+  // they retain is deleted.
+  absl::StatusOr<absl::flat_hash_map<std::string, ThetaSketch>>
+  GetKeyValueSetSketches(
+      const absl::flat_hash_set<std::string_view>& key_set) const override;
+
   // Inserts or updates the key with the new value.
   void UpdateKeyValue(std::string_view key, std::string_view value,
                       int64_t logical_commit_time) override;
@@ -61,6 +92,16 @@ class KeyValueCache : public Cache {
                          absl::Span<std::string_view> input_value_set,
                          int64_t logical_commit_time) override;
 
+  // Same as `UpdateKeyValueSet`, for sets of unsigned integers. The elements
+  // are kept in a sorted array, apart from the deleted ones, which lookups
+  // borrow as it is.
+  void UpdateKeyValueUInt32Set(std::string_view key,
+                               absl::Span<const uint32_t> value_set,
+                               int64_t logical_commit_time) override;
+  void UpdateKeyValueUInt64Set(std::string_view key,
+                               absl::Span<const uint64_t> value_set,
+                               int64_t logical_commit_time) override;
+
   // Deletes a particular (key, value) pair.
   void DeleteKey(std::string_view key, int64_t logical_commit_time) override;
 
@@ -71,14 +112,31 @@ class KeyValueCache : public Cache {
                          absl::Span<std::string_view> value_set,
                          int64_t logical_commit_time) override;
 
+  // Same as `DeleteValuesInSet`, for sets of unsigned integers.
+  void DeleteValuesInUInt32Set(std::string_view key,
+                               absl::Span<const uint32_t> value_set,
+                               int64_t logical_commit_time) override;
+  void DeleteValuesInUInt64Set(std::string_view key,
+                               absl::Span<const uint64_t> value_set,
+                               int64_t logical_commit_time) override;
+
   // Removes the values that were deleted before the specified
   // logical_commit_time.
   // TODO: b/267182790 -- Cache cleanup should be done periodically from a
   // background thread
   void RemoveDeletedKeys(int64_t logical_commit_time) override;
 
+  // Registers `name` as a set that always holds the result of `query`.
+  // The view is computed from the current sets, then, whenever values of a
+  // set it depends on are updated or deleted, only the membership of those
+  // values in the view is re-evaluated. The query may not depend on other
+  // views, and updates and deletions addressed to the view are ignored.
+  absl::Status AddMaterializedView(std::string_view name,
+                                   std::string_view query) override;
+
   static std::unique_ptr<Cache> Create(
-      privacy_sandbox::server_common::MetricsRecorder& metrics_recorder);
+      privacy_sandbox::server_common::MetricsRecorder& metrics_recorder,
+      bool maintain_set_sketches = false, bool maintain_set_versions = false);
 
  private:
   struct CacheValue {
@@ -104,6 +162,45 @@ class KeyValueCache : public Cache {
     SetValueMeta(int64_t logical_commit_time, bool deleted)
         : last_logical_commit_time(logical_commit_time), is_deleted(deleted) {}
   };
+  // A set of unsigned integers. Its values and its deleted values are each
+  // held in a sorted array, with the last logical commit time of each value
+  // at the same index of the array next to it.
+  template <typename T>
+  struct SortedValueSet {
+    std::vector<T> values;
+    std::vector<int64_t> commit_times;
+    std::vector<T> deleted_values;
+    std::vector<int64_t> deleted_commit_times;
+
+    // Adds `sorted_values`, sorted without duplicates, unless they were
+    // updated or deleted at or after `logical_commit_time`. Returns the
+    // values that were not in the set.
+    std::vector<T> Add(absl::Span<const T> sorted_values,
+                       int64_t logical_commit_time);
+    // Marks `sorted_values` deleted, unless they were updated or deleted at
+    // or after `logical_commit_time`. Returns the values that were in the
+    // set.
+    std::vector<T> Delete(absl::Span<const T> sorted_values,
+                          int64_t logical_commit_time);
+    // Drops the values deleted at or before `logical_commit_time`.
+    void CleanUp(int64_t logical_commit_time);
+  };
+  template <typename T>
+  using SortedValueSetMap = absl::flat_hash_map<
+      std::string, std::unique_ptr<std::pair<absl::Mutex, SortedValueSet<T>>>>;
+  struct MaterializedView {
+    std::string name;
+    // Evaluates the query of the view over sets reduced to `probe`, so the
+    // result is non-empty iff `probe` is in the view.
+    std::unique_ptr<Driver> driver;
+    // Serializes the updates of the view, and guards `probe` and
+    // `probe_set`. Acquired before `set_map_mutex_`.
+    absl::Mutex update_mutex;
+    std::string_view probe;
+    // The set of `probe` alone, which the driver borrows for the keys that
+    // hold `probe`.
+    absl::flat_hash_set<std::string_view> probe_set;
+  };
   // mutex for key value map;
   mutable absl::Mutex mutex_;
   // mutex for key value set map;
@@ -136,20 +233,140 @@ class KeyValueCache : public Cache {
       std::unique_ptr<std::pair<
           absl::Mutex, absl::flat_hash_map<std::string, SetValueMeta>>>>
       key_to_value_set_map_ ABSL_GUARDED_BY(set_map_mutex_);
+  // Mapping from a key to its set of unsigned integers, for each width. A key
+  // is in at most one of the set maps.
+  SortedValueSetMap<uint32_t> key_to_uint32_set_map_
+      ABSL_GUARDED_BY(set_map_mutex_);
+  SortedValueSetMap<uint64_t> key_to_uint64_set_map_
+      ABSL_GUARDED_BY(set_map_mutex_);
   // Sorted mapping from logical timestamp to key-value_set map to keep track of
   // deleted key-values to handle out of order update case. In the inner map,
   // the key string is the key for the values, and the string
-  // in the flat_hash_set is the value
+  // in the flat_hash_set is the value. Sets of unsigned integers keep their
+  // deleted values, so only their key is recorded.
   absl::btree_map<int64_t, absl::flat_hash_map<
                                std::string, absl::flat_hash_set<std::string>>>
       deleted_set_nodes_ ABSL_GUARDED_BY(set_map_mutex_);
 
+  // The last version assigned to a set, and the version of each set in
+  // `key_to_value_set_map_` that was updated or deleted from since startup,
+  // if `maintain_set_versions_` is set. The versions of the sets removed by
+  // cleanups are dropped, and `pruned_set_version_`, the highest of them, is
+  // the version of any set without one. This keeps the version of every set
+  // from decreasing.
+  const bool maintain_set_versions_;
+  int64_t last_set_version_ ABSL_GUARDED_BY(set_map_mutex_) = 0;
+  int64_t pruned_set_version_ ABSL_GUARDED_BY(set_map_mutex_) = 0;
+  absl::flat_hash_map<std::string, int64_t> set_versions_
+      ABSL_GUARDED_BY(set_map_mutex_);
+
+  // The sketch of each set that was updated, if `maintain_set_sketches_` is
+  // set, until the set is removed by a cleanup. Each sketch is guarded by the
+  // mutex paired with it, and only used while the lock of its set is held.
+  const bool maintain_set_sketches_;
+  absl::flat_hash_map<std::string,
+                      std::unique_ptr<std::pair<absl::Mutex, ThetaSketch>>>
+      set_sketches_ ABSL_GUARDED_BY(set_map_mutex_);
+
+  // Materialized views by name.
+  absl::flat_hash_map<std::string, std::unique_ptr<MaterializedView>> views_
+      ABSL_GUARDED_BY(set_map_mutex_);
+  // The views depending on each key.
+  absl::flat_hash_map<std::string, std::vector<MaterializedView*>>
+      views_by_key_ ABSL_GUARDED_BY(set_map_mutex_);
+
+  // Returns whether `value` is in the set of `key` and not deleted. Only
+  // called by the drivers of views, while `set_map_mutex_` is held for
+  // reading.
+  bool IsInValueSet(std::string_view key, std::string_view value) const
+      ABSL_NO_THREAD_SAFETY_ANALYSIS;
+
+  // Returns the set map holding the sets of unsigned integers of type `T`.
+  template <typename T>
+  SortedValueSetMap<T>& GetSortedValueSetMap()
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(set_map_mutex_);
+
+  // Returns whether `key` has a set of elements of another type than `T`,
+  // which is std::string for sets of strings, or any set if `T` is void.
+  template <typename T>
+  bool HasOtherSetType(std::string_view key) const
+      ABSL_SHARED_LOCKS_REQUIRED(set_map_mutex_);
+
+  // Implement the updates and deletions of sets of unsigned integers.
+  template <typename T>
+  void UpdateSortedValueSet(std::string_view key,
+                            absl::Span<const T> input_value_set,
+                            int64_t logical_commit_time)
+      ABSL_LOCKS_EXCLUDED(set_map_mutex_);
+  template <typename T>
+  void DeleteValuesInSortedValueSet(std::string_view key,
+                                    absl::Span<const T> value_set,
+                                    int64_t logical_commit_time)
+      ABSL_LOCKS_EXCLUDED(set_map_mutex_);
+
+  // Assigns a new version to the set of `key`. Called before the set is
+  // mutated, while the map lock is held, so that a reader that sees the old
+  // version either sees the old set or reads the version again later.
+  void IncrementSetVersion(std::string_view key)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(set_map_mutex_);
+
+  // Returns the sketch of the set of `key`, or nullptr if sketches are not
+  // maintained.
+  std::pair<absl::Mutex, ThetaSketch>* GetOrCreateSetSketch(
+      std::string_view key) ABSL_EXCLUSIVE_LOCKS_REQUIRED(set_map_mutex_);
+
+  // Adds `added` to and removes `removed` from `sketch`, after they were
+  // added to or deleted from `values`. Rebuilds the sketch from `values` if
+  // a removed value can not be removed from the sketch.
+  static void UpdateSetSketch(
+      std::pair<absl::Mutex, ThetaSketch>& sketch,
+      absl::Span<const std::string_view> added,
+      absl::Span<const std::string_view> removed,
+      const absl::flat_hash_map<std::string, SetValueMeta>& values);
+
+  // Same as `UpdateSetSketch` for a set of unsigned integers, whose values
+  // are sketched as decimal strings.
+  template <typename T>
+  static void UpdateSortedSetSketch(std::pair<absl::Mutex, ThetaSketch>& sketch,
+                                    absl::Span<const T> added,
+                                    absl::Span<const T> removed,
+                                    const SortedValueSet<T>& values);
+
+  // Re-evaluates whether each of `values` is in `view`. The query is
+  // evaluated under a reader lock on the map, and only the changes of the
+  // view are applied under the exclusive lock.
+  void UpdateMaterializedView(MaterializedView& view,
+                              absl::Span<const std::string_view> values,
+                              int64_t logical_commit_time)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(view.update_mutex)
+          ABSL_LOCKS_EXCLUDED(set_map_mutex_);
+
+  // Re-evaluates whether each of `values` is in the views depending on `key`.
+  // Called after the update of `key` was applied and its locks released.
+  void UpdateMaterializedViews(std::string_view key,
+                               absl::Span<const std::string_view> values,
+                               int64_t logical_commit_time)
+      ABSL_LOCKS_EXCLUDED(set_map_mutex_);
+
   // Removes deleted keys from key-value map
   void CleanUpKeyValueMap(int64_t logical_commit_time);
 
   // Removes deleted key-values from key-value_set map
   void CleanUpKeyValueSetMap(int64_t logical_commit_time);
 
+  // Drops the values of the set of `key` deleted at or before
+  // `logical_commit_time`, if it is a set of unsigned integers of type `T`.
+  // Returns whether the set was found and became empty, in which case it is
+  // removed from its map.
+  template <typename T>
+  bool CleanUpSortedValueSet(std::string_view key, int64_t logical_commit_time)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(set_map_mutex_);
+
+  // Drops the version and the sketch of the set of `key`, once the set is
+  // removed by a cleanup.
+  void EraseSetMetadata(std::string_view key)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(set_map_mutex_);
+
   friend class KeyValueCacheTestPeer;
 
   privacy_sandbox::server_common::MetricsRecorder& metrics_recorder_;
@@ -15,6 +15,7 @@
 #include "components/data_server/cache/key_value_cache.h"
 
 #include <algorithm>
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <string_view>
@@ -23,6 +24,7 @@
 #include <vector>
 
 #include "absl/container/flat_hash_map.h"
+#include "absl/strings/str_cat.h"
 #include "absl/synchronization/notification.h"
 #include "components/data_server/cache/cache.h"
 #include "components/data_server/cache/get_key_value_set_result.h"
@@ -81,6 +83,22 @@ class KeyValueCacheTestPeer {
     return iter->second->second.size();
   }
 
+  static int GetUInt32SetMapSize(const KeyValueCache& c) {
+    absl::MutexLock lock(&c.set_map_mutex_);
+    return c.key_to_uint32_set_map_.size();
+  }
+
+  static std::vector<uint32_t> ReadDeletedUInt32Values(const KeyValueCache& c,
+                                                       std::string_view key) {
+    absl::MutexLock lock(&c.set_map_mutex_);
+    return c.key_to_uint32_set_map_.find(key)->second->second.deleted_values;
+  }
+
+  static int GetSetSketchesSize(const KeyValueCache& c) {
+    absl::MutexLock lock(&c.set_map_mutex_);
+    return c.set_sketches_.size();
+  }
+
   static void CallCacheCleanup(KeyValueCache& c, int64_t logical_commit_time) {
     c.CleanUpKeyValueMap(logical_commit_time);
   }
@@ -89,7 +107,9 @@ class KeyValueCacheTestPeer {
 namespace {
 
 using privacy_sandbox::server_common::TelemetryProvider;
+using testing::ElementsAre;
 using testing::UnorderedElementsAre;
+using testing::UnorderedElementsAreArray;
 
 TEST(CacheTest, RetrievesMatchingEntry) {
   auto noop_metrics_recorder =
@@ -190,6 +210,22 @@ TEST(CacheTest, GetForCacheMissingKeyReturnsEmptySet) {
               UnorderedElementsAre("v1", "v2"));
 }
 
+TEST(CacheTest, GetSetMembershipProbesValues) {
+  auto noop_metrics_recorder =
+      TelemetryProvider::GetInstance().CreateMetricsRecorder();
+  std::unique_ptr<Cache> cache = KeyValueCache::Create(*noop_metrics_recorder);
+  std::vector<std::string_view> values = {"v1", "v2", "v3"};
+  std::vector<std::string_view> values_to_delete = {"v2"};
+  cache->UpdateKeyValueSet("my_key", absl::Span<std::string_view>(values), 1);
+  cache->DeleteValuesInSet("my_key",
+                           absl::Span<std::string_view>(values_to_delete), 2);
+  const std::vector<std::string_view> candidates = {"v1", "v2", "v4", "v3"};
+  EXPECT_THAT(cache->GetKeyValueSetMembership("my_key", candidates),
+              ElementsAre(true, false, false, true));
+  EXPECT_THAT(cache->GetKeyValueSetMembership("missing_key", candidates),
+              ElementsAre(false, false, false, false));
+}
+
 TEST(DeleteKeyTest, RemovesKeyEntry) {
   auto noop_metrics_recorder =
       TelemetryProvider::GetInstance().CreateMetricsRecorder();
@@ -1115,5 +1151,406 @@ TEST(ConcurrentSetMemoryAccessTest, ConcurrentGetUpdateDeleteCleanUp) {
       cache->GetKeyValueSet(keys)->GetValueSet("key2");
   EXPECT_THAT(look_up_result_for_key2, UnorderedElementsAre("v2"));
 }
+
+TEST(CacheTest, SetVersionChangesWithSetsOfKeys) {
+  auto noop_metrics_recorder =
+      TelemetryProvider::GetInstance().CreateMetricsRecorder();
+  std::unique_ptr<Cache> cache =
+      KeyValueCache::Create(*noop_metrics_recorder, false, true);
+  EXPECT_EQ(cache->GetKeyValueSetVersion({"a", "b"}), 0);
+  std::vector<std::string_view> values = {"v1", "v2"};
+  cache->UpdateKeyValueSet("a", absl::MakeSpan(values), 1);
+  const int64_t version = cache->GetKeyValueSetVersion({"a", "b"});
+  EXPECT_GT(version, 0);
+
+  cache->UpdateKeyValueSet("c", absl::MakeSpan(values), 2);
+  cache->UpdateKeyValue("b", "value", 3);
+  EXPECT_EQ(cache->GetKeyValueSetVersion({"a", "b"}), version);
+
+  std::vector<std::string_view> deleted = {"v1"};
+  cache->DeleteValuesInSet("b", absl::MakeSpan(deleted), 4);
+  EXPECT_GT(cache->GetKeyValueSetVersion({"a", "b"}), version);
+  EXPECT_GT(cache->GetKeyValueSetVersion({"a"}), 0);
+}
+
+TEST(CacheTest, SetVersionNotMaintainedByDefault) {
+  auto noop_metrics_recorder =
+      TelemetryProvider::GetInstance().CreateMetricsRecorder();
+  std::unique_ptr<Cache> cache = KeyValueCache::Create(*noop_metrics_recorder);
+  std::vector<std::string_view> values = {"v1", "v2"};
+  cache->UpdateKeyValueSet("a", absl::MakeSpan(values), 1);
+  EXPECT_EQ(cache->GetKeyValueSetVersion({"a"}), 0);
+}
+
+TEST(CacheTest, SetVersionDoesNotDecreaseWhenSetIsCleanedUp) {
+  auto noop_metrics_recorder =
+      TelemetryProvider::GetInstance().CreateMetricsRecorder();
+  std::unique_ptr<Cache> cache =
+      KeyValueCache::Create(*noop_metrics_recorder, false, true);
+  std::vector<std::string_view> values = {"v1"};
+  cache->UpdateKeyValueSet("a", absl::MakeSpan(values), 1);
+  cache->UpdateKeyValueSet("b", absl::MakeSpan(values), 2);
+  const int64_t version = cache->GetKeyValueSetVersion({"a", "b"});
+  cache->DeleteValuesInSet("b", absl::MakeSpan(values), 3);
+  const int64_t deleted_version = cache->GetKeyValueSetVersion({"a", "b"});
+  EXPECT_GT(deleted_version, version);
+  cache->RemoveDeletedKeys(3);
+  EXPECT_EQ(cache->GetKeyValueSetVersion({"a", "b"}), deleted_version);
+}
+
+TEST(SetSketchTest, NotMaintainedByDefault) {
+  auto noop_metrics_recorder =
+      TelemetryProvider::GetInstance().CreateMetricsRecorder();
+  std::unique_ptr<Cache> cache = KeyValueCache::Create(*noop_metrics_recorder);
+  EXPECT_EQ(cache->GetKeyValueSetSketches({"a"}).status().code(),
+            absl::StatusCode::kFailedPrecondition);
+}
+
+TEST(SetSketchTest, FollowsUpdatesAndDeletions) {
+  auto noop_metrics_recorder =
+      TelemetryProvider::GetInstance().CreateMetricsRecorder();
+  std::unique_ptr<Cache> cache =
+      KeyValueCache::Create(*noop_metrics_recorder, true);
+  std::vector<std::string_view> values = {"v1", "v2", "v3"};
+  cache->UpdateKeyValueSet("a", absl::MakeSpan(values), 1);
+  std::vector<std::string_view> deleted = {"v1"};
+  cache->DeleteValuesInSet("a", absl::MakeSpan(deleted), 2);
+  // Out of order, the value stays deleted.
+  cache->UpdateKeyValueSet("a", absl::MakeSpan(deleted), 1);
+  const auto sketches = cache->GetKeyValueSetSketches({"a", "b"});
+  ASSERT_TRUE(sketches.ok());
+  ASSERT_EQ(sketches->size(), 1);
+  EXPECT_EQ(sketches->at("a").Estimate(), 2);
+}
+
+TEST(SetSketchTest, RebuiltWhenRetainedValueIsDeleted) {
+  auto noop_metrics_recorder =
+      TelemetryProvider::GetInstance().CreateMetricsRecorder();
+  std::unique_ptr<Cache> cache =
+      KeyValueCache::Create(*noop_metrics_recorder, true);
+  std::vector<std::string> values;
+  for (int i = 0; i < 4'000; i++) {
+    values.push_back(absl::StrCat("v", i));
+  }
+  std::vector<std::string_view> value_views(values.begin(), values.end());
+  cache->UpdateKeyValueSet("a", absl::MakeSpan(value_views), 1);
+  cache->DeleteValuesInSet("a", absl::MakeSpan(value_views).subspan(2'000), 2);
+  const auto sketches = cache->GetKeyValueSetSketches({"a"});
+  ASSERT_TRUE(sketches.ok());
+  EXPECT_FALSE(sketches->at("a").IsExact());
+  EXPECT_NEAR(sketches->at("a").Estimate(), 2'000, 200);
+}
+
+TEST(SetSketchTest, RemovedWithCleanedUpSet) {
+  auto noop_metrics_recorder =
+      TelemetryProvider::GetInstance().CreateMetricsRecorder();
+  auto cache = std::make_unique<KeyValueCache>(*noop_metrics_recorder, true);
+  std::vector<std::string_view> values = {"v1", "v2"};
+  cache->UpdateKeyValueSet("a", absl::MakeSpan(values), 1);
+  cache->UpdateKeyValueSet("b", absl::MakeSpan(values), 1);
+  cache->DeleteValuesInSet("a", absl::MakeSpan(values), 2);
+  EXPECT_EQ(KeyValueCacheTestPeer::GetSetSketchesSize(*cache), 2);
+  cache->RemoveDeletedKeys(2);
+  EXPECT_EQ(KeyValueCacheTestPeer::GetSetSketchesSize(*cache), 1);
+  const auto sketches = cache->GetKeyValueSetSketches({"a", "b"});
+  ASSERT_TRUE(sketches.ok());
+  EXPECT_FALSE(sketches->contains("a"));
+  EXPECT_EQ(sketches->at("b").Estimate(), 2);
+}
+
+TEST(UIntSetTest, GetReturnsSortedValues) {
+  auto noop_metrics_recorder =
+      TelemetryProvider::GetInstance().CreateMetricsRecorder();
+  std::unique_ptr<Cache> cache = KeyValueCache::Create(*noop_metrics_recorder);
+  std::vector<uint32_t> values = {5, 1, 3, 1};
+  cache->UpdateKeyValueUInt32Set("a", values, 1);
+  values = {2, 5};
+  cache->UpdateKeyValueUInt32Set("a", values, 2);
+  std::vector<uint64_t> big_values = {uint64_t{1} << 40};
+  cache->UpdateKeyValueUInt64Set("b", big_values, 1);
+  auto result = cache->GetKeyValueSet({"a", "b", "missing"});
+  ASSERT_TRUE(result->GetUInt32ValueSet("a").has_value());
+  EXPECT_THAT(*result->GetUInt32ValueSet("a"), ElementsAre(1, 2, 3, 5));
+  EXPECT_FALSE(result->GetUInt64ValueSet("a").has_value());
+  EXPECT_THAT(result->GetValueSet("a"),
+              UnorderedElementsAre("1", "2", "3", "5"));
+  ASSERT_TRUE(result->GetUInt64ValueSet("b").has_value());
+  EXPECT_THAT(*result->GetUInt64ValueSet("b"),
+              ElementsAre(uint64_t{1} << 40));
+  EXPECT_THAT(result->GetValueSet("b"), ElementsAre("1099511627776"));
+  ASSERT_TRUE(result->GetUInt32ValueSet("missing").has_value());
+  EXPECT_TRUE(result->GetUInt32ValueSet("missing")->empty());
+  EXPECT_TRUE(result->GetValueSet("missing").empty());
+}
+
+TEST(UIntSetTest, OutOfOrderUpdatesAndDeletions) {
+  auto noop_metrics_recorder =
+      TelemetryProvider::GetInstance().CreateMetricsRecorder();
+  auto cache = std::make_unique<KeyValueCache>(*noop_metrics_recorder);
+  std::vector<uint32_t> values = {1, 2, 3};
+  cache->UpdateKeyValueUInt32Set("a", values, 1);
+  std::vector<uint32_t> two = {2};
+  cache->DeleteValuesInUInt32Set("a", two, 3);
+  // Older than the deletion, the value stays deleted.
+  cache->UpdateKeyValueUInt32Set("a", two, 2);
+  EXPECT_THAT(*cache->GetKeyValueSet({"a"})->GetUInt32ValueSet("a"),
+              ElementsAre(1, 3));
+  cache->UpdateKeyValueUInt32Set("a", two, 4);
+  EXPECT_THAT(*cache->GetKeyValueSet({"a"})->GetUInt32ValueSet("a"),
+              ElementsAre(1, 2, 3));
+  // Older than the update, the value is not deleted.
+  std::vector<uint32_t> one_and_nine = {9, 1};
+  cache->DeleteValuesInUInt32Set("a", one_and_nine, 1);
+  EXPECT_THAT(*cache->GetKeyValueSet({"a"})->GetUInt32ValueSet("a"),
+              ElementsAre(1, 2, 3));
+  EXPECT_THAT(KeyValueCacheTestPeer::ReadDeletedUInt32Values(*cache, "a"),
+              ElementsAre(9));
+  // Deleting from a missing set keeps later updates from inserting older
+  // values.
+  cache->DeleteValuesInUInt32Set("b", two, 5);
+  cache->UpdateKeyValueUInt32Set("b", two, 4);
+  EXPECT_TRUE(cache->GetKeyValueSet({"b"})->GetUInt32ValueSet("b")->empty());
+}
+
+TEST(UIntSetTest, UpdatesOfAnotherTypeAreIgnored) {
+  auto noop_metrics_recorder =
+      TelemetryProvider::GetInstance().CreateMetricsRecorder();
+  std::unique_ptr<Cache> cache = KeyValueCache::Create(*noop_metrics_recorder);
+  std::vector<std::string_view> strings = {"v1"};
+  std::vector<uint32_t> values32 = {1};
+  std::vector<uint64_t> values64 = {2};
+  cache->UpdateKeyValueSet("strings", absl::MakeSpan(strings), 1);
+  cache->UpdateKeyValueUInt32Set("strings", values32, 2);
+  cache->UpdateKeyValueUInt64Set("numbers", values64, 1);
+  cache->UpdateKeyValueUInt32Set("numbers", values32, 2);
+  cache->UpdateKeyValueSet("numbers", absl::MakeSpan(strings), 2);
+  cache->DeleteValuesInUInt32Set("numbers", values32, 3);
+  auto result = cache->GetKeyValueSet({"strings", "numbers"});
+  EXPECT_THAT(result->GetValueSet("strings"), UnorderedElementsAre("v1"));
+  EXPECT_FALSE(result->GetUInt32ValueSet("strings").has_value());
+  EXPECT_THAT(*result->GetUInt64ValueSet("numbers"), ElementsAre(2));
+  EXPECT_FALSE(result->GetUInt32ValueSet("numbers").has_value());
+}
+
+TEST(UIntSetTest, GetSetMembershipParsesCandidates) {
+  auto noop_metrics_recorder =
+      TelemetryProvider::GetInstance().CreateMetricsRecorder();
+  std::unique_ptr<Cache> cache = KeyValueCache::Create(*noop_metrics_recorder);
+  std::vector<uint64_t> values = {3, 7};
+  cache->UpdateKeyValueUInt64Set("a", values, 1);
+  const std::vector<std::string_view> candidates = {"3", "03", "x", "7", "4"};
+  EXPECT_THAT(cache->GetKeyValueSetMembership("a", candidates),
+              ElementsAre(true, false, false, true, false));
+}
+
+TEST(UIntSetTest, RemoveDeletedKeysDropsDeletedValues) {
+  auto noop_metrics_recorder =
+      TelemetryProvider::GetInstance().CreateMetricsRecorder();
+  auto cache = std::make_unique<KeyValueCache>(*noop_metrics_recorder);
+  std::vector<uint32_t> values = {1, 2};
+  cache->UpdateKeyValueUInt32Set("a", values, 1);
+  cache->UpdateKeyValueUInt32Set("b", values, 1);
+  std::vector<uint32_t> one = {1};
+  cache->DeleteValuesInUInt32Set("a", values, 2);
+  cache->DeleteValuesInUInt32Set("b", one, 3);
+  cache->RemoveDeletedKeys(2);
+  EXPECT_EQ(KeyValueCacheTestPeer::GetUInt32SetMapSize(*cache), 1);
+  EXPECT_THAT(KeyValueCacheTestPeer::ReadDeletedUInt32Values(*cache, "b"),
+              ElementsAre(1));
+  cache->RemoveDeletedKeys(3);
+  EXPECT_TRUE(
+      KeyValueCacheTestPeer::ReadDeletedUInt32Values(*cache, "b").empty());
+  EXPECT_EQ(KeyValueCacheTestPeer::GetDeletedSetNodesMapSize(*cache), 0);
+  // Updates older than the cleanup are ignored.
+  cache->UpdateKeyValueUInt32Set("a", values, 3);
+  EXPECT_EQ(KeyValueCacheTestPeer::GetUInt32SetMapSize(*cache), 1);
+  cache->UpdateKeyValueUInt32Set("a", values, 4);
+  EXPECT_THAT(*cache->GetKeyValueSet({"a"})->GetUInt32ValueSet("a"),
+              ElementsAre(1, 2));
+}
+
+TEST(UIntSetTest, SketchesAndViewsUseDecimalValues) {
+  auto noop_metrics_recorder =
+      TelemetryProvider::GetInstance().CreateMetricsRecorder();
+  std::unique_ptr<Cache> cache =
+      KeyValueCache::Create(*noop_metrics_recorder, true);
+  std::vector<uint32_t> a = {1, 2, 3};
+  cache->UpdateKeyValueUInt32Set("a", a, 1);
+  ASSERT_TRUE(cache->AddMaterializedView("view", "a - b").ok());
+  std::vector<uint32_t> b = {2, 4};
+  cache->UpdateKeyValueUInt32Set("b", b, 2);
+  std::vector<uint32_t> deleted = {3};
+  cache->DeleteValuesInUInt32Set("a", deleted, 3);
+  EXPECT_THAT(cache->GetKeyValueSet({"view"})->GetValueSet("view"),
+              UnorderedElementsAre("1"));
+  const auto sketches = cache->GetKeyValueSetSketches({"a", "b", "view"});
+  ASSERT_TRUE(sketches.ok());
+  EXPECT_EQ(sketches->at("a").Estimate(), 2);
+  EXPECT_EQ(sketches->at("b").Estimate(), 2);
+  EXPECT_EQ(sketches->at("view").Estimate(), 1);
+  std::vector<uint32_t> view_values = {5};
+  cache->UpdateKeyValueUInt32Set("view", view_values, 4);
+  EXPECT_THAT(cache->GetKeyValueSet({"view"})->GetValueSet("view"),
+              UnorderedElementsAre("1"));
+}
+
+TEST(MaterializedViewTest, UpdatesViewSketch) {
+  auto noop_metrics_recorder =
+      TelemetryProvider::GetInstance().CreateMetricsRecorder();
+  std::unique_ptr<Cache> cache =
+      KeyValueCache::Create(*noop_metrics_recorder, true);
+  ASSERT_TRUE(cache->AddMaterializedView("view", "a - b").ok());
+  std::vector<std::string_view> a = {"u1", "u2", "u3"};
+  cache->UpdateKeyValueSet("a", absl::MakeSpan(a), 1);
+  std::vector<std::string_view> b = {"u2"};
+  cache->UpdateKeyValueSet("b", absl::MakeSpan(b), 2);
+  const auto sketches = cache->GetKeyValueSetSketches({"view"});
+  ASSERT_TRUE(sketches.ok());
+  EXPECT_EQ(sketches->at("view").Estimate(), 2);
+}
+
+TEST(MaterializedViewTest, UpdatesChangeViewVersion) {
+  auto noop_metrics_recorder =
+      TelemetryProvider::GetInstance().CreateMetricsRecorder();
+  std::unique_ptr<Cache> cache =
+      KeyValueCache::Create(*noop_metrics_recorder, false, true);
+  ASSERT_TRUE(cache->AddMaterializedView("view", "a - b").ok());
+  const int64_t version = cache->GetKeyValueSetVersion({"view"});
+  std::vector<std::string_view> values = {"v1"};
+  cache->UpdateKeyValueSet("a", absl::MakeSpan(values), 1);
+  EXPECT_GT(cache->GetKeyValueSetVersion({"view"}), version);
+}
+
+TEST(MaterializedViewTest, ComputedFromExistingSets) {
+  auto noop_metrics_recorder =
+      TelemetryProvider::GetInstance().CreateMetricsRecorder();
+  std::unique_ptr<Cache> cache = KeyValueCache::Create(*noop_metrics_recorder);
+  std::vector<std::string_view> premium = {"u1", "u2"};
+  std::vector<std::string_view> gold = {"u3"};
+  std::vector<std::string_view> blocked = {"u2"};
+  cache->UpdateKeyValueSet("premium", absl::MakeSpan(premium), 1);
+  cache->UpdateKeyValueSet("gold", absl::MakeSpan(gold), 1);
+  cache->UpdateKeyValueSet("blocked", absl::MakeSpan(blocked), 1);
+  ASSERT_TRUE(
+      cache->AddMaterializedView("eligible", "(premium | gold) - blocked")
+          .ok());
+  EXPECT_THAT(cache->GetKeyValueSet({"eligible"})->GetValueSet("eligible"),
+              UnorderedElementsAre("u1", "u3"));
+}
+
+TEST(MaterializedViewTest, UpdatedIncrementally) {
+  auto noop_metrics_recorder =
+      TelemetryProvider::GetInstance().CreateMetricsRecorder();
+  std::unique_ptr<Cache> cache = KeyValueCache::Create(*noop_metrics_recorder);
+  ASSERT_TRUE(
+      cache->AddMaterializedView("eligible", "(premium | gold) - blocked")
+          .ok());
+  EXPECT_TRUE(
+      cache->GetKeyValueSet({"eligible"})->GetValueSet("eligible").empty());
+
+  std::vector<std::string_view> premium = {"u1", "u2"};
+  cache->UpdateKeyValueSet("premium", absl::MakeSpan(premium), 1);
+  std::vector<std::string_view> blocked = {"u2"};
+  cache->UpdateKeyValueSet("blocked", absl::MakeSpan(blocked), 2);
+  std::vector<std::string_view> gold = {"u2", "u3"};
+  cache->UpdateKeyValueSet("gold", absl::MakeSpan(gold), 3);
+  EXPECT_THAT(cache->GetKeyValueSet({"eligible"})->GetValueSet("eligible"),
+              UnorderedElementsAre("u1", "u3"));
+
+  cache->DeleteValuesInSet("blocked", absl::MakeSpan(blocked), 4);
+  std::vector<std::string_view> deleted_premium = {"u1"};
+  cache->DeleteValuesInSet("premium", absl::MakeSpan(deleted_premium), 5);
+  EXPECT_THAT(cache->GetKeyValueSet({"eligible"})->GetValueSet("eligible"),
+              UnorderedElementsAre("u2", "u3"));
+}
+
+TEST(MaterializedViewTest, DeletedViewValuesAreCleanedUp) {
+  auto noop_metrics_recorder =
+      TelemetryProvider::GetInstance().CreateMetricsRecorder();
+  std::unique_ptr<KeyValueCache> cache =
+      std::make_unique<KeyValueCache>(*noop_metrics_recorder);
+  ASSERT_TRUE(cache->AddMaterializedView("view", "a - b").ok());
+  std::vector<std::string_view> values = {"v1", "v2"};
+  cache->UpdateKeyValueSet("a", absl::MakeSpan(values), 1);
+  std::vector<std::string_view> deleted = {"v1"};
+  cache->UpdateKeyValueSet("b", absl::MakeSpan(deleted), 2);
+  EXPECT_TRUE(
+      KeyValueCacheTestPeer::GetSetValueMeta(*cache, "view", "v1").is_deleted);
+  EXPECT_THAT(KeyValueCacheTestPeer::ReadDeletedSetNodesForTimestamp(
+                  *cache, 2, "view"),
+              UnorderedElementsAre("v1"));
+  cache->RemoveDeletedKeys(2);
+  EXPECT_EQ(KeyValueCacheTestPeer::GetSetValueSize(*cache, "view"), 1);
+  EXPECT_THAT(cache->GetKeyValueSet({"view"})->GetValueSet("view"),
+              UnorderedElementsAre("v2"));
+}
+
+TEST(MaterializedViewTest, UpdatesToViewAreIgnored) {
+  auto noop_metrics_recorder =
+      TelemetryProvider::GetInstance().CreateMetricsRecorder();
+  std::unique_ptr<Cache> cache = KeyValueCache::Create(*noop_metrics_recorder);
+  ASSERT_TRUE(cache->AddMaterializedView("view", "a").ok());
+  std::vector<std::string_view> values = {"v1"};
+  cache->UpdateKeyValueSet("view", absl::MakeSpan(values), 1);
+  EXPECT_TRUE(cache->GetKeyValueSet({"view"})->GetValueSet("view").empty());
+  cache->UpdateKeyValueSet("a", absl::MakeSpan(values), 2);
+  cache->DeleteValuesInSet("view", absl::MakeSpan(values), 3);
+  EXPECT_THAT(cache->GetKeyValueSet({"view"})->GetValueSet("view"),
+              UnorderedElementsAre("v1"));
+}
+
+TEST(MaterializedViewTest, ConcurrentUpdatesOfItsKeys) {
+  auto noop_metrics_recorder =
+      TelemetryProvider::GetInstance().CreateMetricsRecorder();
+  std::unique_ptr<Cache> cache = KeyValueCache::Create(*noop_metrics_recorder);
+  ASSERT_TRUE(cache->AddMaterializedView("view", "a & b").ok());
+  const int num_values =
+      std::min(20, (int)std::thread::hardware_concurrency());
+  std::vector<std::string> values;
+  for (int i = 0; i < num_values; i++) {
+    values.push_back(absl::StrCat("v", i));
+  }
+  absl::Notification start;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < num_values; i++) {
+    for (const std::string_view key : {"a", "b"}) {
+      threads.emplace_back([&cache, &values, &start, key, i]() {
+        std::vector<std::string_view> value = {values[i]};
+        start.WaitForNotification();
+        cache->UpdateKeyValueSet(key, absl::MakeSpan(value), i + 1);
+      });
+    }
+  }
+  start.Notify();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_THAT(cache->GetKeyValueSet({"view"})->GetValueSet("view"),
+              UnorderedElementsAreArray(values));
+}
+
+TEST(MaterializedViewTest, InvalidViews) {
+  auto noop_metrics_recorder =
+      TelemetryProvider::GetInstance().CreateMetricsRecorder();
+  std::unique_ptr<Cache> cache = KeyValueCache::Create(*noop_metrics_recorder);
+  std::vector<std::string_view> values = {"v1"};
+  cache->UpdateKeyValueSet("a", absl::MakeSpan(values), 1);
+  EXPECT_EQ(cache->AddMaterializedView("view", "a |").code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(cache->AddMaterializedView("view", "").code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(cache->AddMaterializedView("view", "view | a").code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(cache->AddMaterializedView("a", "b").code(),
+            absl::StatusCode::kAlreadyExists);
+  ASSERT_TRUE(cache->AddMaterializedView("view", "a").ok());
+  EXPECT_EQ(cache->AddMaterializedView("view", "b").code(),
+            absl::StatusCode::kAlreadyExists);
+  EXPECT_EQ(cache->AddMaterializedView("other", "view & a").code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(cache->AddMaterializedView("b", "a").code(),
+            absl::StatusCode::kOk);
+}
+
 }  // namespace
 }  // namespace kv_server
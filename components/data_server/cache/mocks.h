@@ -15,7 +15,9 @@
 #ifndef COMPONENTS_DATA_SERVER_CACHE_MOCKS_H_
 #define COMPONENTS_DATA_SERVER_CACHE_MOCKS_H_
 
+#include <cstdint>
 #include <memory>
+#include <optional>
 #include <string>
 #include <utility>
 #include <vector>
@@ -38,6 +40,16 @@ class MockCache : public Cache {
   MOCK_METHOD((std::unique_ptr<GetKeyValueSetResult>), GetKeyValueSet,
               (const absl::flat_hash_set<std::string_view>&),
               (const, override));
+  MOCK_METHOD(std::vector<bool>, GetKeyValueSetMembership,
+              (std::string_view, absl::Span<const std::string_view>),
+              (const, override));
+  MOCK_METHOD(int64_t, GetKeyValueSetVersion,
+              (const absl::flat_hash_set<std::string_view>&),
+              (const, override));
+  MOCK_METHOD((absl::StatusOr<absl::flat_hash_map<std::string, ThetaSketch>>),
+              GetKeyValueSetSketches,
+              (const absl::flat_hash_set<std::string_view>&),
+              (const, override));
   MOCK_METHOD(void, UpdateKeyValue,
               (std::string_view key, std::string_view value, int64_t ts),
               (override));
@@ -49,18 +61,48 @@ class MockCache : public Cache {
               (std::string_view key, absl::Span<std::string_view> value_set,
                int64_t logical_commit_time),
               (override));
+  MOCK_METHOD(void, UpdateKeyValueUInt32Set,
+              (std::string_view key, absl::Span<const uint32_t> value_set,
+               int64_t logical_commit_time),
+              (override));
+  MOCK_METHOD(void, UpdateKeyValueUInt64Set,
+              (std::string_view key, absl::Span<const uint64_t> value_set,
+               int64_t logical_commit_time),
+              (override));
+  MOCK_METHOD(void, DeleteValuesInUInt32Set,
+              (std::string_view key, absl::Span<const uint32_t> value_set,
+               int64_t logical_commit_time),
+              (override));
+  MOCK_METHOD(void, DeleteValuesInUInt64Set,
+              (std::string_view key, absl::Span<const uint64_t> value_set,
+               int64_t logical_commit_time),
+              (override));
   MOCK_METHOD(void, DeleteKey, (std::string_view key, int64_t ts), (override));
   MOCK_METHOD(void, RemoveDeletedKeys, (int64_t ts), (override));
+  MOCK_METHOD(absl::Status, AddMaterializedView,
+              (std::string_view name, std::string_view query), (override));
 };
 
 class MockGetKeyValueSetResult : public GetKeyValueSetResult {
  public:
-  MOCK_METHOD((absl::flat_hash_set<std::string_view>), GetValueSet,
+  MOCK_METHOD((const absl::flat_hash_set<std::string_view>&), GetValueSet,
+              (std::string_view), (const, override));
+  MOCK_METHOD(std::optional<absl::Span<const uint32_t>>, GetUInt32ValueSet,
+              (std::string_view), (const, override));
+  MOCK_METHOD(std::optional<absl::Span<const uint64_t>>, GetUInt64ValueSet,
               (std::string_view), (const, override));
   MOCK_METHOD(void, AddKeyValueSet,
               (std::string_view, absl::flat_hash_set<std::string_view>,
                std::unique_ptr<absl::ReaderMutexLock>),
               (override));
+  MOCK_METHOD(void, AddUInt32ValueSet,
+              (std::string_view, absl::Span<const uint32_t>,
+               std::unique_ptr<absl::ReaderMutexLock>),
+              (override));
+  MOCK_METHOD(void, AddUInt64ValueSet,
+              (std::string_view, absl::Span<const uint64_t>,
+               std::unique_ptr<absl::ReaderMutexLock>),
+              (override));
 };
 
 }  // namespace kv_server
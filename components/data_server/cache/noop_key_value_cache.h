@@ -16,7 +16,9 @@
 #ifndef COMPONENTS_DATA_SERVER_CACHE_NOOP_KEY_VALUE_CACHE_H_
 #define COMPONENTS_DATA_SERVER_CACHE_NOOP_KEY_VALUE_CACHE_H_
 
+#include <cstdint>
 #include <memory>
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -33,29 +35,75 @@ class NoOpKeyValueCache : public Cache {
       const absl::flat_hash_set<std::string_view>& key_set) const override {
     return std::make_unique<NoOpGetKeyValueSetResult>();
   }
+  std::vector<bool> GetKeyValueSetMembership(
+      std::string_view key,
+      absl::Span<const std::string_view> candidates) const override {
+    return std::vector<bool>(candidates.size(), false);
+  }
+  int64_t GetKeyValueSetVersion(
+      const absl::flat_hash_set<std::string_view>& key_set) const override {
+    return 0;
+  }
+  absl::StatusOr<absl::flat_hash_map<std::string, ThetaSketch>>
+  GetKeyValueSetSketches(
+      const absl::flat_hash_set<std::string_view>& key_set) const override {
+    return absl::flat_hash_map<std::string, ThetaSketch>();
+  }
   void UpdateKeyValue(std::string_view key, std::string_view value,
                       int64_t logical_commit_time) override {}
   void UpdateKeyValueSet(std::string_view key,
                          absl::Span<std::string_view> value_set,
                          int64_t logical_commit_time) override {}
+  void UpdateKeyValueUInt32Set(std::string_view key,
+                               absl::Span<const uint32_t> value_set,
+                               int64_t logical_commit_time) override {}
+  void UpdateKeyValueUInt64Set(std::string_view key,
+                               absl::Span<const uint64_t> value_set,
+                               int64_t logical_commit_time) override {}
   void DeleteKey(std::string_view key, int64_t logical_commit_time) override {}
   void DeleteValuesInSet(std::string_view key,
                          absl::Span<std::string_view> value_set,
                          int64_t logical_commit_time) override {}
+  void DeleteValuesInUInt32Set(std::string_view key,
+                               absl::Span<const uint32_t> value_set,
+                               int64_t logical_commit_time) override {}
+  void DeleteValuesInUInt64Set(std::string_view key,
+                               absl::Span<const uint64_t> value_set,
+                               int64_t logical_commit_time) override {}
   void RemoveDeletedKeys(int64_t logical_commit_time) override {}
+  absl::Status AddMaterializedView(std::string_view name,
+                                   std::string_view query) override {
+    return absl::OkStatus();
+  }
   static std::unique_ptr<Cache> Create() {
     return std::make_unique<NoOpKeyValueCache>();
   }
 
  private:
   class NoOpGetKeyValueSetResult : public GetKeyValueSetResult {
-    absl::flat_hash_set<std::string_view> GetValueSet(
+    const absl::flat_hash_set<std::string_view>& GetValueSet(
         std::string_view key) const override {
-      return {};
+      static const auto* kEmptySet =
+          new absl::flat_hash_set<std::string_view>();
+      return *kEmptySet;
+    }
+    std::optional<absl::Span<const uint32_t>> GetUInt32ValueSet(
+        std::string_view key) const override {
+      return absl::Span<const uint32_t>();
+    }
+    std::optional<absl::Span<const uint64_t>> GetUInt64ValueSet(
+        std::string_view key) const override {
+      return absl::Span<const uint64_t>();
     }
     void AddKeyValueSet(
         std::string_view key, absl::flat_hash_set<std::string_view> value_set,
         std::unique_ptr<absl::ReaderMutexLock> key_lock) override {}
+    void AddUInt32ValueSet(
+        std::string_view key, absl::Span<const uint32_t> value_set,
+        std::unique_ptr<absl::ReaderMutexLock> key_lock) override {}
+    void AddUInt64ValueSet(
+        std::string_view key, absl::Span<const uint64_t> value_set,
+        std::unique_ptr<absl::ReaderMutexLock> key_lock) override {}
   };
 };
 
@@ -16,11 +16,13 @@
 
 #include <algorithm>
 #include <deque>
+#include <string>
 #include <utility>
 #include <vector>
 
 #include "absl/functional/bind_front.h"
 #include "absl/strings/str_cat.h"
+#include "absl/time/clock.h"
 #include "components/errors/retry.h"
 #include "glog/logging.h"
 #include "public/constants.h"
@@ -64,6 +66,18 @@ absl::Status ApplyUpdateMutation(const KeyValueMutationRecord& record,
                             record.logical_commit_time());
     return absl::OkStatus();
   }
+  if (record.value_type() == Value::UInt32Set) {
+    cache.UpdateKeyValueUInt32Set(record.key()->string_view(),
+                                  GetRecordValue<std::vector<uint32_t>>(record),
+                                  record.logical_commit_time());
+    return absl::OkStatus();
+  }
+  if (record.value_type() == Value::UInt64Set) {
+    cache.UpdateKeyValueUInt64Set(record.key()->string_view(),
+                                  GetRecordValue<std::vector<uint64_t>>(record),
+                                  record.logical_commit_time());
+    return absl::OkStatus();
+  }
   return absl::InvalidArgumentError(
       absl::StrCat("Record with key: ", record.key()->string_view(),
                    " has unsupported value type: ", record.value_type()));
@@ -81,6 +95,18 @@ absl::Status ApplyDeleteMutation(const KeyValueMutationRecord& record,
                             record.logical_commit_time());
     return absl::OkStatus();
   }
+  if (record.value_type() == Value::UInt32Set) {
+    cache.DeleteValuesInUInt32Set(record.key()->string_view(),
+                                  GetRecordValue<std::vector<uint32_t>>(record),
+                                  record.logical_commit_time());
+    return absl::OkStatus();
+  }
+  if (record.value_type() == Value::UInt64Set) {
+    cache.DeleteValuesInUInt64Set(record.key()->string_view(),
+                                  GetRecordValue<std::vector<uint64_t>>(record),
+                                  record.logical_commit_time());
+    return absl::OkStatus();
+  }
   return absl::InvalidArgumentError(
       absl::StrCat("Record with key: ", record.key()->string_view(),
                    " has unsupported value type: ", record.value_type()));
@@ -88,13 +114,13 @@ absl::Status ApplyDeleteMutation(const KeyValueMutationRecord& record,
 
 bool ShouldProcessRecord(const KeyValueMutationRecord& record,
                          int64_t num_shards, int64_t server_shard_num,
+                         const ShardingFunction& sharding_function,
                          MetricsRecorder& metrics_recorder) {
   if (num_shards <= 1) {
     return true;
   }
-  auto shard_num =
-      ShardingFunction(/*seed=*/"")
-          .GetShardNumForKey(record.key()->string_view(), num_shards);
+  auto shard_num = sharding_function.GetShardNumForKey(
+      record.key()->string_view(), num_shards);
   if (shard_num == server_shard_num) {
     return true;
   }
@@ -106,6 +132,16 @@ bool ShouldProcessRecord(const KeyValueMutationRecord& record,
   return false;
 }
 
+// The records of a sharded file only belong to its shard if the server assigns
+// keys to shards the same way, so the file is of no use to the server
+// otherwise.
+bool HasOtherShardingFunction(const KVFileMetadata& metadata,
+                              const ShardingFunction& sharding_function) {
+  return metadata.has_sharding_metadata() &&
+         metadata.sharding_metadata().sharding_function_version() !=
+             static_cast<int32_t>(sharding_function.version());
+}
+
 absl::Status ApplyKeyValueMutationToCache(
     const KeyValueMutationRecord& record, Cache& cache, int64_t& max_timestamp,
     DataLoadingStats& data_loading_stats) {
@@ -137,17 +173,23 @@ absl::Status ApplyKeyValueMutationToCache(
 absl::StatusOr<DataLoadingStats> LoadCacheWithData(
     StreamRecordReader<std::string_view>& record_reader, Cache& cache,
     int64_t& max_timestamp, const int32_t server_shard_num,
-    const int32_t num_shards, MetricsRecorder& metrics_recorder,
-    UdfClient& udf_client) {
+    const int32_t num_shards, const ShardingFunction& sharding_function,
+    MetricsRecorder& metrics_recorder, UdfClient& udf_client,
+    NearCache* near_cache) {
   DataLoadingStats data_loading_stats;
   const auto process_data_record_fn =
       [&cache, &max_timestamp, &data_loading_stats, server_shard_num,
-       num_shards, &metrics_recorder,
-       &udf_client](const DataRecord& data_record) {
+       num_shards, &sharding_function, &metrics_recorder, &udf_client,
+       near_cache](const DataRecord& data_record) {
         if (data_record.record_type() == Record::KeyValueMutationRecord) {
           const auto* record = data_record.record_as_KeyValueMutationRecord();
           if (!ShouldProcessRecord(*record, num_shards, server_shard_num,
-                                   metrics_recorder)) {
+                                   sharding_function, metrics_recorder)) {
+            if (near_cache != nullptr) {
+              // The front-end may have cached the key of the other shard.
+              near_cache->Invalidate(record->key()->string_view(),
+                                     absl::Now());
+            }
             // NOTE: currently upstream logic retries on non-ok status
             // this will get us in a loop
             return absl::OkStatus();
@@ -210,9 +252,21 @@ absl::StatusOr<DataLoadingStats> LoadCacheWithDataFromFile(
         .total_deleted_records = 0,
     };
   }
-  auto status = LoadCacheWithData(*record_reader, cache, max_timestamp,
-                                  options.shard_num, options.num_shards,
-                                  metrics_recorder, options.udf_client);
+  if (HasOtherShardingFunction(*metadata, options.sharding_function)) {
+    LOG(ERROR) << "Blob " << location << " was sharded with sharding function "
+               << metadata->sharding_metadata().sharding_function_version()
+               << " but the server uses sharding function "
+               << static_cast<int32_t>(options.sharding_function.version())
+               << ". Skipping it.";
+    return DataLoadingStats{
+        .total_updated_records = 0,
+        .total_deleted_records = 0,
+    };
+  }
+  auto status = LoadCacheWithData(
+      *record_reader, cache, max_timestamp, options.shard_num,
+      options.num_shards, options.sharding_function, metrics_recorder,
+      options.udf_client, options.near_cache);
   if (status.ok()) {
     cache.RemoveDeletedKeys(max_timestamp);
   }
@@ -411,6 +465,15 @@ class DataOrchestratorImpl : public DataOrchestrator {
                   << ". Skipping it.";
         continue;
       }
+      if (HasOtherShardingFunction(*metadata, options.sharding_function)) {
+        LOG(ERROR) << "Snapshot " << location
+                   << " was sharded with sharding function "
+                   << metadata->sharding_metadata().sharding_function_version()
+                   << " but the server uses sharding function "
+                   << static_cast<int32_t>(options.sharding_function.version())
+                   << ". Skipping it.";
+        continue;
+      }
       LOG(INFO) << "Loading snapshot file: " << location;
       if (auto status = TraceLoadCacheWithDataFromFile(metrics_recorder,
                                                        location, options);
@@ -434,7 +497,8 @@ class DataOrchestratorImpl : public DataOrchestrator {
     auto record_reader = delta_stream_reader_factory.CreateReader(is);
     return LoadCacheWithData(*record_reader, cache, max_timestamp,
                              options_.shard_num, options_.num_shards,
-                             metrics_recorder_, options_.udf_client);
+                             options_.sharding_function, metrics_recorder_,
+                             options_.udf_client, options_.near_cache);
   }
 
   const Options options_;
@@ -28,8 +28,10 @@
 #include "components/data/realtime/realtime_notifier.h"
 #include "components/data/realtime/realtime_thread_pool_manager.h"
 #include "components/data_server/cache/cache.h"
+#include "components/internal_server/near_cache.h"
 #include "components/udf/udf_client.h"
 #include "public/data_loading/readers/riegeli_stream_io.h"
+#include "public/sharding/sharding_function.h"
 #include "src/cpp/telemetry/metrics_recorder.h"
 
 namespace kv_server {
@@ -54,6 +56,10 @@ class DataOrchestrator {
     RealtimeThreadPoolManager& realtime_thread_pool_manager;
     const int32_t shard_num = 0;
     const int32_t num_shards = 1;
+    // Assigns keys to shards. Sharded files of other versions are skipped.
+    const ShardingFunction sharding_function = ShardingFunction(/*seed=*/"");
+    // If set, the keys of other shards that are mutated are invalidated in it.
+    NearCache* const near_cache = nullptr;
   };
 
   // Creates initial state. Scans the bucket and initializes the cache with data
@@ -32,6 +32,7 @@
 #include "public/constants.h"
 #include "public/data_loading/filename_utils.h"
 #include "public/data_loading/records_utils.h"
+#include "public/sharding/sharding_function.h"
 #include "public/test_util/mocks.h"
 #include "public/test_util/proto_matcher.h"
 #include "src/cpp/telemetry/mocks.h"
@@ -357,6 +358,85 @@ TEST_F(DataOrchestratorTest, InitCacheSuccess) {
   EXPECT_FALSE((*maybe_orchestrator)->Start().ok());
 }
 
+TEST_F(DataOrchestratorTest, InitCacheLoadsNumericSets) {
+  const std::vector<std::string> fnames(
+      {ToDeltaFileName(1).value(), ToDeltaFileName(2).value()});
+  EXPECT_CALL(
+      blob_client_,
+      ListBlobs(GetTestLocation(),
+                AllOf(Field(&BlobStorageClient::ListOptions::start_after, ""),
+                      Field(&BlobStorageClient::ListOptions::prefix,
+                            FilePrefix<FileType::SNAPSHOT>()))))
+      .Times(1)
+      .WillOnce(Return(std::vector<std::string>()));
+  EXPECT_CALL(
+      blob_client_,
+      ListBlobs(GetTestLocation(),
+                AllOf(Field(&BlobStorageClient::ListOptions::start_after, ""),
+                      Field(&BlobStorageClient::ListOptions::prefix,
+                            FilePrefix<FileType::DELTA>()))))
+      .WillOnce(Return(fnames));
+
+  KVFileMetadata metadata;
+  auto update_reader = std::make_unique<MockStreamRecordReader>();
+  EXPECT_CALL(*update_reader, GetKVFileMetadata)
+      .Times(1)
+      .WillOnce(Return(metadata));
+  EXPECT_CALL(*update_reader, ReadStreamRecords)
+      .Times(1)
+      .WillOnce(
+          [](const std::function<absl::Status(std::string_view)>& callback) {
+            callback(ToStringView(ToFlatBufferBuilder(
+                         DataRecordStruct{.record =
+                                              KeyValueMutationRecordStruct{
+                                                  KeyValueMutationType::Update,
+                                                  3, "bar",
+                                                  std::vector<uint32_t>{1,
+                                                                        2}}})))
+                .IgnoreError();
+            return absl::OkStatus();
+          });
+  auto delete_reader = std::make_unique<MockStreamRecordReader>();
+  EXPECT_CALL(*delete_reader, GetKVFileMetadata)
+      .Times(1)
+      .WillOnce(Return(metadata));
+  EXPECT_CALL(*delete_reader, ReadStreamRecords)
+      .Times(1)
+      .WillOnce(
+          [](const std::function<absl::Status(std::string_view)>& callback) {
+            callback(ToStringView(ToFlatBufferBuilder(
+                         DataRecordStruct{.record =
+                                              KeyValueMutationRecordStruct{
+                                                  KeyValueMutationType::Delete,
+                                                  4, "bar",
+                                                  std::vector<uint64_t>{2}}})))
+                .IgnoreError();
+            return absl::OkStatus();
+          });
+  EXPECT_CALL(delta_stream_reader_factory_, CreateConcurrentReader)
+      .Times(2)
+      .WillOnce(Return(ByMove(std::move(update_reader))))
+      .WillOnce(Return(ByMove(std::move(delete_reader))));
+
+  EXPECT_CALL(cache_,
+              UpdateKeyValueUInt32Set("bar", testing::ElementsAre(1, 2), 3))
+      .Times(1);
+  EXPECT_CALL(cache_,
+              DeleteValuesInUInt64Set("bar", testing::ElementsAre(2), 4))
+      .Times(1);
+  EXPECT_CALL(cache_, RemoveDeletedKeys(3)).Times(1);
+  EXPECT_CALL(cache_, RemoveDeletedKeys(4)).Times(1);
+
+  auto maybe_orchestrator =
+      DataOrchestrator::TryCreate(options_, metrics_recorder_);
+  ASSERT_TRUE(maybe_orchestrator.ok());
+
+  const std::string last_basename = ToDeltaFileName(2).value();
+  EXPECT_CALL(notifier_, Start(_, GetTestLocation(), last_basename, _))
+      .WillOnce(Return(absl::UnknownError("")));
+  EXPECT_FALSE((*maybe_orchestrator)->Start().ok());
+}
+
 TEST_F(DataOrchestratorTest, UpdateUdfCodeSuccess) {
   const std::vector<std::string> fnames({ToDeltaFileName(1).value()});
   EXPECT_CALL(
@@ -656,4 +736,53 @@ TEST_F(DataOrchestratorTest, InitCacheSkipsSnapshotFilesForOtherShards) {
   EXPECT_TRUE(DataOrchestrator::TryCreate(options_, metrics_recorder_).ok());
 }
 
+TEST_F(DataOrchestratorTest,
+       InitCacheSkipsSnapshotFilesOfOtherShardingFunctions) {
+  auto snapshot_name = ToSnapshotFileName(1);
+  EXPECT_CALL(
+      blob_client_,
+      ListBlobs(GetTestLocation(),
+                AllOf(Field(&BlobStorageClient::ListOptions::start_after, ""),
+                      Field(&BlobStorageClient::ListOptions::prefix,
+                            FilePrefix<FileType::SNAPSHOT>()))))
+      .WillOnce(Return(std::vector<std::string>({*snapshot_name})));
+  KVFileMetadata metadata;
+  *metadata.mutable_snapshot()->mutable_starting_file() =
+      ToDeltaFileName(1).value();
+  *metadata.mutable_snapshot()->mutable_ending_delta_file() =
+      ToDeltaFileName(5).value();
+  metadata.mutable_sharding_metadata()->set_shard_num(1);
+  metadata.mutable_sharding_metadata()->set_sharding_function_version(
+      static_cast<int32_t>(ShardingFunction::Version::kSipHash));
+  auto record_reader = std::make_unique<MockStreamRecordReader>();
+  EXPECT_CALL(*record_reader, GetKVFileMetadata)
+      .Times(1)
+      .WillOnce(Return(metadata));
+  EXPECT_CALL(*record_reader, ReadStreamRecords).Times(0);
+  EXPECT_CALL(delta_stream_reader_factory_, CreateConcurrentReader)
+      .Times(1)
+      .WillOnce(Return(ByMove(std::move(record_reader))));
+  EXPECT_CALL(
+      blob_client_,
+      ListBlobs(GetTestLocation(),
+                AllOf(Field(&BlobStorageClient::ListOptions::start_after, ""),
+                      Field(&BlobStorageClient::ListOptions::prefix,
+                            FilePrefix<FileType::DELTA>()))))
+      .WillOnce(Return(std::vector<std::string>()));
+  auto sharded_options = DataOrchestrator::Options{
+      .data_bucket = GetTestLocation().bucket,
+      .cache = cache_,
+      .blob_client = blob_client_,
+      .delta_notifier = notifier_,
+      .change_notifier = change_notifier_,
+      .udf_client = udf_client_,
+      .delta_stream_reader_factory = delta_stream_reader_factory_,
+      .realtime_thread_pool_manager = realtime_thread_pool_manager_,
+      .shard_num = 1,
+      .num_shards = 2,
+  };
+  EXPECT_TRUE(
+      DataOrchestrator::TryCreate(sharded_options, metrics_recorder_).ok());
+}
+
 }  // namespace
@@ -15,6 +15,9 @@
 #include "components/data_server/server/server.h"
 
 #include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
 
 #include "absl/flags/flag.h"
 #include "absl/flags/parse.h"
@@ -22,6 +25,8 @@
 #include "absl/functional/bind_front.h"
 #include "absl/status/status.h"
 #include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "absl/time/time.h"
 #include "components/data_server/request_handler/get_values_adapter.h"
 #include "components/data_server/request_handler/get_values_handler.h"
 #include "components/data_server/request_handler/get_values_v2_handler.h"
@@ -52,6 +57,30 @@
 
 ABSL_FLAG(uint16_t, port, 50051,
           "Port the server is listening on. Defaults to 50051.");
+ABSL_FLAG(std::vector<std::string>, materialized_views, {},
+          "Sets kept up to date with the result of a set query, as "
+          "comma separated name=query pairs, e.g. "
+          "eligible=(premium | gold) - blocked. Queries can refer to them "
+          "like any other set. Not supported with more than one shard.");
+ABSL_FLAG(int64_t, query_result_cache_bytes, 0,
+          "Maximum size of the cached query responses, which are reused "
+          "until a set they were computed from changes. Responses are not "
+          "cached if this is 0.");
+ABSL_FLAG(bool, maintain_set_sketches, false,
+          "Maintains a sketch of every set as it is updated, so that the "
+          "APPROXIMATE_COUNT query mode can estimate result sizes without "
+          "reading the sets.");
+ABSL_FLAG(int64_t, shard_near_cache_capacity, 0,
+          "Number of results of remote shard lookups that are cached on this "
+          "server, to serve hot keys without going over the network. The "
+          "least recently used are evicted first. 0 disables the cache. Only "
+          "used with more than one shard.");
+ABSL_FLAG(absl::Duration, shard_near_cache_ttl, absl::Seconds(1),
+          "Time for which the results of remote shard lookups are cached. The "
+          "results of keys whose mutations this server sees in its deltas and "
+          "realtime updates are invalidated right away, but the mutations "
+          "that only reach other shards, e.g. in files or topics of a single "
+          "shard, are only picked up once the results expire.");
 
 namespace kv_server {
 namespace {
@@ -79,6 +108,8 @@ constexpr absl::string_view kRealtimeUpdaterThreadNumberParameterSuffix =
 constexpr absl::string_view kDataLoadingNumThreadsParameterSuffix =
     "data-loading-num-threads";
 constexpr absl::string_view kNumShardsParameterSuffix = "num-shards";
+constexpr absl::string_view kShardingFunctionVersionParameterSuffix =
+    "sharding-function-version";
 constexpr absl::string_view kUdfNumWorkersParameterSuffix = "udf-num-workers";
 constexpr absl::string_view kRouteV1ToV2Suffix = "route-v1-to-v2";
 
@@ -153,7 +184,16 @@ Server::Server()
 // called right after telemetry has been initialized but before anything that
 // requires the cache has been initialized.
 void Server::InitializeKeyValueCache() {
-  cache_ = KeyValueCache::Create(*metrics_recorder_);
+  const int64_t query_result_cache_bytes =
+      absl::GetFlag(FLAGS_query_result_cache_bytes);
+  // Set versions are only read to invalidate cached query responses.
+  cache_ = KeyValueCache::Create(*metrics_recorder_,
+                                 absl::GetFlag(FLAGS_maintain_set_sketches),
+                                 query_result_cache_bytes > 0);
+  if (query_result_cache_bytes > 0) {
+    query_result_cache_ = std::make_unique<QueryResultCache>(
+        *cache_, query_result_cache_bytes, *metrics_recorder_);
+  }
   cache_->UpdateKeyValue(
       "hi",
       "Hello, world! If you are seeing this, it means you can "
@@ -161,6 +201,34 @@ void Server::InitializeKeyValueCache() {
       /*logical_commit_time = */ 1);
 }
 
+// Views are evaluated over the sets of this shard only, while the view
+// itself is routed to the shard of its name, so they are only supported
+// without sharding.
+absl::Status Server::InitializeMaterializedViews() {
+  const std::vector<std::string> views =
+      absl::GetFlag(FLAGS_materialized_views);
+  if (!views.empty() && num_shards_ > 1) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("--materialized_views is not supported with ",
+                     num_shards_, " shards"));
+  }
+  for (const std::string& view : views) {
+    const std::vector<std::string_view> name_and_query =
+        absl::StrSplit(view, absl::MaxSplits('=', 1));
+    if (name_and_query.size() != 2) {
+      LOG(ERROR) << "Skipping materialized view " << view
+                 << ", expected name=query";
+      continue;
+    }
+    if (const absl::Status status = cache_->AddMaterializedView(
+            name_and_query[0], name_and_query[1]);
+        !status.ok()) {
+      LOG(ERROR) << "Skipping materialized view " << view << ": " << status;
+    }
+  }
+  return absl::OkStatus();
+}
+
 void Server::InitializeTelemetry(const ParameterClient& parameter_client,
                                  InstanceClient& instance_client) {
   std::string instance_id = RetryUntilOk(
@@ -247,6 +315,10 @@ absl::Status Server::Init(
 }
 
 absl::Status Server::InitOnceInstancesAreCreated() {
+  if (absl::GetFlag(FLAGS_shard_near_cache_ttl) < absl::ZeroDuration()) {
+    return absl::InvalidArgumentError(
+        "--shard_near_cache_ttl must not be negative.");
+  }
   const auto shard_num_status = instance_client_->GetShardNumTag();
   if (!shard_num_status.ok()) {
     return shard_num_status.status();
@@ -277,6 +349,21 @@ absl::Status Server::InitOnceInstancesAreCreated() {
   num_shards_ = parameter_fetcher.GetInt32Parameter(kNumShardsParameterSuffix);
   LOG(INFO) << "Retrieved " << kNumShardsParameterSuffix
             << " parameter: " << num_shards_;
+  if (absl::Status status = InitializeMaterializedViews(); !status.ok()) {
+    return status;
+  }
+  const int32_t sharding_function_version =
+      parameter_fetcher.GetInt32Parameter(
+          kShardingFunctionVersionParameterSuffix);
+  LOG(INFO) << "Retrieved " << kShardingFunctionVersionParameterSuffix
+            << " parameter: " << sharding_function_version;
+  const auto version = ShardingFunction::GetVersion(sharding_function_version);
+  if (!version.ok()) {
+    return version.status();
+  }
+  // The seed is empty, so the shard of every key is public, as it is with
+  // SHA256. Only the padding of the requests to the shards hides it.
+  sharding_function_ = ShardingFunction(/*seed=*/"", *version);
 
   blob_client_ = CreateBlobClient(parameter_fetcher);
   delta_stream_reader_factory_ =
@@ -294,10 +381,18 @@ absl::Status Server::InitOnceInstancesAreCreated() {
   SetQueueManager(metadata, message_service_blob_.get());
 
   grpc_server_ = CreateAndStartGrpcServer();
-  local_lookup_ = CreateLocalLookup(*cache_, *metrics_recorder_);
+  local_lookup_ = CreateLocalLookup(*cache_, *metrics_recorder_,
+                                    query_result_cache_.get());
+  if (const int64_t near_cache_capacity =
+          absl::GetFlag(FLAGS_shard_near_cache_capacity);
+      num_shards_ > 1 && near_cache_capacity > 0) {
+    near_cache_ = std::make_unique<NearCache>(
+        near_cache_capacity, absl::GetFlag(FLAGS_shard_near_cache_ttl));
+  }
   auto server_initializer = GetServerInitializer(
       num_shards_, *metrics_recorder_, *key_fetcher_manager_, *local_lookup_,
-      environment_, shard_num_, *instance_client_, *cache_, parameter_fetcher);
+      environment_, shard_num_, *instance_client_, *cache_, parameter_fetcher,
+      near_cache_.get(), sharding_function_, query_result_cache_.get());
   remote_lookup_ = server_initializer->CreateAndStartRemoteLookupServer();
   {
     auto status_or_notifier = BlobStorageChangeNotifier::Create(
@@ -473,6 +568,8 @@ std::unique_ptr<DataOrchestrator> Server::CreateDataOrchestrator(
                 .udf_client = *udf_client_,
                 .shard_num = shard_num_,
                 .num_shards = num_shards_,
+                .sharding_function = sharding_function_,
+                .near_cache = near_cache_.get(),
             },
             *metrics_recorder_);
       },
@@ -35,6 +35,8 @@
 #include "components/data_server/server/parameter_fetcher.h"
 #include "components/data_server/server/server_initializer.h"
 #include "components/internal_server/lookup.h"
+#include "components/internal_server/near_cache.h"
+#include "components/internal_server/query_result_cache.h"
 #include "components/sharding/cluster_mappings_manager.h"
 #include "components/sharding/shard_manager.h"
 #include "components/udf/hooks/get_values_hook.h"
@@ -44,6 +46,7 @@
 #include "grpcpp/grpcpp.h"
 #include "public/base_types.pb.h"
 #include "public/query/get_values.grpc.pb.h"
+#include "public/sharding/sharding_function.h"
 #include "src/cpp/telemetry/metrics_recorder.h"
 #include "src/cpp/telemetry/telemetry.h"
 
@@ -78,6 +81,7 @@ class Server {
 
   absl::Status InitOnceInstancesAreCreated();
   void InitializeKeyValueCache();
+  absl::Status InitializeMaterializedViews();
 
   std::unique_ptr<BlobStorageClient> CreateBlobClient(
       const ParameterFetcher& parameter_fetcher);
@@ -114,6 +118,8 @@ class Server {
   std::vector<std::unique_ptr<grpc::Service>> grpc_services_;
   std::unique_ptr<grpc::Server> grpc_server_;
   std::unique_ptr<Cache> cache_;
+  // Shared by the local lookups. Only set if responses are cached.
+  std::unique_ptr<QueryResultCache> query_result_cache_;
   std::unique_ptr<GetValuesAdapter> get_values_adapter_;
   std::unique_ptr<GetValuesHook> string_get_values_hook_;
   std::unique_ptr<GetValuesHook> binary_get_values_hook_;
@@ -131,6 +137,8 @@ class Server {
   std::unique_ptr<RealtimeThreadPoolManager> realtime_thread_pool_manager_;
   std::unique_ptr<StreamRecordReaderFactory<std::string_view>>
       delta_stream_reader_factory_;
+  // Results of remote shard lookups. Only set with more than one shard.
+  std::unique_ptr<NearCache> near_cache_;
 
   std::unique_ptr<DataOrchestrator> data_orchestrator_;
 
@@ -150,6 +158,7 @@ class Server {
 
   int32_t shard_num_;
   int32_t num_shards_;
+  ShardingFunction sharding_function_ = ShardingFunction(/*seed=*/"");
 
   std::unique_ptr<privacy_sandbox::server_common::KeyFetcherManagerInterface>
       key_fetcher_manager_;
@@ -45,9 +45,11 @@ absl::Status InitializeUdfHooksInternal(
 
 class NonshardedServerInitializer : public ServerInitializer {
  public:
-  explicit NonshardedServerInitializer(MetricsRecorder& metrics_recorder,
-                                       Cache& cache)
-      : metrics_recorder_(metrics_recorder), cache_(cache) {}
+  NonshardedServerInitializer(MetricsRecorder& metrics_recorder, Cache& cache,
+                              QueryResultCache* query_result_cache)
+      : metrics_recorder_(metrics_recorder),
+        cache_(cache),
+        query_result_cache_(query_result_cache) {}
 
   RemoteLookup CreateAndStartRemoteLookupServer() override {
     RemoteLookup remote_lookup;
@@ -60,8 +62,9 @@ class NonshardedServerInitializer : public ServerInitializer {
       RunQueryHook& run_query_hook) override {
     ShardManagerState shard_manager_state;
     auto lookup_supplier = [&cache = cache_,
-                            &metrics_recorder = metrics_recorder_]() {
-      return CreateLocalLookup(cache, metrics_recorder);
+                            &metrics_recorder = metrics_recorder_,
+                            query_result_cache = query_result_cache_]() {
+      return CreateLocalLookup(cache, metrics_recorder, query_result_cache);
     };
     InitializeUdfHooksInternal(std::move(lookup_supplier),
                                string_get_values_hook, binary_get_values_hook,
@@ -72,6 +75,7 @@ class NonshardedServerInitializer : public ServerInitializer {
  private:
   MetricsRecorder& metrics_recorder_;
   Cache& cache_;
+  QueryResultCache* const query_result_cache_;
 };
 
 class ShardedServerInitializer : public ServerInitializer {
@@ -80,7 +84,8 @@ class ShardedServerInitializer : public ServerInitializer {
       MetricsRecorder& metrics_recorder,
       KeyFetcherManagerInterface& key_fetcher_manager, Lookup& local_lookup,
       std::string environment, int32_t num_shards, int32_t current_shard_num,
-      InstanceClient& instance_client, ParameterFetcher& parameter_fetcher)
+      InstanceClient& instance_client, ParameterFetcher& parameter_fetcher,
+      NearCache* near_cache, ShardingFunction sharding_function)
       : metrics_recorder_(metrics_recorder),
         key_fetcher_manager_(key_fetcher_manager),
         local_lookup_(local_lookup),
@@ -88,12 +93,15 @@ class ShardedServerInitializer : public ServerInitializer {
         num_shards_(num_shards),
         current_shard_num_(current_shard_num),
         instance_client_(instance_client),
-        parameter_fetcher_(parameter_fetcher) {}
+        parameter_fetcher_(parameter_fetcher),
+        near_cache_(near_cache),
+        sharding_function_(std::move(sharding_function)) {}
 
   RemoteLookup CreateAndStartRemoteLookupServer() override {
     RemoteLookup remote_lookup;
     remote_lookup.remote_lookup_service = std::make_unique<LookupServiceImpl>(
-        local_lookup_, key_fetcher_manager_, metrics_recorder_);
+        local_lookup_, key_fetcher_manager_, metrics_recorder_,
+        sharding_function_.version());
     grpc::ServerBuilder remote_lookup_server_builder;
     auto remoteLookupServerAddress =
         absl::StrCat(kLocalIp, ":", kRemoteLookupServerPort);
@@ -120,9 +128,12 @@ class ShardedServerInitializer : public ServerInitializer {
                             num_shards = num_shards_,
                             current_shard_num = current_shard_num_,
                             &shard_manager = *maybe_shard_state->shard_manager,
-                            &metrics_recorder = metrics_recorder_]() {
+                            &metrics_recorder = metrics_recorder_,
+                            near_cache = near_cache_,
+                            sharding_function = sharding_function_]() {
       return CreateShardedLookup(local_lookup, num_shards, current_shard_num,
-                                 shard_manager, metrics_recorder);
+                                 shard_manager, metrics_recorder, near_cache,
+                                 sharding_function);
     };
     InitializeUdfHooksInternal(std::move(lookup_supplier),
                                string_get_values_hook, binary_get_values_hook,
@@ -170,6 +181,8 @@ class ShardedServerInitializer : public ServerInitializer {
   int32_t current_shard_num_;
   InstanceClient& instance_client_;
   ParameterFetcher& parameter_fetcher_;
+  NearCache* const near_cache_;
+  const ShardingFunction sharding_function_;
 };
 
 }  // namespace
@@ -179,15 +192,17 @@ std::unique_ptr<ServerInitializer> GetServerInitializer(
     KeyFetcherManagerInterface& key_fetcher_manager, Lookup& local_lookup,
     std::string environment, int32_t current_shard_num,
     InstanceClient& instance_client, Cache& cache,
-    ParameterFetcher& parameter_fetcher) {
+    ParameterFetcher& parameter_fetcher, NearCache* near_cache,
+    ShardingFunction sharding_function, QueryResultCache* query_result_cache) {
   CHECK_GT(num_shards, 0) << "num_shards must be greater than 0";
   if (num_shards == 1) {
-    return std::make_unique<NonshardedServerInitializer>(metrics_recorder,
-                                                         cache);
+    return std::make_unique<NonshardedServerInitializer>(
+        metrics_recorder, cache, query_result_cache);
   }
 
   return std::make_unique<ShardedServerInitializer>(
       metrics_recorder, key_fetcher_manager, local_lookup, environment,
-      num_shards, current_shard_num, instance_client, parameter_fetcher);
+      num_shards, current_shard_num, instance_client, parameter_fetcher,
+      near_cache, std::move(sharding_function));
 }
 }  // namespace kv_server
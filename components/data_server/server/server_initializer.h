@@ -24,10 +24,13 @@
 #include "absl/status/statusor.h"
 #include "components/data_server/server/parameter_fetcher.h"
 #include "components/internal_server/lookup.h"
+#include "components/internal_server/near_cache.h"
+#include "components/internal_server/query_result_cache.h"
 #include "components/sharding/cluster_mappings_manager.h"
 #include "components/udf/hooks/get_values_hook.h"
 #include "components/udf/hooks/run_query_hook.h"
 #include "grpcpp/grpcpp.h"
+#include "public/sharding/sharding_function.h"
 #include "src/cpp/encryption/key_fetcher/interface/key_fetcher_manager_interface.h"
 #include "src/cpp/telemetry/metrics_recorder.h"
 
@@ -63,7 +66,9 @@ std::unique_ptr<ServerInitializer> GetServerInitializer(
         key_fetcher_manager,
     Lookup& local_lookup, std::string environment, int32_t current_shard_num,
     InstanceClient& instance_client, Cache& cache,
-    ParameterFetcher& parameter_fetcher);
+    ParameterFetcher& parameter_fetcher, NearCache* near_cache = nullptr,
+    ShardingFunction sharding_function = ShardingFunction(/*seed=*/""),
+    QueryResultCache* query_result_cache = nullptr);
 
 }  // namespace kv_server
 #endif  // COMPONENTS_DATA_SERVER_SERVER_INITIALIZER_H_
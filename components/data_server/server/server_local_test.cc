@@ -108,6 +108,10 @@ TEST(ServerLocalTest, InitFailsWithNoDeltaDirectory) {
   EXPECT_CALL(*parameter_client,
               GetInt32Parameter("kv-server-environment-num-shards"))
       .WillOnce(::testing::Return(1));
+  EXPECT_CALL(
+      *parameter_client,
+      GetInt32Parameter("kv-server-environment-sharding-function-version"))
+      .WillOnce(::testing::Return(0));
   EXPECT_CALL(*parameter_client,
               GetInt32Parameter("kv-server-environment-udf-num-workers"))
       .WillOnce(::testing::Return(2));
@@ -155,6 +159,10 @@ TEST(ServerLocalTest, InitPassesWithDeltaDirectoryAndRealtimeDirectory) {
   EXPECT_CALL(*parameter_client,
               GetInt32Parameter("kv-server-environment-num-shards"))
       .WillOnce(::testing::Return(1));
+  EXPECT_CALL(
+      *parameter_client,
+      GetInt32Parameter("kv-server-environment-sharding-function-version"))
+      .WillOnce(::testing::Return(0));
   EXPECT_CALL(*parameter_client,
               GetInt32Parameter("kv-server-environment-udf-num-workers"))
       .WillOnce(::testing::Return(2));
@@ -205,6 +213,10 @@ TEST(ServerLocalTest, GracefulServerShutdown) {
   EXPECT_CALL(*parameter_client,
               GetInt32Parameter("kv-server-environment-num-shards"))
       .WillOnce(::testing::Return(1));
+  EXPECT_CALL(
+      *parameter_client,
+      GetInt32Parameter("kv-server-environment-sharding-function-version"))
+      .WillOnce(::testing::Return(0));
   EXPECT_CALL(*parameter_client,
               GetInt32Parameter("kv-server-environment-udf-num-workers"))
       .WillOnce(::testing::Return(2));
@@ -258,6 +270,10 @@ TEST(ServerLocalTest, ForceServerShutdown) {
   EXPECT_CALL(*parameter_client,
               GetInt32Parameter("kv-server-environment-num-shards"))
       .WillOnce(::testing::Return(1));
+  EXPECT_CALL(
+      *parameter_client,
+      GetInt32Parameter("kv-server-environment-sharding-function-version"))
+      .WillOnce(::testing::Return(0));
   EXPECT_CALL(*parameter_client,
               GetInt32Parameter("kv-server-environment-udf-num-workers"))
       .WillOnce(::testing::Return(2));
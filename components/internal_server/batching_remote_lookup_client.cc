@@ -0,0 +1,306 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "components/internal_server/batching_remote_lookup_client.h"
+
+#include <algorithm>
+#include <future>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/functional/any_invocable.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "components/internal_server/lookup.pb.h"
+#include "google/protobuf/repeated_ptr_field.h"
+
+namespace kv_server {
+namespace {
+
+using privacy_sandbox::server_common::MetricsRecorder;
+
+constexpr char kRemoteLookupBatchSize[] = "RemoteLookupBatchSize";
+constexpr char kRemoteLookupBatchAddedLatency[] =
+    "RemoteLookupBatchAddedLatency";
+
+const std::vector<double> kBatchSizeBucketBoundaries = {1,  2,  4,   8,  16,
+                                                        32, 64, 128, 256};
+// The units below are microseconds.
+const std::vector<double> kAddedLatencyBucketBoundaries = {
+    50, 100, 200, 300, 500, 750, 1'000, 2'000, 5'000, 10'000};
+
+// Calls the callback of a caller exactly once, with the response to its
+// batch, or with an error as soon as the caller cancels.
+class PendingCall {
+ public:
+  explicit PendingCall(
+      absl::AnyInvocable<void(absl::StatusOr<InternalLookupResponse>) &&>
+          callback)
+      : callback_(std::move(callback)) {}
+
+  void Complete(absl::StatusOr<InternalLookupResponse> response) {
+    absl::AnyInvocable<void(absl::StatusOr<InternalLookupResponse>) &&>
+        callback;
+    {
+      absl::MutexLock lock(&mutex_);
+      if (callback_ == nullptr) {
+        return;
+      }
+      callback = std::move(callback_);
+      callback_ = nullptr;
+    }
+    std::move(callback)(std::move(response));
+  }
+
+ private:
+  absl::Mutex mutex_;
+  absl::AnyInvocable<void(absl::StatusOr<InternalLookupResponse>) &&> callback_
+      ABSL_GUARDED_BY(mutex_);
+};
+
+// A caller whose keys are `request.keys()[keys_begin, keys_end)` of its
+// batch.
+struct BatchedCall {
+  std::shared_ptr<PendingCall> call;
+  int keys_begin;
+  int keys_end;
+  bool positional_results;
+  absl::Time enqueued;
+};
+
+struct Batch {
+  InternalLookupRequest request;
+  std::vector<BatchedCall> calls;
+  // Total size of the padded requests of the calls.
+  int64_t padded_bytes = 0;
+  absl::Time deadline;
+};
+
+// Returns the part of the response to a batch that answers `batched_call`.
+// The results of the batch are moved, so each is handed out once.
+InternalLookupResponse SplitResponse(const InternalLookupRequest& request,
+                                     const BatchedCall& batched_call,
+                                     InternalLookupResponse& response) {
+  InternalLookupResponse call_response;
+  if (response.results_size() == request.keys_size()) {
+    for (int i = batched_call.keys_begin; i < batched_call.keys_end; i++) {
+      auto& result = *response.mutable_results(i);
+      if (batched_call.positional_results) {
+        *call_response.add_results() = std::move(result);
+      } else {
+        (*call_response.mutable_kv_pairs())[request.keys(i)] =
+            std::move(result);
+      }
+    }
+    return call_response;
+  }
+  // The server predates positional results, so the results are keyed and
+  // may be shared by several calls.
+  for (int i = batched_call.keys_begin; i < batched_call.keys_end; i++) {
+    const auto result_iter = response.kv_pairs().find(request.keys(i));
+    if (result_iter != response.kv_pairs().end()) {
+      (*call_response.mutable_kv_pairs())[request.keys(i)] =
+          result_iter->second;
+    }
+  }
+  return call_response;
+}
+
+class BatchingRemoteLookupClient : public RemoteLookupClient {
+ public:
+  BatchingRemoteLookupClient(std::unique_ptr<RemoteLookupClient> client,
+                             absl::Duration window, int64_t max_keys,
+                             MetricsRecorder& metrics_recorder)
+      : client_(std::move(client)),
+        window_(window),
+        max_keys_(max_keys),
+        metrics_recorder_(metrics_recorder) {
+    metrics_recorder_.RegisterHistogram(
+        kRemoteLookupBatchSize, "Number of remote lookups sent in a batch",
+        "request", kBatchSizeBucketBoundaries);
+    metrics_recorder_.RegisterHistogram(
+        kRemoteLookupBatchAddedLatency,
+        "Time remote lookups waited to be sent in a batch", "microsecond",
+        kAddedLatencyBucketBoundaries);
+    flusher_ = std::thread([this] { FlushExpiredBatches(); });
+  }
+
+  ~BatchingRemoteLookupClient() override {
+    {
+      absl::MutexLock lock(&mutex_);
+      stopping_ = true;
+    }
+    flusher_.join();
+  }
+
+  absl::StatusOr<InternalLookupResponse> GetValues(
+      std::string_view serialized_message,
+      int32_t padding_length) const override {
+    std::promise<absl::StatusOr<InternalLookupResponse>> response;
+    auto response_future = response.get_future();
+    GetValuesAsync(serialized_message, padding_length,
+                   [&response](absl::StatusOr<InternalLookupResponse> result) {
+                     response.set_value(std::move(result));
+                   });
+    return response_future.get();
+  }
+
+  absl::AnyInvocable<void()> GetValuesAsync(
+      std::string_view serialized_message, int32_t padding_length,
+      absl::AnyInvocable<void(absl::StatusOr<InternalLookupResponse>) &&>
+          callback) const override {
+    InternalLookupRequest request;
+    if (!request.ParseFromArray(serialized_message.data(),
+                                serialized_message.size())) {
+      return client_->GetValuesAsync(serialized_message, padding_length,
+                                     std::move(callback));
+    }
+    auto call = std::make_shared<PendingCall>(std::move(callback));
+    const bool positional_results = request.positional_results();
+    google::protobuf::RepeatedPtrField<std::string> keys;
+    keys.Swap(request.mutable_keys());
+    request.clear_positional_results();
+    // Only requests that only differ by their keys are batched together.
+    const std::string options = request.SerializeAsString();
+    std::optional<Batch> full_batch;
+    {
+      absl::MutexLock lock(&mutex_);
+      const absl::Time now = absl::Now();
+      auto [batch_iter, inserted] = batches_.try_emplace(options);
+      Batch& batch = batch_iter->second;
+      if (inserted) {
+        batch.request = std::move(request);
+        batch.request.set_positional_results(true);
+        batch.deadline = now + window_;
+      }
+      const int keys_begin = batch.request.keys_size();
+      for (auto& key : keys) {
+        batch.request.add_keys(std::move(key));
+      }
+      batch.calls.push_back({call, keys_begin, batch.request.keys_size(),
+                             positional_results, now});
+      batch.padded_bytes += serialized_message.size() + padding_length;
+      if (batch.request.keys_size() >= max_keys_) {
+        full_batch = std::move(batch);
+        batches_.erase(batch_iter);
+      }
+    }
+    if (full_batch.has_value()) {
+      Send(*std::move(full_batch));
+    }
+    // The batch is sent regardless, but the caller no longer waits for it.
+    return [call] { call->Complete(absl::CancelledError("Cancelled")); };
+  }
+
+  std::string_view GetIpAddress() const override {
+    return client_->GetIpAddress();
+  }
+
+ private:
+  bool HasBatchesOrStopping() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    return stopping_ || !batches_.empty();
+  }
+
+  // Sends the batches once their window has passed, and all of them once the
+  // client is stopping.
+  void FlushExpiredBatches() const {
+    while (true) {
+      std::vector<Batch> expired_batches;
+      {
+        absl::MutexLock lock(&mutex_);
+        mutex_.Await(absl::Condition(
+            this, &BatchingRemoteLookupClient::HasBatchesOrStopping));
+        if (batches_.empty()) {
+          return;
+        }
+        absl::Time deadline = absl::InfiniteFuture();
+        for (const auto& [options, batch] : batches_) {
+          deadline = std::min(deadline, batch.deadline);
+        }
+        mutex_.AwaitWithDeadline(absl::Condition(&stopping_), deadline);
+        const absl::Time now = stopping_ ? absl::InfiniteFuture() : absl::Now();
+        for (auto batch_iter = batches_.begin();
+             batch_iter != batches_.end();) {
+          if (batch_iter->second.deadline <= now) {
+            expired_batches.push_back(std::move(batch_iter->second));
+            batches_.erase(batch_iter++);
+          } else {
+            ++batch_iter;
+          }
+        }
+      }
+      for (auto& batch : expired_batches) {
+        Send(std::move(batch));
+      }
+    }
+  }
+
+  void Send(Batch batch) const {
+    const absl::Time now = absl::Now();
+    metrics_recorder_.RecordHistogramEvent(kRemoteLookupBatchSize,
+                                           batch.calls.size());
+    for (const auto& batched_call : batch.calls) {
+      metrics_recorder_.RecordHistogramEvent(
+          kRemoteLookupBatchAddedLatency,
+          absl::ToInt64Microseconds(now - batched_call.enqueued));
+    }
+    const std::string serialized_request = batch.request.SerializeAsString();
+    const int64_t serialized_size = serialized_request.size();
+    const int32_t padding_length =
+        std::max<int64_t>(0, batch.padded_bytes - serialized_size);
+    client_->GetValuesAsync(
+        serialized_request, padding_length,
+        [request = std::move(batch.request), calls = std::move(batch.calls)](
+            absl::StatusOr<InternalLookupResponse> response) mutable {
+          for (const auto& batched_call : calls) {
+            if (!response.ok()) {
+              batched_call.call->Complete(response.status());
+            } else {
+              batched_call.call->Complete(
+                  SplitResponse(request, batched_call, *response));
+            }
+          }
+        });
+  }
+
+  const std::unique_ptr<RemoteLookupClient> client_;
+  const absl::Duration window_;
+  const int64_t max_keys_;
+  MetricsRecorder& metrics_recorder_;
+  mutable absl::Mutex mutex_;
+  // Batches being collected, by the options of their requests.
+  mutable absl::flat_hash_map<std::string, Batch> batches_
+      ABSL_GUARDED_BY(mutex_);
+  bool stopping_ ABSL_GUARDED_BY(mutex_) = false;
+  std::thread flusher_;
+};
+
+}  // namespace
+
+std::unique_ptr<RemoteLookupClient> CreateBatchingRemoteLookupClient(
+    std::unique_ptr<RemoteLookupClient> client, absl::Duration window,
+    int64_t max_keys, MetricsRecorder& metrics_recorder) {
+  return std::make_unique<BatchingRemoteLookupClient>(
+      std::move(client), window, max_keys, metrics_recorder);
+}
+
+}  // namespace kv_server
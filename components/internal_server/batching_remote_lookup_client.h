@@ -0,0 +1,41 @@
+/*
+ * Copyright 2023 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef COMPONENTS_INTERNAL_SERVER_BATCHING_REMOTE_LOOKUP_CLIENT_H_
+#define COMPONENTS_INTERNAL_SERVER_BATCHING_REMOTE_LOOKUP_CLIENT_H_
+
+#include <memory>
+
+#include "absl/time/time.h"
+#include "components/internal_server/remote_lookup_client.h"
+#include "src/cpp/telemetry/metrics_recorder.h"
+
+namespace kv_server {
+
+// Returns a client that batches the requests sent through `client` across
+// callers. Requests with the same lookup options are collected for up to
+// `window`, or until they hold `max_keys` keys, and sent as a single request,
+// whose response is split among the callers. The batched request is padded to
+// the total padded size of the requests it contains, so its size only depends
+// on the requests in it, as it would if they were sent one by one.
+std::unique_ptr<RemoteLookupClient> CreateBatchingRemoteLookupClient(
+    std::unique_ptr<RemoteLookupClient> client, absl::Duration window,
+    int64_t max_keys,
+    privacy_sandbox::server_common::MetricsRecorder& metrics_recorder);
+
+}  // namespace kv_server
+
+#endif  // COMPONENTS_INTERNAL_SERVER_BATCHING_REMOTE_LOOKUP_CLIENT_H_
@@ -0,0 +1,208 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "components/internal_server/batching_remote_lookup_client.h"
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/synchronization/notification.h"
+#include "components/internal_server/mocks.h"
+#include "gmock/gmock.h"
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+#include "public/test_util/proto_matcher.h"
+#include "src/cpp/telemetry/mocks.h"
+
+namespace kv_server {
+namespace {
+
+using google::protobuf::TextFormat;
+using privacy_sandbox::server_common::MockMetricsRecorder;
+using testing::_;
+using testing::Return;
+
+std::string MakeRequest(std::vector<std::string> keys) {
+  InternalLookupRequest request;
+  request.mutable_keys()->Assign(keys.begin(), keys.end());
+  request.set_positional_results(true);
+  return request.SerializeAsString();
+}
+
+InternalLookupResponse ParseResponse(std::string text) {
+  InternalLookupResponse response;
+  TextFormat::ParseFromString(text, &response);
+  return response;
+}
+
+class BatchingRemoteLookupClientTest : public ::testing::Test {
+ protected:
+  std::unique_ptr<MockRemoteLookupClient> mock_client_ =
+      std::make_unique<MockRemoteLookupClient>();
+  MockMetricsRecorder mock_metrics_recorder_;
+};
+
+TEST_F(BatchingRemoteLookupClientTest, BatchesRequestsUpToMaxKeys) {
+  const std::string request_1 = MakeRequest({"key1"});
+  const std::string request_2 = MakeRequest({"key2", "key3"});
+  const std::string batched_request = MakeRequest({"key1", "key2", "key3"});
+  // The batch is as large as the padded requests in it.
+  const int32_t padding =
+      request_1.size() + 5 + request_2.size() + 7 - batched_request.size();
+  EXPECT_CALL(*mock_client_, GetValues(batched_request, padding))
+      .WillOnce(Return(ParseResponse(R"pb(results { value: "value1" }
+                                           results { value: "value2" }
+                                           results { value: "value3" })pb")));
+  auto batching_client = CreateBatchingRemoteLookupClient(
+      std::move(mock_client_), absl::Minutes(1), /*max_keys=*/3,
+      mock_metrics_recorder_);
+
+  absl::StatusOr<InternalLookupResponse> response_1;
+  absl::StatusOr<InternalLookupResponse> response_2;
+  batching_client->GetValuesAsync(
+      request_1, 5, [&response_1](absl::StatusOr<InternalLookupResponse> r) {
+        response_1 = std::move(r);
+      });
+  batching_client->GetValuesAsync(
+      request_2, 7, [&response_2](absl::StatusOr<InternalLookupResponse> r) {
+        response_2 = std::move(r);
+      });
+
+  ASSERT_TRUE(response_1.ok());
+  EXPECT_THAT(*response_1,
+              EqualsProto(ParseResponse(R"pb(results { value: "value1" })pb")));
+  ASSERT_TRUE(response_2.ok());
+  EXPECT_THAT(*response_2,
+              EqualsProto(ParseResponse(R"pb(results { value: "value2" }
+                                             results { value: "value3" })pb")));
+}
+
+TEST_F(BatchingRemoteLookupClientTest, SendsBatchAfterWindow) {
+  const std::string request = MakeRequest({"key1"});
+  EXPECT_CALL(*mock_client_, GetValues(request, 5))
+      .WillOnce(Return(ParseResponse(R"pb(results { value: "value1" })pb")));
+  auto batching_client = CreateBatchingRemoteLookupClient(
+      std::move(mock_client_), absl::Milliseconds(1), /*max_keys=*/100,
+      mock_metrics_recorder_);
+
+  absl::StatusOr<InternalLookupResponse> response;
+  absl::Notification done;
+  batching_client->GetValuesAsync(
+      request, 5,
+      [&response, &done](absl::StatusOr<InternalLookupResponse> r) {
+        response = std::move(r);
+        done.Notify();
+      });
+  ASSERT_TRUE(done.WaitForNotificationWithTimeout(absl::Seconds(10)));
+  ASSERT_TRUE(response.ok());
+  EXPECT_THAT(*response,
+              EqualsProto(ParseResponse(R"pb(results { value: "value1" })pb")));
+}
+
+TEST_F(BatchingRemoteLookupClientTest, SplitsKeyedResponse) {
+  EXPECT_CALL(*mock_client_, GetValues(_, _))
+      .WillOnce(Return(ParseResponse(
+          R"pb(kv_pairs {
+                 key: "key1"
+                 value { value: "value1" }
+               }
+               kv_pairs {
+                 key: "key2"
+                 value { value: "value2" }
+               })pb")));
+  auto batching_client = CreateBatchingRemoteLookupClient(
+      std::move(mock_client_), absl::Minutes(1), /*max_keys=*/2,
+      mock_metrics_recorder_);
+
+  absl::StatusOr<InternalLookupResponse> response_1;
+  absl::StatusOr<InternalLookupResponse> response_2;
+  batching_client->GetValuesAsync(
+      MakeRequest({"key1"}), 0,
+      [&response_1](absl::StatusOr<InternalLookupResponse> r) {
+        response_1 = std::move(r);
+      });
+  batching_client->GetValuesAsync(
+      MakeRequest({"key2"}), 0,
+      [&response_2](absl::StatusOr<InternalLookupResponse> r) {
+        response_2 = std::move(r);
+      });
+
+  ASSERT_TRUE(response_1.ok());
+  EXPECT_THAT(*response_1, EqualsProto(ParseResponse(R"pb(kv_pairs {
+                                                            key: "key1"
+                                                            value {
+                                                              value: "value1"
+                                                            }
+                                                          })pb")));
+  ASSERT_TRUE(response_2.ok());
+  EXPECT_THAT(*response_2, EqualsProto(ParseResponse(R"pb(kv_pairs {
+                                                            key: "key2"
+                                                            value {
+                                                              value: "value2"
+                                                            }
+                                                          })pb")));
+}
+
+TEST_F(BatchingRemoteLookupClientTest, FailedBatchFailsEveryRequest) {
+  EXPECT_CALL(*mock_client_, GetValues(_, _))
+      .WillOnce(Return(absl::UnavailableError("unavailable")));
+  auto batching_client = CreateBatchingRemoteLookupClient(
+      std::move(mock_client_), absl::Minutes(1), /*max_keys=*/2,
+      mock_metrics_recorder_);
+
+  absl::StatusOr<InternalLookupResponse> response_1;
+  absl::StatusOr<InternalLookupResponse> response_2;
+  batching_client->GetValuesAsync(
+      MakeRequest({"key1"}), 0,
+      [&response_1](absl::StatusOr<InternalLookupResponse> r) {
+        response_1 = std::move(r);
+      });
+  batching_client->GetValuesAsync(
+      MakeRequest({"key2"}), 0,
+      [&response_2](absl::StatusOr<InternalLookupResponse> r) {
+        response_2 = std::move(r);
+      });
+
+  EXPECT_EQ(response_1.status().code(), absl::StatusCode::kUnavailable);
+  EXPECT_EQ(response_2.status().code(), absl::StatusCode::kUnavailable);
+}
+
+TEST_F(BatchingRemoteLookupClientTest, CancelledRequestCompletesAtOnce) {
+  // The pending batch is still sent when the client is destroyed.
+  EXPECT_CALL(*mock_client_, GetValues(_, _))
+      .WillOnce(Return(InternalLookupResponse()));
+  auto batching_client = CreateBatchingRemoteLookupClient(
+      std::move(mock_client_), absl::Minutes(1), /*max_keys=*/100,
+      mock_metrics_recorder_);
+
+  int callback_calls = 0;
+  absl::StatusOr<InternalLookupResponse> response;
+  auto cancel = batching_client->GetValuesAsync(
+      MakeRequest({"key1"}), 0,
+      [&response,
+       &callback_calls](absl::StatusOr<InternalLookupResponse> r) {
+        response = std::move(r);
+        callback_calls++;
+      });
+  cancel();
+
+  EXPECT_EQ(response.status().code(), absl::StatusCode::kCancelled);
+  batching_client.reset();
+  EXPECT_EQ(callback_calls, 1);
+}
+
+}  // namespace
+}  // namespace kv_server
@@ -0,0 +1,59 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "components/internal_server/circuit_breaker.h"
+
+#include "absl/log/check.h"
+
+namespace kv_server {
+
+CircuitBreaker::CircuitBreaker(int32_t failure_threshold,
+                               absl::Duration cooldown)
+    : failure_threshold_(failure_threshold), cooldown_(cooldown) {
+  CHECK_GT(failure_threshold, 0);
+}
+
+bool CircuitBreaker::AllowRequest(absl::Time now) {
+  absl::MutexLock lock(&mutex_);
+  if (consecutive_failures_ < failure_threshold_) {
+    return true;
+  }
+  if (now < next_probe_) {
+    return false;
+  }
+  // Probes again after another cooldown if this one never completes.
+  next_probe_ = now + cooldown_;
+  return true;
+}
+
+void CircuitBreaker::RecordSuccess() {
+  absl::MutexLock lock(&mutex_);
+  consecutive_failures_ = 0;
+}
+
+bool CircuitBreaker::RecordFailure(absl::Time now) {
+  absl::MutexLock lock(&mutex_);
+  if (++consecutive_failures_ < failure_threshold_) {
+    return false;
+  }
+  next_probe_ = now + cooldown_;
+  return consecutive_failures_ == failure_threshold_;
+}
+
+bool CircuitBreaker::IsOpen(absl::Time now) const {
+  absl::ReaderMutexLock lock(&mutex_);
+  return consecutive_failures_ >= failure_threshold_ && now < next_probe_;
+}
+
+}  // namespace kv_server
@@ -0,0 +1,61 @@
+/*
+ * Copyright 2023 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef COMPONENTS_INTERNAL_SERVER_CIRCUIT_BREAKER_H_
+#define COMPONENTS_INTERNAL_SERVER_CIRCUIT_BREAKER_H_
+
+#include <cstdint>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+
+namespace kv_server {
+
+// Stops the requests to a remote shard that keeps failing, so that its
+// failures are returned right away instead of piling up requests on the shard
+// and latency on the lookups. The breaker opens after `failure_threshold`
+// consecutive failures. Once `cooldown` has passed, a single request is let
+// through to probe the shard: a success closes the breaker, while a failure,
+// or no outcome within another `cooldown`, keeps it open. Thread safe.
+class CircuitBreaker {
+ public:
+  // `failure_threshold` must be positive.
+  CircuitBreaker(int32_t failure_threshold, absl::Duration cooldown);
+
+  // Returns whether a request may be sent to the shard at `now`.
+  bool AllowRequest(absl::Time now);
+
+  void RecordSuccess();
+
+  // Returns true if this failure opened the breaker.
+  bool RecordFailure(absl::Time now);
+
+  // Returns true if the requests are stopped at `now`.
+  bool IsOpen(absl::Time now) const;
+
+ private:
+  const int32_t failure_threshold_;
+  const absl::Duration cooldown_;
+  mutable absl::Mutex mutex_;
+  int32_t consecutive_failures_ ABSL_GUARDED_BY(mutex_) = 0;
+  // Time from which the next probe is let through, while open.
+  absl::Time next_probe_ ABSL_GUARDED_BY(mutex_) = absl::InfinitePast();
+};
+
+}  // namespace kv_server
+
+#endif  // COMPONENTS_INTERNAL_SERVER_CIRCUIT_BREAKER_H_
@@ -0,0 +1,78 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "components/internal_server/circuit_breaker.h"
+
+#include "gtest/gtest.h"
+
+namespace kv_server {
+namespace {
+
+constexpr absl::Duration kCooldown = absl::Seconds(10);
+
+TEST(CircuitBreakerTest, OpensAfterConsecutiveFailures) {
+  CircuitBreaker breaker(/*failure_threshold=*/3, kCooldown);
+  const absl::Time now = absl::Now();
+  EXPECT_FALSE(breaker.RecordFailure(now));
+  EXPECT_FALSE(breaker.RecordFailure(now));
+  EXPECT_TRUE(breaker.AllowRequest(now));
+  EXPECT_TRUE(breaker.RecordFailure(now));
+  EXPECT_TRUE(breaker.IsOpen(now));
+  EXPECT_FALSE(breaker.AllowRequest(now));
+}
+
+TEST(CircuitBreakerTest, SuccessResetsFailures) {
+  CircuitBreaker breaker(/*failure_threshold=*/2, kCooldown);
+  const absl::Time now = absl::Now();
+  EXPECT_FALSE(breaker.RecordFailure(now));
+  breaker.RecordSuccess();
+  EXPECT_FALSE(breaker.RecordFailure(now));
+  EXPECT_FALSE(breaker.IsOpen(now));
+  EXPECT_TRUE(breaker.AllowRequest(now));
+}
+
+TEST(CircuitBreakerTest, LetsOneProbeThroughAfterCooldown) {
+  CircuitBreaker breaker(/*failure_threshold=*/1, kCooldown);
+  const absl::Time now = absl::Now();
+  EXPECT_TRUE(breaker.RecordFailure(now));
+  EXPECT_FALSE(breaker.AllowRequest(now + kCooldown / 2));
+  EXPECT_TRUE(breaker.AllowRequest(now + kCooldown));
+  EXPECT_FALSE(breaker.AllowRequest(now + kCooldown));
+  // The probe never completed.
+  EXPECT_TRUE(breaker.AllowRequest(now + 2 * kCooldown));
+}
+
+TEST(CircuitBreakerTest, SuccessfulProbeCloses) {
+  CircuitBreaker breaker(/*failure_threshold=*/1, kCooldown);
+  const absl::Time now = absl::Now();
+  EXPECT_TRUE(breaker.RecordFailure(now));
+  EXPECT_TRUE(breaker.AllowRequest(now + kCooldown));
+  breaker.RecordSuccess();
+  EXPECT_FALSE(breaker.IsOpen(now + kCooldown));
+  EXPECT_TRUE(breaker.AllowRequest(now + kCooldown));
+}
+
+TEST(CircuitBreakerTest, FailedProbeReopens) {
+  CircuitBreaker breaker(/*failure_threshold=*/1, kCooldown);
+  const absl::Time now = absl::Now();
+  EXPECT_TRUE(breaker.RecordFailure(now));
+  EXPECT_TRUE(breaker.AllowRequest(now + kCooldown));
+  // Only the first failure counts as opening the breaker.
+  EXPECT_FALSE(breaker.RecordFailure(now + kCooldown));
+  EXPECT_TRUE(breaker.IsOpen(now + kCooldown));
+  EXPECT_FALSE(breaker.AllowRequest(now + kCooldown * 3 / 2));
+}
+
+}  // namespace
+}  // namespace kv_server
@@ -0,0 +1,61 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "components/internal_server/hedging_delay.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "absl/log/check.h"
+
+namespace kv_server {
+
+HedgingDelay::HedgingDelay(double percentile, absl::Duration min_delay,
+                           int64_t window_size)
+    : percentile_(percentile),
+      min_delay_(min_delay),
+      window_size_(window_size),
+      update_interval_(std::max<int64_t>(window_size / 10, 1)) {
+  CHECK(percentile > 0 && percentile < 100)
+      << "Hedging percentile must be in (0, 100)";
+  CHECK_GT(window_size, 0);
+  latencies_.reserve(window_size_);
+}
+
+void HedgingDelay::RecordLatency(absl::Duration latency) {
+  absl::MutexLock lock(&mutex_);
+  if (latencies_.size() < window_size_) {
+    latencies_.push_back(latency);
+  } else {
+    latencies_[next_latency_] = latency;
+  }
+  next_latency_ = (next_latency_ + 1) % window_size_;
+  if (++recorded_since_update_ < update_interval_) {
+    return;
+  }
+  recorded_since_update_ = 0;
+  std::vector<absl::Duration> latencies = latencies_;
+  const auto percentile_iter =
+      latencies.begin() +
+      static_cast<int64_t>(percentile_ / 100 * (latencies.size() - 1));
+  std::nth_element(latencies.begin(), percentile_iter, latencies.end());
+  delay_ = std::max(*percentile_iter, min_delay_);
+}
+
+absl::Duration HedgingDelay::Get() const {
+  absl::ReaderMutexLock lock(&mutex_);
+  return delay_;
+}
+
+}  // namespace kv_server
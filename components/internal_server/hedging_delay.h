@@ -0,0 +1,63 @@
+/*
+ * Copyright 2023 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef COMPONENTS_INTERNAL_SERVER_HEDGING_DELAY_H_
+#define COMPONENTS_INTERNAL_SERVER_HEDGING_DELAY_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+
+namespace kv_server {
+
+// Tracks the latencies of recent requests to remote shards to decide how long
+// to wait for a response before sending the request to another replica as
+// well. The delay is a percentile of the latencies, so only about
+// `100 - percentile` percent of the requests are hedged. Thread safe.
+class HedgingDelay {
+ public:
+  // `percentile` must be in (0, 100). Only the latest `window_size` latencies
+  // are taken into account, and the delay is recomputed after every tenth of
+  // them.
+  HedgingDelay(double percentile, absl::Duration min_delay,
+               int64_t window_size = 1000);
+
+  void RecordLatency(absl::Duration latency);
+
+  // Returns the delay after which a request should be hedged, which is never
+  // below `min_delay`. Requests are not hedged, i.e. the delay is infinite,
+  // until enough latencies have been recorded.
+  absl::Duration Get() const;
+
+ private:
+  const double percentile_;
+  const absl::Duration min_delay_;
+  const int64_t window_size_;
+  const int64_t update_interval_;
+  mutable absl::Mutex mutex_;
+  // Ring buffer of the latest latencies.
+  std::vector<absl::Duration> latencies_ ABSL_GUARDED_BY(mutex_);
+  int64_t next_latency_ ABSL_GUARDED_BY(mutex_) = 0;
+  int64_t recorded_since_update_ ABSL_GUARDED_BY(mutex_) = 0;
+  absl::Duration delay_ ABSL_GUARDED_BY(mutex_) = absl::InfiniteDuration();
+};
+
+}  // namespace kv_server
+
+#endif  // COMPONENTS_INTERNAL_SERVER_HEDGING_DELAY_H_
@@ -0,0 +1,61 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "components/internal_server/hedging_delay.h"
+
+#include "gtest/gtest.h"
+
+namespace kv_server {
+namespace {
+
+TEST(HedgingDelayTest, InfiniteUntilEnoughLatencies) {
+  HedgingDelay hedging_delay(90, absl::ZeroDuration(), /*window_size=*/100);
+  for (int i = 0; i < 9; i++) {
+    hedging_delay.RecordLatency(absl::Milliseconds(1));
+  }
+  EXPECT_EQ(hedging_delay.Get(), absl::InfiniteDuration());
+  hedging_delay.RecordLatency(absl::Milliseconds(1));
+  EXPECT_EQ(hedging_delay.Get(), absl::Milliseconds(1));
+}
+
+TEST(HedgingDelayTest, ReturnsPercentile) {
+  HedgingDelay hedging_delay(90, absl::ZeroDuration(), /*window_size=*/100);
+  for (int i = 1; i <= 100; i++) {
+    hedging_delay.RecordLatency(absl::Milliseconds(i));
+  }
+  EXPECT_EQ(hedging_delay.Get(), absl::Milliseconds(90));
+}
+
+TEST(HedgingDelayTest, ReturnsAtLeastMinDelay) {
+  HedgingDelay hedging_delay(90, absl::Milliseconds(5), /*window_size=*/10);
+  for (int i = 0; i < 10; i++) {
+    hedging_delay.RecordLatency(absl::Milliseconds(1));
+  }
+  EXPECT_EQ(hedging_delay.Get(), absl::Milliseconds(5));
+}
+
+TEST(HedgingDelayTest, OnlyLatestLatenciesCount) {
+  HedgingDelay hedging_delay(50, absl::ZeroDuration(), /*window_size=*/10);
+  for (int i = 0; i < 10; i++) {
+    hedging_delay.RecordLatency(absl::Milliseconds(100));
+  }
+  EXPECT_EQ(hedging_delay.Get(), absl::Milliseconds(100));
+  for (int i = 0; i < 10; i++) {
+    hedging_delay.RecordLatency(absl::Milliseconds(1));
+  }
+  EXPECT_EQ(hedging_delay.Get(), absl::Milliseconds(1));
+}
+
+}  // namespace
+}  // namespace kv_server
@@ -14,33 +14,77 @@
 
 #include "components/internal_server/local_lookup.h"
 
+#include <cstdint>
 #include <memory>
+#include <optional>
 #include <string>
 #include <string_view>
 #include <utility>
 #include <vector>
 
+#include "absl/flags/flag.h"
+#include "absl/random/random.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
 #include "components/data_server/cache/cache.h"
 #include "components/internal_server/lookup.h"
 #include "components/internal_server/lookup.pb.h"
+#include "components/internal_server/query_result_cache.h"
+#include "components/internal_server/run_query_result.h"
+#include "components/query/ast.h"
 #include "components/query/driver.h"
-#include "components/query/scanner.h"
+#include "components/query/parse_query.h"
 #include "glog/logging.h"
 #include "src/cpp/telemetry/metrics_recorder.h"
+#include "src/cpp/telemetry/telemetry.h"
+
+ABSL_FLAG(double, query_stats_sample_rate, 0,
+          "Fraction of queries for which the time spent parsing, fetching "
+          "sets and in each step of the evaluation, along with the sizes of "
+          "the sets involved, is recorded in a trace span. Sampled queries "
+          "are evaluated twice.");
 
 namespace kv_server {
 namespace {
 
+using privacy_sandbox::server_common::GetTracer;
 using privacy_sandbox::server_common::MetricsRecorder;
 using privacy_sandbox::server_common::ScopeLatencyRecorder;
 
 constexpr char kKeySetNotFound[] = "KeysetNotFound";
 constexpr char kLocalRunQuery[] = "LocalRunQuery";
+constexpr char kLocalRunQueries[] = "LocalRunQueries";
+constexpr char kLocalRunQueryStats[] = "LocalRunQueryStats";
+
+// Looks up the sets of unsigned integers of a query in the sets fetched for it
+// from the cache.
+class CachedSortedSets : public SortedSetLookup {
+ public:
+  explicit CachedSortedSets(const GetKeyValueSetResult& key_value_set_result)
+      : key_value_set_result_(key_value_set_result) {}
+
+  std::optional<absl::Span<const uint32_t>> GetUInt32Set(
+      std::string_view key) const override {
+    return key_value_set_result_.GetUInt32ValueSet(key);
+  }
+
+  std::optional<absl::Span<const uint64_t>> GetUInt64Set(
+      std::string_view key) const override {
+    return key_value_set_result_.GetUInt64ValueSet(key);
+  }
+
+ private:
+  const GetKeyValueSetResult& key_value_set_result_;
+};
 
 class LocalLookup : public Lookup {
  public:
-  explicit LocalLookup(const Cache& cache, MetricsRecorder& metrics_recorder)
-      : cache_(cache), metrics_recorder_(metrics_recorder) {}
+  LocalLookup(const Cache& cache, MetricsRecorder& metrics_recorder,
+              QueryResultCache* query_result_cache)
+      : cache_(cache),
+        metrics_recorder_(metrics_recorder),
+        query_result_cache_(query_result_cache) {}
 
   absl::StatusOr<InternalLookupResponse> GetKeyValues(
       const absl::flat_hash_set<std::string_view>& keys) const override {
@@ -52,9 +96,39 @@ class LocalLookup : public Lookup {
     return ProcessKeysetKeys(key_set);
   }
 
+  absl::StatusOr<InternalLookupResponse> GetKeyValueSetSketches(
+      const absl::flat_hash_set<std::string_view>& key_set) const override {
+    return ProcessKeysetSketchKeys(key_set);
+  }
+
+  absl::StatusOr<InternalLookupResponse> GetKeyValueSetMembership(
+      std::string_view key,
+      absl::Span<const std::string_view> candidates) const override {
+    InternalLookupResponse response;
+    auto* keyset_membership =
+        (*response.mutable_kv_pairs())[key].mutable_keyset_membership();
+    for (const bool is_member :
+         cache_.GetKeyValueSetMembership(key, candidates)) {
+      keyset_membership->add_is_member(is_member);
+    }
+    return response;
+  }
+
   absl::StatusOr<InternalRunQueryResponse> RunQuery(
       std::string query) const override {
-    return ProcessQuery(query);
+    InternalRunQueryRequest request;
+    request.set_query(std::move(query));
+    return ProcessQuery(request);
+  }
+
+  absl::StatusOr<InternalRunQueryResponse> ExecuteQuery(
+      const InternalRunQueryRequest& request) const override {
+    return ProcessQuery(request);
+  }
+
+  absl::StatusOr<InternalRunQueriesResponse> RunQueries(
+      const InternalRunQueriesRequest& request) const override {
+    return ProcessQueries(request);
   }
 
  private:
@@ -66,8 +140,11 @@ class LocalLookup : public Lookup {
     }
     auto kv_pairs = cache_.GetKeyValuePairs(keys);
 
+    // Results are built in place in the response, so that neither the result
+    // nor the value is copied.
+    auto& results = *response.mutable_kv_pairs();
     for (const auto& key : keys) {
-      SingleLookupResult result;
+      SingleLookupResult& result = results[key];
       const auto key_iter = kv_pairs.find(key);
       if (key_iter == kv_pairs.end()) {
         auto status = result.mutable_status();
@@ -76,7 +153,6 @@ class LocalLookup : public Lookup {
       } else {
         result.set_value(std::move(key_iter->second));
       }
-      (*response.mutable_kv_pairs())[key] = std::move(result);
     }
     return response;
   }
@@ -88,9 +164,24 @@ class LocalLookup : public Lookup {
       return response;
     }
     auto key_value_set_result = cache_.GetKeyValueSet(key_set);
+    auto& results = *response.mutable_kv_pairs();
     for (const auto& key : key_set) {
-      SingleLookupResult result;
-      const auto value_set = key_value_set_result->GetValueSet(key);
+      SingleLookupResult& result = results[key];
+      // Sets of unsigned integers are sent as they are stored, so that they
+      // are neither converted to strings here nor parsed back by the caller.
+      if (const auto uint32_set = key_value_set_result->GetUInt32ValueSet(key);
+          uint32_set.has_value() && !uint32_set->empty()) {
+        result.mutable_keyset_values()->mutable_uint32_values()->Add(
+            uint32_set->begin(), uint32_set->end());
+        continue;
+      }
+      if (const auto uint64_set = key_value_set_result->GetUInt64ValueSet(key);
+          uint64_set.has_value() && !uint64_set->empty()) {
+        result.mutable_keyset_values()->mutable_uint64_values()->Add(
+            uint64_set->begin(), uint64_set->end());
+        continue;
+      }
+      const auto& value_set = key_value_set_result->GetValueSet(key);
       if (value_set.empty()) {
         auto status = result.mutable_status();
         status->set_code(static_cast<int>(absl::StatusCode::kNotFound));
@@ -101,50 +192,158 @@ class LocalLookup : public Lookup {
         keyset_values->mutable_values()->Add(value_set.begin(),
                                              value_set.end());
       }
-      (*response.mutable_kv_pairs())[key] = std::move(result);
+    }
+    return response;
+  }
+
+  absl::StatusOr<InternalLookupResponse> ProcessKeysetSketchKeys(
+      const absl::flat_hash_set<std::string_view>& key_set) const {
+    InternalLookupResponse response;
+    if (key_set.empty()) {
+      return response;
+    }
+    auto sketches = cache_.GetKeyValueSetSketches(key_set);
+    if (!sketches.ok()) {
+      return sketches.status();
+    }
+    auto& results = *response.mutable_kv_pairs();
+    for (const auto& key : key_set) {
+      SingleLookupResult& result = results[key];
+      const auto sketch_itr = sketches->find(key);
+      if (sketch_itr == sketches->end()) {
+        auto status = result.mutable_status();
+        status->set_code(static_cast<int>(absl::StatusCode::kNotFound));
+        status->set_message("Key not found");
+        metrics_recorder_.IncrementEventCounter(kKeySetNotFound);
+      } else {
+        *result.mutable_keyset_sketch() = ToKeysetSketch(sketch_itr->second);
+      }
     }
     return response;
   }
 
   absl::StatusOr<InternalRunQueryResponse> ProcessQuery(
-      std::string query) const {
+      const InternalRunQueryRequest& request) const {
     ScopeLatencyRecorder latency_recorder(std::string(kLocalRunQuery),
                                           metrics_recorder_);
-    if (query.empty()) return absl::OkStatus();
+    if (request.query().empty()) return InternalRunQueryResponse();
+    if (query_result_cache_ != nullptr) {
+      if (std::optional<InternalRunQueryResponse> response =
+              query_result_cache_->Get(request)) {
+        return *std::move(response);
+      }
+    }
     std::unique_ptr<GetKeyValueSetResult> get_key_value_set_result;
-    kv_server::Driver driver([&get_key_value_set_result](std::string_view key) {
-      return get_key_value_set_result->GetValueSet(key);
-    });
-
-    std::istringstream stream(query);
-    kv_server::Scanner scanner(stream);
-    kv_server::Parser parse(driver, scanner);
-    int parse_result = parse();
+    kv_server::Driver driver(
+        [&get_key_value_set_result](std::string_view key)
+            -> const absl::flat_hash_set<std::string_view>& {
+          return get_key_value_set_result->GetValueSet(key);
+        });
+
+    const absl::Time parse_start = absl::Now();
+    int parse_result = ParseQuery(driver, request.query());
     if (parse_result) {
       return absl::InvalidArgumentError("Parsing failure.");
     }
-    get_key_value_set_result =
-        cache_.GetKeyValueSet(driver.GetRootNode()->Keys());
+    const auto keys = driver.GetRootNode()->Keys();
+    if (request.result_mode() == RunQueryResultMode::APPROXIMATE_COUNT) {
+      auto sketches = cache_.GetKeyValueSetSketches(keys);
+      if (!sketches.ok()) {
+        return sketches.status();
+      }
+      return BuildApproximateCountResponse(driver, *sketches);
+    }
+    // Read the version first, so that a concurrent update invalidates the
+    // cached response instead of being missed.
+    const int64_t version = query_result_cache_ == nullptr
+                                ? 0
+                                : cache_.GetKeyValueSetVersion(keys);
+    const absl::Time fetch_start = absl::Now();
+    get_key_value_set_result = cache_.GetKeyValueSet(keys);
+    const absl::Time eval_start = absl::Now();
+    const CachedSortedSets sorted_sets(*get_key_value_set_result);
+    auto response = BuildRunQueryResponse(driver, request, &sorted_sets);
+    if (ShouldTraceQueryStats()) {
+      TraceQueryStats(driver, fetch_start - parse_start,
+                      eval_start - fetch_start);
+    }
+    if (query_result_cache_ != nullptr && response.ok()) {
+      query_result_cache_->Put(request, keys, version, *response);
+    }
+    return response;
+  }
 
-    auto result = driver.GetResult();
-    if (!result.ok()) {
-      return result.status();
+  bool ShouldTraceQueryStats() const {
+    if (query_stats_sample_rate_ <= 0) {
+      return false;
+    }
+    thread_local absl::BitGen bitgen;
+    return absl::Bernoulli(bitgen, query_stats_sample_rate_);
+  }
+
+  // Evaluates the query again with instrumentation, and records the time
+  // spent in each step of the evaluation along with the sizes of the sets
+  // involved in a trace span.
+  void TraceQueryStats(const Driver& driver, absl::Duration parse_duration,
+                       absl::Duration fetch_duration) const {
+    std::vector<PlanStepStats> stats;
+    const absl::Time eval_start = absl::Now();
+    if (!driver.GetResultWithStats(stats).ok()) {
+      return;
+    }
+    const absl::Duration eval_duration = absl::Now() - eval_start;
+    auto span = GetTracer()->StartSpan(kLocalRunQueryStats);
+    span->SetAttribute("parse_duration_us",
+                       absl::ToInt64Microseconds(parse_duration));
+    span->SetAttribute("fetch_duration_us",
+                       absl::ToInt64Microseconds(fetch_duration));
+    span->SetAttribute("eval_duration_us",
+                       absl::ToInt64Microseconds(eval_duration));
+    span->SetAttribute("plan", PlanStatsToString(stats));
+    span->End();
+  }
+
+  absl::StatusOr<InternalRunQueriesResponse> ProcessQueries(
+      const InternalRunQueriesRequest& request) const {
+    ScopeLatencyRecorder latency_recorder(std::string(kLocalRunQueries),
+                                          metrics_recorder_);
+    std::unique_ptr<GetKeyValueSetResult> get_key_value_set_result;
+    std::vector<std::unique_ptr<Driver>> drivers;
+    drivers.reserve(request.queries_size());
+    for (int i = 0; i < request.queries_size(); i++) {
+      drivers.push_back(std::make_unique<Driver>(
+          [&get_key_value_set_result](std::string_view key)
+              -> const absl::flat_hash_set<std::string_view>& {
+            return get_key_value_set_result->GetValueSet(key);
+          }));
+    }
+    InternalRunQueriesResponse response;
+    const auto keys = ParseRunQueries(request, drivers, response);
+    if (keys.empty()) {
+      BuildRunQueriesResponse(request, drivers, response);
+      return response;
     }
-    InternalRunQueryResponse response;
-    response.mutable_elements()->Assign(result->begin(), result->end());
+    get_key_value_set_result = cache_.GetKeyValueSet(keys);
+    const CachedSortedSets sorted_sets(*get_key_value_set_result);
+    BuildRunQueriesResponse(request, drivers, response, &sorted_sets);
     return response;
   }
 
   const Cache& cache_;
   MetricsRecorder& metrics_recorder_;
+  QueryResultCache* const query_result_cache_;
+  const double query_stats_sample_rate_ =
+      absl::GetFlag(FLAGS_query_stats_sample_rate);
 };
 
 }  // namespace
 
 std::unique_ptr<Lookup> CreateLocalLookup(
     const Cache& cache,
-    privacy_sandbox::server_common::MetricsRecorder& metrics_recorder) {
-  return std::make_unique<LocalLookup>(cache, metrics_recorder);
+    privacy_sandbox::server_common::MetricsRecorder& metrics_recorder,
+    QueryResultCache* query_result_cache) {
+  return std::make_unique<LocalLookup>(cache, metrics_recorder,
+                                       query_result_cache);
 }
 
 }  // namespace kv_server
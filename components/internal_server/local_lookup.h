@@ -21,13 +21,17 @@
 
 #include "components/data_server/cache/cache.h"
 #include "components/internal_server/lookup.h"
+#include "components/internal_server/query_result_cache.h"
 #include "src/cpp/telemetry/metrics_recorder.h"
 
 namespace kv_server {
 
+// Query responses are cached in `query_result_cache` if it is set. It is
+// shared by all the local lookups of `cache`, and must outlive them.
 std::unique_ptr<Lookup> CreateLocalLookup(
     const Cache& cache,
-    privacy_sandbox::server_common::MetricsRecorder& metrics_recorder);
+    privacy_sandbox::server_common::MetricsRecorder& metrics_recorder,
+    QueryResultCache* query_result_cache = nullptr);
 
 }  // namespace kv_server
 
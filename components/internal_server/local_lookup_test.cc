@@ -14,12 +14,17 @@
 
 #include "components/internal_server/local_lookup.h"
 
+#include <cstdint>
 #include <memory>
+#include <optional>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "absl/types/span.h"
 #include "components/data_server/cache/mocks.h"
+#include "components/internal_server/query_result_cache.h"
+#include "components/internal_server/run_query_result.h"
 #include "gmock/gmock.h"
 #include "google/protobuf/text_format.h"
 #include "gtest/gtest.h"
@@ -34,6 +39,7 @@ using privacy_sandbox::server_common::MockMetricsRecorder;
 using testing::_;
 using testing::Return;
 using testing::ReturnRef;
+using testing::ReturnRefOfCopy;
 
 class LocalLookupTest : public ::testing::Test {
  protected:
@@ -120,8 +126,8 @@ TEST_F(LocalLookupTest, GetKeyValueSets_KeysFound_Success) {
   auto mock_get_key_value_set_result =
       std::make_unique<MockGetKeyValueSetResult>();
   EXPECT_CALL(*mock_get_key_value_set_result, GetValueSet("key1"))
-      .WillOnce(
-          Return(absl::flat_hash_set<std::string_view>{"value1", "value2"}));
+      .WillOnce(ReturnRefOfCopy(
+          absl::flat_hash_set<std::string_view>{"value1", "value2"}));
   EXPECT_CALL(mock_cache_, GetKeyValueSet(_))
       .WillOnce(Return(std::move(mock_get_key_value_set_result)));
 
@@ -134,11 +140,28 @@ TEST_F(LocalLookupTest, GetKeyValueSets_KeysFound_Success) {
               testing::UnorderedElementsAreArray(expected_resulting_set));
 }
 
+TEST_F(LocalLookupTest, GetKeyValueSets_UInt32Set_SentPacked) {
+  const std::vector<uint32_t> values = {1, 5, 9};
+  auto mock_get_key_value_set_result =
+      std::make_unique<MockGetKeyValueSetResult>();
+  EXPECT_CALL(*mock_get_key_value_set_result, GetUInt32ValueSet("key1"))
+      .WillOnce(Return(absl::MakeConstSpan(values)));
+  EXPECT_CALL(mock_cache_, GetKeyValueSet(_))
+      .WillOnce(Return(std::move(mock_get_key_value_set_result)));
+
+  auto local_lookup = CreateLocalLookup(mock_cache_, mock_metrics_recorder_);
+  auto response = local_lookup->GetKeyValueSet({"key1"});
+  ASSERT_TRUE(response.ok());
+  const auto& keyset_values = response->kv_pairs().at("key1").keyset_values();
+  EXPECT_THAT(keyset_values.uint32_values(), testing::ElementsAre(1, 5, 9));
+  EXPECT_TRUE(keyset_values.values().empty());
+}
+
 TEST_F(LocalLookupTest, GetKeyValueSets_SetEmpty_Success) {
   auto mock_get_key_value_set_result =
       std::make_unique<MockGetKeyValueSetResult>();
   EXPECT_CALL(*mock_get_key_value_set_result, GetValueSet("key1"))
-      .WillOnce(Return(absl::flat_hash_set<std::string_view>{}));
+      .WillOnce(ReturnRefOfCopy(absl::flat_hash_set<std::string_view>{}));
   EXPECT_CALL(mock_cache_, GetKeyValueSet(_))
       .WillOnce(Return(std::move(mock_get_key_value_set_result)));
 
@@ -172,8 +195,8 @@ TEST_F(LocalLookupTest, RunQuery_Success) {
   auto mock_get_key_value_set_result =
       std::make_unique<MockGetKeyValueSetResult>();
   EXPECT_CALL(*mock_get_key_value_set_result, GetValueSet("someset"))
-      .WillOnce(
-          Return(absl::flat_hash_set<std::string_view>{"value1", "value2"}));
+      .WillOnce(ReturnRefOfCopy(
+          absl::flat_hash_set<std::string_view>{"value1", "value2"}));
   EXPECT_CALL(mock_cache_,
               GetKeyValueSet(absl::flat_hash_set<std::string_view>{"someset"}))
       .WillOnce(Return(std::move(mock_get_key_value_set_result)));
@@ -187,6 +210,31 @@ TEST_F(LocalLookupTest, RunQuery_Success) {
               testing::UnorderedElementsAreArray({"value1", "value2"}));
 }
 
+TEST_F(LocalLookupTest, RunQuery_SharedResultCache_Success) {
+  auto mock_get_key_value_set_result =
+      std::make_unique<MockGetKeyValueSetResult>();
+  EXPECT_CALL(*mock_get_key_value_set_result, GetValueSet("someset"))
+      .WillOnce(ReturnRefOfCopy(
+          absl::flat_hash_set<std::string_view>{"value1", "value2"}));
+  EXPECT_CALL(mock_cache_,
+              GetKeyValueSet(absl::flat_hash_set<std::string_view>{"someset"}))
+      .WillOnce(Return(std::move(mock_get_key_value_set_result)));
+  EXPECT_CALL(mock_cache_, GetKeyValueSetVersion(_)).WillRepeatedly(Return(1));
+
+  QueryResultCache query_result_cache(mock_cache_, 1000,
+                                      mock_metrics_recorder_);
+  auto local_lookup = CreateLocalLookup(mock_cache_, mock_metrics_recorder_,
+                                        &query_result_cache);
+  auto other_local_lookup = CreateLocalLookup(
+      mock_cache_, mock_metrics_recorder_, &query_result_cache);
+  ASSERT_TRUE(local_lookup->RunQuery("someset").ok());
+  // Answered from the cache filled by the other lookup.
+  auto response = other_local_lookup->RunQuery("someset");
+  ASSERT_TRUE(response.ok());
+  EXPECT_THAT(response.value().elements(),
+              testing::UnorderedElementsAreArray({"value1", "value2"}));
+}
+
 TEST_F(LocalLookupTest, RunQuery_ParsingError_Error) {
   std::string query = "someset|(";
 
@@ -196,6 +244,333 @@ TEST_F(LocalLookupTest, RunQuery_ParsingError_Error) {
   EXPECT_EQ(response.status().code(), absl::StatusCode::kInvalidArgument);
 }
 
+TEST_F(LocalLookupTest, RunQuery_EmptyQuery_ReturnsEmptyResponse) {
+  auto local_lookup = CreateLocalLookup(mock_cache_, mock_metrics_recorder_);
+  auto response = local_lookup->RunQuery("");
+  ASSERT_TRUE(response.ok());
+
+  InternalRunQueryResponse expected;
+  EXPECT_THAT(response.value(), EqualsProto(expected));
+}
+
+TEST_F(LocalLookupTest, ExecuteQuery_OrderedPages_Success) {
+  EXPECT_CALL(mock_cache_, GetKeyValueSet(_))
+      .WillRepeatedly([](const absl::flat_hash_set<std::string_view>&) {
+        auto result = std::make_unique<MockGetKeyValueSetResult>();
+        EXPECT_CALL(*result, GetValueSet("A"))
+            .WillRepeatedly(
+                ReturnRefOfCopy(absl::flat_hash_set<std::string_view>{
+                    "e", "a", "d", "b", "c"}));
+        return result;
+      });
+
+  auto local_lookup = CreateLocalLookup(mock_cache_, mock_metrics_recorder_);
+  InternalRunQueryRequest request;
+  TextFormat::ParseFromString(R"pb(query: "A" limit: 2 ordered: true)pb",
+                              &request);
+  auto response = local_lookup->ExecuteQuery(request);
+  ASSERT_TRUE(response.ok());
+  InternalRunQueryResponse expected;
+  TextFormat::ParseFromString(
+      R"pb(elements: "a" elements: "b" next_page_token: "b")pb", &expected);
+  EXPECT_THAT(response.value(), EqualsProto(expected));
+
+  request.set_page_token(response->next_page_token());
+  response = local_lookup->ExecuteQuery(request);
+  ASSERT_TRUE(response.ok());
+  TextFormat::ParseFromString(
+      R"pb(elements: "c" elements: "d" next_page_token: "d")pb", &expected);
+  EXPECT_THAT(response.value(), EqualsProto(expected));
+
+  request.set_page_token(response->next_page_token());
+  response = local_lookup->ExecuteQuery(request);
+  ASSERT_TRUE(response.ok());
+  TextFormat::ParseFromString(R"pb(elements: "e")pb", &expected);
+  EXPECT_THAT(response.value(), EqualsProto(expected));
+
+  request.clear_page_token();
+  request.set_offset(3);
+  response = local_lookup->ExecuteQuery(request);
+  ASSERT_TRUE(response.ok());
+  TextFormat::ParseFromString(R"pb(elements: "d" elements: "e")pb",
+                              &expected);
+  EXPECT_THAT(response.value(), EqualsProto(expected));
+}
+
+TEST_F(LocalLookupTest, ExecuteQuery_UInt32Sets_Success) {
+  const std::vector<uint32_t> a = {1, 2, 10, 20};
+  const std::vector<uint32_t> b = {2, 10, 30};
+  EXPECT_CALL(mock_cache_, GetKeyValueSet(_))
+      .WillRepeatedly([&a, &b](const absl::flat_hash_set<std::string_view>&) {
+        auto result = std::make_unique<MockGetKeyValueSetResult>();
+        EXPECT_CALL(*result, GetUInt32ValueSet("A"))
+            .WillRepeatedly(Return(absl::MakeConstSpan(a)));
+        EXPECT_CALL(*result, GetUInt32ValueSet("B"))
+            .WillRepeatedly(Return(absl::MakeConstSpan(b)));
+        return result;
+      });
+
+  auto local_lookup = CreateLocalLookup(mock_cache_, mock_metrics_recorder_);
+  InternalRunQueryRequest request;
+  request.set_query("A | B");
+  auto response = local_lookup->ExecuteQuery(request);
+  ASSERT_TRUE(response.ok());
+  EXPECT_THAT(response->elements(),
+              testing::UnorderedElementsAre("1", "2", "10", "20", "30"));
+
+  // Pages are in the order of the decimal strings, as for string sets.
+  TextFormat::ParseFromString(
+      R"pb(query: "A | B" limit: 3 ordered: true)pb", &request);
+  response = local_lookup->ExecuteQuery(request);
+  ASSERT_TRUE(response.ok());
+  InternalRunQueryResponse expected;
+  TextFormat::ParseFromString(
+      R"pb(elements: "1" elements: "10" elements: "2" next_page_token: "2")pb",
+      &expected);
+  EXPECT_THAT(response.value(), EqualsProto(expected));
+
+  TextFormat::ParseFromString(
+      R"pb(query: "A & B"
+           result_mode: MEMBERSHIP
+           candidates: "2"
+           candidates: "02"
+           candidates: "20")pb",
+      &request);
+  response = local_lookup->ExecuteQuery(request);
+  ASSERT_TRUE(response.ok());
+  TextFormat::ParseFromString(
+      R"pb(is_member: true is_member: false is_member: false)pb", &expected);
+  EXPECT_THAT(response.value(), EqualsProto(expected));
+
+  TextFormat::ParseFromString(R"pb(query: "A - B" result_mode: COUNT)pb",
+                              &request);
+  response = local_lookup->ExecuteQuery(request);
+  ASSERT_TRUE(response.ok());
+  EXPECT_EQ(response->count(), 2);
+}
+
+TEST_F(LocalLookupTest, ExecuteQuery_MixedSets_EvaluatedAsStrings) {
+  const std::vector<uint32_t> a = {1, 2};
+  auto mock_get_key_value_set_result =
+      std::make_unique<MockGetKeyValueSetResult>();
+  EXPECT_CALL(*mock_get_key_value_set_result, GetUInt32ValueSet("A"))
+      .WillRepeatedly(Return(absl::MakeConstSpan(a)));
+  EXPECT_CALL(*mock_get_key_value_set_result, GetUInt32ValueSet("B"))
+      .WillRepeatedly(Return(std::nullopt));
+  EXPECT_CALL(*mock_get_key_value_set_result, GetValueSet("A"))
+      .WillRepeatedly(
+          ReturnRefOfCopy(absl::flat_hash_set<std::string_view>{"1", "2"}));
+  EXPECT_CALL(*mock_get_key_value_set_result, GetValueSet("B"))
+      .WillRepeatedly(
+          ReturnRefOfCopy(absl::flat_hash_set<std::string_view>{"2", "b"}));
+  EXPECT_CALL(mock_cache_, GetKeyValueSet(_))
+      .WillOnce(Return(std::move(mock_get_key_value_set_result)));
+
+  InternalRunQueryRequest request;
+  request.set_query("A | B");
+  auto local_lookup = CreateLocalLookup(mock_cache_, mock_metrics_recorder_);
+  auto response = local_lookup->ExecuteQuery(request);
+  ASSERT_TRUE(response.ok());
+  EXPECT_THAT(response->elements(),
+              testing::UnorderedElementsAre("1", "2", "b"));
+}
+
+TEST_F(LocalLookupTest, ExecuteQuery_Limit_Success) {
+  auto mock_get_key_value_set_result =
+      std::make_unique<MockGetKeyValueSetResult>();
+  EXPECT_CALL(*mock_get_key_value_set_result, GetValueSet("A"))
+      .WillRepeatedly(ReturnRefOfCopy(
+          absl::flat_hash_set<std::string_view>{"a", "b", "c"}));
+  EXPECT_CALL(mock_cache_, GetKeyValueSet(_))
+      .WillOnce(Return(std::move(mock_get_key_value_set_result)));
+
+  InternalRunQueryRequest request;
+  request.set_query("A");
+  request.set_limit(2);
+  auto local_lookup = CreateLocalLookup(mock_cache_, mock_metrics_recorder_);
+  auto response = local_lookup->ExecuteQuery(request);
+  ASSERT_TRUE(response.ok());
+  EXPECT_EQ(response->elements_size(), 2);
+  EXPECT_TRUE(response->next_page_token().empty());
+}
+
+TEST_F(LocalLookupTest, RunQueries_SingleFetch_Success) {
+  auto mock_get_key_value_set_result =
+      std::make_unique<MockGetKeyValueSetResult>();
+  EXPECT_CALL(*mock_get_key_value_set_result, GetValueSet("A"))
+      .WillRepeatedly(ReturnRefOfCopy(
+          absl::flat_hash_set<std::string_view>{"a", "b", "c"}));
+  EXPECT_CALL(*mock_get_key_value_set_result, GetValueSet("B"))
+      .WillRepeatedly(ReturnRefOfCopy(
+          absl::flat_hash_set<std::string_view>{"b", "d"}));
+  EXPECT_CALL(mock_cache_,
+              GetKeyValueSet(absl::flat_hash_set<std::string_view>{"A", "B"}))
+      .WillOnce(Return(std::move(mock_get_key_value_set_result)));
+
+  InternalRunQueriesRequest request;
+  TextFormat::ParseFromString(
+      R"pb(queries { query: "A & B" }
+           queries { query: "A - B" result_mode: COUNT }
+           queries { query: "B|" }
+           queries { query: "B" ordered: true })pb",
+      &request);
+  auto local_lookup = CreateLocalLookup(mock_cache_, mock_metrics_recorder_);
+  auto response = local_lookup->RunQueries(request);
+  ASSERT_TRUE(response.ok());
+
+  InternalRunQueriesResponse expected;
+  TextFormat::ParseFromString(
+      R"pb(results { response { elements: "b" } }
+           results { response { count: 2 } }
+           results { status { code: 3 message: "Parsing failure." } }
+           results { response { elements: "b" elements: "d" } })pb",
+      &expected);
+  EXPECT_THAT(response.value(), EqualsProto(expected));
+}
+
+TEST_F(LocalLookupTest, ExecuteQuery_Count_Success) {
+  auto mock_get_key_value_set_result =
+      std::make_unique<MockGetKeyValueSetResult>();
+  EXPECT_CALL(*mock_get_key_value_set_result, GetValueSet("A"))
+      .WillRepeatedly(ReturnRefOfCopy(
+          absl::flat_hash_set<std::string_view>{"a", "b", "c"}));
+  EXPECT_CALL(*mock_get_key_value_set_result, GetValueSet("B"))
+      .WillRepeatedly(ReturnRefOfCopy(
+          absl::flat_hash_set<std::string_view>{"b", "d"}));
+  EXPECT_CALL(mock_cache_, GetKeyValueSet(_))
+      .WillOnce(Return(std::move(mock_get_key_value_set_result)));
+
+  InternalRunQueryRequest request;
+  request.set_query("A - B");
+  request.set_result_mode(RunQueryResultMode::COUNT);
+  auto local_lookup = CreateLocalLookup(mock_cache_, mock_metrics_recorder_);
+  auto response = local_lookup->ExecuteQuery(request);
+  ASSERT_TRUE(response.ok());
+
+  InternalRunQueryResponse expected;
+  expected.set_count(2);
+  EXPECT_THAT(response.value(), EqualsProto(expected));
+}
+
+TEST_F(LocalLookupTest, ExecuteQuery_Membership_Success) {
+  auto mock_get_key_value_set_result =
+      std::make_unique<MockGetKeyValueSetResult>();
+  EXPECT_CALL(*mock_get_key_value_set_result, GetValueSet("A"))
+      .WillRepeatedly(ReturnRefOfCopy(
+          absl::flat_hash_set<std::string_view>{"a", "b", "c"}));
+  EXPECT_CALL(*mock_get_key_value_set_result, GetValueSet("B"))
+      .WillRepeatedly(ReturnRefOfCopy(
+          absl::flat_hash_set<std::string_view>{"b", "d"}));
+  EXPECT_CALL(mock_cache_, GetKeyValueSet(_))
+      .WillOnce(Return(std::move(mock_get_key_value_set_result)));
+
+  InternalRunQueryRequest request;
+  TextFormat::ParseFromString(
+      R"pb(query: "A & B"
+           result_mode: MEMBERSHIP
+           candidates: "a"
+           candidates: "b"
+           candidates: "z")pb",
+      &request);
+  auto local_lookup = CreateLocalLookup(mock_cache_, mock_metrics_recorder_);
+  auto response = local_lookup->ExecuteQuery(request);
+  ASSERT_TRUE(response.ok());
+
+  InternalRunQueryResponse expected;
+  TextFormat::ParseFromString(
+      R"pb(is_member: false is_member: true is_member: false)pb", &expected);
+  EXPECT_THAT(response.value(), EqualsProto(expected));
+}
+
+TEST_F(LocalLookupTest, GetKeyValueSetSketches_Success) {
+  ThetaSketch sketch;
+  sketch.Update("value1");
+  EXPECT_CALL(mock_cache_, GetKeyValueSetSketches(_))
+      .WillOnce(Return(
+          absl::flat_hash_map<std::string, ThetaSketch>{{"key1", sketch}}));
+
+  auto local_lookup = CreateLocalLookup(mock_cache_, mock_metrics_recorder_);
+  auto response = local_lookup->GetKeyValueSetSketches({"key1", "key2"});
+  ASSERT_TRUE(response.ok());
+
+  InternalLookupResponse expected;
+  TextFormat::ParseFromString(R"pb(kv_pairs {
+                                     key: "key2"
+                                     value {
+                                       status: {
+                                         code: 5,
+                                         message: "Key not found"
+                                       }
+                                     }
+                                   }
+                              )pb",
+                              &expected);
+  *(*expected.mutable_kv_pairs())["key1"].mutable_keyset_sketch() =
+      ToKeysetSketch(sketch);
+  EXPECT_THAT(response.value(), EqualsProto(expected));
+}
+
+TEST_F(LocalLookupTest, GetKeyValueSetMembership_Success) {
+  const std::vector<std::string_view> candidates = {"value1", "value2"};
+  EXPECT_CALL(mock_cache_, GetKeyValueSetMembership("key1", _))
+      .WillOnce(Return(std::vector<bool>{false, true}));
+
+  auto local_lookup = CreateLocalLookup(mock_cache_, mock_metrics_recorder_);
+  auto response = local_lookup->GetKeyValueSetMembership("key1", candidates);
+  ASSERT_TRUE(response.ok());
+
+  InternalLookupResponse expected;
+  TextFormat::ParseFromString(R"pb(kv_pairs {
+                                     key: "key1"
+                                     value {
+                                       keyset_membership {
+                                         is_member: false
+                                         is_member: true
+                                       }
+                                     }
+                                   }
+                              )pb",
+                              &expected);
+  EXPECT_THAT(response.value(), EqualsProto(expected));
+}
+
+TEST_F(LocalLookupTest, ExecuteQuery_ApproximateCount_Success) {
+  ThetaSketch sketch_a;
+  sketch_a.Update("a");
+  sketch_a.Update("b");
+  sketch_a.Update("c");
+  ThetaSketch sketch_b;
+  sketch_b.Update("b");
+  sketch_b.Update("d");
+  EXPECT_CALL(mock_cache_, GetKeyValueSetSketches(_))
+      .WillOnce(Return(absl::flat_hash_map<std::string, ThetaSketch>{
+          {"A", sketch_a}, {"B", sketch_b}}));
+  EXPECT_CALL(mock_cache_, GetKeyValueSet(_)).Times(0);
+
+  InternalRunQueryRequest request;
+  request.set_query("A - B");
+  request.set_result_mode(RunQueryResultMode::APPROXIMATE_COUNT);
+  auto local_lookup = CreateLocalLookup(mock_cache_, mock_metrics_recorder_);
+  auto response = local_lookup->ExecuteQuery(request);
+  ASSERT_TRUE(response.ok());
+
+  InternalRunQueryResponse expected;
+  expected.set_approximate_count(2);
+  EXPECT_THAT(response.value(), EqualsProto(expected));
+}
+
+TEST_F(LocalLookupTest, ExecuteQuery_ApproximateCountWithoutSketches_Error) {
+  EXPECT_CALL(mock_cache_, GetKeyValueSetSketches(_))
+      .WillOnce(Return(absl::FailedPreconditionError("No sketches")));
+
+  InternalRunQueryRequest request;
+  request.set_query("A - B");
+  request.set_result_mode(RunQueryResultMode::APPROXIMATE_COUNT);
+  auto local_lookup = CreateLocalLookup(mock_cache_, mock_metrics_recorder_);
+  auto response = local_lookup->ExecuteQuery(request);
+  EXPECT_EQ(response.status().code(), absl::StatusCode::kFailedPrecondition);
+}
+
 }  // namespace
 
 }  // namespace kv_server
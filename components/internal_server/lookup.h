@@ -23,6 +23,7 @@
 
 #include "absl/container/flat_hash_set.h"
 #include "absl/status/statusor.h"
+#include "absl/types/span.h"
 #include "components/internal_server/lookup.pb.h"
 
 namespace kv_server {
@@ -38,8 +39,33 @@ class Lookup {
   virtual absl::StatusOr<InternalLookupResponse> GetKeyValueSet(
       const absl::flat_hash_set<std::string_view>& key_set) const = 0;
 
+  // Returns the sketches of the sets of the given keys as `keyset_sketch`
+  // results, which is much smaller than the sets.
+  virtual absl::StatusOr<InternalLookupResponse> GetKeyValueSetSketches(
+      const absl::flat_hash_set<std::string_view>& key_set) const = 0;
+
+  // Returns whether each of `candidates` is in the set of `key`, in order, as
+  // a `keyset_membership` result. Only the candidates are looked up, so the
+  // set is neither copied nor sent between shards. A missing set contains
+  // nothing.
+  virtual absl::StatusOr<InternalLookupResponse> GetKeyValueSetMembership(
+      std::string_view key,
+      absl::Span<const std::string_view> candidates) const = 0;
+
   virtual absl::StatusOr<InternalRunQueryResponse> RunQuery(
       std::string query) const = 0;
+
+  // Runs `request.query()` and returns the result in the shape requested by
+  // `request.result_mode()`.
+  virtual absl::StatusOr<InternalRunQueryResponse> ExecuteQuery(
+      const InternalRunQueryRequest& request) const = 0;
+
+  // Runs all queries of `request` against one fetch of the union of their
+  // key sets and returns one result per query, in order. A query that fails
+  // on its own gets an error result, while failing to fetch the sets fails
+  // the whole batch.
+  virtual absl::StatusOr<InternalRunQueriesResponse> RunQueries(
+      const InternalRunQueriesRequest& request) const = 0;
 };
 
 }  // namespace kv_server
@@ -14,6 +14,7 @@
 
 #include "components/internal_server/lookup_server_impl.h"
 
+#include <algorithm>
 #include <iostream>
 #include <memory>
 #include <sstream>
@@ -21,16 +22,33 @@
 #include <utility>
 #include <vector>
 
+#include "absl/flags/flag.h"
 #include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
 #include "components/data_server/request_handler/ohttp_server_encryptor.h"
 #include "components/internal_server/lookup.grpc.pb.h"
 #include "components/internal_server/lookup.h"
+#include "components/internal_server/session_crypter.h"
 #include "components/internal_server/string_padder.h"
+#include "components/query/worker_pool.h"
 #include "glog/logging.h"
+#include "google/protobuf/arena.h"
 #include "google/protobuf/message.h"
 #include "grpcpp/grpcpp.h"
 #include "src/cpp/telemetry/telemetry.h"
 
+ABSL_FLAG(int32_t, secure_lookup_stream_threads, 16,
+          "Number of threads, shared by all SecureLookupStreams of the "
+          "process, on which the lookups of a stream are processed "
+          "concurrently. Lookups are processed in order on the thread reading "
+          "their stream if this is 0.");
+ABSL_FLAG(int32_t, secure_lookup_stream_max_in_flight, 64,
+          "Maximum number of lookups of a single SecureLookupStream that are "
+          "processed at once. The stream isn't read beyond them until one "
+          "completes, so that a stream can't take over the threads of "
+          "--secure_lookup_stream_threads.");
+
 namespace kv_server {
 using google::protobuf::RepeatedPtrField;
 using privacy_sandbox::server_common::ScopeLatencyRecorder;
@@ -42,7 +60,44 @@ constexpr char kUnpaddingError[] = "UnpaddingError";
 constexpr char kEncryptionError[] = "EncryptionError";
 constexpr char kDeserializationError[] = "DeserializationError";
 constexpr char kRunQueryError[] = "RunQueryError";
+constexpr char kRunQueriesError[] = "RunQueriesError";
 constexpr char kSecureLookup[] = "SecureLookup";
+constexpr char kShardingFunctionVersionMismatch[] =
+    "ShardingFunctionVersionMismatch";
+
+namespace {
+
+// Moves the result of each key of `keys` from `kv_pairs` to `results`, in the
+// order of `keys`. Keys without a result are marked as not found.
+void ToPositionalResults(const RepeatedPtrField<std::string>& keys,
+                         InternalLookupResponse& response) {
+  auto& kv_pairs = *response.mutable_kv_pairs();
+  auto& results = *response.mutable_results();
+  results.Reserve(keys.size());
+  for (const auto& key : keys) {
+    SingleLookupResult* result = results.Add();
+    if (const auto it = kv_pairs.find(key); it != kv_pairs.end()) {
+      *result = std::move(it->second);
+    } else {
+      result->mutable_status()->set_code(
+          static_cast<int>(absl::StatusCode::kNotFound));
+    }
+  }
+  kv_pairs.clear();
+}
+
+// Returns the pool shared by all streams of the process, or nullptr if the
+// lookups of a stream are processed in order. Created on first use, so that no
+// thread is started before the UDF workers fork.
+WorkerPool* GetStreamPool() {
+  static WorkerPool* const pool = []() -> WorkerPool* {
+    const int32_t threads = absl::GetFlag(FLAGS_secure_lookup_stream_threads);
+    return threads > 0 ? new WorkerPool(threads) : nullptr;
+  }();
+  return pool;
+}
+
+}  // namespace
 
 grpc::Status LookupServiceImpl::ToInternalGrpcStatus(
     const absl::Status& status, const char* eventName) const {
@@ -78,6 +133,49 @@ void LookupServiceImpl::ProcessKeysetKeys(
   }
 }
 
+void LookupServiceImpl::ProcessKeysetSketchKeys(
+    const RepeatedPtrField<std::string>& keys,
+    InternalLookupResponse& response) const {
+  if (keys.empty()) return;
+  absl::flat_hash_set<std::string_view> key_list;
+  for (const auto& key : keys) {
+    key_list.insert(key);
+  }
+  auto key_value_set_sketches_result = lookup_.GetKeyValueSetSketches(key_list);
+  if (key_value_set_sketches_result.ok()) {
+    response = *std::move(key_value_set_sketches_result);
+    return;
+  }
+  // Return the error for each key, so that the caller can tell sketches that
+  // are not maintained apart from sets that do not exist.
+  for (const auto& key : key_list) {
+    auto* status = (*response.mutable_kv_pairs())[key].mutable_status();
+    status->set_code(
+        static_cast<int>(key_value_set_sketches_result.status().code()));
+    status->set_message(
+        std::string(key_value_set_sketches_result.status().message()));
+  }
+}
+
+void LookupServiceImpl::ProcessKeysetMembershipKeys(
+    const RepeatedPtrField<std::string>& keys,
+    const RepeatedPtrField<std::string>& candidates,
+    InternalLookupResponse& response) const {
+  const std::vector<std::string_view> candidate_list(candidates.begin(),
+                                                     candidates.end());
+  for (const auto& key : keys) {
+    auto membership_result =
+        lookup_.GetKeyValueSetMembership(key, candidate_list);
+    if (!membership_result.ok()) {
+      continue;
+    }
+    for (auto& [result_key, result] :
+         *membership_result->mutable_kv_pairs()) {
+      (*response.mutable_kv_pairs())[result_key] = std::move(result);
+    }
+  }
+}
+
 grpc::Status LookupServiceImpl::InternalLookup(
     grpc::ServerContext* context, const InternalLookupRequest* request,
     InternalLookupResponse* response) {
@@ -110,29 +208,20 @@ grpc::Status LookupServiceImpl::SecureLookup(
   }
 
   VLOG(9) << "SecureLookup decrypted";
-  auto serialized_request_maybe =
-      kv_server::Unpad(*padded_serialized_request_maybe);
-  if (!serialized_request_maybe.ok()) {
-    metrics_recorder_.IncrementEventCounter(kDeserializationError);
-    return ToInternalGrpcStatus(serialized_request_maybe.status(),
-                                kUnpaddingError);
+  auto payload_maybe = GetPaddedPayload(*padded_serialized_request_maybe);
+  if (!payload_maybe.ok()) {
+    return grpc::Status(StatusCode::INTERNAL,
+                        absl::StrCat(payload_maybe.status().code(), " : ",
+                                     payload_maybe.status().message()));
   }
-
-  VLOG(9) << "SecureLookup unpadded";
-  InternalLookupRequest request;
-  if (!request.ParseFromString(*serialized_request_maybe)) {
-    return grpc::Status(grpc::StatusCode::INTERNAL,
-                        "Failed parsing incoming request");
-  }
-
-  auto payload_to_encrypt = GetPayload(request.lookup_sets(), request.keys());
+  auto& payload_to_encrypt = *payload_maybe;
   if (payload_to_encrypt.empty()) {
     // we cannot encrypt an empty payload. Note, that soon we will add logic
     // to pad responses, so this branch will never be hit.
     return grpc::Status::OK;
   }
   auto encrypted_response_payload =
-      encryptor.EncryptResponse(payload_to_encrypt);
+      encryptor.EncryptResponse(std::move(payload_to_encrypt));
   if (!encrypted_response_payload.ok()) {
     return ToInternalGrpcStatus(encrypted_response_payload.status(),
                                 kEncryptionError);
@@ -141,13 +230,191 @@ grpc::Status LookupServiceImpl::SecureLookup(
   return grpc::Status::OK;
 }
 
+grpc::Status LookupServiceImpl::SecureLookupStream(
+    grpc::ServerContext* context,
+    grpc::ServerReaderWriter<SecureLookupStreamResponse,
+                             SecureLookupStreamRequest>* stream) {
+  SecureLookupStreamRequest request;
+  if (!stream->Read(&request)) {
+    return grpc::Status::OK;
+  }
+  if (!request.has_ohttp_session_key()) {
+    return grpc::Status(
+        StatusCode::INVALID_ARGUMENT,
+        "The first message of a stream must carry its session key.");
+  }
+  OhttpServerEncryptor encryptor(key_fetcher_manager_);
+  auto session_key_maybe =
+      encryptor.DecryptRequest(request.ohttp_session_key());
+  if (!session_key_maybe.ok()) {
+    return ToInternalGrpcStatus(session_key_maybe.status(), kDecryptionError);
+  }
+  auto crypter_maybe = SessionCrypter::Create(*session_key_maybe);
+  if (!crypter_maybe.ok()) {
+    return ToInternalGrpcStatus(crypter_maybe.status(), kDecryptionError);
+  }
+  VLOG(9) << "SecureLookupStream established";
+
+  const SessionCrypter& crypter = **crypter_maybe;
+  WorkerPool* const pool = GetStreamPool();
+  // Lookups are answered as they complete, so a slow lookup doesn't hold up
+  // the ones behind it. Responses are written one at a time, and the stream
+  // isn't left before every lookup read from it is answered. Shared with the
+  // lookups, which may still hold it when the stream is left.
+  struct StreamState {
+    explicit StreamState(int max_in_flight) : max_in_flight(max_in_flight) {}
+
+    // Whether the next lookup may be read from the stream.
+    bool CanRead() const ABSL_SHARED_LOCKS_REQUIRED(mutex) {
+      return in_flight < max_in_flight || write_failed;
+    }
+
+    const int max_in_flight;
+    absl::Mutex mutex;
+    int in_flight ABSL_GUARDED_BY(mutex) = 0;
+    bool write_failed ABSL_GUARDED_BY(mutex) = false;
+  };
+  auto state = std::make_shared<StreamState>(
+      std::max(absl::GetFlag(FLAGS_secure_lookup_stream_max_in_flight), 1));
+  auto write = [stream](StreamState& state,
+                        const SecureLookupStreamResponse& response) {
+    absl::MutexLock lock(&state.mutex);
+    if (!state.write_failed && !stream->Write(response)) {
+      state.write_failed = true;
+    }
+    return !state.write_failed;
+  };
+  grpc::Status status = grpc::Status::OK;
+  uint64_t last_id = 0;
+  while (true) {
+    if (pool != nullptr) {
+      absl::MutexLock lock(&state->mutex);
+      state->mutex.Await(
+          absl::Condition(state.get(), &StreamState::CanRead));
+      if (state->write_failed) {
+        break;
+      }
+    }
+    if (!stream->Read(&request)) {
+      break;
+    }
+    if (request.id() <= last_id) {
+      // Ids are the nonces of the session key, so a repeated id is either a
+      // broken client or a replay.
+      status = grpc::Status(StatusCode::INVALID_ARGUMENT,
+                            "Lookup ids must increase within a stream.");
+      break;
+    }
+    last_id = request.id();
+    if (pool == nullptr) {
+      if (!write(*state, LookupInStream(crypter, request))) {
+        break;
+      }
+      continue;
+    }
+    {
+      absl::MutexLock lock(&state->mutex);
+      if (state->write_failed) {
+        break;
+      }
+      ++state->in_flight;
+    }
+    pool->Schedule(
+        [this, &crypter, write, state, request = std::move(request)]() {
+          write(*state, LookupInStream(crypter, request));
+          absl::MutexLock lock(&state->mutex);
+          --state->in_flight;
+        });
+  }
+  absl::MutexLock lock(&state->mutex);
+  state->mutex.Await(absl::Condition(
+      +[](int* in_flight) { return *in_flight == 0; }, &state->in_flight));
+  return status;
+}
+
+SecureLookupStreamResponse LookupServiceImpl::LookupInStream(
+    const SessionCrypter& crypter,
+    const SecureLookupStreamRequest& request) const {
+  ScopeLatencyRecorder latency_recorder(std::string(kSecureLookup),
+                                        metrics_recorder_);
+  SecureLookupStreamResponse response;
+  response.set_id(request.id());
+  auto sealed_response_maybe = LookupSealed(crypter, request);
+  if (sealed_response_maybe.ok()) {
+    response.set_sealed_response(*std::move(sealed_response_maybe));
+  } else {
+    response.mutable_status()->set_code(
+        static_cast<int>(sealed_response_maybe.status().code()));
+    response.mutable_status()->set_message(
+        std::string(sealed_response_maybe.status().message()));
+  }
+  return response;
+}
+
+absl::StatusOr<std::string> LookupServiceImpl::LookupSealed(
+    const SessionCrypter& crypter,
+    const SecureLookupStreamRequest& request) const {
+  auto padded_serialized_request_maybe =
+      crypter.OpenRequest(request.id(), request.sealed_request());
+  if (!padded_serialized_request_maybe.ok()) {
+    metrics_recorder_.IncrementEventCounter(kDecryptionError);
+    return padded_serialized_request_maybe.status();
+  }
+  auto payload_maybe = GetPaddedPayload(*padded_serialized_request_maybe);
+  if (!payload_maybe.ok()) {
+    return payload_maybe.status();
+  }
+  auto sealed_response_maybe =
+      crypter.SealResponse(request.id(), *payload_maybe);
+  if (!sealed_response_maybe.ok()) {
+    metrics_recorder_.IncrementEventCounter(kEncryptionError);
+  }
+  return sealed_response_maybe;
+}
+
+absl::StatusOr<std::string> LookupServiceImpl::GetPaddedPayload(
+    std::string_view padded_serialized_request) const {
+  auto serialized_request_maybe = kv_server::Unpad(padded_serialized_request);
+  if (!serialized_request_maybe.ok()) {
+    metrics_recorder_.IncrementEventCounter(kDeserializationError);
+    metrics_recorder_.IncrementEventCounter(kUnpaddingError);
+    return serialized_request_maybe.status();
+  }
+
+  VLOG(9) << "SecureLookup unpadded";
+  // The request, and every key in it, only lives for the duration of this
+  // call.
+  google::protobuf::Arena arena;
+  auto* request =
+      google::protobuf::Arena::CreateMessage<InternalLookupRequest>(&arena);
+  if (!request->ParseFromString(*serialized_request_maybe)) {
+    return absl::InvalidArgumentError("Failed parsing incoming request");
+  }
+  if (request->sharding_function_version() !=
+      static_cast<int32_t>(sharding_function_version_)) {
+    metrics_recorder_.IncrementEventCounter(kShardingFunctionVersionMismatch);
+    return absl::FailedPreconditionError(absl::StrCat(
+        "The keys were sharded with sharding function version ",
+        request->sharding_function_version(), " instead of ",
+        static_cast<int32_t>(sharding_function_version_)));
+  }
+  return GetPayload(*request);
+}
+
 std::string LookupServiceImpl::GetPayload(
-    const bool lookup_sets, const RepeatedPtrField<std::string>& keys) const {
+    const InternalLookupRequest& request) const {
   InternalLookupResponse response;
-  if (lookup_sets) {
-    ProcessKeysetKeys(keys, response);
+  if (request.lookup_membership()) {
+    ProcessKeysetMembershipKeys(request.keys(), request.candidates(), response);
+  } else if (request.lookup_sketches()) {
+    ProcessKeysetSketchKeys(request.keys(), response);
+  } else if (request.lookup_sets()) {
+    ProcessKeysetKeys(request.keys(), response);
   } else {
-    ProcessKeys(keys, response);
+    ProcessKeys(request.keys(), response);
+  }
+  if (request.positional_results()) {
+    ToPositionalResults(request.keys(), response);
   }
   return response.SerializeAsString();
 }
@@ -159,7 +426,7 @@ grpc::Status LookupServiceImpl::InternalRunQuery(
     return grpc::Status(grpc::StatusCode::CANCELLED,
                         "Deadline exceeded or client cancelled, abandoning.");
   }
-  const auto process_result = lookup_.RunQuery(request->query());
+  auto process_result = lookup_.ExecuteQuery(*request);
   if (!process_result.ok()) {
     return ToInternalGrpcStatus(process_result.status(), kRunQueryError);
   }
@@ -167,4 +434,19 @@ grpc::Status LookupServiceImpl::InternalRunQuery(
   return grpc::Status::OK;
 }
 
+grpc::Status LookupServiceImpl::InternalRunQueries(
+    grpc::ServerContext* context, const InternalRunQueriesRequest* request,
+    InternalRunQueriesResponse* response) {
+  if (context->IsCancelled()) {
+    return grpc::Status(grpc::StatusCode::CANCELLED,
+                        "Deadline exceeded or client cancelled, abandoning.");
+  }
+  auto process_result = lookup_.RunQueries(*request);
+  if (!process_result.ok()) {
+    return ToInternalGrpcStatus(process_result.status(), kRunQueriesError);
+  }
+  *response = *std::move(process_result);
+  return grpc::Status::OK;
+}
+
 }  // namespace kv_server
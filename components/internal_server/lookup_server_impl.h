@@ -18,16 +18,22 @@
 #define COMPONENTS_INTERNAL_SERVER_LOOKUP_SERVER_IMPL_H_
 
 #include <string>
+#include <string_view>
 
+#include "absl/status/statusor.h"
 #include "components/internal_server/lookup.grpc.pb.h"
 #include "components/internal_server/lookup.h"
+#include "components/internal_server/session_crypter.h"
 #include "grpcpp/grpcpp.h"
+#include "public/sharding/sharding_function.h"
 #include "src/cpp/encryption/key_fetcher/interface/key_fetcher_manager_interface.h"
 #include "src/cpp/telemetry/metrics_recorder.h"
 #include "src/cpp/telemetry/telemetry.h"
 
 namespace kv_server {
-// Implements the internal lookup service for the data store.
+// Implements the internal lookup service for the data store. Secure lookups
+// whose keys were sharded with another version than
+// `sharding_function_version` are refused.
 class LookupServiceImpl final
     : public kv_server::InternalLookupService::Service {
  public:
@@ -35,10 +41,13 @@ class LookupServiceImpl final
       const Lookup& lookup,
       privacy_sandbox::server_common::KeyFetcherManagerInterface&
           key_fetcher_manager,
-      privacy_sandbox::server_common::MetricsRecorder& metrics_recorder)
+      privacy_sandbox::server_common::MetricsRecorder& metrics_recorder,
+      ShardingFunction::Version sharding_function_version =
+          ShardingFunction::Version::kSha256)
       : lookup_(lookup),
         key_fetcher_manager_(key_fetcher_manager),
-        metrics_recorder_(metrics_recorder) {}
+        metrics_recorder_(metrics_recorder),
+        sharding_function_version_(sharding_function_version) {}
 
   ~LookupServiceImpl() override = default;
 
@@ -51,26 +60,56 @@ class LookupServiceImpl final
                             const kv_server::SecureLookupRequest* request,
                             kv_server::SecureLookupResponse* response) override;
 
+  grpc::Status SecureLookupStream(
+      grpc::ServerContext* context,
+      grpc::ServerReaderWriter<kv_server::SecureLookupStreamResponse,
+                               kv_server::SecureLookupStreamRequest>* stream)
+      override;
+
   grpc::Status InternalRunQuery(
       grpc::ServerContext* context,
       const kv_server::InternalRunQueryRequest* request,
       kv_server::InternalRunQueryResponse* response) override;
 
+  grpc::Status InternalRunQueries(
+      grpc::ServerContext* context,
+      const kv_server::InternalRunQueriesRequest* request,
+      kv_server::InternalRunQueriesResponse* response) override;
+
  private:
-  std::string GetPayload(
-      const bool lookup_sets,
-      const google::protobuf::RepeatedPtrField<std::string>& keys) const;
+  std::string GetPayload(const InternalLookupRequest& request) const;
+  // Unpads and parses an InternalLookupRequest, and returns the serialized
+  // response to it.
+  absl::StatusOr<std::string> GetPaddedPayload(
+      std::string_view padded_serialized_request) const;
+  // Returns the response to a lookup of a `SecureLookupStream`, which carries
+  // either the sealed response or the error.
+  SecureLookupStreamResponse LookupInStream(
+      const SessionCrypter& crypter,
+      const SecureLookupStreamRequest& request) const;
+  // Returns the sealed response to a lookup of a `SecureLookupStream`.
+  absl::StatusOr<std::string> LookupSealed(
+      const SessionCrypter& crypter,
+      const SecureLookupStreamRequest& request) const;
   void ProcessKeys(const google::protobuf::RepeatedPtrField<std::string>& keys,
                    InternalLookupResponse& response) const;
   void ProcessKeysetKeys(
       const google::protobuf::RepeatedPtrField<std::string>& keys,
       InternalLookupResponse& response) const;
+  void ProcessKeysetSketchKeys(
+      const google::protobuf::RepeatedPtrField<std::string>& keys,
+      InternalLookupResponse& response) const;
+  void ProcessKeysetMembershipKeys(
+      const google::protobuf::RepeatedPtrField<std::string>& keys,
+      const google::protobuf::RepeatedPtrField<std::string>& candidates,
+      InternalLookupResponse& response) const;
   grpc::Status ToInternalGrpcStatus(const absl::Status& status,
                                     const char* eventName) const;
   const Lookup& lookup_;
   privacy_sandbox::server_common::KeyFetcherManagerInterface&
       key_fetcher_manager_;
   privacy_sandbox::server_common::MetricsRecorder& metrics_recorder_;
+  const ShardingFunction::Version sharding_function_version_;
 };
 
 }  // namespace kv_server
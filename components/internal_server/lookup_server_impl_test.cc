@@ -114,7 +114,7 @@ TEST_F(LookupServiceImplTest, InternalRunQuery_Success) {
   InternalRunQueryResponse expected;
   expected.add_elements("value1");
   expected.add_elements("value2");
-  EXPECT_CALL(mock_lookup_, RunQuery(_)).WillOnce(Return(expected));
+  EXPECT_CALL(mock_lookup_, ExecuteQuery(_)).WillOnce(Return(expected));
   InternalRunQueryResponse response;
   grpc::ClientContext context;
   grpc::Status status = stub_->InternalRunQuery(&context, request, &response);
@@ -126,7 +126,7 @@ TEST_F(LookupServiceImplTest, InternalRunQuery_Success) {
 TEST_F(LookupServiceImplTest, InternalRunQuery_LookupError_Failure) {
   InternalRunQueryRequest request;
   request.set_query("fail|||||now");
-  EXPECT_CALL(mock_lookup_, RunQuery(_))
+  EXPECT_CALL(mock_lookup_, ExecuteQuery(_))
       .WillOnce(Return(absl::UnknownError("Some error")));
   InternalRunQueryResponse response;
   grpc::ClientContext context;
@@ -135,6 +135,39 @@ TEST_F(LookupServiceImplTest, InternalRunQuery_LookupError_Failure) {
   EXPECT_EQ(status.error_code(), grpc::StatusCode::INTERNAL);
 }
 
+TEST_F(LookupServiceImplTest, InternalRunQueries_Success) {
+  InternalRunQueriesRequest request;
+  request.add_queries()->set_query("A");
+  request.add_queries()->set_query("A|");
+
+  InternalRunQueriesResponse expected;
+  TextFormat::ParseFromString(
+      R"pb(results { response { elements: "value1" } }
+           results { status { code: 3 message: "Parsing failure." } })pb",
+      &expected);
+  EXPECT_CALL(mock_lookup_, RunQueries(EqualsProto(request)))
+      .WillOnce(Return(expected));
+  InternalRunQueriesResponse response;
+  grpc::ClientContext context;
+  grpc::Status status =
+      stub_->InternalRunQueries(&context, request, &response);
+  EXPECT_TRUE(status.ok());
+  EXPECT_THAT(response, EqualsProto(expected));
+}
+
+TEST_F(LookupServiceImplTest, InternalRunQueries_LookupError_Failure) {
+  InternalRunQueriesRequest request;
+  request.add_queries()->set_query("A");
+  EXPECT_CALL(mock_lookup_, RunQueries(_))
+      .WillOnce(Return(absl::UnknownError("Some error")));
+  InternalRunQueriesResponse response;
+  grpc::ClientContext context;
+  grpc::Status status =
+      stub_->InternalRunQueries(&context, request, &response);
+
+  EXPECT_EQ(status.error_code(), grpc::StatusCode::INTERNAL);
+}
+
 TEST_F(LookupServiceImplTest, SecureLookupFailure) {
   SecureLookupRequest secure_lookup_request;
   secure_lookup_request.set_ohttp_request("garbage");
@@ -145,6 +178,31 @@ TEST_F(LookupServiceImplTest, SecureLookupFailure) {
   EXPECT_EQ(status.error_code(), grpc::StatusCode::INTERNAL);
 }
 
+TEST_F(LookupServiceImplTest, SecureLookupStreamWithoutSessionKeyFailure) {
+  grpc::ClientContext context;
+  auto stream = stub_->SecureLookupStream(&context);
+  SecureLookupStreamRequest request;
+  request.set_id(1);
+  request.set_sealed_request("garbage");
+  stream->Write(request);
+  stream->WritesDone();
+  SecureLookupStreamResponse response;
+  EXPECT_FALSE(stream->Read(&response));
+  EXPECT_EQ(stream->Finish().error_code(), grpc::StatusCode::INVALID_ARGUMENT);
+}
+
+TEST_F(LookupServiceImplTest, SecureLookupStreamInvalidSessionKeyFailure) {
+  grpc::ClientContext context;
+  auto stream = stub_->SecureLookupStream(&context);
+  SecureLookupStreamRequest request;
+  request.set_ohttp_session_key("garbage");
+  stream->Write(request);
+  stream->WritesDone();
+  SecureLookupStreamResponse response;
+  EXPECT_FALSE(stream->Read(&response));
+  EXPECT_EQ(stream->Finish().error_code(), grpc::StatusCode::INTERNAL);
+}
+
 }  // namespace
 
 }  // namespace kv_server
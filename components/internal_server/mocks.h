@@ -19,8 +19,10 @@
 
 #include <string>
 #include <string_view>
+#include <utility>
 #include <vector>
 
+#include "absl/functional/any_invocable.h"
 #include "absl/status/statusor.h"
 #include "components/internal_server/lookup.h"
 #include "components/internal_server/lookup.pb.h"
@@ -35,6 +37,15 @@ class MockRemoteLookupClient : public RemoteLookupClient {
   MOCK_METHOD(absl::StatusOr<InternalLookupResponse>, GetValues,
               (std::string_view serialized_message, int32_t padding_length),
               (const, override));
+  // Completes inline with the result of `GetValues`, so that expectations
+  // only need to be set on `GetValues`. The call can't be cancelled.
+  absl::AnyInvocable<void()> GetValuesAsync(
+      std::string_view serialized_message, int32_t padding_length,
+      absl::AnyInvocable<void(absl::StatusOr<InternalLookupResponse>) &&>
+          callback) const override {
+    std::move(callback)(GetValues(serialized_message, padding_length));
+    return [] {};
+  }
   MOCK_METHOD(std::string_view, GetIpAddress, (), (const, override));
 };
 
@@ -46,8 +57,18 @@ class MockLookup : public Lookup {
   MOCK_METHOD(absl::StatusOr<InternalLookupResponse>, GetKeyValueSet,
               (const absl::flat_hash_set<std::string_view>&),
               (const, override));
+  MOCK_METHOD(absl::StatusOr<InternalLookupResponse>, GetKeyValueSetSketches,
+              (const absl::flat_hash_set<std::string_view>&),
+              (const, override));
+  MOCK_METHOD(absl::StatusOr<InternalLookupResponse>, GetKeyValueSetMembership,
+              (std::string_view, absl::Span<const std::string_view>),
+              (const, override));
   MOCK_METHOD(absl::StatusOr<InternalRunQueryResponse>, RunQuery,
               (std::string query), (const, override));
+  MOCK_METHOD(absl::StatusOr<InternalRunQueryResponse>, ExecuteQuery,
+              (const InternalRunQueryRequest& request), (const, override));
+  MOCK_METHOD(absl::StatusOr<InternalRunQueriesResponse>, RunQueries,
+              (const InternalRunQueriesRequest& request), (const, override));
 };
 
 }  // namespace kv_server
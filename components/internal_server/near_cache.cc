@@ -0,0 +1,129 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "components/internal_server/near_cache.h"
+
+#include <algorithm>
+#include <optional>
+#include <string>
+#include <utility>
+
+#include "absl/log/check.h"
+#include "absl/status/status.h"
+
+namespace kv_server {
+namespace {
+
+// The kind is prepended to the key.
+std::string CacheKey(NearCache::Kind kind, std::string_view key) {
+  std::string cache_key(1, static_cast<char>(kind));
+  cache_key.append(key);
+  return cache_key;
+}
+
+bool IsCacheable(const SingleLookupResult& result) {
+  constexpr int kNotFound = static_cast<int>(absl::StatusCode::kNotFound);
+  return !result.has_status() || result.status().code() == kNotFound;
+}
+
+}  // namespace
+
+NearCache::NearCache(int64_t capacity, absl::Duration ttl)
+    : capacity_(capacity), ttl_(ttl) {
+  CHECK_GT(capacity, 0);
+  CHECK_GE(ttl, absl::ZeroDuration());
+}
+
+std::optional<SingleLookupResult> NearCache::Get(Kind kind,
+                                                 std::string_view key,
+                                                 absl::Time now) {
+  const std::string cache_key = CacheKey(kind, key);
+  absl::MutexLock lock(&mutex_);
+  const auto index_iter = index_.find(cache_key);
+  if (index_iter == index_.end()) {
+    return std::nullopt;
+  }
+  const auto entry = index_iter->second;
+  if (entry->expires_at <= now) {
+    Erase(cache_key);
+    return std::nullopt;
+  }
+  entries_.splice(entries_.begin(), entries_, entry);
+  return entry->result;
+}
+
+void NearCache::Put(Kind kind, std::string_view key,
+                    const SingleLookupResult& result, absl::Time fetched_at) {
+  if (!IsCacheable(result)) {
+    return;
+  }
+  std::string cache_key = CacheKey(kind, key);
+  absl::MutexLock lock(&mutex_);
+  if (fetched_at <= forgotten_until_) {
+    return;
+  }
+  if (const auto invalidation = last_invalidation_.find(key);
+      invalidation != last_invalidation_.end() &&
+      invalidation->second >= fetched_at) {
+    return;
+  }
+  Erase(cache_key);
+  entries_.push_front(Entry{std::move(cache_key), result, fetched_at + ttl_});
+  index_.emplace(entries_.front().cache_key, entries_.begin());
+  if (static_cast<int64_t>(entries_.size()) > capacity_) {
+    Erase(entries_.back().cache_key);
+  }
+}
+
+void NearCache::Invalidate(std::string_view key, absl::Time now) {
+  absl::MutexLock lock(&mutex_);
+  Erase(CacheKey(Kind::kValue, key));
+  Erase(CacheKey(Kind::kSet, key));
+  invalidations_.emplace_back(now, std::string(key));
+  // Invalidations may come from several threads out of order, so the latest
+  // time of the key is kept.
+  if (auto [invalidation, inserted] = last_invalidation_.try_emplace(key, now);
+      !inserted) {
+    invalidation->second = std::max(invalidation->second, now);
+  }
+  // Results looked up more than `ttl` ago are expired anyway. Beyond
+  // `capacity` invalidations, all results looked up before the forgotten ones
+  // are refused instead.
+  while (!invalidations_.empty() &&
+         (invalidations_.front().first + ttl_ < now ||
+          static_cast<int64_t>(invalidations_.size()) > capacity_)) {
+    auto& [time, invalidated_key] = invalidations_.front();
+    forgotten_until_ = std::max(forgotten_until_, time);
+    // The key may have been invalidated several times at the same time, in
+    // which case the first of them already erased it.
+    if (const auto invalidation = last_invalidation_.find(invalidated_key);
+        invalidation != last_invalidation_.end() &&
+        invalidation->second == time) {
+      last_invalidation_.erase(invalidation);
+    }
+    invalidations_.pop_front();
+  }
+}
+
+void NearCache::Erase(std::string_view cache_key) {
+  const auto index_iter = index_.find(cache_key);
+  if (index_iter == index_.end()) {
+    return;
+  }
+  const auto entry = index_iter->second;
+  index_.erase(index_iter);
+  entries_.erase(entry);
+}
+
+}  // namespace kv_server
@@ -0,0 +1,92 @@
+/*
+ * Copyright 2023 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef COMPONENTS_INTERNAL_SERVER_NEAR_CACHE_H_
+#define COMPONENTS_INTERNAL_SERVER_NEAR_CACHE_H_
+
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "components/internal_server/lookup.pb.h"
+
+namespace kv_server {
+
+// Caches the results that the front-end looked up on remote shards, so that
+// hot keys aren't fetched over the network for every request. Entries expire
+// `ttl` after they were fetched, and the least recently used ones are evicted
+// beyond `capacity` entries. As the front-end sees the mutations of the keys
+// of other shards that are dropped from its deltas and realtime updates, the
+// entries of a mutated key are invalidated right away. Thread safe.
+class NearCache {
+ public:
+  // What is cached for a key.
+  enum class Kind : char { kValue = 'v', kSet = 's' };
+
+  // `capacity` must be positive and `ttl` must not be negative.
+  NearCache(int64_t capacity, absl::Duration ttl);
+
+  // Returns the cached result of `key`, if there is one that hasn't expired
+  // at `now`.
+  std::optional<SingleLookupResult> Get(Kind kind, std::string_view key,
+                                        absl::Time now);
+
+  // Caches `result`, which was looked up at `fetched_at`, unless `key` was
+  // invalidated since. Only values, sets and `NotFound` statuses are cached.
+  void Put(Kind kind, std::string_view key, const SingleLookupResult& result,
+           absl::Time fetched_at);
+
+  // Drops the results of `key`, and keeps results looked up before `now` from
+  // being cached.
+  void Invalidate(std::string_view key, absl::Time now);
+
+ private:
+  struct Entry {
+    std::string cache_key;
+    SingleLookupResult result;
+    absl::Time expires_at;
+  };
+
+  void Erase(std::string_view cache_key) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  const int64_t capacity_;
+  const absl::Duration ttl_;
+  absl::Mutex mutex_;
+  // Most recently used first.
+  std::list<Entry> entries_ ABSL_GUARDED_BY(mutex_);
+  absl::flat_hash_map<std::string_view, std::list<Entry>::iterator> index_
+      ABSL_GUARDED_BY(mutex_);
+  // The latest invalidations, in order, at most `capacity` of them and none
+  // older than `ttl`.
+  std::deque<std::pair<absl::Time, std::string>> invalidations_
+      ABSL_GUARDED_BY(mutex_);
+  absl::flat_hash_map<std::string, absl::Time> last_invalidation_
+      ABSL_GUARDED_BY(mutex_);
+  // Time of the latest invalidation that was dropped from `invalidations_`.
+  absl::Time forgotten_until_ ABSL_GUARDED_BY(mutex_) = absl::InfinitePast();
+};
+
+}  // namespace kv_server
+
+#endif  // COMPONENTS_INTERNAL_SERVER_NEAR_CACHE_H_
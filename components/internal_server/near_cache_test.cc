@@ -0,0 +1,142 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "components/internal_server/near_cache.h"
+
+#include "absl/status/status.h"
+#include "gtest/gtest.h"
+
+namespace kv_server {
+namespace {
+
+constexpr absl::Duration kTtl = absl::Seconds(10);
+
+SingleLookupResult Value(std::string value) {
+  SingleLookupResult result;
+  result.set_value(std::move(value));
+  return result;
+}
+
+TEST(NearCacheTest, ReturnsCachedResult) {
+  NearCache near_cache(/*capacity=*/10, kTtl);
+  const absl::Time now = absl::Now();
+  EXPECT_FALSE(near_cache.Get(NearCache::Kind::kValue, "key", now));
+  near_cache.Put(NearCache::Kind::kValue, "key", Value("value"), now);
+  auto result = near_cache.Get(NearCache::Kind::kValue, "key", now);
+  ASSERT_TRUE(result);
+  EXPECT_EQ(result->value(), "value");
+  EXPECT_FALSE(near_cache.Get(NearCache::Kind::kSet, "key", now));
+}
+
+TEST(NearCacheTest, CachesNotFoundButNotErrors) {
+  NearCache near_cache(/*capacity=*/10, kTtl);
+  const absl::Time now = absl::Now();
+  SingleLookupResult not_found;
+  not_found.mutable_status()->set_code(
+      static_cast<int>(absl::StatusCode::kNotFound));
+  near_cache.Put(NearCache::Kind::kValue, "missing", not_found, now);
+  SingleLookupResult error;
+  error.mutable_status()->set_code(
+      static_cast<int>(absl::StatusCode::kInternal));
+  near_cache.Put(NearCache::Kind::kValue, "failed", error, now);
+  EXPECT_TRUE(near_cache.Get(NearCache::Kind::kValue, "missing", now));
+  EXPECT_FALSE(near_cache.Get(NearCache::Kind::kValue, "failed", now));
+}
+
+TEST(NearCacheTest, ExpiresAfterTtl) {
+  NearCache near_cache(/*capacity=*/10, kTtl);
+  const absl::Time now = absl::Now();
+  near_cache.Put(NearCache::Kind::kValue, "key", Value("value"), now);
+  EXPECT_TRUE(near_cache.Get(NearCache::Kind::kValue, "key", now + kTtl / 2));
+  EXPECT_FALSE(near_cache.Get(NearCache::Kind::kValue, "key", now + kTtl));
+}
+
+TEST(NearCacheTest, EvictsLeastRecentlyUsed) {
+  NearCache near_cache(/*capacity=*/2, kTtl);
+  const absl::Time now = absl::Now();
+  near_cache.Put(NearCache::Kind::kValue, "key1", Value("value1"), now);
+  near_cache.Put(NearCache::Kind::kValue, "key2", Value("value2"), now);
+  EXPECT_TRUE(near_cache.Get(NearCache::Kind::kValue, "key1", now));
+  near_cache.Put(NearCache::Kind::kValue, "key3", Value("value3"), now);
+  EXPECT_TRUE(near_cache.Get(NearCache::Kind::kValue, "key1", now));
+  EXPECT_FALSE(near_cache.Get(NearCache::Kind::kValue, "key2", now));
+  EXPECT_TRUE(near_cache.Get(NearCache::Kind::kValue, "key3", now));
+}
+
+TEST(NearCacheTest, InvalidateDropsAllKinds) {
+  NearCache near_cache(/*capacity=*/10, kTtl);
+  const absl::Time now = absl::Now();
+  near_cache.Put(NearCache::Kind::kValue, "key", Value("value"), now);
+  SingleLookupResult set;
+  set.mutable_keyset_values()->add_values("element");
+  near_cache.Put(NearCache::Kind::kSet, "key", set, now);
+  near_cache.Invalidate("key", now);
+  EXPECT_FALSE(near_cache.Get(NearCache::Kind::kValue, "key", now));
+  EXPECT_FALSE(near_cache.Get(NearCache::Kind::kSet, "key", now));
+}
+
+TEST(NearCacheTest, DropsResultsFetchedBeforeInvalidation) {
+  NearCache near_cache(/*capacity=*/10, kTtl);
+  const absl::Time now = absl::Now();
+  near_cache.Invalidate("key", now);
+  near_cache.Put(NearCache::Kind::kValue, "key", Value("stale"),
+                 now - absl::Milliseconds(1));
+  EXPECT_FALSE(near_cache.Get(NearCache::Kind::kValue, "key", now));
+  near_cache.Put(NearCache::Kind::kValue, "key", Value("fresh"),
+                 now + absl::Milliseconds(1));
+  EXPECT_TRUE(near_cache.Get(NearCache::Kind::kValue, "key", now));
+}
+
+TEST(NearCacheTest, RefusesResultsOlderThanForgottenInvalidations) {
+  NearCache near_cache(/*capacity=*/1, kTtl);
+  const absl::Time now = absl::Now();
+  near_cache.Invalidate("key1", now);
+  near_cache.Invalidate("key2", now + absl::Milliseconds(1));
+  near_cache.Put(NearCache::Kind::kValue, "key3", Value("value3"), now);
+  EXPECT_FALSE(near_cache.Get(NearCache::Kind::kValue, "key3", now));
+}
+
+TEST(NearCacheTest, ForgetsInvalidationsWithZeroTtl) {
+  NearCache near_cache(/*capacity=*/10, absl::ZeroDuration());
+  const absl::Time now = absl::Now();
+  near_cache.Invalidate("key1", now);
+  near_cache.Invalidate("key2", now + absl::Seconds(1));
+  near_cache.Put(NearCache::Kind::kValue, "key1", Value("value1"),
+                 now + absl::Seconds(1));
+  EXPECT_TRUE(near_cache.Get(NearCache::Kind::kValue, "key1", now));
+}
+
+TEST(NearCacheTest, ForgetsKeyInvalidatedTwiceAtTheSameTime) {
+  NearCache near_cache(/*capacity=*/1, kTtl);
+  const absl::Time now = absl::Now();
+  near_cache.Invalidate("key", now);
+  near_cache.Invalidate("key", now);
+  near_cache.Invalidate("other", now + absl::Milliseconds(1));
+  near_cache.Put(NearCache::Kind::kValue, "key", Value("value"),
+                 now + absl::Milliseconds(2));
+  EXPECT_TRUE(near_cache.Get(NearCache::Kind::kValue, "key", now));
+}
+
+TEST(NearCacheTest, KeepsLatestInvalidationOfKey) {
+  NearCache near_cache(/*capacity=*/10, kTtl);
+  const absl::Time now = absl::Now();
+  near_cache.Invalidate("key", now);
+  near_cache.Invalidate("key", now - absl::Milliseconds(2));
+  near_cache.Put(NearCache::Kind::kValue, "key", Value("stale"),
+                 now - absl::Milliseconds(1));
+  EXPECT_FALSE(near_cache.Get(NearCache::Kind::kValue, "key", now));
+}
+
+}  // namespace
+}  // namespace kv_server
@@ -0,0 +1,111 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "components/internal_server/padding_policy.h"
+
+#include <algorithm>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_join.h"
+#include "absl/strings/str_split.h"
+
+namespace kv_server {
+namespace {
+
+constexpr int64_t kMaxPaddedSize = std::numeric_limits<int32_t>::max();
+
+}  // namespace
+
+PaddingPolicy PaddingPolicy::PowersOfTwo() {
+  PaddingPolicy policy;
+  policy.mode_ = Mode::kPowersOfTwo;
+  return policy;
+}
+
+PaddingPolicy PaddingPolicy::Tiers(std::vector<int32_t> tiers) {
+  PaddingPolicy policy;
+  policy.mode_ = Mode::kTiers;
+  policy.tiers_ = std::move(tiers);
+  return policy;
+}
+
+int32_t PaddingPolicy::GetPaddedSize(int32_t max_size) const {
+  int64_t padded_size = max_size;
+  switch (mode_) {
+    case Mode::kMax:
+      return max_size;
+    case Mode::kPowersOfTwo:
+      padded_size = 1;
+      while (padded_size < max_size) {
+        padded_size <<= 1;
+      }
+      break;
+    case Mode::kTiers: {
+      const auto tier =
+          std::lower_bound(tiers_.begin(), tiers_.end(), max_size);
+      if (tier != tiers_.end()) {
+        return *tier;
+      }
+      const int64_t last_tier = tiers_.back();
+      padded_size = (max_size + last_tier - 1) / last_tier * last_tier;
+      break;
+    }
+  }
+  // Sizes that don't fit a bucket are sent as they are.
+  return padded_size > kMaxPaddedSize ? max_size : padded_size;
+}
+
+bool AbslParseFlag(absl::string_view text, PaddingPolicy* policy,
+                   std::string* error) {
+  if (text == "max") {
+    *policy = PaddingPolicy();
+    return true;
+  }
+  if (text == "pow2") {
+    *policy = PaddingPolicy::PowersOfTwo();
+    return true;
+  }
+  std::vector<int32_t> tiers;
+  for (absl::string_view tier_text : absl::StrSplit(text, ',')) {
+    int32_t tier;
+    if (!absl::SimpleAtoi(tier_text, &tier) || tier <= 0) {
+      *error = "expected 'max', 'pow2' or a list of positive sizes";
+      return false;
+    }
+    if (!tiers.empty() && tier <= tiers.back()) {
+      *error = "sizes must be increasing";
+      return false;
+    }
+    tiers.push_back(tier);
+  }
+  *policy = PaddingPolicy::Tiers(std::move(tiers));
+  return true;
+}
+
+std::string AbslUnparseFlag(const PaddingPolicy& policy) {
+  switch (policy.mode_) {
+    case PaddingPolicy::Mode::kMax:
+      return "max";
+    case PaddingPolicy::Mode::kPowersOfTwo:
+      return "pow2";
+    case PaddingPolicy::Mode::kTiers:
+      return absl::StrJoin(policy.tiers_, ",");
+  }
+  return "max";
+}
+
+}  // namespace kv_server
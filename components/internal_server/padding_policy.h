@@ -0,0 +1,64 @@
+/*
+ * Copyright 2023 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef COMPONENTS_INTERNAL_SERVER_PADDING_POLICY_H_
+#define COMPONENTS_INTERNAL_SERVER_PADDING_POLICY_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+
+namespace kv_server {
+
+// Picks the size that every request of one lookup is padded to before it is
+// sent to the shards, so that the sizes on the wire don't reveal how the keys
+// are spread over the shards. Bucketed sizes also hide the exact size of the
+// largest request, and bound the number of distinct sizes on the wire.
+class PaddingPolicy {
+ public:
+  // Pads to the size of the largest request.
+  PaddingPolicy() = default;
+
+  // Pads to the smallest power of two that fits the largest request.
+  static PaddingPolicy PowersOfTwo();
+
+  // Pads to the smallest of `tiers` that fits the largest request, or to the
+  // smallest multiple of the last tier that does if none does. `tiers` must be
+  // non-empty, positive and increasing.
+  static PaddingPolicy Tiers(std::vector<int32_t> tiers);
+
+  // Returns the size to pad every request to, given the size of the largest
+  // one. Never less than `max_size`.
+  int32_t GetPaddedSize(int32_t max_size) const;
+
+  // Parses "max", "pow2" or a comma separated list of tiers, e.g.
+  // "1024,4096,16384".
+  friend bool AbslParseFlag(absl::string_view text, PaddingPolicy* policy,
+                            std::string* error);
+  friend std::string AbslUnparseFlag(const PaddingPolicy& policy);
+
+ private:
+  enum class Mode { kMax, kPowersOfTwo, kTiers };
+
+  Mode mode_ = Mode::kMax;
+  std::vector<int32_t> tiers_;
+};
+
+}  // namespace kv_server
+
+#endif  // COMPONENTS_INTERNAL_SERVER_PADDING_POLICY_H_
@@ -0,0 +1,82 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "components/internal_server/padding_policy.h"
+
+#include <limits>
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace kv_server {
+namespace {
+
+TEST(PaddingPolicyTest, MaxPadsToLargestRequest) {
+  PaddingPolicy policy;
+  EXPECT_EQ(policy.GetPaddedSize(0), 0);
+  EXPECT_EQ(policy.GetPaddedSize(123), 123);
+}
+
+TEST(PaddingPolicyTest, PowersOfTwo) {
+  const PaddingPolicy policy = PaddingPolicy::PowersOfTwo();
+  EXPECT_EQ(policy.GetPaddedSize(0), 1);
+  EXPECT_EQ(policy.GetPaddedSize(1), 1);
+  EXPECT_EQ(policy.GetPaddedSize(24), 32);
+  EXPECT_EQ(policy.GetPaddedSize(32), 32);
+  EXPECT_EQ(policy.GetPaddedSize(33), 64);
+  EXPECT_EQ(policy.GetPaddedSize(1 << 30), 1 << 30);
+  // There is no larger power of two that fits an int32_t.
+  EXPECT_EQ(policy.GetPaddedSize((1 << 30) + 1), (1 << 30) + 1);
+}
+
+TEST(PaddingPolicyTest, Tiers) {
+  const PaddingPolicy policy = PaddingPolicy::Tiers({100, 1000, 5000});
+  EXPECT_EQ(policy.GetPaddedSize(1), 100);
+  EXPECT_EQ(policy.GetPaddedSize(100), 100);
+  EXPECT_EQ(policy.GetPaddedSize(101), 1000);
+  EXPECT_EQ(policy.GetPaddedSize(5000), 5000);
+  EXPECT_EQ(policy.GetPaddedSize(5001), 10000);
+  EXPECT_EQ(policy.GetPaddedSize(12345), 15000);
+  EXPECT_EQ(policy.GetPaddedSize(std::numeric_limits<int32_t>::max()),
+            std::numeric_limits<int32_t>::max());
+}
+
+TEST(PaddingPolicyTest, ParseAndUnparse) {
+  PaddingPolicy policy = PaddingPolicy::PowersOfTwo();
+  std::string error;
+  ASSERT_TRUE(AbslParseFlag("max", &policy, &error));
+  EXPECT_EQ(AbslUnparseFlag(policy), "max");
+  EXPECT_EQ(policy.GetPaddedSize(24), 24);
+
+  ASSERT_TRUE(AbslParseFlag("pow2", &policy, &error));
+  EXPECT_EQ(AbslUnparseFlag(policy), "pow2");
+  EXPECT_EQ(policy.GetPaddedSize(24), 32);
+
+  ASSERT_TRUE(AbslParseFlag("16,64", &policy, &error));
+  EXPECT_EQ(AbslUnparseFlag(policy), "16,64");
+  EXPECT_EQ(policy.GetPaddedSize(24), 64);
+}
+
+TEST(PaddingPolicyTest, ParseInvalidFails) {
+  PaddingPolicy policy;
+  std::string error;
+  EXPECT_FALSE(AbslParseFlag("", &policy, &error));
+  EXPECT_FALSE(AbslParseFlag("pow3", &policy, &error));
+  EXPECT_FALSE(AbslParseFlag("16,0", &policy, &error));
+  EXPECT_FALSE(AbslParseFlag("64,16", &policy, &error));
+  EXPECT_FALSE(AbslParseFlag("16,16", &policy, &error));
+}
+
+}  // namespace
+}  // namespace kv_server
@@ -0,0 +1,144 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "components/internal_server/query_result_cache.h"
+
+#include <iterator>
+#include <list>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_set.h"
+#include "absl/synchronization/mutex.h"
+#include "components/data_server/cache/cache.h"
+#include "components/internal_server/lookup.pb.h"
+#include "src/cpp/telemetry/metrics_recorder.h"
+
+namespace kv_server {
+namespace {
+
+using privacy_sandbox::server_common::MetricsRecorder;
+
+constexpr char kQueryResultCacheHit[] = "QueryResultCacheHit";
+constexpr char kQueryResultCacheMiss[] = "QueryResultCacheMiss";
+constexpr char kQueryResultCacheInvalidated[] = "QueryResultCacheInvalidated";
+constexpr char kQueryResultCacheBytesUsed[] = "QueryResultCacheBytesUsed";
+
+// The units below are bytes.
+const std::vector<double> kBytesUsedBucketBoundaries = {
+    1'000,       10'000,      100'000,       1'000'000,     10'000'000,
+    100'000'000, 500'000'000, 1'000'000'000, 4'000'000'000, 16'000'000'000};
+
+}  // namespace
+
+QueryResultCache::QueryResultCache(const Cache& cache, int64_t max_bytes,
+                                   MetricsRecorder& metrics_recorder)
+    : cache_(cache),
+      max_bytes_(max_bytes),
+      metrics_recorder_(metrics_recorder) {
+  metrics_recorder_.RegisterHistogram(kQueryResultCacheBytesUsed,
+                                      "Size of the cached query results",
+                                      "byte", kBytesUsedBucketBoundaries);
+}
+
+std::optional<InternalRunQueryResponse> QueryResultCache::Get(
+    const InternalRunQueryRequest& request) {
+  const std::string serialized_request = request.SerializeAsString();
+  int64_t stale_version;
+  {
+    absl::ReaderMutexLock lock(&mutex_);
+    const auto index_itr = index_.find(serialized_request);
+    if (index_itr == index_.end()) {
+      metrics_recorder_.IncrementEventCounter(kQueryResultCacheMiss);
+      return std::nullopt;
+    }
+    const Entry& entry = *index_itr->second;
+    const absl::flat_hash_set<std::string_view> keys(entry.keys.begin(),
+                                                     entry.keys.end());
+    if (cache_.GetKeyValueSetVersion(keys) == entry.version) {
+      metrics_recorder_.IncrementEventCounter(kQueryResultCacheHit);
+      entry.used.store(true, std::memory_order_relaxed);
+      return entry.response;
+    }
+    stale_version = entry.version;
+  }
+  metrics_recorder_.IncrementEventCounter(kQueryResultCacheInvalidated);
+  metrics_recorder_.IncrementEventCounter(kQueryResultCacheMiss);
+  absl::MutexLock lock(&mutex_);
+  // Unless the entry was replaced by a newer one meanwhile.
+  if (const auto index_itr = index_.find(serialized_request);
+      index_itr != index_.end() &&
+      index_itr->second->version == stale_version) {
+    Erase(index_itr->second);
+  }
+  return std::nullopt;
+}
+
+void QueryResultCache::Put(const InternalRunQueryRequest& request,
+                           const absl::flat_hash_set<std::string_view>& keys,
+                           int64_t version,
+                           const InternalRunQueryResponse& response) {
+  std::string serialized_request = request.SerializeAsString();
+  int64_t bytes = serialized_request.size() + response.ByteSizeLong();
+  for (const auto& key : keys) {
+    bytes += key.size();
+  }
+  if (bytes > max_bytes_) {
+    return;
+  }
+  absl::MutexLock lock(&mutex_);
+  if (const auto index_itr = index_.find(serialized_request);
+      index_itr != index_.end()) {
+    // Keep the response computed from the most recent sets.
+    if (index_itr->second->version >= version) {
+      return;
+    }
+    Erase(index_itr->second);
+  }
+  while (bytes_used_ + bytes > max_bytes_) {
+    const auto last = std::prev(entries_.end());
+    if (last->used.exchange(false, std::memory_order_relaxed)) {
+      entries_.splice(entries_.begin(), entries_, last);
+      continue;
+    }
+    Erase(last);
+  }
+  bytes_used_ += bytes;
+  // Entries are not movable, so they are constructed in place.
+  Entry& entry = entries_.emplace_front();
+  entry.request = std::move(serialized_request);
+  entry.keys.assign(keys.begin(), keys.end());
+  entry.version = version;
+  entry.response = response;
+  entry.bytes = bytes;
+  index_.emplace(entry.request, entries_.begin());
+  metrics_recorder_.RecordHistogramEvent(kQueryResultCacheBytesUsed,
+                                         bytes_used_);
+}
+
+int64_t QueryResultCache::GetBytesUsed() const {
+  absl::ReaderMutexLock lock(&mutex_);
+  return bytes_used_;
+}
+
+void QueryResultCache::Erase(std::list<Entry>::iterator entry) {
+  bytes_used_ -= entry->bytes;
+  index_.erase(entry->request);
+  entries_.erase(entry);
+}
+
+}  // namespace kv_server
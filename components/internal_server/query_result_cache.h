@@ -0,0 +1,92 @@
+/*
+ * Copyright 2023 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef COMPONENTS_INTERNAL_SERVER_QUERY_RESULT_CACHE_H_
+#define COMPONENTS_INTERNAL_SERVER_QUERY_RESULT_CACHE_H_
+
+#include <atomic>
+#include <list>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/synchronization/mutex.h"
+#include "components/data_server/cache/cache.h"
+#include "components/internal_server/lookup.pb.h"
+#include "src/cpp/telemetry/metrics_recorder.h"
+
+namespace kv_server {
+
+// Cache of query responses, bounded by the size of the cached entries. Each
+// entry records the keys of the sets its response was computed from and their
+// version in `cache`, and is dropped on the first lookup after any of those
+// sets changed. Lookups only take a reader lock, so entries are evicted in
+// approximately least recently used order: an entry that was returned since
+// it was last considered for eviction is kept once more.
+class QueryResultCache {
+ public:
+  QueryResultCache(
+      const Cache& cache, int64_t max_bytes,
+      privacy_sandbox::server_common::MetricsRecorder& metrics_recorder);
+
+  // Returns the cached response to `request`, if the sets it was computed
+  // from have not changed since.
+  std::optional<InternalRunQueryResponse> Get(
+      const InternalRunQueryRequest& request);
+
+  // Caches `response` to `request`, computed from the sets of `keys`.
+  // `version` is the version of those sets, read before the sets were.
+  void Put(const InternalRunQueryRequest& request,
+           const absl::flat_hash_set<std::string_view>& keys, int64_t version,
+           const InternalRunQueryResponse& response);
+
+  // Returns the size of the cached entries.
+  int64_t GetBytesUsed() const;
+
+ private:
+  struct Entry {
+    std::string request;
+    std::vector<std::string> keys;
+    int64_t version;
+    InternalRunQueryResponse response;
+    int64_t bytes;
+    // Whether the entry was returned since it was last considered for
+    // eviction. Set under the reader lock.
+    mutable std::atomic<bool> used = false;
+  };
+
+  // Removes the entry and updates the size of the cache.
+  void Erase(std::list<Entry>::iterator entry)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  const Cache& cache_;
+  const int64_t max_bytes_;
+  privacy_sandbox::server_common::MetricsRecorder& metrics_recorder_;
+  mutable absl::Mutex mutex_;
+  // Entries from the most to the least recently used.
+  std::list<Entry> entries_ ABSL_GUARDED_BY(mutex_);
+  // Mapping from a serialized request to its entry.
+  absl::flat_hash_map<std::string_view, std::list<Entry>::iterator> index_
+      ABSL_GUARDED_BY(mutex_);
+  int64_t bytes_used_ ABSL_GUARDED_BY(mutex_) = 0;
+};
+
+}  // namespace kv_server
+
+#endif  // COMPONENTS_INTERNAL_SERVER_QUERY_RESULT_CACHE_H_
@@ -0,0 +1,128 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "components/internal_server/query_result_cache.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "components/data_server/cache/mocks.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "public/test_util/proto_matcher.h"
+#include "src/cpp/telemetry/mocks.h"
+
+namespace kv_server {
+namespace {
+
+using privacy_sandbox::server_common::MockMetricsRecorder;
+using testing::_;
+using testing::Optional;
+using testing::Return;
+
+InternalRunQueryRequest MakeRequest(std::string query) {
+  InternalRunQueryRequest request;
+  request.set_query(std::move(query));
+  return request;
+}
+
+InternalRunQueryResponse MakeResponse(std::string element) {
+  InternalRunQueryResponse response;
+  response.add_elements(std::move(element));
+  return response;
+}
+
+class QueryResultCacheTest : public ::testing::Test {
+ protected:
+  MockCache mock_cache_;
+  MockMetricsRecorder mock_metrics_recorder_;
+};
+
+TEST_F(QueryResultCacheTest, ReturnsCachedResponse) {
+  EXPECT_CALL(mock_cache_, GetKeyValueSetVersion(_)).WillOnce(Return(1));
+  QueryResultCache cache(mock_cache_, 1000, mock_metrics_recorder_);
+  EXPECT_FALSE(cache.Get(MakeRequest("A & B")).has_value());
+
+  cache.Put(MakeRequest("A & B"), {"A", "B"}, 1, MakeResponse("a"));
+  EXPECT_THAT(cache.Get(MakeRequest("A & B")),
+              Optional(EqualsProto(MakeResponse("a"))));
+  EXPECT_FALSE(cache.Get(MakeRequest("A | B")).has_value());
+}
+
+TEST_F(QueryResultCacheTest, DropsResponseWhenSetsChange) {
+  EXPECT_CALL(mock_cache_, GetKeyValueSetVersion(_)).WillOnce(Return(2));
+  QueryResultCache cache(mock_cache_, 1000, mock_metrics_recorder_);
+  cache.Put(MakeRequest("A & B"), {"A", "B"}, 1, MakeResponse("a"));
+  EXPECT_FALSE(cache.Get(MakeRequest("A & B")).has_value());
+  EXPECT_EQ(cache.GetBytesUsed(), 0);
+  EXPECT_FALSE(cache.Get(MakeRequest("A & B")).has_value());
+}
+
+TEST_F(QueryResultCacheTest, KeepsResponseFromNewerSets) {
+  EXPECT_CALL(mock_cache_, GetKeyValueSetVersion(_)).WillOnce(Return(2));
+  QueryResultCache cache(mock_cache_, 1000, mock_metrics_recorder_);
+  cache.Put(MakeRequest("A"), {"A"}, 2, MakeResponse("new"));
+  cache.Put(MakeRequest("A"), {"A"}, 1, MakeResponse("old"));
+  EXPECT_THAT(cache.Get(MakeRequest("A")),
+              Optional(EqualsProto(MakeResponse("new"))));
+}
+
+TEST_F(QueryResultCacheTest, EvictsLeastRecentlyUsedResponses) {
+  EXPECT_CALL(mock_cache_, GetKeyValueSetVersion(_))
+      .WillRepeatedly(Return(1));
+  const int64_t entry_bytes =
+      MakeRequest("A").ByteSizeLong() + MakeResponse("a").ByteSizeLong() + 1;
+  QueryResultCache cache(mock_cache_, 2 * entry_bytes, mock_metrics_recorder_);
+  cache.Put(MakeRequest("A"), {"A"}, 1, MakeResponse("a"));
+  cache.Put(MakeRequest("B"), {"B"}, 1, MakeResponse("b"));
+  EXPECT_EQ(cache.GetBytesUsed(), 2 * entry_bytes);
+  // Use A, so that B is evicted first.
+  EXPECT_TRUE(cache.Get(MakeRequest("A")).has_value());
+  cache.Put(MakeRequest("C"), {"C"}, 1, MakeResponse("c"));
+  EXPECT_EQ(cache.GetBytesUsed(), 2 * entry_bytes);
+  EXPECT_FALSE(cache.Get(MakeRequest("B")).has_value());
+  EXPECT_TRUE(cache.Get(MakeRequest("A")).has_value());
+  EXPECT_TRUE(cache.Get(MakeRequest("C")).has_value());
+}
+
+TEST_F(QueryResultCacheTest, ConcurrentGetsReturnCachedResponse) {
+  EXPECT_CALL(mock_cache_, GetKeyValueSetVersion(_))
+      .WillRepeatedly(Return(1));
+  QueryResultCache cache(mock_cache_, 1000, mock_metrics_recorder_);
+  cache.Put(MakeRequest("A"), {"A"}, 1, MakeResponse("a"));
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 8; i++) {
+    threads.emplace_back([&cache]() {
+      for (int j = 0; j < 100; j++) {
+        EXPECT_THAT(cache.Get(MakeRequest("A")),
+                    Optional(EqualsProto(MakeResponse("a"))));
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+TEST_F(QueryResultCacheTest, DoesNotCacheResponseLargerThanCache) {
+  QueryResultCache cache(mock_cache_, 10, mock_metrics_recorder_);
+  cache.Put(MakeRequest("A"), {"A"}, 1,
+            MakeResponse("a response larger than the cache"));
+  EXPECT_EQ(cache.GetBytesUsed(), 0);
+  EXPECT_FALSE(cache.Get(MakeRequest("A")).has_value());
+}
+
+}  // namespace
+}  // namespace kv_server
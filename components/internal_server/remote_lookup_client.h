@@ -21,12 +21,17 @@
 #include <string>
 #include <vector>
 
+#include "absl/flags/declare.h"
+#include "absl/functional/any_invocable.h"
 #include "absl/status/statusor.h"
+#include "absl/time/time.h"
 #include "components/internal_server/lookup.grpc.pb.h"
 #include "src/cpp/encryption/key_fetcher/interface/key_fetcher_manager_interface.h"
 #include "src/cpp/telemetry/metrics_recorder.h"
 #include "src/cpp/telemetry/telemetry.h"
 
+ABSL_DECLARE_FLAG(absl::Duration, shard_lookup_timeout);
+
 namespace kv_server {
 
 class RemoteLookupClient {
@@ -39,6 +44,16 @@ class RemoteLookupClient {
   // with preventing double serialization.
   virtual absl::StatusOr<InternalLookupResponse> GetValues(
       std::string_view serialized_message, int32_t padding_length) const = 0;
+  // Same as `GetValues`, but returns as soon as the request is sent. Once the
+  // response arrives, `callback` is called with it on a gRPC thread, so no
+  // thread is blocked while the request is in flight. The client must outlive
+  // the call. Returns a function that cancels the call, in which case
+  // `callback` is called with a cancelled status unless the response already
+  // arrived. It may be called at any time, also after the call completed.
+  virtual absl::AnyInvocable<void()> GetValuesAsync(
+      std::string_view serialized_message, int32_t padding_length,
+      absl::AnyInvocable<void(absl::StatusOr<InternalLookupResponse>) &&>
+          callback) const = 0;
   virtual std::string_view GetIpAddress() const = 0;
   static std::unique_ptr<RemoteLookupClient> Create(
       std::string ip_address,
@@ -11,30 +11,339 @@
 // WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 // See the License for the specific language governing permissions and
 // limitations under the License.
+#include <atomic>
+#include <deque>
+#include <future>
 #include <memory>
+#include <optional>
 #include <string>
+#include <utility>
 
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/flags/flag.h"
+#include "absl/functional/any_invocable.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/str_format.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
 #include "components/data_server/request_handler/ohttp_client_encryptor.h"
 #include "components/internal_server/constants.h"
 #include "components/internal_server/lookup.grpc.pb.h"
 #include "components/internal_server/remote_lookup_client.h"
+#include "components/internal_server/session_crypter.h"
 #include "components/internal_server/string_padder.h"
 #include "glog/logging.h"
+#include "google/protobuf/arena.h"
 #include "grpcpp/grpcpp.h"
 
+ABSL_FLAG(bool, use_secure_lookup_stream, false,
+          "Whether lookups to remote shards are multiplexed over a long-lived "
+          "SecureLookupStream per replica, which only pays for the OHTTP key "
+          "exchange once per stream, instead of one SecureLookup call each. "
+          "Only enable once every server supports SecureLookupStream.");
+ABSL_FLAG(absl::Duration, shard_lookup_timeout, absl::Milliseconds(300),
+          "Time after which a lookup stops waiting for the remote shards that "
+          "have not responded yet, and cancels their requests. Also the "
+          "deadline of each SecureLookup call, so that the remote shards stop "
+          "working on requests nobody waits for anymore. Should be well below "
+          "--udf_timeout, so that a slow shard doesn't use up the time of the "
+          "whole UDF.");
+
 namespace kv_server {
 namespace {
 
 using privacy_sandbox::server_common::ScopeLatencyRecorder;
 
+using LookupCallback =
+    absl::AnyInvocable<void(absl::StatusOr<InternalLookupResponse>) &&>;
+
 constexpr char kEncryptionFailure[] = "EncryptionFailure";
 constexpr char kSecureLookupFailure[] = "SecureLookupFailure";
 constexpr char kDecryptionFailure[] = "DecryptionFailure";
 constexpr char kRemoteLookupGetValues[] = "RemoteLookupGetValues";
 
+// Lookup ids are the nonces of the session key, so a stream is replaced by one
+// with a new key well before AES-GCM's limit on messages per key.
+constexpr uint64_t kMaxLookupsPerStream = 1 << 24;
+
+// State of one `SecureLookup` call, which has to live until the call
+// completes. The encryptor is stateful, as the response is decrypted with the
+// context of the request.
+struct SecureLookupCall {
+  SecureLookupCall(
+      privacy_sandbox::server_common::KeyFetcherManagerInterface&
+          key_fetcher_manager,
+      privacy_sandbox::server_common::MetricsRecorder& metrics_recorder,
+      absl::AnyInvocable<void(absl::StatusOr<InternalLookupResponse>) &&>
+          callback)
+      : latency_recorder(std::string(kRemoteLookupGetValues),
+                         metrics_recorder),
+        encryptor(key_fetcher_manager),
+        callback(std::move(callback)) {}
+
+  ScopeLatencyRecorder latency_recorder;
+  OhttpClientEncryptor encryptor;
+  absl::AnyInvocable<void(absl::StatusOr<InternalLookupResponse>) &&>
+      callback;
+  grpc::ClientContext context;
+  // The encrypted request and response are allocated on the arena of the
+  // call.
+  google::protobuf::Arena arena;
+  SecureLookupRequest* request =
+      google::protobuf::Arena::CreateMessage<SecureLookupRequest>(&arena);
+  SecureLookupResponse* response =
+      google::protobuf::Arena::CreateMessage<SecureLookupResponse>(&arena);
+};
+
+// A lookup sent over a `SecureLookupStream`, which is sent again in a
+// `SecureLookup` call if the server doesn't support streams.
+struct StreamedLookup {
+  std::string padded_serialized_request;
+  absl::Mutex mutex;
+  bool cancelled ABSL_GUARDED_BY(mutex) = false;
+  // Cancels the `SecureLookup` call the lookup was sent again in, if any.
+  absl::AnyInvocable<void()> cancel_secure_lookup ABSL_GUARDED_BY(mutex);
+};
+
+// A `SecureLookupStream`, over which concurrent lookups are multiplexed by
+// id. Keeps itself alive until the stream is done, so it may outlive its
+// client.
+class SecureLookupStreamCall
+    : public grpc::ClientBidiReactor<SecureLookupStreamRequest,
+                                     SecureLookupStreamResponse> {
+ public:
+  // Starts a stream over `stub`, whose first message carries the OHTTP
+  // encrypted key of `crypter`.
+  static std::shared_ptr<SecureLookupStreamCall> Start(
+      InternalLookupService::Stub& stub, std::string ohttp_session_key,
+      std::unique_ptr<SessionCrypter> crypter,
+      privacy_sandbox::server_common::MetricsRecorder& metrics_recorder) {
+    std::shared_ptr<SecureLookupStreamCall> call(
+        new SecureLookupStreamCall(std::move(crypter), metrics_recorder));
+    const SecureLookupStreamRequest* key_request;
+    {
+      absl::MutexLock lock(&call->mutex_);
+      call->self_ = call;
+      SecureLookupStreamRequest& request = call->writes_.emplace_back();
+      request.set_ohttp_session_key(std::move(ohttp_session_key));
+      call->writing_ = true;
+      key_request = &request;
+    }
+    stub.async()->SecureLookupStream(&call->context_, call.get());
+    call->StartWrite(key_request);
+    call->StartRead(&call->response_);
+    call->StartCall();
+    return call;
+  }
+
+  // Sends a lookup, whose result is passed to `callback`, and returns its id.
+  // Returns nullopt, and leaves `callback` untouched, if the stream no longer
+  // accepts lookups.
+  std::optional<uint64_t> Lookup(std::string_view padded_serialized_request,
+                                 LookupCallback&& callback) {
+    absl::StatusOr<std::string> sealed_request;
+    const SecureLookupStreamRequest* write = nullptr;
+    uint64_t id;
+    {
+      absl::MutexLock lock(&mutex_);
+      if (closed_) {
+        return std::nullopt;
+      }
+      id = next_id_++;
+      if (id == kMaxLookupsPerStream) {
+        closed_ = true;
+      }
+      // Sealed under the lock, as the server expects increasing ids.
+      sealed_request = crypter_->SealRequest(id, padded_serialized_request);
+      if (sealed_request.ok()) {
+        pending_.emplace(id, std::move(callback));
+        SecureLookupStreamRequest& request = writes_.emplace_back();
+        request.set_id(id);
+        request.set_sealed_request(*std::move(sealed_request));
+        if (!writing_) {
+          writing_ = true;
+          write = &request;
+        }
+      }
+    }
+    if (!sealed_request.ok()) {
+      metrics_recorder_.IncrementEventCounter(kEncryptionFailure);
+      std::move(callback)(sealed_request.status());
+      return id;
+    }
+    if (write != nullptr) {
+      StartWrite(write);
+    }
+    return id;
+  }
+
+  // Completes lookup `id` as cancelled, unless it is already completed. The
+  // server still answers it, but the response is dropped.
+  void Cancel(uint64_t id) {
+    LookupCallback callback;
+    bool finish;
+    {
+      absl::MutexLock lock(&mutex_);
+      const auto it = pending_.find(id);
+      if (it == pending_.end()) {
+        return;
+      }
+      callback = std::move(it->second);
+      pending_.erase(it);
+      finish = ShouldFinish();
+    }
+    std::move(callback)(absl::CancelledError("Lookup cancelled."));
+    if (finish) {
+      context_.TryCancel();
+    }
+  }
+
+  // Ends the stream, failing its pending lookups.
+  void Shutdown() { context_.TryCancel(); }
+
+  // Whether the stream no longer accepts lookups.
+  bool IsClosed() const {
+    absl::MutexLock lock(&mutex_);
+    return closed_;
+  }
+
+  void OnWriteDone(bool ok) override {
+    const SecureLookupStreamRequest* write = nullptr;
+    {
+      absl::MutexLock lock(&mutex_);
+      writes_.pop_front();
+      if (!ok) {
+        // The stream is broken, OnDone fails the pending lookups.
+        closed_ = true;
+        writes_.clear();
+        return;
+      }
+      if (writes_.empty()) {
+        writing_ = false;
+      } else {
+        write = &writes_.front();
+      }
+    }
+    if (write != nullptr) {
+      StartWrite(write);
+    }
+  }
+
+  void OnReadDone(bool ok) override {
+    if (!ok) {
+      absl::MutexLock lock(&mutex_);
+      closed_ = true;
+      return;
+    }
+    LookupCallback callback;
+    bool finish;
+    {
+      absl::MutexLock lock(&mutex_);
+      const auto it = pending_.find(response_.id());
+      if (it != pending_.end()) {
+        callback = std::move(it->second);
+        pending_.erase(it);
+      }
+      finish = ShouldFinish();
+    }
+    std::optional<absl::StatusOr<InternalLookupResponse>> result;
+    if (callback) {
+      result = ToLookupResult(response_);
+    }
+    StartRead(&response_);
+    if (callback) {
+      std::move(callback)(*std::move(result));
+    }
+    if (finish) {
+      context_.TryCancel();
+    }
+  }
+
+  void OnDone(const grpc::Status& status) override {
+    absl::flat_hash_map<uint64_t, LookupCallback> pending;
+    std::shared_ptr<SecureLookupStreamCall> self;
+    {
+      absl::MutexLock lock(&mutex_);
+      closed_ = true;
+      pending.swap(pending_);
+      self = std::move(self_);
+    }
+    if (pending.empty()) {
+      return;
+    }
+    absl::Status error =
+        status.ok() ? absl::UnavailableError("Lookup stream ended.")
+                    : absl::Status((absl::StatusCode)status.error_code(),
+                                   status.error_message());
+    if (status.error_code() != grpc::StatusCode::CANCELLED) {
+      metrics_recorder_.IncrementEventCounter(kSecureLookupFailure);
+      LOG(ERROR) << status.error_code() << ": " << status.error_message();
+    }
+    for (auto& [id, callback] : pending) {
+      std::move(callback)(error);
+    }
+  }
+
+ private:
+  SecureLookupStreamCall(
+      std::unique_ptr<SessionCrypter> crypter,
+      privacy_sandbox::server_common::MetricsRecorder& metrics_recorder)
+      : crypter_(std::move(crypter)), metrics_recorder_(metrics_recorder) {}
+
+  // Whether a stream that no longer accepts lookups has completed the last
+  // one, so that it can be ended.
+  bool ShouldFinish() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    if (!closed_ || !pending_.empty() || finishing_) {
+      return false;
+    }
+    finishing_ = true;
+    return true;
+  }
+
+  absl::StatusOr<InternalLookupResponse> ToLookupResult(
+      const SecureLookupStreamResponse& stream_response) const {
+    if (stream_response.has_status()) {
+      metrics_recorder_.IncrementEventCounter(kSecureLookupFailure);
+      return absl::Status(
+          static_cast<absl::StatusCode>(stream_response.status().code()),
+          stream_response.status().message());
+    }
+    auto serialized_response_maybe = crypter_->OpenResponse(
+        stream_response.id(), stream_response.sealed_response());
+    if (!serialized_response_maybe.ok()) {
+      metrics_recorder_.IncrementEventCounter(kDecryptionFailure);
+      return serialized_response_maybe.status();
+    }
+    InternalLookupResponse response;
+    if (!response.ParseFromString(*serialized_response_maybe)) {
+      return absl::InvalidArgumentError("Failed parsing the response.");
+    }
+    return response;
+  }
+
+  const std::unique_ptr<SessionCrypter> crypter_;
+  privacy_sandbox::server_common::MetricsRecorder& metrics_recorder_;
+  grpc::ClientContext context_;
+  // Only accessed by the reactor, which has at most one read outstanding.
+  SecureLookupStreamResponse response_;
+  mutable absl::Mutex mutex_;
+  // Released by OnDone.
+  std::shared_ptr<SecureLookupStreamCall> self_ ABSL_GUARDED_BY(mutex_);
+  uint64_t next_id_ ABSL_GUARDED_BY(mutex_) = 1;
+  // Set once the stream no longer accepts lookups, because it is broken or
+  // has used up its ids.
+  bool closed_ ABSL_GUARDED_BY(mutex_) = false;
+  bool finishing_ ABSL_GUARDED_BY(mutex_) = false;
+  // Messages to send, of which the front one is being written if `writing_`.
+  std::deque<SecureLookupStreamRequest> writes_ ABSL_GUARDED_BY(mutex_);
+  bool writing_ ABSL_GUARDED_BY(mutex_) = false;
+  absl::flat_hash_map<uint64_t, LookupCallback> pending_
+      ABSL_GUARDED_BY(mutex_);
+};
+
 class RemoteLookupClientImpl : public RemoteLookupClient {
  public:
   RemoteLookupClientImpl(const RemoteLookupClientImpl&) = delete;
@@ -50,7 +359,9 @@ class RemoteLookupClientImpl : public RemoteLookupClient {
         stub_(InternalLookupService::NewStub(grpc::CreateChannel(
             ip_address_, grpc::InsecureChannelCredentials()))),
         key_fetcher_manager_(key_fetcher_manager),
-        metrics_recorder_(metrics_recorder) {}
+        metrics_recorder_(metrics_recorder),
+        use_stream_(absl::GetFlag(FLAGS_use_secure_lookup_stream)),
+        timeout_(absl::GetFlag(FLAGS_shard_lookup_timeout)) {}
 
   explicit RemoteLookupClientImpl(
       std::unique_ptr<InternalLookupService::Stub> stub,
@@ -59,27 +370,190 @@ class RemoteLookupClientImpl : public RemoteLookupClient {
       privacy_sandbox::server_common::MetricsRecorder& metrics_recorder)
       : stub_(std::move(stub)),
         key_fetcher_manager_(key_fetcher_manager),
-        metrics_recorder_(metrics_recorder) {}
+        metrics_recorder_(metrics_recorder),
+        use_stream_(absl::GetFlag(FLAGS_use_secure_lookup_stream)),
+        timeout_(absl::GetFlag(FLAGS_shard_lookup_timeout)) {}
+
+  ~RemoteLookupClientImpl() override {
+    absl::MutexLock lock(&stream_mutex_);
+    if (stream_ != nullptr) {
+      stream_->Shutdown();
+    }
+  }
 
   absl::StatusOr<InternalLookupResponse> GetValues(
       std::string_view serialized_message,
       int32_t padding_length) const override {
-    ScopeLatencyRecorder latency_recorder(std::string(kRemoteLookupGetValues),
-                                          metrics_recorder_);
-    OhttpClientEncryptor encryptor(key_fetcher_manager_);
+    std::promise<absl::StatusOr<InternalLookupResponse>> response;
+    auto response_future = response.get_future();
+    GetValuesAsync(serialized_message, padding_length,
+                   [&response](absl::StatusOr<InternalLookupResponse> result) {
+                     response.set_value(std::move(result));
+                   });
+    return response_future.get();
+  }
+
+  absl::AnyInvocable<void()> GetValuesAsync(
+      std::string_view serialized_message, int32_t padding_length,
+      absl::AnyInvocable<void(absl::StatusOr<InternalLookupResponse>) &&>
+          callback) const override {
+    if (use_stream_ && !stream_unsupported_.load(std::memory_order_relaxed)) {
+      return GetValuesOverStream(serialized_message, padding_length,
+                                 std::move(callback));
+    }
+    return SecureLookup(Pad(serialized_message, padding_length),
+                        std::move(callback));
+  }
+
+  std::string_view GetIpAddress() const override { return ip_address_; }
+
+ private:
+  // Sends a lookup in its own `SecureLookup` call, and returns a function that
+  // cancels it.
+  absl::AnyInvocable<void()> SecureLookup(std::string padded_serialized_request,
+                                          LookupCallback callback) const {
+    auto call = std::make_shared<SecureLookupCall>(
+        key_fetcher_manager_, metrics_recorder_, std::move(callback));
     auto encrypted_padded_serialized_request_maybe =
-        encryptor.EncryptRequest(Pad(serialized_message, padding_length));
+        call->encryptor.EncryptRequest(std::move(padded_serialized_request));
     if (!encrypted_padded_serialized_request_maybe.ok()) {
       metrics_recorder_.IncrementEventCounter(kEncryptionFailure);
-      return encrypted_padded_serialized_request_maybe.status();
-    }
-    SecureLookupRequest secure_lookup_request;
-    secure_lookup_request.set_ohttp_request(
-        *encrypted_padded_serialized_request_maybe);
-    SecureLookupResponse secure_response;
-    grpc::ClientContext context;
-    grpc::Status status =
-        stub_->SecureLookup(&context, secure_lookup_request, &secure_response);
+      std::move(call->callback)(
+          encrypted_padded_serialized_request_maybe.status());
+      return [] {};
+    }
+    call->request->set_ohttp_request(
+        *std::move(encrypted_padded_serialized_request_maybe));
+    if (timeout_ != absl::InfiniteDuration()) {
+      call->context.set_deadline(absl::ToChronoTime(absl::Now() + timeout_));
+    }
+    // Kept alive by the completion callback, so cancelling only needs a weak
+    // reference to the call.
+    std::weak_ptr<SecureLookupCall> cancellable_call = call;
+    stub_->async()->SecureLookup(
+        &call->context, call->request, call->response,
+        [this, call](grpc::Status status) {
+          std::move(call->callback)(OnSecureLookupDone(status, *call));
+        });
+    return [cancellable_call = std::move(cancellable_call)] {
+      if (auto call = cancellable_call.lock()) {
+        call->context.TryCancel();
+      }
+    };
+  }
+
+  absl::AnyInvocable<void()> GetValuesOverStream(
+      std::string_view serialized_message, int32_t padding_length,
+      LookupCallback callback) const {
+    auto lookup = std::make_shared<StreamedLookup>();
+    lookup->padded_serialized_request = Pad(serialized_message, padding_length);
+    LookupCallback stream_callback =
+        [this, lookup,
+         latency_recorder = std::make_unique<ScopeLatencyRecorder>(
+             std::string(kRemoteLookupGetValues), metrics_recorder_),
+         callback = std::move(callback)](
+            absl::StatusOr<InternalLookupResponse> result) mutable {
+          if (result.status().code() != absl::StatusCode::kUnimplemented) {
+            latency_recorder.reset();
+            std::move(callback)(std::move(result));
+            return;
+          }
+          // The server predates SecureLookupStream, so the lookup, and every
+          // one after it, is sent in a SecureLookup call instead.
+          stream_unsupported_.store(true, std::memory_order_relaxed);
+          latency_recorder.reset();
+          bool cancelled;
+          {
+            absl::MutexLock lock(&lookup->mutex);
+            cancelled = lookup->cancelled;
+          }
+          if (cancelled) {
+            std::move(callback)(absl::CancelledError("Lookup cancelled."));
+            return;
+          }
+          auto cancel_secure_lookup =
+              SecureLookup(std::move(lookup->padded_serialized_request),
+                           std::move(callback));
+          {
+            absl::MutexLock lock(&lookup->mutex);
+            cancelled = lookup->cancelled;
+            if (!cancelled) {
+              lookup->cancel_secure_lookup = std::move(cancel_secure_lookup);
+            }
+          }
+          if (cancelled) {
+            cancel_secure_lookup();
+          }
+        };
+    // A stream may close between being picked and the lookup, in which case
+    // the lookup is retried on a new one.
+    for (int attempt = 0; attempt < 2; ++attempt) {
+      auto stream_maybe = GetStream();
+      if (!stream_maybe.ok()) {
+        std::move(stream_callback)(stream_maybe.status());
+        return [] {};
+      }
+      const std::optional<uint64_t> id = (*stream_maybe)->Lookup(
+          lookup->padded_serialized_request, std::move(stream_callback));
+      if (id.has_value()) {
+        return [lookup = std::move(lookup),
+                stream = std::weak_ptr<SecureLookupStreamCall>(*stream_maybe),
+                id = *id] {
+          absl::AnyInvocable<void()> cancel_secure_lookup;
+          {
+            absl::MutexLock lock(&lookup->mutex);
+            lookup->cancelled = true;
+            cancel_secure_lookup = std::move(lookup->cancel_secure_lookup);
+          }
+          if (cancel_secure_lookup) {
+            cancel_secure_lookup();
+          }
+          if (auto locked_stream = stream.lock()) {
+            locked_stream->Cancel(id);
+          }
+        };
+      }
+    }
+    std::move(stream_callback)(
+        absl::UnavailableError("No lookup stream to send the lookup over."));
+    return [] {};
+  }
+
+  // Returns the open stream of this client, starting a new one if there is
+  // none.
+  absl::StatusOr<std::shared_ptr<SecureLookupStreamCall>> GetStream() const {
+    absl::MutexLock lock(&stream_mutex_);
+    if (stream_ != nullptr && !stream_->IsClosed()) {
+      return stream_;
+    }
+    auto session_key_maybe = SessionCrypter::GenerateKey();
+    if (!session_key_maybe.ok()) {
+      metrics_recorder_.IncrementEventCounter(kEncryptionFailure);
+      return session_key_maybe.status();
+    }
+    auto crypter_maybe = SessionCrypter::Create(*session_key_maybe);
+    if (!crypter_maybe.ok()) {
+      return crypter_maybe.status();
+    }
+    OhttpClientEncryptor encryptor(key_fetcher_manager_);
+    auto ohttp_session_key_maybe =
+        encryptor.EncryptRequest(*std::move(session_key_maybe));
+    if (!ohttp_session_key_maybe.ok()) {
+      metrics_recorder_.IncrementEventCounter(kEncryptionFailure);
+      return ohttp_session_key_maybe.status();
+    }
+    stream_ = SecureLookupStreamCall::Start(
+        *stub_, *std::move(ohttp_session_key_maybe), *std::move(crypter_maybe),
+        metrics_recorder_);
+    return stream_;
+  }
+
+  absl::StatusOr<InternalLookupResponse> OnSecureLookupDone(
+      const grpc::Status& status, SecureLookupCall& call) const {
+    if (status.error_code() == grpc::StatusCode::CANCELLED) {
+      // Cancelled by the caller, e.g. because another replica answered first.
+      return absl::CancelledError(status.error_message());
+    }
     if (!status.ok()) {
       metrics_recorder_.IncrementEventCounter(kSecureLookupFailure);
       LOG(ERROR) << status.error_code() << ": " << status.error_message();
@@ -87,13 +561,13 @@ class RemoteLookupClientImpl : public RemoteLookupClient {
                           status.error_message());
     }
     InternalLookupResponse response;
-    if (secure_response.ohttp_response().empty()) {
+    if (call.response->ohttp_response().empty()) {
       // we cannot decrypt an empty response. Note, that soon we will add logic
       // to pad responses, so this branch will never be hit.
       return response;
     }
-    auto decrypted_response_maybe =
-        encryptor.DecryptResponse(std::move(secure_response.ohttp_response()));
+    auto decrypted_response_maybe = call.encryptor.DecryptResponse(
+        std::move(*call.response->mutable_ohttp_response()));
     if (!decrypted_response_maybe.ok()) {
       metrics_recorder_.IncrementEventCounter(kDecryptionFailure);
       return decrypted_response_maybe.status();
@@ -106,14 +580,21 @@ class RemoteLookupClientImpl : public RemoteLookupClient {
     return response;
   }
 
-  std::string_view GetIpAddress() const override { return ip_address_; }
-
- private:
   const std::string ip_address_;
   std::unique_ptr<InternalLookupService::Stub> stub_;
   privacy_sandbox::server_common::KeyFetcherManagerInterface&
       key_fetcher_manager_;
   privacy_sandbox::server_common::MetricsRecorder& metrics_recorder_;
+  const bool use_stream_;
+  // Deadline of each `SecureLookup` call. The lookups of a stream share its
+  // context, so they are cancelled by the caller instead.
+  const absl::Duration timeout_;
+  // Set once the server turned out not to support SecureLookupStream, after
+  // which SecureLookup is used instead.
+  mutable std::atomic<bool> stream_unsupported_ = false;
+  mutable absl::Mutex stream_mutex_;
+  mutable std::shared_ptr<SecureLookupStreamCall> stream_
+      ABSL_GUARDED_BY(stream_mutex_);
 };
 
 }  // namespace
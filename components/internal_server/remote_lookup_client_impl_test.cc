@@ -12,6 +12,11 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include "absl/flags/declare.h"
+#include "absl/flags/flag.h"
+#include "absl/flags/reflection.h"
+#include "absl/synchronization/notification.h"
+#include "absl/time/time.h"
 #include "components/data_server/cache/cache.h"
 #include "components/internal_server/lookup_server_impl.h"
 #include "components/internal_server/mocks.h"
@@ -20,10 +25,14 @@
 #include "google/protobuf/text_format.h"
 #include "grpcpp/grpcpp.h"
 #include "gtest/gtest.h"
+#include "public/sharding/sharding_function.h"
 #include "public/test_util/proto_matcher.h"
 #include "src/cpp/encryption/key_fetcher/src/fake_key_fetcher_manager.h"
 #include "src/cpp/telemetry/mocks.h"
 
+ABSL_DECLARE_FLAG(bool, use_secure_lookup_stream);
+ABSL_DECLARE_FLAG(int32_t, secure_lookup_stream_max_in_flight);
+
 namespace kv_server {
 namespace {
 
@@ -32,6 +41,22 @@ using privacy_sandbox::server_common::MockMetricsRecorder;
 using testing::_;
 using testing::Return;
 
+// Service of a server that predates SecureLookupStream.
+class UnaryLookupService : public InternalLookupService::Service {
+ public:
+  explicit UnaryLookupService(LookupServiceImpl& lookup_service)
+      : lookup_service_(lookup_service) {}
+
+  grpc::Status SecureLookup(grpc::ServerContext* context,
+                            const SecureLookupRequest* request,
+                            SecureLookupResponse* response) override {
+    return lookup_service_.SecureLookup(context, request, response);
+  }
+
+ private:
+  LookupServiceImpl& lookup_service_;
+};
+
 class RemoteLookupClientImplTest : public ::testing::Test {
  protected:
   RemoteLookupClientImplTest() {
@@ -97,6 +122,38 @@ TEST_F(RemoteLookupClientImplTest, EncryptedPaddedSuccessfulCall) {
   EXPECT_THAT(response, EqualsProto(expected));
 }
 
+TEST_F(RemoteLookupClientImplTest, EncryptedPaddedPositionalSuccessfulCall) {
+  std::vector<std::string> keys = {"key2", "key3", "key1"};
+  InternalLookupRequest request;
+  request.mutable_keys()->Assign(keys.begin(), keys.end());
+  request.set_positional_results(true);
+  std::string serialized_message = request.SerializeAsString();
+  int32_t padding_length = 10;
+  InternalLookupResponse local_lookup_response;
+  TextFormat::ParseFromString(R"pb(kv_pairs {
+                                     key: "key1"
+                                     value { value: "value1" }
+                                   }
+                                   kv_pairs {
+                                     key: "key2"
+                                     value { value: "value2" }
+                                   }
+                              )pb",
+                              &local_lookup_response);
+  EXPECT_CALL(mock_lookup_, GetKeyValues(_))
+      .WillOnce(Return(local_lookup_response));
+  auto response_status =
+      remote_lookup_client_->GetValues(serialized_message, padding_length);
+  EXPECT_TRUE(response_status.ok());
+  InternalLookupResponse expected;
+  TextFormat::ParseFromString(R"pb(results { value: "value2" }
+                                   results { status { code: 5 } }
+                                   results { value: "value1" }
+                              )pb",
+                              &expected);
+  EXPECT_THAT(*response_status, EqualsProto(expected));
+}
+
 TEST_F(RemoteLookupClientImplTest, EncryptedPaddedEmptySuccessfulCall) {
   std::vector<std::string> keys = {};
   InternalLookupRequest request;
@@ -167,5 +224,208 @@ TEST_F(RemoteLookupClientImplTest,
   EXPECT_EQ(0, response.mutable_kv_pairs()->size());
 }
 
+TEST_F(RemoteLookupClientImplTest, ShardingFunctionVersionMismatchFails) {
+  InternalLookupRequest request;
+  request.add_keys("key1");
+  request.set_sharding_function_version(
+      static_cast<int32_t>(ShardingFunction::Version::kSipHash));
+  EXPECT_CALL(mock_lookup_, GetKeyValues(_)).Times(0);
+  EXPECT_CALL(mock_metrics_recorder_,
+              IncrementEventCounter("ShardingFunctionVersionMismatch"));
+  EXPECT_CALL(mock_metrics_recorder_, IncrementEventCounter(testing::Ne(
+                                          "ShardingFunctionVersionMismatch")))
+      .Times(testing::AnyNumber());
+  auto response_status = remote_lookup_client_->GetValues(
+      request.SerializeAsString(), /*padding_length=*/10);
+  EXPECT_FALSE(response_status.ok());
+}
+
+TEST_F(RemoteLookupClientImplTest, SlowCallExceedsDeadline) {
+  absl::FlagSaver flag_saver;
+  absl::SetFlag(&FLAGS_shard_lookup_timeout, absl::Milliseconds(10));
+  auto client = RemoteLookupClient::Create(
+      InternalLookupService::NewStub(
+          server_->InProcessChannel(grpc::ChannelArguments())),
+      fake_key_fetcher_manager_, mock_metrics_recorder_);
+  absl::Notification deadline_exceeded;
+  EXPECT_CALL(mock_lookup_, GetKeyValues(_))
+      .WillOnce([&deadline_exceeded](
+                    const absl::flat_hash_set<std::string_view>& keys) {
+        deadline_exceeded.WaitForNotification();
+        return InternalLookupResponse();
+      });
+  InternalLookupRequest request;
+  request.add_keys("key1");
+  auto response_status = client->GetValues(request.SerializeAsString(), 0);
+  deadline_exceeded.Notify();
+  EXPECT_EQ(response_status.status().code(),
+            absl::StatusCode::kDeadlineExceeded);
+}
+
+TEST_F(RemoteLookupClientImplTest, StreamedLookupsSuccessfulCalls) {
+  absl::FlagSaver flag_saver;
+  absl::SetFlag(&FLAGS_use_secure_lookup_stream, true);
+  auto stream_client = RemoteLookupClient::Create(
+      InternalLookupService::NewStub(
+          server_->InProcessChannel(grpc::ChannelArguments())),
+      fake_key_fetcher_manager_, mock_metrics_recorder_);
+  InternalLookupResponse local_lookup_response;
+  TextFormat::ParseFromString(R"pb(kv_pairs {
+                                     key: "key1"
+                                     value { value: "value1" }
+                                   }
+                              )pb",
+                              &local_lookup_response);
+  EXPECT_CALL(mock_lookup_, GetKeyValues(_))
+      .Times(3)
+      .WillRepeatedly(Return(local_lookup_response));
+  InternalLookupRequest request;
+  request.add_keys("key1");
+  request.set_positional_results(true);
+  InternalLookupResponse expected;
+  TextFormat::ParseFromString(R"pb(results { value: "value1" })pb",
+                              &expected);
+  // Every lookup is sent over the same stream.
+  for (int i = 0; i < 3; ++i) {
+    auto response_status =
+        stream_client->GetValues(request.SerializeAsString(), 10);
+    ASSERT_TRUE(response_status.ok()) << response_status.status();
+    EXPECT_THAT(*response_status, EqualsProto(expected));
+  }
+}
+
+TEST_F(RemoteLookupClientImplTest, StreamedLookupFailureKeepsStream) {
+  absl::FlagSaver flag_saver;
+  absl::SetFlag(&FLAGS_use_secure_lookup_stream, true);
+  auto stream_client = RemoteLookupClient::Create(
+      InternalLookupService::NewStub(
+          server_->InProcessChannel(grpc::ChannelArguments())),
+      fake_key_fetcher_manager_, mock_metrics_recorder_);
+  EXPECT_FALSE(stream_client->GetValues("garbage", 0).ok());
+
+  InternalLookupRequest request;
+  request.set_lookup_sets(true);
+  auto response_status =
+      stream_client->GetValues(request.SerializeAsString(), 0);
+  ASSERT_TRUE(response_status.ok()) << response_status.status();
+  EXPECT_THAT(*response_status, EqualsProto(InternalLookupResponse()));
+}
+
+TEST_F(RemoteLookupClientImplTest, StreamedSlowLookupDoesNotBlockOthers) {
+  absl::FlagSaver flag_saver;
+  absl::SetFlag(&FLAGS_use_secure_lookup_stream, true);
+  auto stream_client = RemoteLookupClient::Create(
+      InternalLookupService::NewStub(
+          server_->InProcessChannel(grpc::ChannelArguments())),
+      fake_key_fetcher_manager_, mock_metrics_recorder_);
+  absl::Notification fast_lookup_done;
+  EXPECT_CALL(mock_lookup_, GetKeyValues(_))
+      .WillRepeatedly([&fast_lookup_done](
+                          const absl::flat_hash_set<std::string_view>& keys) {
+        if (keys.contains("slow")) {
+          fast_lookup_done.WaitForNotification();
+        }
+        return InternalLookupResponse();
+      });
+  InternalLookupRequest slow_request;
+  slow_request.add_keys("slow");
+  absl::Notification slow_lookup_done;
+  stream_client->GetValuesAsync(
+      slow_request.SerializeAsString(), 0,
+      [&slow_lookup_done](absl::StatusOr<InternalLookupResponse> result) {
+        EXPECT_TRUE(result.ok()) << result.status();
+        slow_lookup_done.Notify();
+      });
+  // Sent over the same stream, after the slow lookup.
+  InternalLookupRequest fast_request;
+  fast_request.add_keys("fast");
+  auto response_status =
+      stream_client->GetValues(fast_request.SerializeAsString(), 0);
+  EXPECT_TRUE(response_status.ok()) << response_status.status();
+  fast_lookup_done.Notify();
+  slow_lookup_done.WaitForNotification();
+}
+
+TEST_F(RemoteLookupClientImplTest, StreamedLookupsInFlightAreCapped) {
+  absl::FlagSaver flag_saver;
+  absl::SetFlag(&FLAGS_use_secure_lookup_stream, true);
+  absl::SetFlag(&FLAGS_secure_lookup_stream_max_in_flight, 1);
+  auto stream_client = RemoteLookupClient::Create(
+      InternalLookupService::NewStub(
+          server_->InProcessChannel(grpc::ChannelArguments())),
+      fake_key_fetcher_manager_, mock_metrics_recorder_);
+  absl::Notification slow_lookup_started;
+  absl::Notification slow_lookup_released;
+  EXPECT_CALL(mock_lookup_, GetKeyValues(_))
+      .WillRepeatedly([&slow_lookup_started, &slow_lookup_released](
+                          const absl::flat_hash_set<std::string_view>& keys) {
+        if (keys.contains("slow")) {
+          slow_lookup_started.Notify();
+          slow_lookup_released.WaitForNotification();
+        }
+        return InternalLookupResponse();
+      });
+  InternalLookupRequest slow_request;
+  slow_request.add_keys("slow");
+  absl::Notification slow_lookup_done;
+  stream_client->GetValuesAsync(
+      slow_request.SerializeAsString(), 0,
+      [&slow_lookup_done](absl::StatusOr<InternalLookupResponse> result) {
+        EXPECT_TRUE(result.ok()) << result.status();
+        slow_lookup_done.Notify();
+      });
+  slow_lookup_started.WaitForNotification();
+  // The next lookup of the stream isn't read while the slow one is pending.
+  InternalLookupRequest fast_request;
+  fast_request.add_keys("fast");
+  absl::Notification fast_lookup_done;
+  stream_client->GetValuesAsync(
+      fast_request.SerializeAsString(), 0,
+      [&fast_lookup_done](absl::StatusOr<InternalLookupResponse> result) {
+        EXPECT_TRUE(result.ok()) << result.status();
+        fast_lookup_done.Notify();
+      });
+  EXPECT_FALSE(
+      fast_lookup_done.WaitForNotificationWithTimeout(absl::Milliseconds(100)));
+  slow_lookup_released.Notify();
+  slow_lookup_done.WaitForNotification();
+  fast_lookup_done.WaitForNotification();
+}
+
+TEST_F(RemoteLookupClientImplTest, StreamedLookupFallsBackToSecureLookup) {
+  absl::FlagSaver flag_saver;
+  absl::SetFlag(&FLAGS_use_secure_lookup_stream, true);
+  UnaryLookupService unary_lookup_service(*lookup_service_);
+  grpc::ServerBuilder builder;
+  builder.RegisterService(&unary_lookup_service);
+  auto unary_server = builder.BuildAndStart();
+  auto stream_client = RemoteLookupClient::Create(
+      InternalLookupService::NewStub(
+          unary_server->InProcessChannel(grpc::ChannelArguments())),
+      fake_key_fetcher_manager_, mock_metrics_recorder_);
+  InternalLookupResponse local_lookup_response;
+  TextFormat::ParseFromString(R"pb(kv_pairs {
+                                     key: "key1"
+                                     value { value: "value1" }
+                                   }
+                              )pb",
+                              &local_lookup_response);
+  EXPECT_CALL(mock_lookup_, GetKeyValues(_))
+      .Times(2)
+      .WillRepeatedly(Return(local_lookup_response));
+  InternalLookupRequest request;
+  request.add_keys("key1");
+  // The lookup sent over the stream the server rejects is sent again, and the
+  // next one is only sent in a SecureLookup call.
+  for (int i = 0; i < 2; ++i) {
+    auto response_status =
+        stream_client->GetValues(request.SerializeAsString(), 0);
+    ASSERT_TRUE(response_status.ok()) << response_status.status();
+    EXPECT_THAT(*response_status, EqualsProto(local_lookup_response));
+  }
+  unary_server->Shutdown();
+  unary_server->Wait();
+}
+
 }  // namespace
 }  // namespace kv_server
@@ -0,0 +1,396 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "components/internal_server/run_query_result.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/functional/any_invocable.h"
+#include "absl/functional/function_ref.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "components/query/parse_query.h"
+#include "components/query/worker_pool.h"
+
+ABSL_FLAG(int32_t, query_eval_threads, 0,
+          "Number of threads, shared by all queries of the process, on which "
+          "independent subtrees of large queries are evaluated in parallel. "
+          "Queries are evaluated on the thread running them if this is 0.");
+ABSL_FLAG(int64_t, query_parallel_eval_min_work, 100000,
+          "Minimum total size of the sets looked up by a subtree of a query "
+          "for its two operands to be evaluated in parallel. Only used with "
+          "--query_eval_threads.");
+
+namespace kv_server {
+namespace {
+
+// Returns the pool shared by all queries of the process, or nullptr if
+// queries are evaluated sequentially. Created on first use, so that no thread
+// is started before the UDF workers fork.
+WorkerPool* GetEvalPool() {
+  static WorkerPool* const pool = []() -> WorkerPool* {
+    const int32_t threads = absl::GetFlag(FLAGS_query_eval_threads);
+    return threads > 0 ? new WorkerPool(threads) : nullptr;
+  }();
+  return pool;
+}
+
+absl::StatusOr<absl::flat_hash_set<std::string_view>> GetResult(
+    const Driver& driver) {
+  WorkerPool* pool = GetEvalPool();
+  if (pool == nullptr) {
+    return driver.GetResult();
+  }
+  return driver.GetResultParallel(
+      [pool](absl::AnyInvocable<void()> task) {
+        pool->Schedule(std::move(task));
+      },
+      std::max<int64_t>(absl::GetFlag(FLAGS_query_parallel_eval_min_work), 0));
+}
+
+void SetStatus(const absl::Status& status, RunQueryResult& result) {
+  auto* result_status = result.mutable_status();
+  result_status->set_code(static_cast<int>(status.code()));
+  result_status->set_message(std::string(status.message()));
+}
+
+bool IsPaged(const InternalRunQueryRequest& request) {
+  return request.limit() > 0 || request.offset() > 0 || request.ordered() ||
+         !request.page_token().empty();
+}
+
+// Returns the elements in `[offset, offset + limit)` of the result in
+// whatever order the evaluation yields them, and stops the evaluation as soon
+// as the page is full.
+absl::StatusOr<InternalRunQueryResponse> BuildUnorderedPage(
+    const Driver& driver, const InternalRunQueryRequest& request) {
+  InternalRunQueryResponse response;
+  uint64_t to_skip = request.offset();
+  const uint64_t limit = request.limit();
+  if (const auto status = driver.ForEachResult([&](std::string_view element) {
+        if (to_skip > 0) {
+          --to_skip;
+          return true;
+        }
+        response.add_elements(std::string(element));
+        return limit == 0 ||
+               static_cast<uint64_t>(response.elements_size()) < limit;
+      });
+      !status.ok()) {
+    return status;
+  }
+  return response;
+}
+
+// Calls its argument on each element of a result, until it returns false.
+using ForEachElement = absl::FunctionRef<absl::Status(
+    absl::FunctionRef<bool(std::string_view)>)>;
+
+// Returns the elements in `[offset, offset + limit)` of the result sorted in
+// ascending order, skipping every element up to and including `page_token`.
+// Only the `offset + limit` smallest elements are kept while evaluating, in a
+// max-heap, so the full result is never materialized or sorted.
+absl::StatusOr<InternalRunQueryResponse> BuildOrderedPage(
+    ForEachElement for_each_element, const InternalRunQueryRequest& request) {
+  const std::string& page_token = request.page_token();
+  const uint64_t limit = request.limit();
+  const uint64_t offset = request.offset();
+  const uint64_t window =
+      limit == 0 || offset > std::numeric_limits<uint64_t>::max() - limit
+          ? std::numeric_limits<uint64_t>::max()
+          : offset + limit;
+  std::vector<std::string_view> heap;
+  bool has_more = false;
+  if (const auto status = for_each_element([&](std::string_view element) {
+        if (!page_token.empty() && element <= page_token) {
+          return true;
+        }
+        if (heap.size() < window) {
+          heap.push_back(element);
+          std::push_heap(heap.begin(), heap.end());
+          return true;
+        }
+        has_more = true;
+        if (element < heap.front()) {
+          std::pop_heap(heap.begin(), heap.end());
+          heap.back() = element;
+          std::push_heap(heap.begin(), heap.end());
+        }
+        return true;
+      });
+      !status.ok()) {
+    return status;
+  }
+  std::sort_heap(heap.begin(), heap.end());
+  InternalRunQueryResponse response;
+  if (offset < heap.size()) {
+    response.mutable_elements()->Assign(heap.begin() + offset, heap.end());
+  }
+  if (has_more && !response.elements().empty()) {
+    response.set_next_page_token(*response.elements().rbegin());
+  }
+  return response;
+}
+
+template <typename T>
+std::optional<absl::Span<const T>> GetSortedSet(
+    const SortedSetLookup& sorted_sets, std::string_view key) {
+  if constexpr (std::is_same_v<T, uint32_t>) {
+    return sorted_sets.GetUInt32Set(key);
+  } else {
+    return sorted_sets.GetUInt64Set(key);
+  }
+}
+
+// Returns whether every key of the query held by `driver` has a set of
+// unsigned integers of type `T` in `sorted_sets`, or no set.
+template <typename T>
+bool HasSortedSets(const Driver& driver, const SortedSetLookup& sorted_sets) {
+  const Node* root = driver.GetRootNode();
+  if (root == nullptr) {
+    return false;
+  }
+  for (const auto key : root->Keys()) {
+    if (!GetSortedSet<T>(sorted_sets, key).has_value()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Returns whether `candidate` is the decimal form of an element of `result`.
+// Only the form elements are returned in matches, so that membership agrees
+// with the string sets the elements are otherwise converted to.
+template <typename T>
+bool ContainsDecimal(const std::vector<T>& result, std::string_view candidate) {
+  T value;
+  return absl::SimpleAtoi(candidate, &value) &&
+         absl::AlphaNum(value).Piece() == candidate &&
+         std::binary_search(result.begin(), result.end(), value);
+}
+
+// Same as `BuildRunQueryResponse`, over the sets of unsigned integers of type
+// `T` in `sorted_sets`. The result is sorted numerically, so only pages in the
+// lexicographic order of its decimal strings need them.
+template <typename T>
+absl::StatusOr<InternalRunQueryResponse> BuildSortedResponse(
+    const Driver& driver, const InternalRunQueryRequest& request,
+    const SortedSetLookup& sorted_sets) {
+  const auto lookup_fn = [&sorted_sets](std::string_view key) {
+    return GetSortedSet<T>(sorted_sets, key).value_or(absl::Span<const T>());
+  };
+  absl::StatusOr<std::vector<T>> result;
+  if constexpr (std::is_same_v<T, uint32_t>) {
+    result = driver.GetUInt32Result(lookup_fn);
+  } else {
+    result = driver.GetUInt64Result(lookup_fn);
+  }
+  if (!result.ok()) {
+    return result.status();
+  }
+  InternalRunQueryResponse response;
+  switch (request.result_mode()) {
+    case RunQueryResultMode::COUNT:
+      response.set_count(result->size());
+      return response;
+    case RunQueryResultMode::MEMBERSHIP:
+      for (const std::string& candidate : request.candidates()) {
+        response.add_is_member(ContainsDecimal(*result, candidate));
+      }
+      return response;
+    case RunQueryResultMode::APPROXIMATE_COUNT:
+      response.set_approximate_count(result->size());
+      return response;
+    default:
+      break;
+  }
+  if (request.ordered() || !request.page_token().empty()) {
+    // The page keeps views of the elements, so they must outlive it.
+    std::vector<std::string> elements;
+    elements.reserve(result->size());
+    for (const T value : *result) {
+      elements.push_back(absl::StrCat(value));
+    }
+    return BuildOrderedPage(
+        [&elements](absl::FunctionRef<bool(std::string_view)> fn) {
+          for (const std::string& element : elements) {
+            if (!fn(element)) {
+              break;
+            }
+          }
+          return absl::OkStatus();
+        },
+        request);
+  }
+  const uint64_t offset = std::min<uint64_t>(request.offset(), result->size());
+  const uint64_t end =
+      request.limit() == 0
+          ? result->size()
+          : offset + std::min<uint64_t>(request.limit(),
+                                        result->size() - offset);
+  response.mutable_elements()->Reserve(end - offset);
+  for (uint64_t i = offset; i < end; ++i) {
+    response.add_elements(absl::StrCat((*result)[i]));
+  }
+  return response;
+}
+
+}  // namespace
+
+absl::StatusOr<InternalRunQueryResponse> BuildRunQueryResponse(
+    const Driver& driver, const InternalRunQueryRequest& request,
+    const SortedSetLookup* sorted_sets) {
+  if (sorted_sets != nullptr) {
+    if (HasSortedSets<uint32_t>(driver, *sorted_sets)) {
+      return BuildSortedResponse<uint32_t>(driver, request, *sorted_sets);
+    }
+    if (HasSortedSets<uint64_t>(driver, *sorted_sets)) {
+      return BuildSortedResponse<uint64_t>(driver, request, *sorted_sets);
+    }
+  }
+  InternalRunQueryResponse response;
+  switch (request.result_mode()) {
+    case RunQueryResultMode::COUNT: {
+      auto count = driver.GetResultCount();
+      if (!count.ok()) {
+        return count.status();
+      }
+      response.set_count(*count);
+      return response;
+    }
+    case RunQueryResultMode::MEMBERSHIP: {
+      std::vector<std::string_view> candidates(request.candidates().begin(),
+                                               request.candidates().end());
+      auto is_member = driver.GetResultMembership(candidates);
+      if (!is_member.ok()) {
+        return is_member.status();
+      }
+      response.mutable_is_member()->Assign(is_member->begin(),
+                                           is_member->end());
+      return response;
+    }
+    case RunQueryResultMode::APPROXIMATE_COUNT: {
+      auto count = driver.GetResultCount();
+      if (!count.ok()) {
+        return count.status();
+      }
+      response.set_approximate_count(*count);
+      return response;
+    }
+    default: {
+      if (IsPaged(request)) {
+        if (request.ordered() || !request.page_token().empty()) {
+          return BuildOrderedPage(
+              [&driver](absl::FunctionRef<bool(std::string_view)> fn) {
+                return driver.ForEachResult(fn);
+              },
+              request);
+        }
+        return BuildUnorderedPage(driver, request);
+      }
+      auto result = GetResult(driver);
+      if (!result.ok()) {
+        return result.status();
+      }
+      response.mutable_elements()->Assign(result->begin(), result->end());
+      return response;
+    }
+  }
+}
+
+absl::StatusOr<InternalRunQueryResponse> BuildApproximateCountResponse(
+    const Driver& driver,
+    const absl::flat_hash_map<std::string, ThetaSketch>& sketches) {
+  auto count = driver.GetApproximateResultCount([&sketches](
+                                                    std::string_view key) {
+    const auto sketch_itr = sketches.find(key);
+    return sketch_itr == sketches.end() ? ThetaSketch() : sketch_itr->second;
+  });
+  if (!count.ok()) {
+    return count.status();
+  }
+  InternalRunQueryResponse response;
+  response.set_approximate_count(*count);
+  return response;
+}
+
+KeysetSketch ToKeysetSketch(const ThetaSketch& sketch) {
+  KeysetSketch keyset_sketch;
+  keyset_sketch.set_nominal_entries(sketch.nominal_entries());
+  keyset_sketch.set_theta(sketch.theta());
+  keyset_sketch.mutable_hashes()->Add(sketch.hashes().begin(),
+                                      sketch.hashes().end());
+  return keyset_sketch;
+}
+
+ThetaSketch FromKeysetSketch(const KeysetSketch& keyset_sketch) {
+  const size_t nominal_entries = keyset_sketch.nominal_entries() > 0
+                                     ? keyset_sketch.nominal_entries()
+                                     : ThetaSketch::kDefaultNominalEntries;
+  return ThetaSketch::Create(
+      nominal_entries, keyset_sketch.theta(),
+      absl::MakeConstSpan(keyset_sketch.hashes().data(),
+                          keyset_sketch.hashes().size()));
+}
+
+absl::flat_hash_set<std::string_view> ParseRunQueries(
+    const InternalRunQueriesRequest& request,
+    absl::Span<const std::unique_ptr<Driver>> drivers,
+    InternalRunQueriesResponse& response) {
+  absl::flat_hash_set<std::string_view> keys;
+  for (int i = 0; i < request.queries_size(); i++) {
+    auto* result = response.add_results();
+    const std::string& query = request.queries(i).query();
+    if (query.empty()) {
+      continue;
+    }
+    if (ParseQuery(*drivers[i], query)) {
+      SetStatus(absl::InvalidArgumentError("Parsing failure."), *result);
+      continue;
+    }
+    for (const auto key : drivers[i]->GetRootNode()->Keys()) {
+      keys.insert(key);
+    }
+  }
+  return keys;
+}
+
+void BuildRunQueriesResponse(const InternalRunQueriesRequest& request,
+                             absl::Span<const std::unique_ptr<Driver>> drivers,
+                             InternalRunQueriesResponse& response,
+                             const SortedSetLookup* sorted_sets) {
+  for (int i = 0; i < request.queries_size(); i++) {
+    auto* result = response.mutable_results(i);
+    if (result->has_status()) {
+      continue;
+    }
+    auto query_response =
+        BuildRunQueryResponse(*drivers[i], request.queries(i), sorted_sets);
+    if (!query_response.ok()) {
+      SetStatus(query_response.status(), *result);
+      continue;
+    }
+    *result->mutable_response() = *std::move(query_response);
+  }
+}
+
+}  // namespace kv_server
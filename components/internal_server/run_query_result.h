@@ -0,0 +1,94 @@
+/*
+ * Copyright 2023 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef COMPONENTS_INTERNAL_SERVER_RUN_QUERY_RESULT_H_
+#define COMPONENTS_INTERNAL_SERVER_RUN_QUERY_RESULT_H_
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/status/statusor.h"
+#include "absl/types/span.h"
+#include "components/internal_server/lookup.pb.h"
+#include "components/query/driver.h"
+#include "components/query/set_sketch.h"
+
+namespace kv_server {
+
+// Looks up the sorted elements of the sets of unsigned integers that a query
+// is evaluated over. Returns an empty set if a key has no set, and nullopt if
+// its set has elements of another type.
+class SortedSetLookup {
+ public:
+  virtual ~SortedSetLookup() = default;
+
+  virtual std::optional<absl::Span<const uint32_t>> GetUInt32Set(
+      std::string_view key) const = 0;
+  virtual std::optional<absl::Span<const uint64_t>> GetUInt64Set(
+      std::string_view key) const = 0;
+};
+
+// Evaluates the query held by `driver` and fills in the response fields for
+// the `result_mode` of `request`. COUNT and MEMBERSHIP modes never
+// materialize the result set. ELEMENTS mode honors `limit`, `offset`,
+// `page_token` and `ordered`, stopping the evaluation once an unordered page
+// is full and keeping only the page window in memory for ordered ones.
+// APPROXIMATE_COUNT mode counts exactly, since the sets were fetched anyway.
+// Unpaged ELEMENTS results are evaluated in parallel on a pool shared by all
+// queries of the process with `--query_eval_threads`. If `sorted_sets` holds
+// sets of unsigned integers of one width for every key of the query, the
+// query is evaluated over them with integer set operations instead, and the
+// elements are returned as decimal strings.
+absl::StatusOr<InternalRunQueryResponse> BuildRunQueryResponse(
+    const Driver& driver, const InternalRunQueryRequest& request,
+    const SortedSetLookup* sorted_sets = nullptr);
+
+// Estimates the number of elements in the result of the query held by
+// `driver` from the `sketches` of its sets, for the APPROXIMATE_COUNT result
+// mode. Sets without a sketch are empty.
+absl::StatusOr<InternalRunQueryResponse> BuildApproximateCountResponse(
+    const Driver& driver,
+    const absl::flat_hash_map<std::string, ThetaSketch>& sketches);
+
+// Converts a sketch to and from the form it is sent between shards in.
+KeysetSketch ToKeysetSketch(const ThetaSketch& sketch);
+ThetaSketch FromKeysetSketch(const KeysetSketch& keyset_sketch);
+
+// Parses every query of `request` with the driver at the same index of
+// `drivers` and adds one result per query to `response`. Queries that fail to
+// parse get an error status as their result. Returns the union of the keys of
+// all parsed queries, which stays valid as long as `drivers`.
+absl::flat_hash_set<std::string_view> ParseRunQueries(
+    const InternalRunQueriesRequest& request,
+    absl::Span<const std::unique_ptr<Driver>> drivers,
+    InternalRunQueriesResponse& response);
+
+// Evaluates every query that `ParseRunQueries` parsed and sets its result in
+// `response`. The sets of all keys it returned must be fetched beforehand.
+// `sorted_sets` is used as by `BuildRunQueryResponse`.
+void BuildRunQueriesResponse(const InternalRunQueriesRequest& request,
+                             absl::Span<const std::unique_ptr<Driver>> drivers,
+                             InternalRunQueriesResponse& response,
+                             const SortedSetLookup* sorted_sets = nullptr);
+
+}  // namespace kv_server
+
+#endif  // COMPONENTS_INTERNAL_SERVER_RUN_QUERY_RESULT_H_
@@ -0,0 +1,124 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "components/internal_server/session_crypter.h"
+
+#include <array>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_format.h"
+#include "openssl/rand.h"
+
+namespace kv_server {
+namespace {
+
+constexpr size_t kNonceLength = 12;
+
+// [8 bit direction][24 bit zero][64 bit big endian id]
+std::array<uint8_t, kNonceLength> MakeNonce(uint8_t direction, uint64_t id) {
+  std::array<uint8_t, kNonceLength> nonce{};
+  nonce[0] = direction;
+  for (int i = 0; i < 8; ++i) {
+    nonce[kNonceLength - 1 - i] = id & 0xff;
+    id >>= 8;
+  }
+  return nonce;
+}
+
+}  // namespace
+
+absl::StatusOr<std::string> SessionCrypter::GenerateKey() {
+  std::string key(kKeyLength, '\0');
+  if (RAND_bytes(reinterpret_cast<uint8_t*>(key.data()), key.size()) != 1) {
+    return absl::InternalError("Failed generating a session key.");
+  }
+  return key;
+}
+
+absl::StatusOr<std::unique_ptr<SessionCrypter>> SessionCrypter::Create(
+    std::string_view key) {
+  if (key.size() != kKeyLength) {
+    return absl::InvalidArgumentError(absl::StrFormat(
+        "Session keys are %d bytes long, got %d.", kKeyLength, key.size()));
+  }
+  auto crypter = std::unique_ptr<SessionCrypter>(new SessionCrypter());
+  EVP_AEAD_CTX_zero(&crypter->context_);
+  if (!EVP_AEAD_CTX_init(&crypter->context_, EVP_aead_aes_256_gcm(),
+                         reinterpret_cast<const uint8_t*>(key.data()),
+                         key.size(), EVP_AEAD_DEFAULT_TAG_LENGTH,
+                         /*impl=*/nullptr)) {
+    return absl::InternalError("Failed initializing the session cipher.");
+  }
+  return crypter;
+}
+
+SessionCrypter::~SessionCrypter() { EVP_AEAD_CTX_cleanup(&context_); }
+
+absl::StatusOr<std::string> SessionCrypter::SealRequest(
+    uint64_t id, std::string_view request) const {
+  return Seal(Direction::kRequest, id, request);
+}
+
+absl::StatusOr<std::string> SessionCrypter::OpenRequest(
+    uint64_t id, std::string_view sealed) const {
+  return Open(Direction::kRequest, id, sealed);
+}
+
+absl::StatusOr<std::string> SessionCrypter::SealResponse(
+    uint64_t id, std::string_view response) const {
+  return Seal(Direction::kResponse, id, response);
+}
+
+absl::StatusOr<std::string> SessionCrypter::OpenResponse(
+    uint64_t id, std::string_view sealed) const {
+  return Open(Direction::kResponse, id, sealed);
+}
+
+absl::StatusOr<std::string> SessionCrypter::Seal(
+    Direction direction, uint64_t id, std::string_view plaintext) const {
+  const auto nonce = MakeNonce(static_cast<uint8_t>(direction), id);
+  std::string sealed(
+      plaintext.size() + EVP_AEAD_max_overhead(EVP_aead_aes_256_gcm()), '\0');
+  size_t sealed_length;
+  if (!EVP_AEAD_CTX_seal(&context_, reinterpret_cast<uint8_t*>(sealed.data()),
+                         &sealed_length, sealed.size(), nonce.data(),
+                         nonce.size(),
+                         reinterpret_cast<const uint8_t*>(plaintext.data()),
+                         plaintext.size(), /*ad=*/nullptr, /*ad_len=*/0)) {
+    return absl::InternalError("Failed encrypting the message.");
+  }
+  sealed.resize(sealed_length);
+  return sealed;
+}
+
+absl::StatusOr<std::string> SessionCrypter::Open(
+    Direction direction, uint64_t id, std::string_view sealed) const {
+  const auto nonce = MakeNonce(static_cast<uint8_t>(direction), id);
+  std::string plaintext(sealed.size(), '\0');
+  size_t plaintext_length;
+  if (!EVP_AEAD_CTX_open(&context_,
+                         reinterpret_cast<uint8_t*>(plaintext.data()),
+                         &plaintext_length, plaintext.size(), nonce.data(),
+                         nonce.size(),
+                         reinterpret_cast<const uint8_t*>(sealed.data()),
+                         sealed.size(), /*ad=*/nullptr, /*ad_len=*/0)) {
+    return absl::InvalidArgumentError("Failed decrypting the message.");
+  }
+  plaintext.resize(plaintext_length);
+  return plaintext;
+}
+
+}  // namespace kv_server
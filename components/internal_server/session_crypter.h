@@ -0,0 +1,78 @@
+/*
+ * Copyright 2023 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef COMPONENTS_INTERNAL_SERVER_SESSION_CRYPTER_H_
+#define COMPONENTS_INTERNAL_SERVER_SESSION_CRYPTER_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "absl/status/statusor.h"
+#include "openssl/aead.h"
+
+namespace kv_server {
+
+// Encrypts the messages of a `SecureLookupStream` with the symmetric key of
+// the stream, which is exchanged once per stream over OHTTP.
+// Every message is sealed with AES-256-GCM under a nonce made of its direction
+// and the id of its lookup, so an id must not be used twice with the same key.
+// Thread safe.
+class SessionCrypter {
+ public:
+  static constexpr int kKeyLength = 32;
+
+  // Returns a new random key, or an error if no randomness is available.
+  static absl::StatusOr<std::string> GenerateKey();
+
+  // Returns an error if `key` isn't `kKeyLength` bytes long.
+  static absl::StatusOr<std::unique_ptr<SessionCrypter>> Create(
+      std::string_view key);
+
+  SessionCrypter(const SessionCrypter&) = delete;
+  SessionCrypter& operator=(const SessionCrypter&) = delete;
+  ~SessionCrypter();
+
+  // Encrypts the request of lookup `id`. Called by the client.
+  absl::StatusOr<std::string> SealRequest(uint64_t id,
+                                          std::string_view request) const;
+  // Decrypts the request of lookup `id`. Called by the server.
+  absl::StatusOr<std::string> OpenRequest(uint64_t id,
+                                          std::string_view sealed) const;
+  // Encrypts the response of lookup `id`. Called by the server.
+  absl::StatusOr<std::string> SealResponse(uint64_t id,
+                                           std::string_view response) const;
+  // Decrypts the response of lookup `id`. Called by the client.
+  absl::StatusOr<std::string> OpenResponse(uint64_t id,
+                                           std::string_view sealed) const;
+
+ private:
+  enum class Direction : uint8_t { kRequest = 0, kResponse = 1 };
+
+  SessionCrypter() = default;
+
+  absl::StatusOr<std::string> Seal(Direction direction, uint64_t id,
+                                   std::string_view plaintext) const;
+  absl::StatusOr<std::string> Open(Direction direction, uint64_t id,
+                                   std::string_view sealed) const;
+
+  EVP_AEAD_CTX context_;
+};
+
+}  // namespace kv_server
+
+#endif  // COMPONENTS_INTERNAL_SERVER_SESSION_CRYPTER_H_
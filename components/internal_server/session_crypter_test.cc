@@ -0,0 +1,112 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "components/internal_server/session_crypter.h"
+
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace kv_server {
+namespace {
+
+TEST(SessionCrypterTest, GenerateKey) {
+  auto key = SessionCrypter::GenerateKey();
+  ASSERT_TRUE(key.ok()) << key.status();
+  EXPECT_EQ(key->size(), SessionCrypter::kKeyLength);
+  auto other_key = SessionCrypter::GenerateKey();
+  ASSERT_TRUE(other_key.ok()) << other_key.status();
+  EXPECT_NE(*key, *other_key);
+}
+
+TEST(SessionCrypterTest, CreateWithInvalidKeyFails) {
+  EXPECT_EQ(SessionCrypter::Create("short").status().code(),
+            absl::StatusCode::kInvalidArgument);
+}
+
+TEST(SessionCrypterTest, RequestRoundTrip) {
+  auto key = SessionCrypter::GenerateKey();
+  ASSERT_TRUE(key.ok()) << key.status();
+  auto client = SessionCrypter::Create(*key);
+  ASSERT_TRUE(client.ok());
+  auto server = SessionCrypter::Create(*key);
+  ASSERT_TRUE(server.ok());
+
+  auto sealed = (*client)->SealRequest(1, "request");
+  ASSERT_TRUE(sealed.ok());
+  EXPECT_EQ(sealed->find("request"), std::string::npos);
+  auto opened = (*server)->OpenRequest(1, *sealed);
+  ASSERT_TRUE(opened.ok());
+  EXPECT_EQ(*opened, "request");
+}
+
+TEST(SessionCrypterTest, ResponseRoundTrip) {
+  auto crypter = SessionCrypter::Create(*SessionCrypter::GenerateKey());
+  ASSERT_TRUE(crypter.ok());
+  auto sealed = (*crypter)->SealResponse(7, "");
+  ASSERT_TRUE(sealed.ok());
+  auto opened = (*crypter)->OpenResponse(7, *sealed);
+  ASSERT_TRUE(opened.ok());
+  EXPECT_EQ(*opened, "");
+}
+
+TEST(SessionCrypterTest, SealedSizeOnlyDependsOnPlaintextSize) {
+  auto crypter = SessionCrypter::Create(*SessionCrypter::GenerateKey());
+  ASSERT_TRUE(crypter.ok());
+  auto first = (*crypter)->SealRequest(1, "aaaa");
+  ASSERT_TRUE(first.ok());
+  auto second = (*crypter)->SealRequest(2, "bbbb");
+  ASSERT_TRUE(second.ok());
+  EXPECT_EQ(first->size(), second->size());
+  EXPECT_NE(*first, *second);
+}
+
+TEST(SessionCrypterTest, OpenWithOtherIdFails) {
+  auto crypter = SessionCrypter::Create(*SessionCrypter::GenerateKey());
+  ASSERT_TRUE(crypter.ok());
+  auto sealed = (*crypter)->SealRequest(1, "request");
+  ASSERT_TRUE(sealed.ok());
+  EXPECT_FALSE((*crypter)->OpenRequest(2, *sealed).ok());
+}
+
+TEST(SessionCrypterTest, OpenResponseOfRequestFails) {
+  auto crypter = SessionCrypter::Create(*SessionCrypter::GenerateKey());
+  ASSERT_TRUE(crypter.ok());
+  auto sealed = (*crypter)->SealRequest(1, "request");
+  ASSERT_TRUE(sealed.ok());
+  EXPECT_FALSE((*crypter)->OpenResponse(1, *sealed).ok());
+}
+
+TEST(SessionCrypterTest, OpenWithOtherKeyFails) {
+  auto client = SessionCrypter::Create(*SessionCrypter::GenerateKey());
+  ASSERT_TRUE(client.ok());
+  auto server = SessionCrypter::Create(*SessionCrypter::GenerateKey());
+  ASSERT_TRUE(server.ok());
+  auto sealed = (*client)->SealRequest(1, "request");
+  ASSERT_TRUE(sealed.ok());
+  EXPECT_FALSE((*server)->OpenRequest(1, *sealed).ok());
+}
+
+TEST(SessionCrypterTest, OpenTamperedMessageFails) {
+  auto crypter = SessionCrypter::Create(*SessionCrypter::GenerateKey());
+  ASSERT_TRUE(crypter.ok());
+  auto sealed = (*crypter)->SealRequest(1, "request");
+  ASSERT_TRUE(sealed.ok());
+  (*sealed)[0] ^= 1;
+  EXPECT_FALSE((*crypter)->OpenRequest(1, *sealed).ok());
+  EXPECT_FALSE((*crypter)->OpenRequest(1, "").ok());
+}
+
+}  // namespace
+}  // namespace kv_server
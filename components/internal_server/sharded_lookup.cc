@@ -14,24 +14,71 @@
 #include "components/internal_server/sharded_lookup.h"
 
 #include <algorithm>
+#include <cstdint>
+#include <deque>
 #include <future>
 #include <memory>
+#include <optional>
 #include <string>
 #include <string_view>
 #include <utility>
 #include <vector>
 
+#include "absl/flags/flag.h"
+#include "absl/functional/any_invocable.h"
 #include "absl/log/check.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "components/internal_server/circuit_breaker.h"
+#include "components/internal_server/hedging_delay.h"
 #include "components/internal_server/lookup.h"
 #include "components/internal_server/lookup.pb.h"
+#include "components/internal_server/near_cache.h"
+#include "components/internal_server/padding_policy.h"
 #include "components/internal_server/remote_lookup_client.h"
+#include "components/internal_server/run_query_result.h"
 #include "components/query/driver.h"
-#include "components/query/scanner.h"
+#include "components/query/parse_query.h"
+#include "components/query/set_sketch.h"
 #include "components/sharding/shard_manager.h"
 #include "glog/logging.h"
-#include "pir/hashing/sha256_hash_family.h"
+#include "google/protobuf/arena.h"
+#include "public/sharding/sharding_function.h"
 #include "src/cpp/telemetry/metrics_recorder.h"
 
+ABSL_FLAG(double, shard_request_hedging_percentile, 0,
+          "Percentile of the latencies of recent requests to remote shards "
+          "after which a request that has not completed yet is also sent to "
+          "another replica of its shard. The first response is used and the "
+          "other request is cancelled. 0 disables hedging.");
+ABSL_FLAG(absl::Duration, shard_request_hedging_min_delay,
+          absl::Milliseconds(1),
+          "Minimum time to wait for a remote shard before hedging the request. "
+          "Only used with --shard_request_hedging_percentile.");
+ABSL_FLAG(kv_server::PaddingPolicy, shard_request_padding,
+          kv_server::PaddingPolicy(),
+          "Size that the requests of a lookup to the shards are padded to: "
+          "'max' pads them to the largest of them, 'pow2' to the smallest "
+          "power of two that fits the largest, and a list of increasing "
+          "sizes, e.g. '1024,4096,16384', to the smallest of them that fits "
+          "the largest, or a multiple of the last one.");
+ABSL_FLAG(bool, shard_lookup_partial_results, false,
+          "If true, a lookup whose remote shards partly fail returns the "
+          "results of the other shards, and marks the keys of the failed "
+          "shards as unavailable, instead of failing as a whole. Queries "
+          "that use a set of a failed shard still fail.");
+ABSL_FLAG(bool, shard_near_cache_skip_fan_out, false,
+          "If true, a lookup whose remote keys are all in the near cache "
+          "sends no request to the remote shards. This saves the padded "
+          "requests, but lets an observer of the network tell which lookups "
+          "were served from the cache. Only used with "
+          "--shard_near_cache_capacity.");
+
 namespace kv_server {
 namespace {
 
@@ -41,6 +88,7 @@ using privacy_sandbox::server_common::ScopeLatencyRecorder;
 
 constexpr char kShardedLookupGrpcFailure[] = "ShardedLookupGrpcFailure";
 constexpr char kInternalRunQuery[] = "InternalRunQuery";
+constexpr char kInternalRunQueries[] = "InternalRunQueries";
 constexpr char kInternalRunQueryQueryFailure[] = "InternalRunQueryQueryFailure";
 constexpr char kInternalRunQueryKeysetRetrievalFailure[] =
     "InternalRunQueryKeysetRetrievalFailure";
@@ -57,25 +105,71 @@ constexpr char kShardedLookupServerRequestFailed[] =
     "ShardedLookupServerRequestFailed";
 constexpr char kLookupFuturesCreationFailure[] = "LookupFuturesCreationFailure";
 constexpr char kShardedLookupFailure[] = "ShardedLookupFailure";
+constexpr char kShardedLookupShardRequest[] = "ShardedLookupShardRequest";
+constexpr char kShardedLookupHedgedRequest[] = "ShardedLookupHedgedRequest";
+constexpr char kShardedLookupHedgeWin[] = "ShardedLookupHedgeWin";
+constexpr char kShardedLookupShardTimeout[] = "ShardedLookupShardTimeout";
+constexpr char kShardedLookupCircuitOpened[] = "ShardedLookupCircuitOpened";
+constexpr char kShardedLookupCircuitRejected[] = "ShardedLookupCircuitRejected";
+constexpr char kShardedLookupPartialResult[] = "ShardedLookupPartialResult";
+constexpr char kShardedLookupNearCacheHit[] = "ShardedLookupNearCacheHit";
+constexpr char kShardedLookupNearCacheMiss[] = "ShardedLookupNearCacheMiss";
+
+const absl::flat_hash_set<std::string_view>& EmptyKeySet() {
+  static const auto* kEmptySet = new absl::flat_hash_set<std::string_view>();
+  return *kEmptySet;
+}
+
+int CountFailedQueries(const InternalRunQueriesResponse& response) {
+  return std::count_if(
+      response.results().begin(), response.results().end(),
+      [](const RunQueryResult& result) { return result.has_status(); });
+}
 
-void UpdateResponse(
-    const std::vector<std::string_view>& key_list,
-    ::google::protobuf::Map<std::string, ::kv_server::SingleLookupResult>&
-        kv_pairs,
-    InternalLookupResponse& response) {
+// Calls `fn` with each key of `key_list` sent to a shard and its result in
+// `shard_response`, or nullptr if the shard returned no result for the key.
+// The results are in the order of the keys, unless the shard predates
+// positional results and keyed them in `kv_pairs` instead. The local shard
+// always keys them.
+template <typename Fn>
+void ForEachShardResult(const std::vector<std::string_view>& key_list,
+                        InternalLookupResponse& shard_response, Fn fn) {
+  if (shard_response.results_size() == static_cast<int>(key_list.size())) {
+    for (int i = 0; i < shard_response.results_size(); i++) {
+      fn(key_list[i], shard_response.mutable_results(i));
+    }
+    return;
+  }
+  auto& kv_pairs = *shard_response.mutable_kv_pairs();
   for (const auto& key : key_list) {
     const auto key_iter = kv_pairs.find(key);
-    if (key_iter == kv_pairs.end()) {
-      SingleLookupResult result;
-      auto status = result.mutable_status();
-      status->set_code(static_cast<int>(absl::StatusCode::kNotFound));
-      (*response.mutable_kv_pairs())[key] = std::move(result);
-    } else {
-      (*response.mutable_kv_pairs())[key] = std::move(key_iter->second);
-    }
+    fn(key, key_iter == kv_pairs.end() ? nullptr : &key_iter->second);
   }
 }
 
+void UpdateResponse(const std::vector<std::string_view>& key_list,
+                    InternalLookupResponse& shard_response,
+                    InternalLookupResponse& response) {
+  auto& results = *response.mutable_kv_pairs();
+  ForEachShardResult(
+      key_list, shard_response,
+      [&results](std::string_view key, SingleLookupResult* result) {
+        if (result == nullptr) {
+          results[key].mutable_status()->set_code(
+              static_cast<int>(absl::StatusCode::kNotFound));
+        } else {
+          results[key] = std::move(*result);
+        }
+      });
+}
+
+SingleLookupResult NotFoundResult() {
+  SingleLookupResult result;
+  result.mutable_status()->set_code(
+      static_cast<int>(absl::StatusCode::kNotFound));
+  return result;
+}
+
 void SetRequestFailed(const std::vector<std::string_view>& key_list,
                       InternalLookupResponse& response) {
   SingleLookupResult result;
@@ -88,24 +182,246 @@ void SetRequestFailed(const std::vector<std::string_view>& key_list,
   LOG(ERROR) << "Sharded lookup failed:" << response.DebugString();
 }
 
+void SetUnavailable(SingleLookupResult& result) {
+  auto status = result.mutable_status();
+  status->set_code(static_cast<int>(absl::StatusCode::kUnavailable));
+  status->set_message("Shard unavailable");
+}
+
+// Returns an error if a set of the query of `driver` is unavailable, since
+// the result of e.g. a difference or an intersection can't be told without it.
+absl::Status CheckQueryKeysAvailable(
+    const Driver& driver,
+    const absl::flat_hash_set<std::string_view>& unavailable_keys) {
+  std::vector<std::string_view> missing_keys;
+  for (const auto key : driver.GetRootNode()->Keys()) {
+    if (unavailable_keys.contains(key)) {
+      missing_keys.push_back(key);
+    }
+  }
+  if (missing_keys.empty()) {
+    return absl::OkStatus();
+  }
+  std::sort(missing_keys.begin(), missing_keys.end());
+  return absl::UnavailableError(absl::StrCat(
+      "Sets of unavailable shards: ", absl::StrJoin(missing_keys, ", ")));
+}
+
+// A request to a remote shard, which may be hedged, i.e. sent to a second
+// replica of the shard as well. Its future is completed with the first
+// successful response, or with the last error if no request succeeded, and the
+// other request is then cancelled.
+class ShardCall : public std::enable_shared_from_this<ShardCall> {
+ public:
+  ShardCall(MetricsRecorder& metrics_recorder, HedgingDelay* hedging_delay)
+      : metrics_recorder_(metrics_recorder), hedging_delay_(hedging_delay) {}
+
+  std::future<absl::StatusOr<InternalLookupResponse>> GetFuture() {
+    return response_.get_future();
+  }
+
+  // Sends the request to `client`, unless a response was already received,
+  // in which case false is returned. `is_hedge` is true for the request to
+  // the second replica.
+  bool Send(const RemoteLookupClient& client,
+            std::string_view serialized_request, int32_t padding,
+            bool is_hedge) {
+    {
+      absl::MutexLock lock(&mutex_);
+      if (done_) {
+        return false;
+      }
+      in_flight_++;
+    }
+    auto cancel = client.GetValuesAsync(
+        serialized_request, padding,
+        [call = shared_from_this(),
+         is_hedge](absl::StatusOr<InternalLookupResponse> response) {
+          call->OnResponse(is_hedge, std::move(response));
+        });
+    {
+      absl::MutexLock lock(&mutex_);
+      if (!done_) {
+        cancel_calls_.push_back(std::move(cancel));
+        return true;
+      }
+    }
+    // The call completed meanwhile, possibly with this request.
+    cancel();
+    return true;
+  }
+
+  // Completes the future with `status` and cancels the requests in flight,
+  // unless a response was already received, in which case false is returned.
+  bool Abandon(absl::Status status) {
+    std::vector<absl::AnyInvocable<void()>> cancel_calls;
+    {
+      absl::MutexLock lock(&mutex_);
+      if (done_) {
+        return false;
+      }
+      done_ = true;
+      cancel_calls = std::move(cancel_calls_);
+    }
+    for (auto& cancel : cancel_calls) {
+      cancel();
+    }
+    response_.set_value(std::move(status));
+    return true;
+  }
+
+ private:
+  void OnResponse(bool is_hedge,
+                  absl::StatusOr<InternalLookupResponse> response) {
+    std::vector<absl::AnyInvocable<void()>> cancel_calls;
+    {
+      absl::MutexLock lock(&mutex_);
+      in_flight_--;
+      // An error is only returned once the other request can't succeed.
+      if (done_ || (!response.ok() && in_flight_ > 0)) {
+        return;
+      }
+      done_ = true;
+      cancel_calls = std::move(cancel_calls_);
+    }
+    for (auto& cancel : cancel_calls) {
+      cancel();
+    }
+    if (response.ok()) {
+      if (is_hedge) {
+        metrics_recorder_.IncrementEventCounter(kShardedLookupHedgeWin);
+      }
+      if (hedging_delay_ != nullptr) {
+        hedging_delay_->RecordLatency(absl::Now() - start_);
+      }
+    }
+    response_.set_value(std::move(response));
+  }
+
+  const absl::Time start_ = absl::Now();
+  MetricsRecorder& metrics_recorder_;
+  HedgingDelay* const hedging_delay_;
+  std::promise<absl::StatusOr<InternalLookupResponse>> response_;
+  absl::Mutex mutex_;
+  int in_flight_ ABSL_GUARDED_BY(mutex_) = 0;
+  bool done_ ABSL_GUARDED_BY(mutex_) = false;
+  std::vector<absl::AnyInvocable<void()>> cancel_calls_
+      ABSL_GUARDED_BY(mutex_);
+};
+
+// The responses of the shards to one lookup, which are waited for until the
+// deadline of the lookup. The remote shards that haven't responded by then are
+// abandoned: their requests are cancelled, so that the gRPC calls and the
+// callbacks are released right away, and their response is a
+// `DeadlineExceeded` error. The remote shards whose response is never asked
+// for, e.g. because another shard failed first, are abandoned on destruction.
+// The outcome of the remote shards is recorded in their circuit breaker.
+class ShardResponses {
+ public:
+  ShardResponses(int32_t num_shards, absl::Time deadline,
+                 MetricsRecorder& metrics_recorder)
+      : futures_(num_shards),
+        calls_(num_shards),
+        circuit_breakers_(num_shards),
+        deadline_(deadline),
+        metrics_recorder_(metrics_recorder) {}
+
+  ShardResponses(ShardResponses&&) = default;
+
+  ~ShardResponses() {
+    for (auto& call : calls_) {
+      if (call != nullptr) {
+        call->Abandon(absl::CancelledError("The lookup was abandoned."));
+      }
+    }
+  }
+
+  absl::Time deadline() const { return deadline_; }
+
+  // `circuit_breaker` may be nullptr.
+  void SetRemote(int32_t shard_num, std::shared_ptr<ShardCall> call,
+                 CircuitBreaker* circuit_breaker) {
+    futures_[shard_num] = call->GetFuture();
+    calls_[shard_num] = std::move(call);
+    circuit_breakers_[shard_num] = circuit_breaker;
+  }
+
+  // Sets the response of a shard that no request is sent to, e.g. the local
+  // one.
+  void SetResponse(int32_t shard_num,
+                   absl::StatusOr<InternalLookupResponse> response) {
+    std::promise<absl::StatusOr<InternalLookupResponse>> promise;
+    futures_[shard_num] = promise.get_future();
+    promise.set_value(std::move(response));
+  }
+
+  // Returns the call to remote shard `shard_num` if it hasn't responded by
+  // `time`, or nullptr.
+  ShardCall* GetPendingCall(int32_t shard_num, absl::Time time) const {
+    if (calls_[shard_num] == nullptr ||
+        futures_[shard_num].wait_until(absl::ToChronoTime(time)) ==
+            std::future_status::ready) {
+      return nullptr;
+    }
+    return calls_[shard_num].get();
+  }
+
+  // Waits for the response of `shard_num` until the deadline. Can only be
+  // called once per shard.
+  absl::StatusOr<InternalLookupResponse> Get(int32_t shard_num) {
+    if (deadline_ != absl::InfiniteFuture() &&
+        GetPendingCall(shard_num, deadline_) != nullptr &&
+        calls_[shard_num]->Abandon(absl::DeadlineExceededError(
+            "The shard did not respond before the deadline."))) {
+      metrics_recorder_.IncrementEventCounter(kShardedLookupShardTimeout);
+    }
+    auto response = futures_[shard_num].get();
+    if (CircuitBreaker* circuit_breaker = circuit_breakers_[shard_num];
+        circuit_breaker != nullptr) {
+      if (response.ok()) {
+        circuit_breaker->RecordSuccess();
+      } else if (circuit_breaker->RecordFailure(absl::Now())) {
+        metrics_recorder_.IncrementEventCounter(kShardedLookupCircuitOpened);
+      }
+    }
+    return response;
+  }
+
+ private:
+  std::vector<std::future<absl::StatusOr<InternalLookupResponse>>> futures_;
+  std::vector<std::shared_ptr<ShardCall>> calls_;
+  std::vector<CircuitBreaker*> circuit_breakers_;
+  absl::Time deadline_;
+  MetricsRecorder& metrics_recorder_;
+};
+
 class ShardedLookup : public Lookup {
  public:
   explicit ShardedLookup(
       const Lookup& local_lookup, const int32_t num_shards,
       const int32_t current_shard_num, const ShardManager& shard_manager,
       privacy_sandbox::server_common::MetricsRecorder& metrics_recorder,
-      // We're currently going with a default empty string and not
-      // allowing AdTechs to modify it.
-      const std::string hashing_seed)
+      NearCache* near_cache, ShardingFunction sharding_function)
       : local_lookup_(local_lookup),
         num_shards_(num_shards),
         current_shard_num_(current_shard_num),
-        hashing_seed_(hashing_seed),
-        hash_function_(
-            distributed_point_functions::SHA256HashFunction(hashing_seed_)),
+        sharding_function_(std::move(sharding_function)),
         shard_manager_(shard_manager),
-        metrics_recorder_(metrics_recorder) {
+        metrics_recorder_(metrics_recorder),
+        near_cache_(near_cache),
+        padding_policy_(absl::GetFlag(FLAGS_shard_request_padding)),
+        lookup_timeout_(absl::GetFlag(FLAGS_shard_lookup_timeout)),
+        partial_results_(absl::GetFlag(FLAGS_shard_lookup_partial_results)),
+        skip_fan_out_on_near_cache_hit_(
+            absl::GetFlag(FLAGS_shard_near_cache_skip_fan_out)) {
     CHECK_GT(num_shards, 1) << "num_shards for ShardedLookup must be > 1";
+    const double hedging_percentile =
+        absl::GetFlag(FLAGS_shard_request_hedging_percentile);
+    if (hedging_percentile > 0) {
+      hedging_delay_ = std::make_unique<HedgingDelay>(
+          hedging_percentile,
+          absl::GetFlag(FLAGS_shard_request_hedging_min_delay));
+    }
   }
 
   // Iterates over all keys specified in the `request` and assigns them to shard
@@ -127,89 +443,267 @@ class ShardedLookup : public Lookup {
     if (keys.empty()) {
       return response;
     }
-    absl::flat_hash_map<std::string, absl::flat_hash_set<std::string>> key_sets;
-    auto get_key_value_set_result_maybe = GetShardedKeyValueSet(keys);
+    absl::flat_hash_set<std::string_view> unavailable_keys;
+    auto get_key_value_set_result_maybe =
+        GetShardedKeyValueSet(keys, unavailable_keys);
     if (!get_key_value_set_result_maybe.ok()) {
       metrics_recorder_.IncrementEventCounter(
           kInternalRunQueryKeysetRetrievalFailure);
       return get_key_value_set_result_maybe.status();
     }
-    key_sets = *std::move(get_key_value_set_result_maybe);
+    const ShardedKeySets key_sets = *std::move(get_key_value_set_result_maybe);
+
+    auto& results = *response.mutable_kv_pairs();
+    for (const auto& key : keys) {
+      SingleLookupResult& result = results[key];
+      const auto key_iter = key_sets.sets.find(key);
+      if (unavailable_keys.contains(key)) {
+        SetUnavailable(result);
+      } else if (const auto uint32_iter = key_sets.uint32_sets.find(key);
+                 uint32_iter != key_sets.uint32_sets.end()) {
+        result.mutable_keyset_values()->mutable_uint32_values()->Add(
+            uint32_iter->second.begin(), uint32_iter->second.end());
+      } else if (const auto uint64_iter = key_sets.uint64_sets.find(key);
+                 uint64_iter != key_sets.uint64_sets.end()) {
+        result.mutable_keyset_values()->mutable_uint64_values()->Add(
+            uint64_iter->second.begin(), uint64_iter->second.end());
+      } else if (key_iter == key_sets.sets.end()) {
+        auto status = result.mutable_status();
+        status->set_code(static_cast<int>(absl::StatusCode::kNotFound));
+        metrics_recorder_.IncrementEventCounter(kKeySetNotFound);
+      } else {
+        auto* values = result.mutable_keyset_values()->mutable_values();
+        values->Reserve(key_iter->second.size());
+        for (const auto value : key_iter->second) {
+          values->Add(std::string(value));
+        }
+      }
+    }
+    return response;
+  }
 
+  absl::StatusOr<InternalLookupResponse> GetKeyValueSetSketches(
+      const absl::flat_hash_set<std::string_view>& keys) const override {
+    InternalLookupResponse response;
+    if (keys.empty()) {
+      return response;
+    }
+    absl::flat_hash_set<std::string_view> unavailable_keys;
+    auto sketches = GetShardedKeyValueSetSketches(keys, unavailable_keys);
+    if (!sketches.ok()) {
+      metrics_recorder_.IncrementEventCounter(
+          kInternalRunQueryKeysetRetrievalFailure);
+      return sketches.status();
+    }
+    auto& results = *response.mutable_kv_pairs();
     for (const auto& key : keys) {
-      SingleLookupResult result;
-      const auto key_iter = key_sets.find(key);
-      if (key_iter == key_sets.end()) {
+      SingleLookupResult& result = results[key];
+      const auto sketch_itr = sketches->find(key);
+      if (unavailable_keys.contains(key)) {
+        SetUnavailable(result);
+      } else if (sketch_itr == sketches->end()) {
         auto status = result.mutable_status();
         status->set_code(static_cast<int>(absl::StatusCode::kNotFound));
         metrics_recorder_.IncrementEventCounter(kKeySetNotFound);
       } else {
-        auto keyset_values = result.mutable_keyset_values();
-        keyset_values->mutable_values()->Add(key_iter->second.begin(),
-                                             key_iter->second.end());
+        *result.mutable_keyset_sketch() = ToKeysetSketch(sketch_itr->second);
+      }
+    }
+    return response;
+  }
+
+  // Only the shard holding the set of `key` is sent the candidates, while
+  // the other shards are sent padded requests without keys.
+  absl::StatusOr<InternalLookupResponse> GetKeyValueSetMembership(
+      std::string_view key,
+      absl::Span<const std::string_view> candidates) const override {
+    const auto shard_lookup_inputs =
+        ShardKeys({key}, LookupType::kMembership, candidates);
+    auto responses = GetLookupFutures(
+        shard_lookup_inputs,
+        [this, candidates](const std::vector<std::string_view>& key_list) {
+          return GetLocalKeyValueSetMembership(key_list, candidates);
+        });
+    if (!responses.ok()) {
+      metrics_recorder_.IncrementEventCounter(kLookupFuturesCreationFailure);
+      return responses.status();
+    }
+    InternalLookupResponse response;
+    for (int shard_num = 0; shard_num < num_shards_; shard_num++) {
+      auto& shard_lookup_input = shard_lookup_inputs[shard_num];
+      auto result = responses->Get(shard_num);
+      if (!result.ok()) {
+        metrics_recorder_.IncrementEventCounter(kShardedLookupFailure);
+        if (!CanSkipFailedShard(shard_lookup_input)) {
+          return result.status();
+        }
+        for (const auto shard_key : shard_lookup_input.keys) {
+          SetUnavailable((*response.mutable_kv_pairs())[shard_key]);
+        }
+        continue;
       }
-      (*response.mutable_kv_pairs())[key] = std::move(result);
+      ForEachShardResult(
+          shard_lookup_input.keys, *result,
+          [&response](std::string_view result_key,
+                      SingleLookupResult* membership) {
+            if (membership != nullptr) {
+              (*response.mutable_kv_pairs())[result_key] =
+                  std::move(*membership);
+            }
+          });
     }
     return response;
   }
 
   absl::StatusOr<InternalRunQueryResponse> RunQuery(
       std::string query) const override {
+    InternalRunQueryRequest request;
+    request.set_query(std::move(query));
+    return ExecuteQuery(request);
+  }
+
+  absl::StatusOr<InternalRunQueryResponse> ExecuteQuery(
+      const InternalRunQueryRequest& request) const override {
     ScopeLatencyRecorder latency_recorder(std::string(kInternalRunQuery),
                                           metrics_recorder_);
     InternalRunQueryResponse response;
-    if (query.empty()) {
+    if (request.query().empty()) {
       metrics_recorder_.IncrementEventCounter(kInternalRunQueryEmtpyQuery);
       return response;
     }
 
-    absl::flat_hash_map<std::string, absl::flat_hash_set<std::string>> keysets;
+    // The driver borrows the fetched sets, which are views of the responses
+    // of the shards.
+    ShardedKeySets keysets;
     auto& metrics_recorder = metrics_recorder_;
-    kv_server::Driver driver([&keysets,
-                              &metrics_recorder](std::string_view key) {
-      const auto key_iter = keysets.find(key);
-      if (key_iter == keysets.end()) {
-        VLOG(8) << "Driver can't find " << key << "key_set. Returning empty.";
-        metrics_recorder.IncrementEventCounter(kInternalRunQueryMissingKeyset);
-        absl::flat_hash_set<std::string_view> set;
-        return set;
-      } else {
-        absl::flat_hash_set<std::string_view> set(key_iter->second.begin(),
-                                                  key_iter->second.end());
-        return set;
-      }
-    });
-    std::istringstream stream(query);
-    kv_server::Scanner scanner(stream);
-    kv_server::Parser parse(driver, scanner);
-    int parse_result = parse();
+    kv_server::Driver driver(
+        [&keysets, &metrics_recorder](std::string_view key)
+            -> const absl::flat_hash_set<std::string_view>& {
+          const auto* value_set = keysets.GetValueSet(key);
+          if (value_set == nullptr) {
+            VLOG(8) << "Driver can't find " << key
+                    << "key_set. Returning empty.";
+            metrics_recorder.IncrementEventCounter(
+                kInternalRunQueryMissingKeyset);
+            return EmptyKeySet();
+          }
+          return *value_set;
+        });
+    int parse_result = ParseQuery(driver, request.query());
     if (parse_result) {
       metrics_recorder_.IncrementEventCounter(kInternalRunQueryParsingFailure);
       return absl::InvalidArgumentError("Parsing failure.");
     }
+    absl::flat_hash_set<std::string_view> unavailable_keys;
+    if (request.result_mode() == RunQueryResultMode::APPROXIMATE_COUNT) {
+      // Only the sketches of the sets are fetched from the shards.
+      auto sketches = GetShardedKeyValueSetSketches(
+          driver.GetRootNode()->Keys(), unavailable_keys);
+      if (!sketches.ok()) {
+        metrics_recorder_.IncrementEventCounter(
+            kInternalRunQueryKeysetRetrievalFailure);
+        return sketches.status();
+      }
+      if (auto status = CheckQueryKeysAvailable(driver, unavailable_keys);
+          !status.ok()) {
+        metrics_recorder_.IncrementEventCounter(
+            kInternalRunQueryKeysetRetrievalFailure);
+        return status;
+      }
+      return BuildApproximateCountResponse(driver, *sketches);
+    }
     auto get_key_value_set_result_maybe =
-        GetShardedKeyValueSet(driver.GetRootNode()->Keys());
+        GetShardedKeyValueSet(driver.GetRootNode()->Keys(), unavailable_keys);
     if (!get_key_value_set_result_maybe.ok()) {
       metrics_recorder_.IncrementEventCounter(
           kInternalRunQueryKeysetRetrievalFailure);
       return get_key_value_set_result_maybe.status();
     }
+    if (auto status = CheckQueryKeysAvailable(driver, unavailable_keys);
+        !status.ok()) {
+      metrics_recorder_.IncrementEventCounter(
+          kInternalRunQueryKeysetRetrievalFailure);
+      return status;
+    }
     keysets = std::move(*get_key_value_set_result_maybe);
-    auto result = driver.GetResult();
+    auto result = BuildRunQueryResponse(driver, request, &keysets);
     if (!result.ok()) {
       metrics_recorder_.IncrementEventCounter(kInternalRunQueryQueryFailure);
       return result.status();
     }
-    VLOG(8) << "Driver results for query " << query;
-    for (const auto& value : *result) {
-      VLOG(8) << "Value: " << value << "\n";
-    }
+    VLOG(8) << "Driver results for query " << request.query() << ": "
+            << result->DebugString();
+    return result;
+  }
 
-    response.mutable_elements()->Assign(result->begin(), result->end());
+  absl::StatusOr<InternalRunQueriesResponse> RunQueries(
+      const InternalRunQueriesRequest& request) const override {
+    ScopeLatencyRecorder latency_recorder(std::string(kInternalRunQueries),
+                                          metrics_recorder_);
+    // The sets are fetched once for all queries, whose drivers borrow them.
+    ShardedKeySets keysets;
+    std::vector<std::unique_ptr<Driver>> drivers;
+    drivers.reserve(request.queries_size());
+    for (int i = 0; i < request.queries_size(); i++) {
+      drivers.push_back(std::make_unique<Driver>(
+          [&keysets, &metrics_recorder = metrics_recorder_](
+              std::string_view key)
+              -> const absl::flat_hash_set<std::string_view>& {
+            const auto* value_set = keysets.GetValueSet(key);
+            if (value_set == nullptr) {
+              metrics_recorder.IncrementEventCounter(
+                  kInternalRunQueryMissingKeyset);
+              return EmptyKeySet();
+            }
+            return *value_set;
+          }));
+    }
+    InternalRunQueriesResponse response;
+    const auto keys = ParseRunQueries(request, drivers, response);
+    const int parse_failures = CountFailedQueries(response);
+    for (int i = 0; i < parse_failures; i++) {
+      metrics_recorder_.IncrementEventCounter(kInternalRunQueryParsingFailure);
+    }
+    absl::flat_hash_set<std::string_view> unavailable_keys;
+    if (!keys.empty()) {
+      // All queries share a single fan-out for the union of their keys.
+      auto get_key_value_set_result_maybe =
+          GetShardedKeyValueSet(keys, unavailable_keys);
+      if (!get_key_value_set_result_maybe.ok()) {
+        metrics_recorder_.IncrementEventCounter(
+            kInternalRunQueryKeysetRetrievalFailure);
+        return get_key_value_set_result_maybe.status();
+      }
+      keysets = std::move(*get_key_value_set_result_maybe);
+    }
+    BuildRunQueriesResponse(request, drivers, response, &keysets);
+    for (int i = CountFailedQueries(response) - parse_failures; i > 0; i--) {
+      metrics_recorder_.IncrementEventCounter(kInternalRunQueryQueryFailure);
+    }
+    if (!unavailable_keys.empty()) {
+      // Only the queries that use a set of a failed shard fail.
+      for (int i = 0; i < response.results_size(); i++) {
+        if (!response.results(i).has_response()) {
+          continue;
+        }
+        const auto status =
+            CheckQueryKeysAvailable(*drivers[i], unavailable_keys);
+        if (!status.ok()) {
+          metrics_recorder_.IncrementEventCounter(
+              kInternalRunQueryKeysetRetrievalFailure);
+          auto* result_status = response.mutable_results(i)->mutable_status();
+          result_status->set_code(static_cast<int>(status.code()));
+          result_status->set_message(std::string(status.message()));
+        }
+      }
+    }
     return response;
   }
 
  private:
+  // What is looked up for the keys sent to the shards.
+  enum class LookupType { kValues, kSets, kSketches, kMembership };
+
   // Keeps sharded keys and assosiated metdata.
   struct ShardLookupInput {
     // Keys that are being looked up.
@@ -218,30 +712,132 @@ class ShardedLookup : public Lookup {
     // from `keys`.
     std::string serialized_request;
     // Identifies by how many chars `keys` should be padded, so that
-    // all requests add up to the same length.
+    // all requests add up to the same length, picked by `padding_policy_`.
     int32_t padding;
   };
 
+  // The sets of unsigned integers of `ShardedKeySets` that were converted to
+  // decimal strings. Each is allocated once, so that returned sets stay valid.
+  struct DecimalSets {
+    struct DecimalSet {
+      std::vector<std::string> values;
+      absl::flat_hash_set<std::string_view> value_set;
+    };
+
+    template <typename T>
+    const absl::flat_hash_set<std::string_view>& Get(
+        std::string_view key, absl::Span<const T> values) {
+      absl::MutexLock lock(&mutex);
+      auto& decimal_set = sets[key];
+      if (decimal_set == nullptr) {
+        decimal_set = std::make_unique<DecimalSet>();
+        decimal_set->values.reserve(values.size());
+        for (const T value : values) {
+          decimal_set->values.push_back(absl::StrCat(value));
+        }
+        decimal_set->value_set.insert(decimal_set->values.begin(),
+                                      decimal_set->values.end());
+      }
+      return decimal_set->value_set;
+    }
+
+    absl::Mutex mutex;
+    absl::flat_hash_map<std::string, std::unique_ptr<DecimalSet>> sets
+        ABSL_GUARDED_BY(mutex);
+  };
+
+  // The sets fetched for some keys. The values of the sets are views of the
+  // strings and of the packed integers of `responses`, which are not modified
+  // once fetched. Sets of unsigned integers are only converted to strings for
+  // queries that mix them with other sets.
+  struct ShardedKeySets : public SortedSetLookup {
+    // Returns the set of `key` as strings, or nullptr if it has no set.
+    const absl::flat_hash_set<std::string_view>* GetValueSet(
+        std::string_view key) const {
+      if (const auto key_iter = sets.find(key); key_iter != sets.end()) {
+        return &key_iter->second;
+      }
+      if (const auto key_iter = uint32_sets.find(key);
+          key_iter != uint32_sets.end()) {
+        return &decimal_sets->Get(key, key_iter->second);
+      }
+      if (const auto key_iter = uint64_sets.find(key);
+          key_iter != uint64_sets.end()) {
+        return &decimal_sets->Get(key, key_iter->second);
+      }
+      return nullptr;
+    }
+
+    std::optional<absl::Span<const uint32_t>> GetUInt32Set(
+        std::string_view key) const override {
+      if (const auto key_iter = uint32_sets.find(key);
+          key_iter != uint32_sets.end()) {
+        return key_iter->second;
+      }
+      if (sets.contains(key) || uint64_sets.contains(key)) {
+        return std::nullopt;
+      }
+      return absl::Span<const uint32_t>();
+    }
+
+    std::optional<absl::Span<const uint64_t>> GetUInt64Set(
+        std::string_view key) const override {
+      if (const auto key_iter = uint64_sets.find(key);
+          key_iter != uint64_sets.end()) {
+        return key_iter->second;
+      }
+      if (sets.contains(key) || uint32_sets.contains(key)) {
+        return std::nullopt;
+      }
+      return absl::Span<const uint64_t>();
+    }
+
+    std::deque<InternalLookupResponse> responses;
+    absl::flat_hash_map<std::string, absl::flat_hash_set<std::string_view>>
+        sets;
+    absl::flat_hash_map<std::string, absl::Span<const uint32_t>> uint32_sets;
+    absl::flat_hash_map<std::string, absl::Span<const uint64_t>> uint64_sets;
+    std::unique_ptr<DecimalSets> decimal_sets =
+        std::make_unique<DecimalSets>();
+  };
+
   std::vector<ShardLookupInput> BucketKeys(
       const absl::flat_hash_set<std::string_view>& keys) const {
     ShardLookupInput sli;
     std::vector<ShardLookupInput> lookup_inputs(num_shards_, sli);
     for (const auto& key : keys) {
-      int32_t shard_num = hash_function_(key, num_shards_);
+      int32_t shard_num =
+          sharding_function_.GetShardNumForKey(key, num_shards_);
       VLOG(9) << "key: " << key << ", shard number: " << shard_num;
       lookup_inputs[shard_num].keys.emplace_back(key);
     }
     return lookup_inputs;
   }
 
-  void SerializeShardedRequests(std::vector<ShardLookupInput>& lookup_inputs,
-                                bool lookup_sets) const {
+  // `candidates` are only sent to the shards that are sent keys. The requests
+  // only live until they are serialized, so they are all allocated on one
+  // arena.
+  void SerializeShardedRequests(
+      std::vector<ShardLookupInput>& lookup_inputs, LookupType lookup_type,
+      absl::Span<const std::string_view> candidates) const {
+    google::protobuf::Arena arena;
     for (auto& lookup_input : lookup_inputs) {
-      InternalLookupRequest request;
-      request.mutable_keys()->Assign(lookup_input.keys.begin(),
-                                     lookup_input.keys.end());
-      request.set_lookup_sets(lookup_sets);
-      lookup_input.serialized_request = request.SerializeAsString();
+      auto* request =
+          google::protobuf::Arena::CreateMessage<InternalLookupRequest>(
+              &arena);
+      request->mutable_keys()->Assign(lookup_input.keys.begin(),
+                                      lookup_input.keys.end());
+      request->set_lookup_sets(lookup_type == LookupType::kSets);
+      request->set_lookup_sketches(lookup_type == LookupType::kSketches);
+      request->set_lookup_membership(lookup_type == LookupType::kMembership);
+      request->set_positional_results(true);
+      request->set_sharding_function_version(
+          static_cast<int32_t>(sharding_function_.version()));
+      if (!lookup_input.keys.empty()) {
+        request->mutable_candidates()->Assign(candidates.begin(),
+                                              candidates.end());
+      }
+      lookup_input.serialized_request = request->SerializeAsString();
     }
   }
 
@@ -251,51 +847,171 @@ class ShardedLookup : public Lookup {
       max_length =
           std::max(max_length, int32_t(lookup_input.serialized_request.size()));
     }
+    const int32_t padded_length = padding_policy_.GetPaddedSize(max_length);
     for (auto& lookup_input : lookup_inputs) {
       lookup_input.padding =
-          max_length - lookup_input.serialized_request.size();
+          padded_length - lookup_input.serialized_request.size();
     }
   }
 
   std::vector<ShardLookupInput> ShardKeys(
-      const absl::flat_hash_set<std::string_view>& keys,
-      bool lookup_sets) const {
+      const absl::flat_hash_set<std::string_view>& keys, LookupType lookup_type,
+      absl::Span<const std::string_view> candidates = {}) const {
     auto lookup_inputs = BucketKeys(keys);
-    SerializeShardedRequests(lookup_inputs, lookup_sets);
+    SerializeShardedRequests(lookup_inputs, lookup_type, candidates);
     ComputePadding(lookup_inputs);
     return lookup_inputs;
   }
 
-  absl::StatusOr<
-      std::vector<std::future<absl::StatusOr<InternalLookupResponse>>>>
-  GetLookupFutures(const std::vector<ShardLookupInput>& shard_lookup_inputs,
-                   std::function<absl::StatusOr<InternalLookupResponse>(
-                       const std::vector<std::string_view>& key_list)>
-                       get_local_future) const {
-    std::vector<std::future<absl::StatusOr<InternalLookupResponse>>> responses;
+  // Sends the requests to the remote shards without blocking, then looks up
+  // the keys of the current shard inline while the remote requests are in
+  // flight. No thread is created per request: the remote responses complete
+  // the futures from gRPC's threads. With hedging enabled, the remote requests
+  // still pending after the hedging delay are then sent to another replica of
+  // their shard as well. The responses are waited for until
+  // `--shard_lookup_timeout` has passed since the lookup started.
+  // Every remote shard is sent a request, even without keys, so that the
+  // requests don't reveal which shards the keys are on, unless
+  // `near_cache_hit` is set, the near cache already had the results of all
+  // the remote keys and `--shard_near_cache_skip_fan_out` is set, in which
+  // case no request is sent.
+  absl::StatusOr<ShardResponses> GetLookupFutures(
+      const std::vector<ShardLookupInput>& shard_lookup_inputs,
+      std::function<absl::StatusOr<InternalLookupResponse>(
+          const std::vector<std::string_view>& key_list)>
+          get_local_response,
+      bool near_cache_hit = false) const {
+    const absl::Time start = absl::Now();
+    ShardResponses responses(num_shards_, start + lookup_timeout_,
+                             metrics_recorder_);
+    std::vector<const RemoteLookupClient*> clients(num_shards_);
+    const bool send_remote_requests = !near_cache_hit ||
+                                      !skip_fan_out_on_near_cache_hit_ ||
+                                      HasRemoteKeys(shard_lookup_inputs);
     for (int shard_num = 0; shard_num < num_shards_; shard_num++) {
-      auto& shard_lookup_input = shard_lookup_inputs[shard_num];
       if (shard_num == current_shard_num_) {
-        // Eventually this whole branch will go away.
-        responses.push_back(std::async(std::launch::async, get_local_future,
-                                       std::ref(shard_lookup_input.keys)));
-      } else {
-        const auto client = shard_manager_.Get(shard_num);
-        if (client == nullptr) {
-          metrics_recorder_.IncrementEventCounter(kLookupClientMissing);
+        continue;
+      }
+      if (!send_remote_requests) {
+        responses.SetResponse(shard_num, InternalLookupResponse());
+        continue;
+      }
+      auto& shard_lookup_input = shard_lookup_inputs[shard_num];
+      CircuitBreaker* circuit_breaker =
+          shard_manager_.GetCircuitBreaker(shard_num);
+      if (circuit_breaker != nullptr) {
+        const bool allowed = circuit_breaker->AllowRequest(start);
+        metrics_recorder_.RecordHistogramEvent(
+            GetCircuitBreakerOpenMetricName(shard_num), allowed ? 0 : 1);
+        if (!allowed) {
+          metrics_recorder_.IncrementEventCounter(
+              kShardedLookupCircuitRejected);
+          responses.SetResponse(shard_num, absl::UnavailableError(
+                                               "The shard's circuit is open."));
+          continue;
+        }
+      }
+      clients[shard_num] = shard_manager_.Get(shard_num);
+      if (clients[shard_num] == nullptr) {
+        metrics_recorder_.IncrementEventCounter(kLookupClientMissing);
+        if (!partial_results_) {
           return absl::InternalError("Internal lookup client is unavailable.");
         }
-        responses.push_back(std::async(
-            std::launch::async,
-            [client](std::string_view serialized_request, int32_t padding) {
-              return client->GetValues(serialized_request, padding);
-            },
-            shard_lookup_input.serialized_request, shard_lookup_input.padding));
+        responses.SetResponse(
+            shard_num,
+            absl::UnavailableError("Internal lookup client is unavailable."));
+        continue;
       }
+      auto shard_call =
+          std::make_shared<ShardCall>(metrics_recorder_, hedging_delay_.get());
+      shard_call->Send(*clients[shard_num],
+                       shard_lookup_input.serialized_request,
+                       shard_lookup_input.padding,
+                       /*is_hedge=*/false);
+      responses.SetRemote(shard_num, std::move(shard_call), circuit_breaker);
+      metrics_recorder_.IncrementEventCounter(kShardedLookupShardRequest);
+    }
+    // Eventually this will go away.
+    responses.SetResponse(
+        current_shard_num_,
+        get_local_response(shard_lookup_inputs[current_shard_num_].keys));
+    if (hedging_delay_ != nullptr) {
+      HedgePendingRequests(start, shard_lookup_inputs, clients, responses);
     }
     return responses;
   }
 
+  bool HasRemoteKeys(
+      const std::vector<ShardLookupInput>& shard_lookup_inputs) const {
+    for (int shard_num = 0; shard_num < num_shards_; shard_num++) {
+      if (shard_num != current_shard_num_ &&
+          !shard_lookup_inputs[shard_num].keys.empty()) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Adds the results of `keys` that are in the near cache to `cached`, and
+  // the other keys to `uncached_keys`. Returns true if any key was cached.
+  bool GetCachedResults(NearCache::Kind kind,
+                        const absl::flat_hash_set<std::string_view>& keys,
+                        absl::Time now,
+                        absl::flat_hash_set<std::string_view>& uncached_keys,
+                        InternalLookupResponse& cached) const {
+    for (const auto key : keys) {
+      if (auto result = near_cache_->Get(kind, key, now)) {
+        (*cached.mutable_kv_pairs())[key] = *std::move(result);
+      } else {
+        uncached_keys.insert(key);
+      }
+    }
+    const int64_t hits = keys.size() - uncached_keys.size();
+    if (hits > 0) {
+      metrics_recorder_.IncrementEventCounter(kShardedLookupNearCacheHit);
+    }
+    if (!uncached_keys.empty()) {
+      metrics_recorder_.IncrementEventCounter(kShardedLookupNearCacheMiss);
+    }
+    return hits > 0;
+  }
+
+  // Waits until the hedging delay has passed since `start`, and sends the
+  // requests that are still pending to another replica of their shard. The
+  // request is the same serialized and padded one, so the hedge looks the same
+  // as any other request from the outside, but it is encrypted anew, as the
+  // encryption context is bound to a single request. Nothing is hedged past
+  // the deadline of the lookup.
+  void HedgePendingRequests(
+      absl::Time start,
+      const std::vector<ShardLookupInput>& shard_lookup_inputs,
+      const std::vector<const RemoteLookupClient*>& clients,
+      const ShardResponses& responses) const {
+    const absl::Duration delay = hedging_delay_->Get();
+    if (delay == absl::InfiniteDuration() ||
+        start + delay >= responses.deadline()) {
+      return;
+    }
+    for (int shard_num = 0; shard_num < num_shards_; shard_num++) {
+      ShardCall* shard_call =
+          responses.GetPendingCall(shard_num, start + delay);
+      if (shard_call == nullptr) {
+        continue;
+      }
+      const auto client =
+          shard_manager_.GetOtherReplica(shard_num, *clients[shard_num]);
+      if (client == nullptr) {
+        continue;
+      }
+      auto& shard_lookup_input = shard_lookup_inputs[shard_num];
+      if (shard_call->Send(*client, shard_lookup_input.serialized_request,
+                           shard_lookup_input.padding,
+                           /*is_hedge=*/true)) {
+        metrics_recorder_.IncrementEventCounter(kShardedLookupHedgedRequest);
+      }
+    }
+  }
+
   absl::StatusOr<InternalLookupResponse> GetLocalValues(
       const std::vector<std::string_view>& key_list) const {
     InternalLookupResponse response;
@@ -321,102 +1037,293 @@ class ShardedLookup : public Lookup {
     return local_lookup_.GetKeyValueSet(key_list_set);
   }
 
+  absl::StatusOr<InternalLookupResponse> GetLocalKeyValueSetSketches(
+      const std::vector<std::string_view>& key_list) const {
+    if (key_list.empty()) {
+      InternalLookupResponse response;
+      return response;
+    }
+    absl::flat_hash_set<std::string_view> key_list_set(key_list.begin(),
+                                                       key_list.end());
+    return local_lookup_.GetKeyValueSetSketches(key_list_set);
+  }
+
+  absl::StatusOr<InternalLookupResponse> GetLocalKeyValueSetMembership(
+      const std::vector<std::string_view>& key_list,
+      absl::Span<const std::string_view> candidates) const {
+    if (key_list.empty()) {
+      InternalLookupResponse response;
+      return response;
+    }
+    return local_lookup_.GetKeyValueSetMembership(key_list.front(),
+                                                  candidates);
+  }
+
   absl::StatusOr<InternalLookupResponse> ProcessShardedKeys(
       const absl::flat_hash_set<std::string_view>& keys) const {
     InternalLookupResponse response;
     if (keys.empty()) {
       return response;
     }
-    const auto shard_lookup_inputs = ShardKeys(keys, false);
+    const absl::Time start = absl::Now();
+    absl::flat_hash_set<std::string_view> uncached_keys;
+    bool near_cache_hit = false;
+    if (near_cache_ != nullptr) {
+      near_cache_hit = GetCachedResults(NearCache::Kind::kValue, keys, start,
+                                        uncached_keys, response);
+      if (uncached_keys.empty() && skip_fan_out_on_near_cache_hit_) {
+        return response;
+      }
+    }
+    const auto shard_lookup_inputs = ShardKeys(
+        near_cache_ != nullptr ? uncached_keys : keys, LookupType::kValues);
     auto responses =
         GetLookupFutures(shard_lookup_inputs,
                          [this](const std::vector<std::string_view>& key_list) {
                            return GetLocalValues(key_list);
-                         });
+                         },
+                         near_cache_hit);
     if (!responses.ok()) {
       return responses.status();
     }
     // process responses
     for (int shard_num = 0; shard_num < num_shards_; shard_num++) {
       auto& shard_lookup_input = shard_lookup_inputs[shard_num];
-      auto result = (*responses)[shard_num].get();
+      auto result = responses->Get(shard_num);
       if (!result.ok()) {
-        // mark all keys as internal failure
         metrics_recorder_.IncrementEventCounter(
             kShardedLookupServerRequestFailed);
+        if (CanSkipFailedShard(shard_lookup_input)) {
+          for (const auto key : shard_lookup_input.keys) {
+            SetUnavailable((*response.mutable_kv_pairs())[key]);
+          }
+          continue;
+        }
+        // mark all keys as internal failure
         SetRequestFailed(shard_lookup_input.keys, response);
         continue;
       }
-      auto kv_pairs = result->mutable_kv_pairs();
-      UpdateResponse(shard_lookup_input.keys, *kv_pairs, response);
+      UpdateResponse(shard_lookup_input.keys, *result, response);
+      if (near_cache_ != nullptr && shard_num != current_shard_num_) {
+        for (const auto key : shard_lookup_input.keys) {
+          near_cache_->Put(NearCache::Kind::kValue, key,
+                           response.kv_pairs().find(key)->second, start);
+        }
+      }
     }
     return response;
   }
 
-  void CollectKeySets(
-      absl::flat_hash_map<std::string, absl::flat_hash_set<std::string>>&
-          key_sets,
-      InternalLookupResponse& keysets_lookup_response) const {
-    for (auto& [key, keyset_lookup_result] :
-         (*(keysets_lookup_response.mutable_kv_pairs()))) {
-      switch (keyset_lookup_result.single_lookup_result_case()) {
-        case SingleLookupResult::kStatusFieldNumber:
-          // this means it wasn't found, no need to insert an empty set.
-          break;
-        case SingleLookupResult::kKeysetValuesFieldNumber:
-          absl::flat_hash_set<std::string> value_set;
-          for (auto& v : keyset_lookup_result.keyset_values().values()) {
+  // Keeps `keysets_lookup_response` in `key_sets` and adds views of its sets.
+  void CollectKeySets(const std::vector<std::string_view>& key_list,
+                      ShardedKeySets& key_sets,
+                      InternalLookupResponse keysets_lookup_response) const {
+    auto& response =
+        key_sets.responses.emplace_back(std::move(keysets_lookup_response));
+    ForEachShardResult(key_list, response,
+                       [this, &key_sets](std::string_view key,
+                                         SingleLookupResult* result) {
+                         if (result != nullptr) {
+                           CollectKeySet(key, *result, key_sets);
+                         }
+                       });
+  }
+
+  // `keyset_lookup_result` must be in `key_sets.responses`.
+  void CollectKeySet(std::string_view key,
+                     const SingleLookupResult& keyset_lookup_result,
+                     ShardedKeySets& key_sets) const {
+    switch (keyset_lookup_result.single_lookup_result_case()) {
+      case SingleLookupResult::kKeysetValuesFieldNumber: {
+        const auto& keyset_values = keyset_lookup_result.keyset_values();
+        bool inserted;
+        if (!keyset_values.uint32_values().empty()) {
+          inserted = key_sets.uint32_sets
+                         .insert_or_assign(
+                             key, absl::MakeConstSpan(
+                                      keyset_values.uint32_values().data(),
+                                      keyset_values.uint32_values().size()))
+                         .second;
+        } else if (!keyset_values.uint64_values().empty()) {
+          inserted = key_sets.uint64_sets
+                         .insert_or_assign(
+                             key, absl::MakeConstSpan(
+                                      keyset_values.uint64_values().data(),
+                                      keyset_values.uint64_values().size()))
+                         .second;
+        } else {
+          const auto& values = keyset_values.values();
+          absl::flat_hash_set<std::string_view> value_set;
+          value_set.reserve(values.size());
+          for (const auto& v : values) {
             VLOG(8) << "keyset name: " << key << " value: " << v;
-            value_set.emplace(std::move(v));
+            value_set.emplace(v);
           }
-          auto [_, inserted] =
-              key_sets.insert_or_assign(key, std::move(value_set));
-          if (!inserted) {
-            metrics_recorder_.IncrementEventCounter(
-                kShardedLookupServerKeyCollisionOnCollection);
-            LOG(ERROR) << "Key collision, when collecting results from shards: "
-                       << key;
-          }
-          break;
+          inserted =
+              key_sets.sets.insert_or_assign(key, std::move(value_set)).second;
+        }
+        if (!inserted) {
+          metrics_recorder_.IncrementEventCounter(
+              kShardedLookupServerKeyCollisionOnCollection);
+          LOG(ERROR) << "Key collision, when collecting results from shards: "
+                     << key;
+        }
+        break;
       }
+      default:
+        // A status means it wasn't found, no need to insert an empty set.
+        break;
+    }
+  }
+
+  // Returns true if the lookup goes on without the result of the shard of
+  // `shard_lookup_input`, which failed, i.e. in partial-result mode.
+  bool CanSkipFailedShard(const ShardLookupInput& shard_lookup_input) const {
+    if (!partial_results_) {
+      return false;
     }
+    if (!shard_lookup_input.keys.empty()) {
+      metrics_recorder_.IncrementEventCounter(kShardedLookupPartialResult);
+    }
+    return true;
   }
 
-  absl::StatusOr<
-      absl::flat_hash_map<std::string, absl::flat_hash_set<std::string>>>
-  GetShardedKeyValueSet(
-      const absl::flat_hash_set<std::string_view>& key_set) const {
-    const auto shard_lookup_inputs = ShardKeys(key_set, true);
+  // The keys of the shards that failed are added to `unavailable_keys` in
+  // partial-result mode, and make the lookup fail otherwise.
+  absl::StatusOr<ShardedKeySets> GetShardedKeyValueSet(
+      const absl::flat_hash_set<std::string_view>& key_set,
+      absl::flat_hash_set<std::string_view>& unavailable_keys) const {
+    const absl::Time start = absl::Now();
+    ShardedKeySets key_sets;
+    absl::flat_hash_set<std::string_view> uncached_keys;
+    bool near_cache_hit = false;
+    if (near_cache_ != nullptr) {
+      InternalLookupResponse& cached = key_sets.responses.emplace_back();
+      near_cache_hit = GetCachedResults(NearCache::Kind::kSet, key_set, start,
+                                        uncached_keys, cached);
+      for (const auto& [key, result] : cached.kv_pairs()) {
+        CollectKeySet(key, result, key_sets);
+      }
+      if (uncached_keys.empty() && skip_fan_out_on_near_cache_hit_) {
+        return key_sets;
+      }
+    }
+    const auto shard_lookup_inputs = ShardKeys(
+        near_cache_ != nullptr ? uncached_keys : key_set, LookupType::kSets);
     auto responses =
         GetLookupFutures(shard_lookup_inputs,
                          [this](const std::vector<std::string_view>& key_list) {
                            return GetLocalKeyValuesSet(key_list);
-                         });
+                         },
+                         near_cache_hit);
     if (!responses.ok()) {
       metrics_recorder_.IncrementEventCounter(kLookupFuturesCreationFailure);
       return responses.status();
     }
     // process responses
-    absl::flat_hash_map<std::string, absl::flat_hash_set<std::string>> key_sets;
     for (int shard_num = 0; shard_num < num_shards_; shard_num++) {
       auto& shard_lookup_input = shard_lookup_inputs[shard_num];
-      auto result = (*responses)[shard_num].get();
+      auto result = responses->Get(shard_num);
       if (!result.ok()) {
         metrics_recorder_.IncrementEventCounter(kShardedLookupFailure);
-        return result.status();
+        if (!CanSkipFailedShard(shard_lookup_input)) {
+          return result.status();
+        }
+        unavailable_keys.insert(shard_lookup_input.keys.begin(),
+                                shard_lookup_input.keys.end());
+        continue;
+      }
+      if (near_cache_ != nullptr && shard_num != current_shard_num_) {
+        ForEachShardResult(
+            shard_lookup_input.keys, *result,
+            [this, start](std::string_view key,
+                          SingleLookupResult* keyset_result) {
+              near_cache_->Put(
+                  NearCache::Kind::kSet, key,
+                  keyset_result == nullptr ? NotFoundResult() : *keyset_result,
+                  start);
+            });
       }
-      CollectKeySets(key_sets, *result);
+      CollectKeySets(shard_lookup_input.keys, key_sets, *std::move(result));
     }
     return key_sets;
   }
 
+  // Fetches the sketch of the set of each key from the shard that holds it.
+  // Keys without a set are missing from the result. Failed shards are handled
+  // as in `GetShardedKeyValueSet`, except that the lookup fails with
+  // FailedPrecondition if any shard does not maintain sketches.
+  absl::StatusOr<absl::flat_hash_map<std::string, ThetaSketch>>
+  GetShardedKeyValueSetSketches(
+      const absl::flat_hash_set<std::string_view>& key_set,
+      absl::flat_hash_set<std::string_view>& unavailable_keys) const {
+    const auto shard_lookup_inputs = ShardKeys(key_set, LookupType::kSketches);
+    auto responses =
+        GetLookupFutures(shard_lookup_inputs,
+                         [this](const std::vector<std::string_view>& key_list) {
+                           return GetLocalKeyValueSetSketches(key_list);
+                         });
+    if (!responses.ok()) {
+      metrics_recorder_.IncrementEventCounter(kLookupFuturesCreationFailure);
+      return responses.status();
+    }
+    absl::flat_hash_map<std::string, ThetaSketch> sketches;
+    for (int shard_num = 0; shard_num < num_shards_; shard_num++) {
+      auto& shard_lookup_input = shard_lookup_inputs[shard_num];
+      auto result = responses->Get(shard_num);
+      if (!result.ok()) {
+        // Not an availability problem, the estimate would be wrong.
+        if (absl::IsFailedPrecondition(result.status())) {
+          return result.status();
+        }
+        metrics_recorder_.IncrementEventCounter(kShardedLookupFailure);
+        if (!CanSkipFailedShard(shard_lookup_input)) {
+          return result.status();
+        }
+        unavailable_keys.insert(shard_lookup_input.keys.begin(),
+                                shard_lookup_input.keys.end());
+        continue;
+      }
+      absl::Status sketch_status;
+      ForEachShardResult(
+          shard_lookup_input.keys, *result,
+          [&sketches, &sketch_status](
+              std::string_view key, SingleLookupResult* sketch_lookup_result) {
+            if (sketch_lookup_result == nullptr) {
+              return;
+            }
+            if (sketch_lookup_result->has_keyset_sketch()) {
+              sketches.insert_or_assign(
+                  key,
+                  FromKeysetSketch(sketch_lookup_result->keyset_sketch()));
+            } else if (sketch_lookup_result->status().code() ==
+                       static_cast<int>(
+                           absl::StatusCode::kFailedPrecondition)) {
+              sketch_status = absl::FailedPreconditionError(
+                  sketch_lookup_result->status().message());
+            }
+          });
+      if (!sketch_status.ok()) {
+        return sketch_status;
+      }
+    }
+    return sketches;
+  }
+
   const Lookup& local_lookup_;
   const int32_t num_shards_;
   const int32_t current_shard_num_;
-  const std::string hashing_seed_;
-  const distributed_point_functions::SHA256HashFunction hash_function_;
+  const ShardingFunction sharding_function_;
   const ShardManager& shard_manager_;
   MetricsRecorder& metrics_recorder_;
+  // Not owned, may be nullptr.
+  NearCache* const near_cache_;
+  const PaddingPolicy padding_policy_;
+  const absl::Duration lookup_timeout_;
+  const bool partial_results_;
+  const bool skip_fan_out_on_near_cache_hit_;
+  // Only set if hedging is enabled.
+  std::unique_ptr<HedgingDelay> hedging_delay_;
 };
 
 }  // namespace
@@ -425,12 +1332,10 @@ std::unique_ptr<Lookup> CreateShardedLookup(
     const Lookup& local_lookup, const int32_t num_shards,
     const int32_t current_shard_num, const ShardManager& shard_manager,
     privacy_sandbox::server_common::MetricsRecorder& metrics_recorder,
-    // We're currently going with a default empty string and not
-    // allowing AdTechs to modify it.
-    const std::string hashing_seed) {
-  return std::make_unique<ShardedLookup>(local_lookup, num_shards,
-                                         current_shard_num, shard_manager,
-                                         metrics_recorder, hashing_seed);
+    NearCache* near_cache, ShardingFunction sharding_function) {
+  return std::make_unique<ShardedLookup>(
+      local_lookup, num_shards, current_shard_num, shard_manager,
+      metrics_recorder, near_cache, std::move(sharding_function));
 }
 
 }  // namespace kv_server
@@ -21,18 +21,23 @@
 #include <string>
 
 #include "components/internal_server/lookup.h"
+#include "components/internal_server/near_cache.h"
 #include "components/sharding/shard_manager.h"
+#include "public/sharding/sharding_function.h"
 #include "src/cpp/telemetry/metrics_recorder.h"
 
 namespace kv_server {
 
+// If `near_cache` is set, the values and sets looked up on remote shards are
+// cached in it.
 std::unique_ptr<Lookup> CreateShardedLookup(
     const Lookup& local_lookup, const int32_t num_shards,
     const int32_t current_shard_num, const ShardManager& shard_manager,
     privacy_sandbox::server_common::MetricsRecorder& metrics_recorder,
-    // We're currently going with a default empty string and not
+    NearCache* near_cache = nullptr,
+    // We're currently going with a default empty seed and not
     // allowing AdTechs to modify it.
-    const std::string hashing_seed = "");
+    ShardingFunction sharding_function = ShardingFunction(/*seed=*/""));
 
 }  // namespace kv_server
 
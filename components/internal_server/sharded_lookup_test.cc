@@ -14,13 +14,20 @@
 
 #include "components/internal_server/sharded_lookup.h"
 
+#include <atomic>
 #include <memory>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "absl/flags/declare.h"
+#include "absl/flags/flag.h"
+#include "absl/flags/reflection.h"
 #include "components/data_server/cache/mocks.h"
 #include "components/internal_server/mocks.h"
+#include "components/internal_server/near_cache.h"
+#include "components/internal_server/padding_policy.h"
+#include "components/internal_server/run_query_result.h"
 #include "components/sharding/mocks.h"
 #include "gmock/gmock.h"
 #include "google/protobuf/text_format.h"
@@ -28,15 +35,66 @@
 #include "public/test_util/proto_matcher.h"
 #include "src/cpp/telemetry/mocks.h"
 
+ABSL_DECLARE_FLAG(double, shard_request_hedging_percentile);
+ABSL_DECLARE_FLAG(absl::Duration, shard_request_hedging_min_delay);
+ABSL_DECLARE_FLAG(kv_server::PaddingPolicy, shard_request_padding);
+ABSL_DECLARE_FLAG(absl::Duration, shard_lookup_timeout);
+ABSL_DECLARE_FLAG(bool, shard_lookup_partial_results);
+ABSL_DECLARE_FLAG(int32_t, shard_circuit_breaker_failures);
+ABSL_DECLARE_FLAG(bool, shard_near_cache_skip_fan_out);
+
 namespace kv_server {
 namespace {
 
 using google::protobuf::TextFormat;
 using privacy_sandbox::server_common::MockMetricsRecorder;
 using testing::_;
+using testing::AnyNumber;
 using testing::Return;
 using testing::ReturnRef;
 
+// Answers every request with the value of "key1", except that once
+// `hang_next_request` is set, the next request of any replica is only
+// answered once it is cancelled.
+class FakeRemoteLookupClient : public RemoteLookupClient {
+ public:
+  FakeRemoteLookupClient(std::atomic<bool>& hang_next_request,
+                         std::atomic<int>& cancelled_requests)
+      : hang_next_request_(hang_next_request),
+        cancelled_requests_(cancelled_requests) {}
+
+  absl::StatusOr<InternalLookupResponse> GetValues(
+      std::string_view serialized_message,
+      int32_t padding_length) const override {
+    return absl::UnimplementedError("Only GetValuesAsync is supported.");
+  }
+
+  absl::AnyInvocable<void()> GetValuesAsync(
+      std::string_view serialized_message, int32_t padding_length,
+      absl::AnyInvocable<void(absl::StatusOr<InternalLookupResponse>) &&>
+          callback) const override {
+    if (hang_next_request_.exchange(false)) {
+      pending_callback_ = std::move(callback);
+      return [this] {
+        cancelled_requests_++;
+        std::move(pending_callback_)(absl::CancelledError("Cancelled"));
+      };
+    }
+    InternalLookupResponse response;
+    (*response.mutable_kv_pairs())["key1"].set_value("value1");
+    std::move(callback)(std::move(response));
+    return [] {};
+  }
+
+  std::string_view GetIpAddress() const override { return ""; }
+
+ private:
+  std::atomic<bool>& hang_next_request_;
+  std::atomic<int>& cancelled_requests_;
+  mutable absl::AnyInvocable<void(absl::StatusOr<InternalLookupResponse>) &&>
+      pending_callback_;
+};
+
 class ShardedLookupTest : public ::testing::Test {
  protected:
   int32_t num_shards_ = 2;
@@ -74,6 +132,7 @@ TEST_F(ShardedLookupTest, GetKeyValues_Success) {
         InternalLookupRequest request;
         request.mutable_keys()->Assign(key_list_remote.begin(),
                                        key_list_remote.end());
+        request.set_positional_results(true);
         const std::string serialized_request = request.SerializeAsString();
         EXPECT_CALL(*mock_remote_lookup_client_1,
                     GetValues(serialized_request, 0))
@@ -137,6 +196,7 @@ TEST_F(ShardedLookupTest, GetKeyValues_KeyMissing_ReturnsStatus) {
         InternalLookupRequest request;
         request.mutable_keys()->Assign(key_list_remote.begin(),
                                        key_list_remote.end());
+        request.set_positional_results(true);
         const std::string serialized_request = request.SerializeAsString();
 
         EXPECT_CALL(*mock_remote_lookup_client_1, GetValues(_, 0))
@@ -186,6 +246,76 @@ TEST_F(ShardedLookupTest, GetKeyValues_KeyMissing_ReturnsStatus) {
   EXPECT_THAT(response.value(), EqualsProto(expected));
 }
 
+TEST_F(ShardedLookupTest, GetKeyValues_PositionalResults_Success) {
+  InternalLookupResponse local_lookup_response;
+  TextFormat::ParseFromString(R"pb(kv_pairs {
+                                     key: "key4"
+                                     value { value: "value4" }
+                                   }
+                              )pb",
+                              &local_lookup_response);
+  EXPECT_CALL(mock_local_lookup_, GetKeyValues(_))
+      .WillOnce(Return(local_lookup_response));
+
+  std::vector<absl::flat_hash_set<std::string>> cluster_mappings;
+  for (int i = 0; i < 2; i++) {
+    cluster_mappings.push_back({std::to_string(i)});
+  }
+  auto shard_manager = ShardManager::Create(
+      num_shards_, std::move(cluster_mappings),
+      std::make_unique<MockRandomGenerator>(), [](const std::string& ip) {
+        if (ip != "1") {
+          return std::make_unique<MockRemoteLookupClient>();
+        }
+        auto mock_remote_lookup_client_1 =
+            std::make_unique<MockRemoteLookupClient>();
+        EXPECT_CALL(*mock_remote_lookup_client_1, GetValues(_, 0))
+            .WillOnce([](const std::string_view serialized_message,
+                         const int32_t padding_length) {
+              InternalLookupRequest request;
+              EXPECT_TRUE(request.ParseFromString(serialized_message));
+              EXPECT_TRUE(request.positional_results());
+              // Only the results are returned, in the order of the keys.
+              InternalLookupResponse resp;
+              for (const auto& key : request.keys()) {
+                SingleLookupResult* result = resp.add_results();
+                if (key == "key1") {
+                  result->set_value("value1");
+                } else {
+                  result->mutable_status()->set_code(
+                      static_cast<int>(absl::StatusCode::kNotFound));
+                }
+              }
+              return resp;
+            });
+        return mock_remote_lookup_client_1;
+      });
+
+  auto sharded_lookup =
+      CreateShardedLookup(mock_local_lookup_, num_shards_, shard_num_,
+                          *(*shard_manager), mock_metrics_recorder_);
+  auto response = sharded_lookup->GetKeyValues({"key1", "key4", "key5"});
+  EXPECT_TRUE(response.ok());
+
+  InternalLookupResponse expected;
+  TextFormat::ParseFromString(
+      R"pb(kv_pairs {
+             key: "key1"
+             value { value: "value1" }
+           }
+           kv_pairs {
+             key: "key4"
+             value { value: "value4" }
+           },
+           kv_pairs {
+             key: "key5"
+             value { status: { code: 5, message: "" } }
+           }
+      )pb",
+      &expected);
+  EXPECT_THAT(response.value(), EqualsProto(expected));
+}
+
 TEST_F(ShardedLookupTest, GetKeyValues_EmptyRequest_ReturnsEmptyResponse) {
   std::vector<absl::flat_hash_set<std::string>> cluster_mappings;
   for (int i = 0; i < 2; i++) {
@@ -234,6 +364,7 @@ TEST_F(ShardedLookupTest, GetKeyValues_FailedDownstreamRequest) {
         InternalLookupRequest request;
         request.mutable_keys()->Assign(key_list_remote.begin(),
                                        key_list_remote.end());
+        request.set_positional_results(true);
         const std::string serialized_request = request.SerializeAsString();
         EXPECT_CALL(*mock_remote_lookup_client_1,
                     GetValues(serialized_request, 0))
@@ -263,6 +394,297 @@ TEST_F(ShardedLookupTest, GetKeyValues_FailedDownstreamRequest) {
   EXPECT_THAT(response.value(), EqualsProto(expected));
 }
 
+TEST_F(ShardedLookupTest, GetKeyValues_SlowReplica_HedgedToOtherReplica) {
+  absl::FlagSaver flag_saver;
+  absl::SetFlag(&FLAGS_shard_request_hedging_percentile, 50);
+  absl::SetFlag(&FLAGS_shard_request_hedging_min_delay, absl::Milliseconds(1));
+  EXPECT_CALL(mock_local_lookup_, GetKeyValues(_))
+      .WillRepeatedly(Return(InternalLookupResponse()));
+
+  std::atomic<bool> hang_next_request = false;
+  std::atomic<int> cancelled_requests = 0;
+  std::vector<absl::flat_hash_set<std::string>> cluster_mappings = {
+      {"0"}, {"1", "2"}};
+  auto shard_manager = ShardManager::Create(
+      num_shards_, std::move(cluster_mappings),
+      std::make_unique<MockRandomGenerator>(),
+      [&hang_next_request, &cancelled_requests](const std::string& ip) {
+        return std::make_unique<FakeRemoteLookupClient>(hang_next_request,
+                                                        cancelled_requests);
+      });
+
+  auto sharded_lookup =
+      CreateShardedLookup(mock_local_lookup_, num_shards_, shard_num_,
+                          *(*shard_manager), mock_metrics_recorder_);
+  // Requests are only hedged once enough latencies were recorded.
+  for (int i = 0; i < 100; i++) {
+    ASSERT_TRUE(sharded_lookup->GetKeyValues({"key1"}).ok());
+  }
+
+  EXPECT_CALL(mock_metrics_recorder_, IncrementEventCounter(_))
+      .Times(AnyNumber());
+  EXPECT_CALL(mock_metrics_recorder_,
+              IncrementEventCounter("ShardedLookupHedgedRequest"))
+      .Times(1);
+  EXPECT_CALL(mock_metrics_recorder_,
+              IncrementEventCounter("ShardedLookupHedgeWin"))
+      .Times(1);
+  hang_next_request = true;
+  auto response = sharded_lookup->GetKeyValues({"key1"});
+  ASSERT_TRUE(response.ok());
+
+  InternalLookupResponse expected;
+  TextFormat::ParseFromString(R"pb(kv_pairs {
+                                     key: "key1"
+                                     value { value: "value1" }
+                                   }
+                              )pb",
+                              &expected);
+  EXPECT_THAT(response.value(), EqualsProto(expected));
+  EXPECT_EQ(cancelled_requests, 1);
+}
+
+TEST_F(ShardedLookupTest, GetKeyValues_SlowShard_TimesOutAndCancels) {
+  absl::FlagSaver flag_saver;
+  absl::SetFlag(&FLAGS_shard_lookup_timeout, absl::Milliseconds(10));
+  EXPECT_CALL(mock_local_lookup_, GetKeyValues(_))
+      .WillOnce(Return(InternalLookupResponse()));
+  EXPECT_CALL(mock_metrics_recorder_, IncrementEventCounter(_))
+      .Times(AnyNumber());
+  EXPECT_CALL(mock_metrics_recorder_,
+              IncrementEventCounter("ShardedLookupShardTimeout"))
+      .Times(1);
+
+  std::atomic<bool> hang_next_request = true;
+  std::atomic<int> cancelled_requests = 0;
+  std::vector<absl::flat_hash_set<std::string>> cluster_mappings = {{"0"},
+                                                                    {"1"}};
+  auto shard_manager = ShardManager::Create(
+      num_shards_, std::move(cluster_mappings),
+      std::make_unique<MockRandomGenerator>(),
+      [&hang_next_request, &cancelled_requests](const std::string& ip) {
+        return std::make_unique<FakeRemoteLookupClient>(hang_next_request,
+                                                        cancelled_requests);
+      });
+
+  auto sharded_lookup =
+      CreateShardedLookup(mock_local_lookup_, num_shards_, shard_num_,
+                          *(*shard_manager), mock_metrics_recorder_);
+  auto response = sharded_lookup->GetKeyValues({"key1"});
+  ASSERT_TRUE(response.ok());
+
+  InternalLookupResponse expected;
+  TextFormat::ParseFromString(
+      R"pb(kv_pairs {
+             key: "key1"
+             value { status { code: 13 message: "Data lookup failed" } }
+           })pb",
+      &expected);
+  EXPECT_THAT(response.value(), EqualsProto(expected));
+  EXPECT_EQ(cancelled_requests, 1);
+}
+
+TEST_F(ShardedLookupTest, GetKeyValues_CircuitBreakerStopsFailingShard) {
+  absl::FlagSaver flag_saver;
+  absl::SetFlag(&FLAGS_shard_circuit_breaker_failures, 2);
+  EXPECT_CALL(mock_local_lookup_, GetKeyValues(_))
+      .WillRepeatedly(Return(InternalLookupResponse()));
+  EXPECT_CALL(mock_metrics_recorder_, IncrementEventCounter(_))
+      .Times(AnyNumber());
+  EXPECT_CALL(mock_metrics_recorder_,
+              IncrementEventCounter("ShardedLookupCircuitOpened"))
+      .Times(1);
+  EXPECT_CALL(mock_metrics_recorder_,
+              IncrementEventCounter("ShardedLookupCircuitRejected"))
+      .Times(1);
+
+  std::vector<absl::flat_hash_set<std::string>> cluster_mappings = {{"0"},
+                                                                    {"1"}};
+  auto shard_manager = ShardManager::Create(
+      num_shards_, std::move(cluster_mappings),
+      std::make_unique<MockRandomGenerator>(), [](const std::string& ip) {
+        auto mock_remote_lookup_client =
+            std::make_unique<MockRemoteLookupClient>();
+        if (ip == "1") {
+          EXPECT_CALL(*mock_remote_lookup_client, GetValues(_, _))
+              .Times(2)
+              .WillRepeatedly(
+                  []() { return absl::UnavailableError("Shard down"); });
+        }
+        return mock_remote_lookup_client;
+      });
+
+  auto sharded_lookup =
+      CreateShardedLookup(mock_local_lookup_, num_shards_, shard_num_,
+                          *(*shard_manager), mock_metrics_recorder_);
+  for (int i = 0; i < 3; i++) {
+    auto response = sharded_lookup->GetKeyValues({"key1"});
+    ASSERT_TRUE(response.ok());
+    EXPECT_EQ(response->kv_pairs().at("key1").status().code(),
+              static_cast<int>(absl::StatusCode::kInternal));
+  }
+}
+
+TEST_F(ShardedLookupTest, GetKeyValues_CircuitBreakerIsSharedByLookups) {
+  absl::FlagSaver flag_saver;
+  absl::SetFlag(&FLAGS_shard_circuit_breaker_failures, 2);
+  EXPECT_CALL(mock_local_lookup_, GetKeyValues(_))
+      .WillRepeatedly(Return(InternalLookupResponse()));
+  EXPECT_CALL(mock_metrics_recorder_,
+              RecordHistogramEvent("ShardCircuitBreakerOpen1", 0))
+      .Times(2);
+  EXPECT_CALL(mock_metrics_recorder_,
+              RecordHistogramEvent("ShardCircuitBreakerOpen1", 1))
+      .Times(1);
+
+  std::vector<absl::flat_hash_set<std::string>> cluster_mappings = {{"0"},
+                                                                    {"1"}};
+  auto shard_manager = ShardManager::Create(
+      num_shards_, std::move(cluster_mappings),
+      std::make_unique<MockRandomGenerator>(), [](const std::string& ip) {
+        auto mock_remote_lookup_client =
+            std::make_unique<MockRemoteLookupClient>();
+        if (ip == "1") {
+          EXPECT_CALL(*mock_remote_lookup_client, GetValues(_, _))
+              .Times(2)
+              .WillRepeatedly(
+                  []() { return absl::UnavailableError("Shard down"); });
+        }
+        return mock_remote_lookup_client;
+      });
+
+  // The failures through either lookup open the breaker for both of them.
+  auto first_lookup =
+      CreateShardedLookup(mock_local_lookup_, num_shards_, shard_num_,
+                          *(*shard_manager), mock_metrics_recorder_);
+  auto second_lookup =
+      CreateShardedLookup(mock_local_lookup_, num_shards_, shard_num_,
+                          *(*shard_manager), mock_metrics_recorder_);
+  ASSERT_TRUE(first_lookup->GetKeyValues({"key1"}).ok());
+  ASSERT_TRUE(second_lookup->GetKeyValues({"key1"}).ok());
+  ASSERT_TRUE(first_lookup->GetKeyValues({"key1"}).ok());
+}
+
+TEST_F(ShardedLookupTest, GetKeyValues_NearCache_ServesUntilInvalidated) {
+  absl::FlagSaver flag_saver;
+  absl::SetFlag(&FLAGS_shard_near_cache_skip_fan_out, true);
+  EXPECT_CALL(mock_local_lookup_, GetKeyValues(_))
+      .Times(2)
+      .WillRepeatedly(Return(InternalLookupResponse()));
+
+  std::vector<absl::flat_hash_set<std::string>> cluster_mappings = {{"0"},
+                                                                    {"1"}};
+  auto shard_manager = ShardManager::Create(
+      num_shards_, std::move(cluster_mappings),
+      std::make_unique<MockRandomGenerator>(), [](const std::string& ip) {
+        auto mock_remote_lookup_client =
+            std::make_unique<MockRemoteLookupClient>();
+        if (ip == "1") {
+          InternalLookupResponse response;
+          (*response.mutable_kv_pairs())["key1"].set_value("value1");
+          EXPECT_CALL(*mock_remote_lookup_client, GetValues(_, _))
+              .Times(2)
+              .WillRepeatedly(Return(response));
+        }
+        return mock_remote_lookup_client;
+      });
+
+  NearCache near_cache(/*capacity=*/10, absl::Minutes(1));
+  auto sharded_lookup = CreateShardedLookup(
+      mock_local_lookup_, num_shards_, shard_num_, *(*shard_manager),
+      mock_metrics_recorder_, &near_cache);
+  InternalLookupResponse expected;
+  TextFormat::ParseFromString(R"pb(kv_pairs {
+                                     key: "key1"
+                                     value { value: "value1" }
+                                   }
+                              )pb",
+                              &expected);
+  for (int i = 0; i < 3; i++) {
+    auto response = sharded_lookup->GetKeyValues({"key1"});
+    ASSERT_TRUE(response.ok());
+    EXPECT_THAT(response.value(), EqualsProto(expected));
+  }
+  near_cache.Invalidate("key1", absl::Now());
+  auto response = sharded_lookup->GetKeyValues({"key1"});
+  ASSERT_TRUE(response.ok());
+  EXPECT_THAT(response.value(), EqualsProto(expected));
+}
+
+TEST_F(ShardedLookupTest, GetKeyValues_NearCache_FullHitStillFansOut) {
+  EXPECT_CALL(mock_local_lookup_, GetKeyValues(_))
+      .Times(2)
+      .WillRepeatedly(Return(InternalLookupResponse()));
+
+  std::vector<absl::flat_hash_set<std::string>> cluster_mappings = {{"0"},
+                                                                    {"1"}};
+  auto shard_manager = ShardManager::Create(
+      num_shards_, std::move(cluster_mappings),
+      std::make_unique<MockRandomGenerator>(), [](const std::string& ip) {
+        auto mock_remote_lookup_client =
+            std::make_unique<MockRemoteLookupClient>();
+        if (ip == "1") {
+          InternalLookupResponse response;
+          (*response.mutable_kv_pairs())["key1"].set_value("value1");
+          // The cached key is left out of the second request, which is still
+          // sent so that the lookup looks the same on the network.
+          EXPECT_CALL(*mock_remote_lookup_client, GetValues(_, _))
+              .WillOnce(Return(response))
+              .WillOnce(Return(InternalLookupResponse()));
+        }
+        return mock_remote_lookup_client;
+      });
+
+  NearCache near_cache(/*capacity=*/10, absl::Minutes(1));
+  auto sharded_lookup = CreateShardedLookup(
+      mock_local_lookup_, num_shards_, shard_num_, *(*shard_manager),
+      mock_metrics_recorder_, &near_cache);
+  InternalLookupResponse expected;
+  TextFormat::ParseFromString(R"pb(kv_pairs {
+                                     key: "key1"
+                                     value { value: "value1" }
+                                   }
+                              )pb",
+                              &expected);
+  for (int i = 0; i < 2; i++) {
+    auto response = sharded_lookup->GetKeyValues({"key1"});
+    ASSERT_TRUE(response.ok());
+    EXPECT_THAT(response.value(), EqualsProto(expected));
+  }
+}
+
+TEST_F(ShardedLookupTest, GetKeyValues_SendsShardingFunctionVersion) {
+  EXPECT_CALL(mock_local_lookup_, GetKeyValues(_))
+      .WillRepeatedly(Return(InternalLookupResponse()));
+
+  std::vector<absl::flat_hash_set<std::string>> cluster_mappings = {{"0"},
+                                                                    {"1"}};
+  auto shard_manager = ShardManager::Create(
+      num_shards_, std::move(cluster_mappings),
+      std::make_unique<MockRandomGenerator>(), [](const std::string& ip) {
+        auto mock_remote_lookup_client =
+            std::make_unique<MockRemoteLookupClient>();
+        EXPECT_CALL(*mock_remote_lookup_client, GetValues(_, _))
+            .WillRepeatedly([](std::string_view serialized_message,
+                               int32_t padding_length) {
+              InternalLookupRequest request;
+              EXPECT_TRUE(request.ParseFromArray(serialized_message.data(),
+                                                 serialized_message.size()));
+              EXPECT_EQ(
+                  request.sharding_function_version(),
+                  static_cast<int32_t>(ShardingFunction::Version::kSipHash));
+              return InternalLookupResponse();
+            });
+        return mock_remote_lookup_client;
+      });
+
+  auto sharded_lookup = CreateShardedLookup(
+      mock_local_lookup_, num_shards_, shard_num_, *(*shard_manager),
+      mock_metrics_recorder_, /*near_cache=*/nullptr,
+      ShardingFunction(/*seed=*/"", ShardingFunction::Version::kSipHash));
+  EXPECT_TRUE(sharded_lookup->GetKeyValues({"key1", "key2"}).ok());
+}
+
 TEST_F(ShardedLookupTest, GetKeyValues_ReturnsKeysFromCachePadding) {
   auto num_shards = 4;
   absl::flat_hash_set<std::string_view> keys;
@@ -279,7 +701,7 @@ TEST_F(ShardedLookupTest, GetKeyValues_ReturnsKeysFromCachePadding) {
   keys.insert("longkey1");
   keys.insert("randomkey3");
 
-  int total_length = 22;
+  int total_length = 24;
 
   std::vector<std::string> key_list = {"key4", "verylongkey2"};
   InternalLookupResponse local_lookup_response;
@@ -318,6 +740,7 @@ TEST_F(ShardedLookupTest, GetKeyValues_ReturnsKeysFromCachePadding) {
           InternalLookupRequest request;
           request.mutable_keys()->Assign(key_list_remote.begin(),
                                          key_list_remote.end());
+          request.set_positional_results(true);
           const std::string serialized_request = request.SerializeAsString();
           EXPECT_CALL(*mock_remote_lookup_client_1,
                       GetValues(testing::_, testing::_))
@@ -354,6 +777,7 @@ TEST_F(ShardedLookupTest, GetKeyValues_ReturnsKeysFromCachePadding) {
           InternalLookupRequest request;
           request.mutable_keys()->Assign(key_list_remote.begin(),
                                          key_list_remote.end());
+          request.set_positional_results(true);
           const std::string serialized_request = request.SerializeAsString();
           EXPECT_CALL(*mock_remote_lookup_client_1,
                       GetValues(serialized_request, testing::_))
@@ -373,6 +797,7 @@ TEST_F(ShardedLookupTest, GetKeyValues_ReturnsKeysFromCachePadding) {
           InternalLookupRequest request;
           request.mutable_keys()->Assign(key_list_remote.begin(),
                                          key_list_remote.end());
+          request.set_positional_results(true);
           const std::string serialized_request = request.SerializeAsString();
           EXPECT_CALL(*mock_remote_lookup_client_1, GetValues(_, testing::_))
               .WillOnce([=](const std::string_view serialized_message,
@@ -446,6 +871,59 @@ TEST_F(ShardedLookupTest, GetKeyValues_ReturnsKeysFromCachePadding) {
   EXPECT_THAT(response.value(), EqualsProto(expected));
 }
 
+TEST_F(ShardedLookupTest, GetKeyValues_PadsToBucket) {
+  absl::FlagSaver flag_saver;
+  absl::SetFlag(&FLAGS_shard_request_padding, PaddingPolicy::PowersOfTwo());
+  auto num_shards = 4;
+  absl::flat_hash_set<std::string_view> keys;
+  // 0
+  keys.insert("key4");
+  keys.insert("verylongkey2");
+  // 1
+  keys.insert("key1");
+  keys.insert("key2");
+  keys.insert("key3");
+  // 2
+  keys.insert("randomkey5");
+  // 3
+  keys.insert("longkey1");
+  keys.insert("randomkey3");
+
+  // The largest request is 24 bytes long.
+  int padded_length = 32;
+
+  EXPECT_CALL(mock_local_lookup_, GetKeyValues(_))
+      .WillOnce(Return(InternalLookupResponse()));
+
+  std::vector<absl::flat_hash_set<std::string>> cluster_mappings;
+  for (int i = 0; i < num_shards; i++) {
+    cluster_mappings.push_back({std::to_string(i)});
+  }
+  auto shard_manager = ShardManager::Create(
+      num_shards, std::move(cluster_mappings),
+      std::make_unique<MockRandomGenerator>(),
+      [padded_length](const std::string& ip) {
+        auto mock_remote_lookup_client =
+            std::make_unique<MockRemoteLookupClient>();
+        if (ip != "0") {
+          EXPECT_CALL(*mock_remote_lookup_client, GetValues(_, _))
+              .WillOnce([padded_length](
+                            const std::string_view serialized_message,
+                            const int32_t padding_length) {
+                EXPECT_EQ(padded_length,
+                          serialized_message.size() + padding_length);
+                return InternalLookupResponse();
+              });
+        }
+        return mock_remote_lookup_client;
+      });
+
+  auto sharded_lookup =
+      CreateShardedLookup(mock_local_lookup_, num_shards, shard_num_,
+                          *(*shard_manager), mock_metrics_recorder_);
+  EXPECT_TRUE(sharded_lookup->GetKeyValues(keys).ok());
+}
+
 TEST_F(ShardedLookupTest, GetKeyValueSets_KeysFound_Success) {
   InternalLookupResponse local_lookup_response;
   TextFormat::ParseFromString(
@@ -476,6 +954,7 @@ TEST_F(ShardedLookupTest, GetKeyValueSets_KeysFound_Success) {
         InternalLookupRequest request;
         request.mutable_keys()->Assign(key_list_remote.begin(),
                                        key_list_remote.end());
+        request.set_positional_results(true);
         request.set_lookup_sets(true);
         const std::string serialized_request = request.SerializeAsString();
         EXPECT_CALL(*mock_remote_lookup_client_1, GetValues(_, 0))
@@ -545,6 +1024,7 @@ TEST_F(ShardedLookupTest, GetKeyValueSets_KeysMissing_ReturnsStatus) {
         InternalLookupRequest request;
         request.mutable_keys()->Assign(key_list_remote.begin(),
                                        key_list_remote.end());
+        request.set_positional_results(true);
         request.set_lookup_sets(true);
         const std::string serialized_request = request.SerializeAsString();
         EXPECT_CALL(*mock_remote_lookup_client_1, GetValues(_, 0))
@@ -642,6 +1122,7 @@ TEST_F(ShardedLookupTest, GetKeyValueSet_FailedDownstreamRequest) {
         InternalLookupRequest request;
         request.mutable_keys()->Assign(key_list_remote.begin(),
                                        key_list_remote.end());
+        request.set_positional_results(true);
         request.set_lookup_sets(true);
         const std::string serialized_request = request.SerializeAsString();
         EXPECT_CALL(*mock_remote_lookup_client_1,
@@ -659,7 +1140,10 @@ TEST_F(ShardedLookupTest, GetKeyValueSet_FailedDownstreamRequest) {
   EXPECT_EQ(response.status().code(), absl::StatusCode::kDeadlineExceeded);
 }
 
-TEST_F(ShardedLookupTest, RunQuery_Success) {
+TEST_F(ShardedLookupTest,
+       GetKeyValueSet_PartialResults_FailedShardUnavailable) {
+  absl::FlagSaver flag_saver;
+  absl::SetFlag(&FLAGS_shard_lookup_partial_results, true);
   InternalLookupResponse local_lookup_response;
   TextFormat::ParseFromString(
       R"pb(kv_pairs {
@@ -678,45 +1162,658 @@ TEST_F(ShardedLookupTest, RunQuery_Success) {
   auto shard_manager = ShardManager::Create(
       num_shards_, std::move(cluster_mappings),
       std::make_unique<MockRandomGenerator>(), [](const std::string& ip) {
-        if (ip != "1") {
-          return std::make_unique<MockRemoteLookupClient>();
-        }
-
-        auto mock_remote_lookup_client_1 =
+        auto mock_remote_lookup_client =
             std::make_unique<MockRemoteLookupClient>();
-        const std::vector<std::string_view> key_list_remote = {"key1"};
-        InternalLookupRequest request;
-        request.mutable_keys()->Assign(key_list_remote.begin(),
-                                       key_list_remote.end());
-        request.set_lookup_sets(true);
-        const std::string serialized_request = request.SerializeAsString();
-        EXPECT_CALL(*mock_remote_lookup_client_1,
-                    GetValues(serialized_request, 0))
-            .WillOnce([&]() {
-              InternalLookupResponse resp;
-              TextFormat::ParseFromString(
-                  R"pb(kv_pairs {
-                         key: "key1"
-                         value { keyset_values { values: "value1" } }
-                       }
-                  )pb",
-                  &resp);
-              return resp;
-            });
-
-        return mock_remote_lookup_client_1;
+        if (ip == "1") {
+          EXPECT_CALL(*mock_remote_lookup_client, GetValues(_, _))
+              .WillOnce(
+                  []() { return absl::DeadlineExceededError("too long"); });
+        }
+        return mock_remote_lookup_client;
       });
 
   auto sharded_lookup =
       CreateShardedLookup(mock_local_lookup_, num_shards_, shard_num_,
                           *(*shard_manager), mock_metrics_recorder_);
-  auto response = sharded_lookup->RunQuery("key1|key4");
-  EXPECT_TRUE(response.ok());
+  auto response = sharded_lookup->GetKeyValueSet({"key1", "key4"});
+  ASSERT_TRUE(response.ok());
+
+  InternalLookupResponse expected;
+  TextFormat::ParseFromString(
+      R"pb(kv_pairs {
+             key: "key1"
+             value { status { code: 14 message: "Shard unavailable" } }
+           }
+           kv_pairs {
+             key: "key4"
+             value { keyset_values { values: "value4" } }
+           }
+      )pb",
+      &expected);
+  EXPECT_THAT(response.value(), EqualsProto(expected));
+}
+
+TEST_F(ShardedLookupTest, GetKeyValueSet_NearCache_ServesRepeatedLookups) {
+  absl::FlagSaver flag_saver;
+  absl::SetFlag(&FLAGS_shard_near_cache_skip_fan_out, true);
+  EXPECT_CALL(mock_local_lookup_, GetKeyValueSet(_)).Times(0);
+
+  std::vector<absl::flat_hash_set<std::string>> cluster_mappings = {{"0"},
+                                                                    {"1"}};
+  auto shard_manager = ShardManager::Create(
+      num_shards_, std::move(cluster_mappings),
+      std::make_unique<MockRandomGenerator>(), [](const std::string& ip) {
+        auto mock_remote_lookup_client =
+            std::make_unique<MockRemoteLookupClient>();
+        if (ip == "1") {
+          InternalLookupResponse response;
+          (*response.mutable_kv_pairs())["key1"]
+              .mutable_keyset_values()
+              ->add_values("value1");
+          EXPECT_CALL(*mock_remote_lookup_client, GetValues(_, _))
+              .WillOnce(Return(response));
+        }
+        return mock_remote_lookup_client;
+      });
+
+  NearCache near_cache(/*capacity=*/10, absl::Minutes(1));
+  auto sharded_lookup = CreateShardedLookup(
+      mock_local_lookup_, num_shards_, shard_num_, *(*shard_manager),
+      mock_metrics_recorder_, &near_cache);
+  InternalLookupResponse expected;
+  TextFormat::ParseFromString(
+      R"pb(kv_pairs {
+             key: "key1"
+             value { keyset_values { values: "value1" } }
+           }
+      )pb",
+      &expected);
+  for (int i = 0; i < 2; i++) {
+    auto response = sharded_lookup->GetKeyValueSet({"key1"});
+    ASSERT_TRUE(response.ok());
+    EXPECT_THAT(response.value(), EqualsProto(expected));
+  }
+}
+
+TEST_F(ShardedLookupTest, GetKeyValueSetMembership_SendsOnlyCandidates) {
+  EXPECT_CALL(mock_local_lookup_, GetKeyValueSetMembership(_, _)).Times(0);
+  EXPECT_CALL(mock_local_lookup_, GetKeyValueSet(_)).Times(0);
+
+  std::vector<absl::flat_hash_set<std::string>> cluster_mappings;
+  for (int i = 0; i < 2; i++) {
+    cluster_mappings.push_back({std::to_string(i)});
+  }
+  auto shard_manager = ShardManager::Create(
+      num_shards_, std::move(cluster_mappings),
+      std::make_unique<MockRandomGenerator>(), [](const std::string& ip) {
+        if (ip != "1") {
+          return std::make_unique<MockRemoteLookupClient>();
+        }
+
+        auto mock_remote_lookup_client_1 =
+            std::make_unique<MockRemoteLookupClient>();
+        InternalLookupRequest request;
+        request.add_keys("key1");
+        request.set_lookup_membership(true);
+        request.add_candidates("value1");
+        request.add_candidates("value2");
+        request.set_positional_results(true);
+        const std::string serialized_request = request.SerializeAsString();
+        EXPECT_CALL(*mock_remote_lookup_client_1,
+                    GetValues(serialized_request, 0))
+            .WillOnce([&]() {
+              InternalLookupResponse resp;
+              TextFormat::ParseFromString(
+                  R"pb(kv_pairs {
+                         key: "key1"
+                         value {
+                           keyset_membership {
+                             is_member: true
+                             is_member: false
+                           }
+                         }
+                       }
+                  )pb",
+                  &resp);
+              return resp;
+            });
+
+        return mock_remote_lookup_client_1;
+      });
+
+  auto sharded_lookup =
+      CreateShardedLookup(mock_local_lookup_, num_shards_, shard_num_,
+                          *(*shard_manager), mock_metrics_recorder_);
+  const std::vector<std::string_view> candidates = {"value1", "value2"};
+  auto response = sharded_lookup->GetKeyValueSetMembership("key1", candidates);
+  ASSERT_TRUE(response.ok());
+
+  InternalLookupResponse expected;
+  TextFormat::ParseFromString(R"pb(kv_pairs {
+                                     key: "key1"
+                                     value {
+                                       keyset_membership {
+                                         is_member: true
+                                         is_member: false
+                                       }
+                                     }
+                                   }
+                              )pb",
+                              &expected);
+  EXPECT_THAT(response.value(), EqualsProto(expected));
+}
+
+TEST_F(ShardedLookupTest, RunQuery_Success) {
+  InternalLookupResponse local_lookup_response;
+  TextFormat::ParseFromString(
+      R"pb(kv_pairs {
+             key: "key4"
+             value { keyset_values { values: "value4" } }
+           }
+      )pb",
+      &local_lookup_response);
+  EXPECT_CALL(mock_local_lookup_, GetKeyValueSet(_))
+      .WillOnce(Return(local_lookup_response));
+
+  std::vector<absl::flat_hash_set<std::string>> cluster_mappings;
+  for (int i = 0; i < 2; i++) {
+    cluster_mappings.push_back({std::to_string(i)});
+  }
+  auto shard_manager = ShardManager::Create(
+      num_shards_, std::move(cluster_mappings),
+      std::make_unique<MockRandomGenerator>(), [](const std::string& ip) {
+        if (ip != "1") {
+          return std::make_unique<MockRemoteLookupClient>();
+        }
+
+        auto mock_remote_lookup_client_1 =
+            std::make_unique<MockRemoteLookupClient>();
+        const std::vector<std::string_view> key_list_remote = {"key1"};
+        InternalLookupRequest request;
+        request.mutable_keys()->Assign(key_list_remote.begin(),
+                                       key_list_remote.end());
+        request.set_positional_results(true);
+        request.set_lookup_sets(true);
+        const std::string serialized_request = request.SerializeAsString();
+        EXPECT_CALL(*mock_remote_lookup_client_1,
+                    GetValues(serialized_request, 0))
+            .WillOnce([&]() {
+              InternalLookupResponse resp;
+              TextFormat::ParseFromString(
+                  R"pb(kv_pairs {
+                         key: "key1"
+                         value { keyset_values { values: "value1" } }
+                       }
+                  )pb",
+                  &resp);
+              return resp;
+            });
+
+        return mock_remote_lookup_client_1;
+      });
+
+  auto sharded_lookup =
+      CreateShardedLookup(mock_local_lookup_, num_shards_, shard_num_,
+                          *(*shard_manager), mock_metrics_recorder_);
+  auto response = sharded_lookup->RunQuery("key1|key4");
+  EXPECT_TRUE(response.ok());
 
   EXPECT_THAT(response.value().elements(),
               testing::UnorderedElementsAreArray({"value1", "value4"}));
 }
 
+TEST_F(ShardedLookupTest, RunQuery_UInt32Sets_Success) {
+  InternalLookupResponse local_lookup_response;
+  TextFormat::ParseFromString(
+      R"pb(kv_pairs {
+             key: "key4"
+             value { keyset_values { uint32_values: [ 2, 4 ] } }
+           }
+      )pb",
+      &local_lookup_response);
+  EXPECT_CALL(mock_local_lookup_, GetKeyValueSet(_))
+      .WillOnce(Return(local_lookup_response));
+
+  std::vector<absl::flat_hash_set<std::string>> cluster_mappings;
+  for (int i = 0; i < 2; i++) {
+    cluster_mappings.push_back({std::to_string(i)});
+  }
+  auto shard_manager = ShardManager::Create(
+      num_shards_, std::move(cluster_mappings),
+      std::make_unique<MockRandomGenerator>(), [](const std::string& ip) {
+        if (ip != "1") {
+          return std::make_unique<MockRemoteLookupClient>();
+        }
+
+        auto mock_remote_lookup_client_1 =
+            std::make_unique<MockRemoteLookupClient>();
+        const std::vector<std::string_view> key_list_remote = {"key1"};
+        InternalLookupRequest request;
+        request.mutable_keys()->Assign(key_list_remote.begin(),
+                                       key_list_remote.end());
+        request.set_positional_results(true);
+        request.set_lookup_sets(true);
+        const std::string serialized_request = request.SerializeAsString();
+        EXPECT_CALL(*mock_remote_lookup_client_1,
+                    GetValues(serialized_request, 0))
+            .WillOnce([&]() {
+              InternalLookupResponse resp;
+              TextFormat::ParseFromString(
+                  R"pb(kv_pairs {
+                         key: "key1"
+                         value { keyset_values { uint32_values: [ 1, 2 ] } }
+                       }
+                  )pb",
+                  &resp);
+              return resp;
+            });
+
+        return mock_remote_lookup_client_1;
+      });
+
+  auto sharded_lookup =
+      CreateShardedLookup(mock_local_lookup_, num_shards_, shard_num_,
+                          *(*shard_manager), mock_metrics_recorder_);
+  auto response = sharded_lookup->RunQuery("key1|key4");
+  ASSERT_TRUE(response.ok());
+
+  EXPECT_THAT(response.value().elements(),
+              testing::UnorderedElementsAreArray({"1", "2", "4"}));
+}
+
+TEST_F(ShardedLookupTest, RunQuery_MixedSets_Success) {
+  InternalLookupResponse local_lookup_response;
+  TextFormat::ParseFromString(
+      R"pb(kv_pairs {
+             key: "key4"
+             value { keyset_values { values: "2" values: "b" } }
+           }
+      )pb",
+      &local_lookup_response);
+  EXPECT_CALL(mock_local_lookup_, GetKeyValueSet(_))
+      .WillOnce(Return(local_lookup_response));
+
+  std::vector<absl::flat_hash_set<std::string>> cluster_mappings;
+  for (int i = 0; i < 2; i++) {
+    cluster_mappings.push_back({std::to_string(i)});
+  }
+  auto shard_manager = ShardManager::Create(
+      num_shards_, std::move(cluster_mappings),
+      std::make_unique<MockRandomGenerator>(), [](const std::string& ip) {
+        if (ip != "1") {
+          return std::make_unique<MockRemoteLookupClient>();
+        }
+
+        auto mock_remote_lookup_client_1 =
+            std::make_unique<MockRemoteLookupClient>();
+        const std::vector<std::string_view> key_list_remote = {"key1"};
+        InternalLookupRequest request;
+        request.mutable_keys()->Assign(key_list_remote.begin(),
+                                       key_list_remote.end());
+        request.set_positional_results(true);
+        request.set_lookup_sets(true);
+        const std::string serialized_request = request.SerializeAsString();
+        EXPECT_CALL(*mock_remote_lookup_client_1,
+                    GetValues(serialized_request, 0))
+            .WillOnce([&]() {
+              InternalLookupResponse resp;
+              TextFormat::ParseFromString(
+                  R"pb(kv_pairs {
+                         key: "key1"
+                         value { keyset_values { uint32_values: [ 1, 2 ] } }
+                       }
+                  )pb",
+                  &resp);
+              return resp;
+            });
+
+        return mock_remote_lookup_client_1;
+      });
+
+  auto sharded_lookup =
+      CreateShardedLookup(mock_local_lookup_, num_shards_, shard_num_,
+                          *(*shard_manager), mock_metrics_recorder_);
+  auto response = sharded_lookup->RunQuery("key1|key4");
+  ASSERT_TRUE(response.ok());
+
+  EXPECT_THAT(response.value().elements(),
+              testing::UnorderedElementsAreArray({"1", "2", "b"}));
+}
+
+TEST_F(ShardedLookupTest, RunQueries_Success) {
+  InternalLookupResponse local_lookup_response;
+  TextFormat::ParseFromString(
+      R"pb(kv_pairs {
+             key: "key4"
+             value { keyset_values { values: "value4" } }
+           }
+      )pb",
+      &local_lookup_response);
+  EXPECT_CALL(mock_local_lookup_, GetKeyValueSet(_))
+      .WillOnce(Return(local_lookup_response));
+
+  std::vector<absl::flat_hash_set<std::string>> cluster_mappings;
+  for (int i = 0; i < 2; i++) {
+    cluster_mappings.push_back({std::to_string(i)});
+  }
+  auto shard_manager = ShardManager::Create(
+      num_shards_, std::move(cluster_mappings),
+      std::make_unique<MockRandomGenerator>(), [](const std::string& ip) {
+        if (ip != "1") {
+          return std::make_unique<MockRemoteLookupClient>();
+        }
+
+        auto mock_remote_lookup_client_1 =
+            std::make_unique<MockRemoteLookupClient>();
+        const std::vector<std::string_view> key_list_remote = {"key1"};
+        InternalLookupRequest request;
+        request.mutable_keys()->Assign(key_list_remote.begin(),
+                                       key_list_remote.end());
+        request.set_positional_results(true);
+        request.set_lookup_sets(true);
+        const std::string serialized_request = request.SerializeAsString();
+        EXPECT_CALL(*mock_remote_lookup_client_1,
+                    GetValues(serialized_request, 0))
+            .WillOnce([&]() {
+              InternalLookupResponse resp;
+              TextFormat::ParseFromString(
+                  R"pb(kv_pairs {
+                         key: "key1"
+                         value { keyset_values { values: "value1" } }
+                       }
+                  )pb",
+                  &resp);
+              return resp;
+            });
+
+        return mock_remote_lookup_client_1;
+      });
+
+  auto sharded_lookup =
+      CreateShardedLookup(mock_local_lookup_, num_shards_, shard_num_,
+                          *(*shard_manager), mock_metrics_recorder_);
+  InternalRunQueriesRequest request;
+  TextFormat::ParseFromString(
+      R"pb(queries { query: "key1" }
+           queries { query: "key4" }
+           queries { query: "key1|key4" result_mode: COUNT })pb",
+      &request);
+  auto response = sharded_lookup->RunQueries(request);
+  ASSERT_TRUE(response.ok());
+
+  InternalRunQueriesResponse expected;
+  TextFormat::ParseFromString(
+      R"pb(results { response { elements: "value1" } }
+           results { response { elements: "value4" } }
+           results { response { count: 2 } })pb",
+      &expected);
+  EXPECT_THAT(response.value(), EqualsProto(expected));
+}
+
+TEST_F(ShardedLookupTest, RunQueries_CountsFailedQueries) {
+  EXPECT_CALL(mock_metrics_recorder_, IncrementEventCounter(_))
+      .Times(AnyNumber());
+  EXPECT_CALL(mock_metrics_recorder_,
+              IncrementEventCounter("InternalRunQueryParsingFailure"))
+      .Times(2);
+
+  std::vector<absl::flat_hash_set<std::string>> cluster_mappings = {{"0"},
+                                                                    {"1"}};
+  auto shard_manager = ShardManager::Create(
+      num_shards_, std::move(cluster_mappings),
+      std::make_unique<MockRandomGenerator>(), [](const std::string& ip) {
+        return std::make_unique<MockRemoteLookupClient>();
+      });
+  auto sharded_lookup =
+      CreateShardedLookup(mock_local_lookup_, num_shards_, shard_num_,
+                          *(*shard_manager), mock_metrics_recorder_);
+  InternalRunQueriesRequest request;
+  TextFormat::ParseFromString(
+      R"pb(queries { query: "key1|" } queries { query: "(key2" })pb",
+      &request);
+  auto response = sharded_lookup->RunQueries(request);
+  ASSERT_TRUE(response.ok());
+  ASSERT_EQ(response->results_size(), 2);
+  EXPECT_TRUE(response->results(0).has_status());
+  EXPECT_TRUE(response->results(1).has_status());
+}
+
+TEST_F(ShardedLookupTest, ExecuteQuery_Count_Success) {
+  InternalLookupResponse local_lookup_response;
+  TextFormat::ParseFromString(
+      R"pb(kv_pairs {
+             key: "key4"
+             value { keyset_values { values: "value4" } }
+           }
+      )pb",
+      &local_lookup_response);
+  EXPECT_CALL(mock_local_lookup_, GetKeyValueSet(_))
+      .WillOnce(Return(local_lookup_response));
+
+  std::vector<absl::flat_hash_set<std::string>> cluster_mappings;
+  for (int i = 0; i < 2; i++) {
+    cluster_mappings.push_back({std::to_string(i)});
+  }
+  auto shard_manager = ShardManager::Create(
+      num_shards_, std::move(cluster_mappings),
+      std::make_unique<MockRandomGenerator>(), [](const std::string& ip) {
+        if (ip != "1") {
+          return std::make_unique<MockRemoteLookupClient>();
+        }
+
+        auto mock_remote_lookup_client_1 =
+            std::make_unique<MockRemoteLookupClient>();
+        const std::vector<std::string_view> key_list_remote = {"key1"};
+        InternalLookupRequest request;
+        request.mutable_keys()->Assign(key_list_remote.begin(),
+                                       key_list_remote.end());
+        request.set_positional_results(true);
+        request.set_lookup_sets(true);
+        const std::string serialized_request = request.SerializeAsString();
+        EXPECT_CALL(*mock_remote_lookup_client_1,
+                    GetValues(serialized_request, 0))
+            .WillOnce([&]() {
+              InternalLookupResponse resp;
+              TextFormat::ParseFromString(
+                  R"pb(kv_pairs {
+                         key: "key1"
+                         value { keyset_values { values: "value1" } }
+                       }
+                  )pb",
+                  &resp);
+              return resp;
+            });
+
+        return mock_remote_lookup_client_1;
+      });
+
+  auto sharded_lookup =
+      CreateShardedLookup(mock_local_lookup_, num_shards_, shard_num_,
+                          *(*shard_manager), mock_metrics_recorder_);
+  InternalRunQueryRequest request;
+  request.set_query("key1|key4");
+  request.set_result_mode(RunQueryResultMode::COUNT);
+  auto response = sharded_lookup->ExecuteQuery(request);
+  ASSERT_TRUE(response.ok());
+
+  InternalRunQueryResponse expected;
+  expected.set_count(2);
+  EXPECT_THAT(response.value(), EqualsProto(expected));
+}
+
+TEST_F(ShardedLookupTest, ExecuteQuery_ApproximateCount_Success) {
+  ThetaSketch local_sketch;
+  local_sketch.Update("value4");
+  InternalLookupResponse local_lookup_response;
+  *(*local_lookup_response.mutable_kv_pairs())["key4"]
+       .mutable_keyset_sketch() = ToKeysetSketch(local_sketch);
+  EXPECT_CALL(mock_local_lookup_, GetKeyValueSetSketches(_))
+      .WillOnce(Return(local_lookup_response));
+  EXPECT_CALL(mock_local_lookup_, GetKeyValueSet(_)).Times(0);
+
+  std::vector<absl::flat_hash_set<std::string>> cluster_mappings;
+  for (int i = 0; i < 2; i++) {
+    cluster_mappings.push_back({std::to_string(i)});
+  }
+  auto shard_manager = ShardManager::Create(
+      num_shards_, std::move(cluster_mappings),
+      std::make_unique<MockRandomGenerator>(), [](const std::string& ip) {
+        if (ip != "1") {
+          return std::make_unique<MockRemoteLookupClient>();
+        }
+
+        auto mock_remote_lookup_client_1 =
+            std::make_unique<MockRemoteLookupClient>();
+        const std::vector<std::string_view> key_list_remote = {"key1"};
+        InternalLookupRequest request;
+        request.mutable_keys()->Assign(key_list_remote.begin(),
+                                       key_list_remote.end());
+        request.set_positional_results(true);
+        request.set_lookup_sketches(true);
+        const std::string serialized_request = request.SerializeAsString();
+        EXPECT_CALL(*mock_remote_lookup_client_1,
+                    GetValues(serialized_request, 0))
+            .WillOnce([&]() {
+              ThetaSketch remote_sketch;
+              remote_sketch.Update("value1");
+              remote_sketch.Update("value4");
+              InternalLookupResponse resp;
+              *(*resp.mutable_kv_pairs())["key1"].mutable_keyset_sketch() =
+                  ToKeysetSketch(remote_sketch);
+              return resp;
+            });
+
+        return mock_remote_lookup_client_1;
+      });
+
+  auto sharded_lookup =
+      CreateShardedLookup(mock_local_lookup_, num_shards_, shard_num_,
+                          *(*shard_manager), mock_metrics_recorder_);
+  InternalRunQueryRequest request;
+  request.set_query("key1|key4");
+  request.set_result_mode(RunQueryResultMode::APPROXIMATE_COUNT);
+  auto response = sharded_lookup->ExecuteQuery(request);
+  ASSERT_TRUE(response.ok());
+
+  InternalRunQueryResponse expected;
+  expected.set_approximate_count(2);
+  EXPECT_THAT(response.value(), EqualsProto(expected));
+}
+
+TEST_F(ShardedLookupTest,
+       ExecuteQuery_ApproximateCountWithoutRemoteSketches_Error) {
+  ThetaSketch local_sketch;
+  local_sketch.Update("value4");
+  InternalLookupResponse local_lookup_response;
+  *(*local_lookup_response.mutable_kv_pairs())["key4"]
+       .mutable_keyset_sketch() = ToKeysetSketch(local_sketch);
+  EXPECT_CALL(mock_local_lookup_, GetKeyValueSetSketches(_))
+      .WillOnce(Return(local_lookup_response));
+
+  std::vector<absl::flat_hash_set<std::string>> cluster_mappings;
+  for (int i = 0; i < 2; i++) {
+    cluster_mappings.push_back({std::to_string(i)});
+  }
+  auto shard_manager = ShardManager::Create(
+      num_shards_, std::move(cluster_mappings),
+      std::make_unique<MockRandomGenerator>(), [](const std::string& ip) {
+        auto mock_remote_lookup_client_1 =
+            std::make_unique<MockRemoteLookupClient>();
+        if (ip != "1") {
+          return mock_remote_lookup_client_1;
+        }
+        EXPECT_CALL(*mock_remote_lookup_client_1, GetValues(_, 0))
+            .WillOnce([]() {
+              // A shard without --maintain_set_sketches.
+              InternalLookupResponse resp;
+              auto* status =
+                  (*resp.mutable_kv_pairs())["key1"].mutable_status();
+              status->set_code(
+                  static_cast<int>(absl::StatusCode::kFailedPrecondition));
+              status->set_message("Set sketches are not maintained.");
+              return resp;
+            });
+        return mock_remote_lookup_client_1;
+      });
+
+  auto sharded_lookup =
+      CreateShardedLookup(mock_local_lookup_, num_shards_, shard_num_,
+                          *(*shard_manager), mock_metrics_recorder_);
+  InternalRunQueryRequest request;
+  request.set_query("key1|key4");
+  request.set_result_mode(RunQueryResultMode::APPROXIMATE_COUNT);
+  auto response = sharded_lookup->ExecuteQuery(request);
+  EXPECT_EQ(response.status().code(), absl::StatusCode::kFailedPrecondition);
+}
+
+TEST_F(ShardedLookupTest, ExecuteQuery_Membership_Success) {
+  InternalLookupResponse local_lookup_response;
+  TextFormat::ParseFromString(
+      R"pb(kv_pairs {
+             key: "key4"
+             value { keyset_values { values: "value4" } }
+           }
+      )pb",
+      &local_lookup_response);
+  EXPECT_CALL(mock_local_lookup_, GetKeyValueSet(_))
+      .WillOnce(Return(local_lookup_response));
+
+  std::vector<absl::flat_hash_set<std::string>> cluster_mappings;
+  for (int i = 0; i < 2; i++) {
+    cluster_mappings.push_back({std::to_string(i)});
+  }
+  auto shard_manager = ShardManager::Create(
+      num_shards_, std::move(cluster_mappings),
+      std::make_unique<MockRandomGenerator>(), [](const std::string& ip) {
+        if (ip != "1") {
+          return std::make_unique<MockRemoteLookupClient>();
+        }
+
+        auto mock_remote_lookup_client_1 =
+            std::make_unique<MockRemoteLookupClient>();
+        const std::vector<std::string_view> key_list_remote = {"key1"};
+        InternalLookupRequest request;
+        request.mutable_keys()->Assign(key_list_remote.begin(),
+                                       key_list_remote.end());
+        request.set_positional_results(true);
+        request.set_lookup_sets(true);
+        const std::string serialized_request = request.SerializeAsString();
+        EXPECT_CALL(*mock_remote_lookup_client_1,
+                    GetValues(serialized_request, 0))
+            .WillOnce([&]() {
+              InternalLookupResponse resp;
+              TextFormat::ParseFromString(
+                  R"pb(kv_pairs {
+                         key: "key1"
+                         value { keyset_values { values: "value1" } }
+                       }
+                  )pb",
+                  &resp);
+              return resp;
+            });
+
+        return mock_remote_lookup_client_1;
+      });
+
+  auto sharded_lookup =
+      CreateShardedLookup(mock_local_lookup_, num_shards_, shard_num_,
+                          *(*shard_manager), mock_metrics_recorder_);
+  InternalRunQueryRequest request;
+  TextFormat::ParseFromString(
+      R"pb(query: "key1|key4"
+           result_mode: MEMBERSHIP
+           candidates: "value4"
+           candidates: "value2")pb",
+      &request);
+  auto response = sharded_lookup->ExecuteQuery(request);
+  ASSERT_TRUE(response.ok());
+
+  InternalRunQueryResponse expected;
+  TextFormat::ParseFromString(R"pb(is_member: true is_member: false)pb",
+                              &expected);
+  EXPECT_THAT(response.value(), EqualsProto(expected));
+}
+
 TEST_F(ShardedLookupTest, RunQuery_MissingKeySet_IgnoresMissingSet_Success) {
   InternalLookupResponse local_lookup_response;
   TextFormat::ParseFromString(
@@ -746,6 +1843,7 @@ TEST_F(ShardedLookupTest, RunQuery_MissingKeySet_IgnoresMissingSet_Success) {
         InternalLookupRequest request;
         request.mutable_keys()->Assign(key_list_remote.begin(),
                                        key_list_remote.end());
+        request.set_positional_results(true);
         request.set_lookup_sets(true);
         const std::string serialized_request = request.SerializeAsString();
         EXPECT_CALL(*mock_remote_lookup_client_1,
@@ -776,6 +1874,30 @@ TEST_F(ShardedLookupTest, RunQuery_MissingKeySet_IgnoresMissingSet_Success) {
 }
 
 TEST_F(ShardedLookupTest, RunQuery_ShardedLookupFails_Error) {
+  // The local shard is not looked up once a remote shard is unreachable.
+  EXPECT_CALL(mock_local_lookup_, GetKeyValueSet(_)).Times(0);
+
+  std::vector<absl::flat_hash_set<std::string>> cluster_mappings;
+  for (int i = 0; i < 2; i++) {
+    cluster_mappings.push_back({std::to_string(i)});
+  }
+  auto shard_manager =
+      ShardManager::Create(num_shards_, std::move(cluster_mappings),
+                           std::make_unique<MockRandomGenerator>(),
+                           [](const std::string& ip) { return nullptr; });
+
+  auto sharded_lookup =
+      CreateShardedLookup(mock_local_lookup_, num_shards_, shard_num_,
+                          *(*shard_manager), mock_metrics_recorder_);
+  auto response = sharded_lookup->RunQuery("key1|key4");
+  EXPECT_FALSE(response.ok());
+
+  EXPECT_THAT(response.status().code(), absl::StatusCode::kInternal);
+}
+
+TEST_F(ShardedLookupTest, RunQuery_PartialResults_MissingClient) {
+  absl::FlagSaver flag_saver;
+  absl::SetFlag(&FLAGS_shard_lookup_partial_results, true);
   InternalLookupResponse local_lookup_response;
   TextFormat::ParseFromString(
       R"pb(kv_pairs {
@@ -785,7 +1907,8 @@ TEST_F(ShardedLookupTest, RunQuery_ShardedLookupFails_Error) {
       )pb",
       &local_lookup_response);
   EXPECT_CALL(mock_local_lookup_, GetKeyValueSet(_))
-      .WillOnce(Return(local_lookup_response));
+      .Times(2)
+      .WillRepeatedly(Return(local_lookup_response));
 
   std::vector<absl::flat_hash_set<std::string>> cluster_mappings;
   for (int i = 0; i < 2; i++) {
@@ -800,9 +1923,11 @@ TEST_F(ShardedLookupTest, RunQuery_ShardedLookupFails_Error) {
       CreateShardedLookup(mock_local_lookup_, num_shards_, shard_num_,
                           *(*shard_manager), mock_metrics_recorder_);
   auto response = sharded_lookup->RunQuery("key1|key4");
-  EXPECT_FALSE(response.ok());
-
-  EXPECT_THAT(response.status().code(), absl::StatusCode::kInternal);
+  EXPECT_EQ(response.status().code(), absl::StatusCode::kUnavailable);
+  // Queries that don't use the sets of the failed shard still succeed.
+  response = sharded_lookup->RunQuery("key4");
+  ASSERT_TRUE(response.ok());
+  EXPECT_THAT(response->elements(), testing::ElementsAre("value4"));
 }
 
 TEST_F(ShardedLookupTest, RunQuery_ParseError_ReturnStatus) {
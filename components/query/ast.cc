@@ -15,11 +15,23 @@
 #include "components/query/ast.h"
 
 #include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <tuple>
 #include <utility>
 #include <vector>
 
+#include "absl/container/flat_hash_map.h"
 #include "absl/container/flat_hash_set.h"
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/notification.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
 #include "components/query/sets.h"
 
 namespace kv_server {
@@ -48,39 +60,521 @@ std::vector<const Node*> PostOrderTraversal(const Node* root) {
   return result;
 }
 
+// Names nodes for hash-consing: a `ValueNode` by its key and an `OpNode` by
+// its operator.
+class ASTSignatureVisitor : public ASTStringVisitor {
+ public:
+  std::string Visit(const UnionNode&) override { return "|"; }
+  std::string Visit(const DifferenceNode&) override { return "-"; }
+  std::string Visit(const IntersectionNode&) override { return "&"; }
+  std::string Visit(const ValueNode& node) override {
+    return std::string(*node.Keys().begin());
+  }
+};
+
+bool IsCommutative(std::string_view op_name) {
+  return op_name == "|" || op_name == "&";
+}
+
 }  // namespace
 
-void ASTStackVisitor::Visit(const OpNode& node, std::vector<KVSetView>& stack) {
-  KVSetView right = std::move(stack.back());
-  stack.pop_back();
-  KVSetView left = std::move(stack.back());
-  stack.pop_back();
-  stack.emplace_back(node.Op(std::move(left), std::move(right)));
+std::vector<PlanStep> BuildPlan(const Node& root, std::vector<size_t>& uses) {
+  ASTSignatureVisitor signature_visitor;
+  // Maps the signature of a subtree, i.e. its name and the steps of its
+  // operands, to the step evaluating it.
+  absl::flat_hash_map<std::tuple<std::string, size_t, size_t>, size_t>
+      signature_to_step;
+  absl::flat_hash_map<const Node*, size_t> node_to_step;
+  std::vector<PlanStep> plan;
+  uses.clear();
+  for (const auto* node : PostOrderTraversal(&root)) {
+    PlanStep step{node};
+    std::string name = node->Accept(signature_visitor);
+    if (node->Left() != nullptr) {
+      step.left = node_to_step[node->Left()];
+      step.right = node_to_step[node->Right()];
+      if (IsCommutative(name) && step.right < step.left) {
+        std::swap(step.left, step.right);
+      }
+    }
+    const auto [it, inserted] = signature_to_step.try_emplace(
+        std::make_tuple(std::move(name), step.left, step.right), plan.size());
+    node_to_step[node] = it->second;
+    if (!inserted) {
+      continue;
+    }
+    if (step.left != PlanStep::kNoOperand) {
+      ++uses[step.left];
+      ++uses[step.right];
+    }
+    plan.push_back(step);
+    uses.push_back(0);
+  }
+  // The result of the root is consumed by the caller.
+  ++uses.back();
+  return plan;
 }
 
-void ASTStackVisitor::Visit(const ValueNode& node,
-                            std::vector<KVSetView>& stack) {
-  stack.emplace_back(node.Lookup());
+void ASTPlanVisitor::Visit(const OpNode& node, const PlanStep& step) {
+  absl::Time start;
+  if (stats_ != nullptr) {
+    stats_->push_back({.step = step,
+                       .left_size = results_[step.left].Get().size(),
+                       .right_size = results_[step.right].Get().size()});
+    start = absl::Now();
+  }
+  const bool last_left_use = --remaining_uses_[step.left] == 0;
+  const bool last_right_use = --remaining_uses_[step.right] == 0;
+  PlanStepResult& left = results_[step.left];
+  PlanStepResult& right = results_[step.right];
+  KVSetView result;
+  if (last_left_use && last_right_use && step.left != step.right &&
+      left.borrowed == nullptr && right.borrowed == nullptr) {
+    result = node.Op(std::move(left.owned), std::move(right.owned));
+  } else {
+    result = node.OpView(left.Get(), right.Get());
+    // Release shared results as soon as nothing refers to them anymore.
+    if (last_left_use) {
+      left = PlanStepResult();
+    }
+    if (last_right_use) {
+      right = PlanStepResult();
+    }
+  }
+  if (stats_ != nullptr) {
+    stats_->back().duration = absl::Now() - start;
+    stats_->back().output_size = result.size();
+  }
+  results_.push_back({.owned = std::move(result)});
 }
 
-KVSetView Compute(const std::vector<const Node*>& postorder) {
-  std::vector<KVSetView> stack;
-  ASTStackVisitor visitor;
-  // Apply the operations on the postorder stack
-  for (const auto* node : postorder) {
-    node->Accept(visitor, stack);
+void ASTPlanVisitor::Visit(const ValueNode& node, const PlanStep& step) {
+  if (stats_ == nullptr) {
+    results_.push_back({.borrowed = &node.Lookup()});
+    return;
   }
-  return stack.back();
+  const absl::Time start = absl::Now();
+  results_.push_back({.borrowed = &node.Lookup()});
+  stats_->push_back({.step = step,
+                     .output_size = results_.back().Get().size(),
+                     .duration = absl::Now() - start});
 }
 
 KVSetView Eval(const Node& node) {
-  std::vector<const Node*> postorder = PostOrderTraversal(&node);
-  return Compute(postorder);
+  std::vector<size_t> uses;
+  const std::vector<PlanStep> plan = BuildPlan(node, uses);
+  ASTPlanVisitor visitor(std::move(uses));
+  for (const auto& step : plan) {
+    step.node->Accept(visitor, step);
+  }
+  return visitor.TakeResult();
+}
+
+KVSetView EvalWithStats(const Node& node, std::vector<PlanStepStats>& stats) {
+  std::vector<size_t> uses;
+  const std::vector<PlanStep> plan = BuildPlan(node, uses);
+  stats.clear();
+  stats.reserve(plan.size());
+  ASTPlanVisitor visitor(std::move(uses), &stats);
+  for (const auto& step : plan) {
+    step.node->Accept(visitor, step);
+  }
+  return visitor.TakeResult();
+}
+
+std::string PlanStatsToString(absl::Span<const PlanStepStats> stats) {
+  ASTSignatureVisitor signature_visitor;
+  std::string result;
+  for (size_t i = 0; i < stats.size(); i++) {
+    const PlanStepStats& step_stats = stats[i];
+    const std::string name = step_stats.step.node->Accept(signature_visitor);
+    if (step_stats.step.left == PlanStep::kNoOperand) {
+      absl::StrAppend(&result, "#", i, " ", name, ": ");
+    } else {
+      absl::StrAppend(&result, "#", i, " #", step_stats.step.left, " ", name,
+                      " #", step_stats.step.right, ": ", step_stats.left_size,
+                      ", ", step_stats.right_size, " -> ");
+    }
+    absl::StrAppend(&result, step_stats.output_size, " in ",
+                    absl::FormatDuration(step_stats.duration), "\n");
+  }
+  return result;
+}
+
+void ASTParallelVisitor::Visit(const OpNode& node, const PlanStep& step) {
+  work_.push_back(work_[step.left] + work_[step.right]);
+  ops_.push_back(&node);
+  results_.emplace_back();
+  steps_.push_back(step);
+}
+
+void ASTParallelVisitor::Visit(const ValueNode& node, const PlanStep& step) {
+  results_.push_back({.borrowed = &node.Lookup()});
+  work_.push_back(results_.back().Get().size());
+  ops_.push_back(nullptr);
+  steps_.push_back(step);
+}
+
+KVSetView ASTParallelVisitor::Evaluate() {
+  Compute(steps_.size() - 1);
+  return std::move(results_.back()).Take();
+}
+
+void ASTParallelVisitor::Compute(size_t index) {
+  if (ops_[index] == nullptr) {
+    return;
+  }
+  std::call_once(computed_[index],
+                 [this, index]() { results_[index].owned = Apply(index); });
+}
+
+KVSetView ASTParallelVisitor::Apply(size_t index) {
+  const PlanStep& step = steps_[index];
+  if (work_[index] >= min_parallel_work_ && step.left != step.right) {
+    struct Fork {
+      std::atomic<bool> claimed{false};
+      absl::Notification done;
+    };
+    // The left operand is evaluated by whoever claims it first: a worker if
+    // the task is picked up in time, otherwise this thread once it is done
+    // with the right operand. This thread never waits on a task that has not
+    // started, so a saturated pool can not deadlock. A task that loses the
+    // claim only touches `fork`.
+    auto fork = std::make_shared<Fork>();
+    schedule_([this, fork, left = step.left]() {
+      if (!fork->claimed.exchange(true)) {
+        Compute(left);
+        fork->done.Notify();
+      }
+    });
+    Compute(step.right);
+    if (!fork->claimed.exchange(true)) {
+      Compute(step.left);
+    } else {
+      fork->done.WaitForNotification();
+    }
+  } else {
+    Compute(step.left);
+    Compute(step.right);
+  }
+  PlanStepResult& left = results_[step.left];
+  PlanStepResult& right = results_[step.right];
+  // Computed operands only consumed by this step can be moved into the
+  // operation.
+  if (uses_[step.left] == 1 && uses_[step.right] == 1 &&
+      left.borrowed == nullptr && right.borrowed == nullptr) {
+    return ops_[index]->Op(std::move(left.owned), std::move(right.owned));
+  }
+  return ops_[index]->OpView(left.Get(), right.Get());
+}
+
+KVSetView ParallelEval(const Node& node, ScheduleFn schedule,
+                       size_t min_parallel_work) {
+  std::vector<size_t> uses;
+  const std::vector<PlanStep> plan = BuildPlan(node, uses);
+  ASTParallelVisitor visitor(std::move(uses), std::move(schedule),
+                             min_parallel_work);
+  for (const auto& step : plan) {
+    step.node->Accept(visitor, step);
+  }
+  return visitor.Evaluate();
+}
+
+void ASTMembershipVisitor::Visit(const OpNode& node, const PlanStep& step) {
+  const std::vector<bool>& left = results_[step.left];
+  const std::vector<bool>& right = results_[step.right];
+  std::vector<bool> membership;
+  membership.reserve(left.size());
+  for (size_t i = 0; i < left.size(); i++) {
+    membership.push_back(node.OpContains(left[i], right[i]));
+  }
+  results_.push_back(std::move(membership));
+}
+
+void ASTMembershipVisitor::Visit(const ValueNode& node, const PlanStep& step) {
+  const KVSetView& set = node.Lookup();
+  std::vector<bool> membership;
+  membership.reserve(elements_.size());
+  for (const auto& element : elements_) {
+    membership.push_back(set.contains(element));
+  }
+  results_.push_back(std::move(membership));
+}
+
+void ASTCountVisitor::Visit(const OpNode& node, const PlanStep& step) {
+  // No operation keeps an element that is in none of its operands, so the
+  // candidates of an operand are only needed if the operation can keep the
+  // elements that are only in that operand.
+  const bool left_only = node.OpContains(true, false);
+  const bool right_only = node.OpContains(false, true);
+  std::vector<size_t> candidates;
+  if (left_only && right_only) {
+    candidates = candidates_[step.left];
+    for (size_t candidate : candidates_[step.right]) {
+      if (std::find(candidates.begin(), candidates.end(), candidate) ==
+          candidates.end()) {
+        candidates.push_back(candidate);
+      }
+    }
+  } else if (left_only || (!right_only && candidates_size_[step.left] <=
+                                              candidates_size_[step.right])) {
+    candidates = candidates_[step.left];
+  } else {
+    candidates = candidates_[step.right];
+  }
+  size_t candidates_size = 0;
+  for (size_t candidate : candidates) {
+    candidates_size += sets_[candidate]->size();
+  }
+  candidates_.push_back(std::move(candidates));
+  candidates_size_.push_back(candidates_size);
+  ops_.push_back(&node);
+  sets_.push_back(nullptr);
+  steps_.push_back(step);
+}
+
+void ASTCountVisitor::Visit(const ValueNode& node, const PlanStep& step) {
+  sets_.push_back(&node.Lookup());
+  candidates_.push_back({steps_.size()});
+  candidates_size_.push_back(sets_.back()->size());
+  ops_.push_back(nullptr);
+  steps_.push_back(step);
+}
+
+size_t ASTCountVisitor::Count() {
+  const std::vector<size_t>& candidates = candidates_.back();
+  if (ops_.back() == nullptr) {
+    return sets_.back()->size();
+  }
+  size_t count = 0;
+  for (size_t i = 0; i < candidates.size(); i++) {
+    for (const auto& element : *sets_[candidates[i]]) {
+      // Elements shared by several candidates are counted with the first.
+      const bool counted =
+          std::any_of(candidates.begin(), candidates.begin() + i,
+                      [this, element](size_t candidate) {
+                        return sets_[candidate]->contains(element);
+                      });
+      if (!counted && Contains(element)) {
+        ++count;
+      }
+    }
+  }
+  return count;
+}
+
+bool ASTCountVisitor::Contains(std::string_view element) {
+  bits_.resize(steps_.size());
+  for (size_t i = 0; i < steps_.size(); i++) {
+    bits_[i] = ops_[i] == nullptr
+                   ? sets_[i]->contains(element)
+                   : ops_[i]->OpContains(bits_[steps_[i].left],
+                                         bits_[steps_[i].right]);
+  }
+  return bits_.back();
+}
+
+void ASTForEachVisitor::Visit(const OpNode& node, const PlanStep& step) {
+  ops_.push_back(&node);
+  values_.push_back(nullptr);
+  results_.push_back(nullptr);
+  steps_.push_back(step);
+}
+
+void ASTForEachVisitor::Visit(const ValueNode& node, const PlanStep& step) {
+  ops_.push_back(nullptr);
+  values_.push_back(&node);
+  results_.push_back(nullptr);
+  steps_.push_back(step);
+}
+
+bool ASTForEachVisitor::ForEach(
+    absl::FunctionRef<bool(std::string_view)> fn) {
+  return ForEach(steps_.size() - 1, fn);
+}
+
+bool ASTForEachVisitor::ForEach(size_t index,
+                                absl::FunctionRef<bool(std::string_view)> fn) {
+  if (ops_[index] == nullptr || results_[index] != nullptr) {
+    for (const auto& element : Materialize(index)) {
+      if (!fn(element)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  const OpNode& op = *ops_[index];
+  const PlanStep& step = steps_[index];
+  if (!op.OpContains(false, true)) {
+    // Every element of the result is in the left operand.
+    const KVSetView& right = Materialize(step.right);
+    return ForEach(step.left, [&op, &right, fn](std::string_view element) {
+      return !op.OpContains(true, right.contains(element)) || fn(element);
+    });
+  }
+  const KVSetView& left = Materialize(step.left);
+  if (!op.OpContains(true, false)) {
+    // Every element of the result is in the right operand.
+    return ForEach(step.right, [&op, &left, fn](std::string_view element) {
+      return !op.OpContains(left.contains(element), true) || fn(element);
+    });
+  }
+  // Every element of either operand is in the result.
+  for (const auto& element : left) {
+    if (!fn(element)) {
+      return false;
+    }
+  }
+  return ForEach(step.right, [&left, fn](std::string_view element) {
+    return left.contains(element) || fn(element);
+  });
+}
+
+const KVSetView& ASTForEachVisitor::Materialize(size_t index) {
+  if (results_[index] == nullptr) {
+    if (ops_[index] == nullptr) {
+      results_[index] = &values_[index]->Lookup();
+    } else {
+      const PlanStep& step = steps_[index];
+      const KVSetView& left = Materialize(step.left);
+      results_[index] = &computed_.emplace_back(
+          ops_[index]->OpView(left, Materialize(step.right)));
+    }
+  }
+  return *results_[index];
+}
+
+bool EvalForEach(const Node& node,
+                 absl::FunctionRef<bool(std::string_view)> fn) {
+  std::vector<size_t> uses;
+  const std::vector<PlanStep> plan = BuildPlan(node, uses);
+  ASTForEachVisitor visitor;
+  for (const auto& step : plan) {
+    step.node->Accept(visitor, step);
+  }
+  return visitor.ForEach(fn);
+}
+
+size_t EvalCount(const Node& node) {
+  std::vector<size_t> uses;
+  const std::vector<PlanStep> plan = BuildPlan(node, uses);
+  ASTCountVisitor visitor;
+  for (const auto& step : plan) {
+    step.node->Accept(visitor, step);
+  }
+  return visitor.Count();
 }
 
-void OpNode::Accept(ASTStackVisitor& visitor,
-                    std::vector<KVSetView>& stack) const {
-  visitor.Visit(*this, stack);
+ThetaSketch ASTSketchVisitor::Visit(const OpNode& node) {
+  return ThetaSketch::Combine(
+      node.Left()->Accept(*this), node.Right()->Accept(*this),
+      [&node](bool in_left, bool in_right) {
+        return node.OpContains(in_left, in_right);
+      });
+}
+
+ThetaSketch ASTSketchVisitor::Visit(const ValueNode& node) {
+  return sketch_fn_(*node.Keys().begin());
+}
+
+ThetaSketch EvalSketch(
+    const Node& node,
+    absl::FunctionRef<ThetaSketch(std::string_view key)> sketch_fn) {
+  ASTSketchVisitor visitor(sketch_fn);
+  return node.Accept(visitor);
+}
+
+template <typename T>
+void ASTSortedVisitor<T>::Visit(const OpNode& node, const PlanStep& step) {
+  computed_.push_back(node.OpSorted(results_[step.left], results_[step.right]));
+  results_.push_back(computed_.back());
+}
+
+template <typename T>
+void ASTSortedVisitor<T>::Visit(const ValueNode& node, const PlanStep& step) {
+  results_.push_back(lookup_fn_(*node.Keys().begin()));
+}
+
+template <typename T>
+std::vector<T> ASTSortedVisitor<T>::TakeResult() {
+  const absl::Span<const T> result = results_.back();
+  if (!computed_.empty() && result.data() == computed_.back().data()) {
+    return std::move(computed_.back());
+  }
+  // The query is a single key, whose set is borrowed.
+  return std::vector<T>(result.begin(), result.end());
+}
+
+template <typename T>
+std::vector<T> EvalSorted(
+    const Node& node,
+    absl::FunctionRef<absl::Span<const T>(std::string_view key)> lookup_fn) {
+  std::vector<size_t> uses;
+  const std::vector<PlanStep> plan = BuildPlan(node, uses);
+  ASTSortedVisitor<T> visitor(lookup_fn);
+  for (const auto& step : plan) {
+    step.node->Accept(visitor, step);
+  }
+  return visitor.TakeResult();
+}
+
+template class ASTSortedVisitor<uint32_t>;
+template class ASTSortedVisitor<uint64_t>;
+template std::vector<uint32_t> EvalSorted(
+    const Node& node,
+    absl::FunctionRef<absl::Span<const uint32_t>(std::string_view key)>
+        lookup_fn);
+template std::vector<uint64_t> EvalSorted(
+    const Node& node,
+    absl::FunctionRef<absl::Span<const uint64_t>(std::string_view key)>
+        lookup_fn);
+
+std::vector<bool> EvalMembership(const Node& node,
+                                 absl::Span<const std::string_view> elements) {
+  std::vector<size_t> uses;
+  const std::vector<PlanStep> plan = BuildPlan(node, uses);
+  ASTMembershipVisitor visitor(elements);
+  for (const auto& step : plan) {
+    step.node->Accept(visitor, step);
+  }
+  return visitor.TakeResult();
+}
+
+void OpNode::Accept(ASTPlanVisitor& visitor, const PlanStep& step) const {
+  visitor.Visit(*this, step);
+}
+
+void OpNode::Accept(ASTParallelVisitor& visitor,
+                    const PlanStep& step) const {
+  visitor.Visit(*this, step);
+}
+
+void OpNode::Accept(ASTMembershipVisitor& visitor,
+                    const PlanStep& step) const {
+  visitor.Visit(*this, step);
+}
+
+void OpNode::Accept(ASTCountVisitor& visitor, const PlanStep& step) const {
+  visitor.Visit(*this, step);
+}
+
+void OpNode::Accept(ASTForEachVisitor& visitor,
+                    const PlanStep& step) const {
+  visitor.Visit(*this, step);
+}
+
+void OpNode::Accept(ASTSortedVisitor<uint32_t>& visitor,
+                    const PlanStep& step) const {
+  visitor.Visit(*this, step);
+}
+
+void OpNode::Accept(ASTSortedVisitor<uint64_t>& visitor,
+                    const PlanStep& step) const {
+  visitor.Visit(*this, step);
+}
+
+ThetaSketch OpNode::Accept(ASTSketchVisitor& visitor) const {
+  return visitor.Visit(*this);
 }
 
 std::string UnionNode::Accept(ASTStringVisitor& visitor) const {
@@ -118,15 +612,46 @@ absl::flat_hash_set<std::string_view> OpNode::Keys() const {
   return key_set;
 }
 
-ValueNode::ValueNode(
-    absl::AnyInvocable<KVSetView(std::string_view key) const> lookup_fn,
-    std::string key)
+ValueNode::ValueNode(LookupFn lookup_fn, std::string key)
     : lookup_fn_(absl::bind_front(std::move(lookup_fn), key)),
       key_(std::move(key)) {}
 
-void ValueNode::Accept(ASTStackVisitor& visitor,
-                       std::vector<KVSetView>& stack) const {
-  visitor.Visit(*this, stack);
+void ValueNode::Accept(ASTPlanVisitor& visitor, const PlanStep& step) const {
+  visitor.Visit(*this, step);
+}
+
+void ValueNode::Accept(ASTParallelVisitor& visitor,
+                       const PlanStep& step) const {
+  visitor.Visit(*this, step);
+}
+
+void ValueNode::Accept(ASTMembershipVisitor& visitor,
+                       const PlanStep& step) const {
+  visitor.Visit(*this, step);
+}
+
+void ValueNode::Accept(ASTCountVisitor& visitor,
+                       const PlanStep& step) const {
+  visitor.Visit(*this, step);
+}
+
+void ValueNode::Accept(ASTForEachVisitor& visitor,
+                       const PlanStep& step) const {
+  visitor.Visit(*this, step);
+}
+
+void ValueNode::Accept(ASTSortedVisitor<uint32_t>& visitor,
+                       const PlanStep& step) const {
+  visitor.Visit(*this, step);
+}
+
+void ValueNode::Accept(ASTSortedVisitor<uint64_t>& visitor,
+                       const PlanStep& step) const {
+  visitor.Visit(*this, step);
+}
+
+ThetaSketch ValueNode::Accept(ASTSketchVisitor& visitor) const {
+  return visitor.Visit(*this);
 }
 
 std::string ValueNode::Accept(ASTStringVisitor& visitor) const {
@@ -141,6 +666,6 @@ absl::flat_hash_set<std::string_view> ValueNode::Keys() const {
   };
 }
 
-KVSetView ValueNode::Lookup() const { return lookup_fn_(); }
+const KVSetView& ValueNode::Lookup() const { return lookup_fn_(); }
 
 }  // namespace kv_server
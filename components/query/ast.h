@@ -16,7 +16,11 @@
 
 #ifndef COMPONENTS_QUERY_AST_H_
 #define COMPONENTS_QUERY_AST_H_
+#include <cstddef>
+#include <cstdint>
+#include <deque>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <string_view>
 #include <utility>
@@ -25,17 +29,35 @@
 #include "absl/container/flat_hash_set.h"
 #include "absl/functional/any_invocable.h"
 #include "absl/functional/bind_front.h"
+#include "absl/functional/function_ref.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "components/query/set_sketch.h"
 #include "components/query/sets.h"
 
 namespace kv_server {
-class ASTStackVisitor;
+class ASTCountVisitor;
+class ASTForEachVisitor;
+class ASTMembershipVisitor;
+class ASTParallelVisitor;
+class ASTPlanVisitor;
+class ASTSketchVisitor;
+template <typename T>
+class ASTSortedVisitor;
 class ASTStringVisitor;
+struct PlanStep;
 
 // All set operations operate on a reference to the data in the DB
 // This means that the data in the DB must be locked throughout the lifetime of
 // the result.
 using KVSetView = absl::flat_hash_set<std::string_view>;
 
+// Returns the set associated with `key`, or an empty set if there is none.
+// The set is only borrowed by the evaluation, so it must stay alive and
+// unchanged until the evaluation is done.
+using LookupFn =
+    absl::AnyInvocable<const KVSetView&(std::string_view key) const>;
+
 class Node {
  public:
   virtual ~Node() = default;
@@ -44,25 +66,47 @@ class Node {
   // Return all Keys associated with ValueNodes in the tree.
   virtual absl::flat_hash_set<std::string_view> Keys() const = 0;
   // Uses the Visitor pattern for the concrete class
-  // to mutate the stack accordingly for `Eval` (ValueNode vs. OpNode)
-  virtual void Accept(ASTStackVisitor& visitor,
-                      std::vector<KVSetView>& stack) const = 0;
+  // to evaluate a plan step accordingly for `Eval` (ValueNode vs. OpNode)
+  virtual void Accept(ASTPlanVisitor& visitor, const PlanStep& step) const = 0;
+  virtual void Accept(ASTParallelVisitor& visitor,
+                      const PlanStep& step) const = 0;
+  virtual void Accept(ASTMembershipVisitor& visitor,
+                      const PlanStep& step) const = 0;
+  virtual void Accept(ASTCountVisitor& visitor,
+                      const PlanStep& step) const = 0;
+  virtual void Accept(ASTForEachVisitor& visitor,
+                      const PlanStep& step) const = 0;
+  virtual void Accept(ASTSortedVisitor<uint32_t>& visitor,
+                      const PlanStep& step) const = 0;
+  virtual void Accept(ASTSortedVisitor<uint64_t>& visitor,
+                      const PlanStep& step) const = 0;
+  virtual ThetaSketch Accept(ASTSketchVisitor& visitor) const = 0;
   virtual std::string Accept(ASTStringVisitor& visitor) const = 0;
 };
 
 // The value associated with a `ValueNode` is the set with its associated `key`.
 class ValueNode : public Node {
  public:
-  ValueNode(absl::AnyInvocable<KVSetView(std::string_view key) const> lookup_fn,
-            std::string key);
+  ValueNode(LookupFn lookup_fn, std::string key);
   absl::flat_hash_set<std::string_view> Keys() const override;
-  KVSetView Lookup() const;
-  void Accept(ASTStackVisitor& visitor,
-              std::vector<KVSetView>& stack) const override;
+  const KVSetView& Lookup() const;
+  void Accept(ASTPlanVisitor& visitor, const PlanStep& step) const override;
+  void Accept(ASTParallelVisitor& visitor,
+              const PlanStep& step) const override;
+  void Accept(ASTMembershipVisitor& visitor,
+              const PlanStep& step) const override;
+  void Accept(ASTCountVisitor& visitor, const PlanStep& step) const override;
+  void Accept(ASTForEachVisitor& visitor,
+              const PlanStep& step) const override;
+  void Accept(ASTSortedVisitor<uint32_t>& visitor,
+              const PlanStep& step) const override;
+  void Accept(ASTSortedVisitor<uint64_t>& visitor,
+              const PlanStep& step) const override;
+  ThetaSketch Accept(ASTSketchVisitor& visitor) const override;
   std::string Accept(ASTStringVisitor& visitor) const override;
 
  private:
-  absl::AnyInvocable<KVSetView() const> lookup_fn_;
+  absl::AnyInvocable<const KVSetView&() const> lookup_fn_;
   std::string key_;
 };
 
@@ -75,8 +119,36 @@ class OpNode : public Node {
   inline Node* Right() const override { return right_.get(); }
   // Computes the operation over the `left` and `right` nodes.
   virtual KVSetView Op(KVSetView left, KVSetView right) const = 0;
-  void Accept(ASTStackVisitor& visitor,
-              std::vector<KVSetView>& stack) const override;
+  // Computes the operation without modifying the operands, for operands that
+  // are shared with other parts of the plan.
+  virtual KVSetView OpView(const KVSetView& left,
+                           const KVSetView& right) const = 0;
+  // Computes the size of `Op(left, right)` without materializing it.
+  virtual size_t OpCount(const KVSetView& left,
+                         const KVSetView& right) const = 0;
+  // Computes whether an element is in the result of the operation, given
+  // whether it is in the `left` and `right` operands.
+  virtual bool OpContains(bool in_left, bool in_right) const = 0;
+  // Computes the operation over sorted sets of unsigned integers.
+  virtual std::vector<uint32_t> OpSorted(
+      absl::Span<const uint32_t> left,
+      absl::Span<const uint32_t> right) const = 0;
+  virtual std::vector<uint64_t> OpSorted(
+      absl::Span<const uint64_t> left,
+      absl::Span<const uint64_t> right) const = 0;
+  void Accept(ASTPlanVisitor& visitor, const PlanStep& step) const override;
+  void Accept(ASTParallelVisitor& visitor,
+              const PlanStep& step) const override;
+  void Accept(ASTMembershipVisitor& visitor,
+              const PlanStep& step) const override;
+  void Accept(ASTCountVisitor& visitor, const PlanStep& step) const override;
+  void Accept(ASTForEachVisitor& visitor,
+              const PlanStep& step) const override;
+  void Accept(ASTSortedVisitor<uint32_t>& visitor,
+              const PlanStep& step) const override;
+  void Accept(ASTSortedVisitor<uint64_t>& visitor,
+              const PlanStep& step) const override;
+  ThetaSketch Accept(ASTSketchVisitor& visitor) const override;
 
  private:
   std::unique_ptr<Node> left_;
@@ -90,6 +162,27 @@ class UnionNode : public OpNode {
   inline KVSetView Op(KVSetView left, KVSetView right) const override {
     return Union(std::move(left), std::move(right));
   }
+  inline KVSetView OpView(const KVSetView& left,
+                          const KVSetView& right) const override {
+    return UnionView(left, right);
+  }
+  inline size_t OpCount(const KVSetView& left,
+                        const KVSetView& right) const override {
+    return UnionCount(left, right);
+  }
+  inline bool OpContains(bool in_left, bool in_right) const override {
+    return in_left || in_right;
+  }
+  inline std::vector<uint32_t> OpSorted(
+      absl::Span<const uint32_t> left,
+      absl::Span<const uint32_t> right) const override {
+    return SortedUnion(left, right);
+  }
+  inline std::vector<uint64_t> OpSorted(
+      absl::Span<const uint64_t> left,
+      absl::Span<const uint64_t> right) const override {
+    return SortedUnion(left, right);
+  }
   std::string Accept(ASTStringVisitor& visitor) const override;
 };
 
@@ -100,6 +193,27 @@ class IntersectionNode : public OpNode {
   inline KVSetView Op(KVSetView left, KVSetView right) const override {
     return Intersection(std::move(left), std::move(right));
   }
+  inline KVSetView OpView(const KVSetView& left,
+                          const KVSetView& right) const override {
+    return IntersectionView(left, right);
+  }
+  inline size_t OpCount(const KVSetView& left,
+                        const KVSetView& right) const override {
+    return IntersectionCount(left, right);
+  }
+  inline bool OpContains(bool in_left, bool in_right) const override {
+    return in_left && in_right;
+  }
+  inline std::vector<uint32_t> OpSorted(
+      absl::Span<const uint32_t> left,
+      absl::Span<const uint32_t> right) const override {
+    return SortedIntersection(left, right);
+  }
+  inline std::vector<uint64_t> OpSorted(
+      absl::Span<const uint64_t> left,
+      absl::Span<const uint64_t> right) const override {
+    return SortedIntersection(left, right);
+  }
   std::string Accept(ASTStringVisitor& visitor) const override;
 };
 
@@ -110,21 +224,315 @@ class DifferenceNode : public OpNode {
   inline KVSetView Op(KVSetView left, KVSetView right) const override {
     return Difference(std::move(left), std::move(right));
   }
+  inline KVSetView OpView(const KVSetView& left,
+                          const KVSetView& right) const override {
+    return DifferenceView(left, right);
+  }
+  inline size_t OpCount(const KVSetView& left,
+                        const KVSetView& right) const override {
+    return DifferenceCount(left, right);
+  }
+  inline bool OpContains(bool in_left, bool in_right) const override {
+    return in_left && !in_right;
+  }
+  inline std::vector<uint32_t> OpSorted(
+      absl::Span<const uint32_t> left,
+      absl::Span<const uint32_t> right) const override {
+    return SortedDifference(left, right);
+  }
+  inline std::vector<uint64_t> OpSorted(
+      absl::Span<const uint64_t> left,
+      absl::Span<const uint64_t> right) const override {
+    return SortedDifference(left, right);
+  }
   std::string Accept(ASTStringVisitor& visitor) const override;
 };
 
 // Creates execution plan and runs it.
 KVSetView Eval(const Node& node);
 
-// Responsible for mutating the stack with the given `Node`.
+// Runs a task, typically on a worker thread of a pool shared across queries.
+// Called concurrently from the threads evaluating a query. Tasks may run
+// after the evaluation returned, in which case they do nothing.
+using ScheduleFn = absl::AnyInvocable<void(absl::AnyInvocable<void()>) const>;
+
+// Same result as `Eval`, but the two operands of an operation are evaluated
+// concurrently when its estimated work, the total size of the sets looked up
+// in its subtree, is at least `min_parallel_work`: the left operand is handed
+// to `schedule` while the calling thread evaluates the right one. Smaller
+// subtrees are evaluated on the calling thread. Lookups always happen on the
+// calling thread.
+KVSetView ParallelEval(const Node& node, ScheduleFn schedule,
+                       size_t min_parallel_work);
+
+// Returns the number of elements `Eval` would return. No set is
+// materialized: each `ValueNode` is looked up once and the elements that can
+// be in the result are tested against the whole expression, see
+// `ASTCountVisitor`.
+size_t EvalCount(const Node& node);
+
+// Calls `fn` once for every element `Eval` would return, until `fn` returns
+// false. Returns false if the iteration was stopped early. Operands are only
+// materialized where membership checks require it, so stopping early skips
+// building the rest of the result. See `ASTForEachVisitor`.
+bool EvalForEach(const Node& node,
+                 absl::FunctionRef<bool(std::string_view)> fn);
+
+// Returns whether each of `elements` is in the set `Eval` would return, in the
+// same order. No intermediate sets are materialized, each `ValueNode` is
+// looked up once and probed for every element.
+std::vector<bool> EvalMembership(const Node& node,
+                                 absl::Span<const std::string_view> elements);
+
+// Returns the sketch of the set `Eval` would return, combined from the
+// sketches `sketch_fn` returns for the keys of the `ValueNode`s. No set is
+// looked up, so the cost only depends on the size of the sketches.
+ThetaSketch EvalSketch(
+    const Node& node,
+    absl::FunctionRef<ThetaSketch(std::string_view key)> sketch_fn);
+
+// Returns the set `Eval` would return, for sets of unsigned integers:
+// `lookup_fn` returns the set of each key as a sorted array without
+// duplicates, and the result is sorted the same way. The operations merge the
+// arrays, see `SortedUnion`. Looked up sets are only borrowed, so they must
+// stay alive and unchanged until the evaluation is done. Only instantiated
+// for uint32_t and uint64_t.
+template <typename T>
+std::vector<T> EvalSorted(
+    const Node& node,
+    absl::FunctionRef<absl::Span<const T>(std::string_view key)> lookup_fn);
+
+// A step of the execution plan built by `BuildPlan`. Identical subtrees of
+// the AST, including repeated keys, share a single step, so each of them is
+// evaluated once and its result is reused by every step that refers to it.
+struct PlanStep {
+  static constexpr size_t kNoOperand = static_cast<size_t>(-1);
+  // Any of the identical nodes this step evaluates.
+  const Node* node;
+  // Indices of the steps whose results are the operands of an `OpNode`.
+  size_t left = kNoOperand;
+  size_t right = kNoOperand;
+};
+
+// Returns the steps evaluating `root` in post order, ending with `root`.
+// `uses` is set to how many times the result of each step is consumed.
+std::vector<PlanStep> BuildPlan(const Node& root, std::vector<size_t>& uses);
+
+// The result of a plan step: the set looked up by a `ValueNode`, which is
+// borrowed, or the set computed by an `OpNode`, which is owned.
+struct PlanStepResult {
+  const KVSetView& Get() const {
+    return borrowed == nullptr ? owned : *borrowed;
+  }
+  // Returns the set, which is only copied if it is borrowed.
+  KVSetView Take() && {
+    return borrowed == nullptr ? std::move(owned) : *borrowed;
+  }
+
+  const KVSetView* borrowed = nullptr;
+  KVSetView owned;
+};
+
+// What evaluating a plan step took, as recorded by `EvalWithStats`.
+struct PlanStepStats {
+  PlanStep step;
+  // The sizes of the operands, for an `OpNode`.
+  size_t left_size = 0;
+  size_t right_size = 0;
+  size_t output_size = 0;
+  // The time it took to evaluate the step, which for a `ValueNode` is the
+  // time it took to look up its set.
+  absl::Duration duration;
+};
+
+// Same result as `Eval`. `stats` is set to the statistics of each step of the
+// plan, in the order they were evaluated.
+KVSetView EvalWithStats(const Node& node, std::vector<PlanStepStats>& stats);
+
+// Returns one line per step of `stats`, e.g. `#2 #0 | #1: 3, 2 -> 4 in 5us`
+// for an operation or `#0 A: 3 in 1us` for a lookup.
+std::string PlanStatsToString(absl::Span<const PlanStepStats> stats);
+
+// Responsible for evaluating a plan step with the given `Node`.
 // Avoids downcasting for subclass specific behaviors.
-class ASTStackVisitor {
+// Computed results that are consumed for the last time are moved into the
+// operation, while looked up sets and shared results are only read, so no
+// operand is ever copied.
+class ASTPlanVisitor {
  public:
-  // Applies the operation to the top two values on the stack.
-  // Replaces the top two values with the result.
-  void Visit(const OpNode& node, std::vector<KVSetView>& stack);
-  // Pushes the result of `Lookup` to the stack.
-  void Visit(const ValueNode& node, std::vector<KVSetView>& stack);
+  // Records the statistics of every step in `stats` when it is set.
+  explicit ASTPlanVisitor(std::vector<size_t> remaining_uses,
+                          std::vector<PlanStepStats>* stats = nullptr)
+      : remaining_uses_(std::move(remaining_uses)), stats_(stats) {}
+  // Applies the operation to the results of the operand steps.
+  // Appends the result.
+  void Visit(const OpNode& node, const PlanStep& step);
+  // Appends the result of `Lookup`.
+  void Visit(const ValueNode& node, const PlanStep& step);
+  // Returns the result of the last step.
+  KVSetView TakeResult() { return std::move(results_.back()).Take(); }
+
+ private:
+  std::vector<PlanStepResult> results_;
+  std::vector<size_t> remaining_uses_;
+  std::vector<PlanStepStats>* stats_;
+};
+
+// Responsible for evaluating a plan with independent subtrees running
+// concurrently. Visiting the steps in order looks up every `ValueNode` and
+// estimates the work of each step, `Evaluate` then applies the operations.
+// A step shared by concurrently evaluated subtrees is computed once, by
+// whichever gets to it first.
+class ASTParallelVisitor {
+ public:
+  ASTParallelVisitor(std::vector<size_t> uses, ScheduleFn schedule,
+                     size_t min_parallel_work)
+      : uses_(std::move(uses)),
+        computed_(uses_.size()),
+        schedule_(std::move(schedule)),
+        min_parallel_work_(min_parallel_work) {}
+  // Records the operation, its work is the sum of the work of its operands.
+  void Visit(const OpNode& node, const PlanStep& step);
+  // Records the result of `Lookup`, its size is the work of the step.
+  void Visit(const ValueNode& node, const PlanStep& step);
+  // Returns the result of the last step.
+  KVSetView Evaluate();
+
+ private:
+  // Makes sure the result of the step at `index` is available.
+  void Compute(size_t index);
+  KVSetView Apply(size_t index);
+
+  std::vector<size_t> uses_;
+  std::vector<std::once_flag> computed_;
+  std::vector<PlanStep> steps_;
+  // The operation of each step, nullptr for lookups.
+  std::vector<const OpNode*> ops_;
+  std::vector<size_t> work_;
+  std::vector<PlanStepResult> results_;
+  ScheduleFn schedule_;
+  size_t min_parallel_work_;
+};
+
+// Responsible for computing the per element membership bits of a plan step
+// with the given `Node`.
+class ASTMembershipVisitor {
+ public:
+  explicit ASTMembershipVisitor(absl::Span<const std::string_view> elements)
+      : elements_(elements) {}
+  // Combines the bits of the operand steps element-wise.
+  // Appends the result.
+  void Visit(const OpNode& node, const PlanStep& step);
+  // Appends whether each element is in the result of `Lookup`.
+  void Visit(const ValueNode& node, const PlanStep& step);
+  // Returns the bits of the last step.
+  std::vector<bool> TakeResult() { return std::move(results_.back()); }
+
+ private:
+  absl::Span<const std::string_view> elements_;
+  std::vector<std::vector<bool>> results_;
+};
+
+// Computes the number of elements in the result of a plan. The result only
+// holds elements of a few of the looked up sets, its candidates, e.g. the
+// left operand of a difference or the smaller operand of an intersection.
+// Each element of the candidates is counted once, if it is in the result of
+// the plan, combining its membership bits up the plan like
+// `ASTMembershipVisitor`.
+class ASTCountVisitor {
+ public:
+  // Records the operation and the candidates of its result.
+  void Visit(const OpNode& node, const PlanStep& step);
+  // Records the result of `Lookup`, which is its own candidate.
+  void Visit(const ValueNode& node, const PlanStep& step);
+  // Returns the number of elements in the result of the last step.
+  size_t Count();
+
+ private:
+  // Returns whether `element` is in the result of the last step.
+  bool Contains(std::string_view element);
+
+  std::vector<PlanStep> steps_;
+  // The operation of each step, nullptr for lookups.
+  std::vector<const OpNode*> ops_;
+  // The looked up set of each lookup step, nullptr for operations.
+  std::vector<const KVSetView*> sets_;
+  // The lookup steps whose sets hold every element of each step's result,
+  // and the total size of these sets.
+  std::vector<std::vector<size_t>> candidates_;
+  std::vector<size_t> candidates_size_;
+  // Scratch space for `Contains`.
+  std::vector<bool> bits_;
+};
+
+// Streams the elements of the result of a plan. The elements of a difference
+// or an intersection are streamed from its left operand, filtered by the
+// right one, and those of a union from both, skipping the elements of the
+// right operand that are in the left one. The operands used as filters are
+// materialized, each step at most once, so shared subtrees are evaluated once
+// however many operations they are an operand of.
+class ASTForEachVisitor {
+ public:
+  // Records the operation.
+  void Visit(const OpNode& node, const PlanStep& step);
+  // Records the node, whose set is looked up on first use.
+  void Visit(const ValueNode& node, const PlanStep& step);
+  // Calls `fn` for every element of the result of the last step, until `fn`
+  // returns false. Returns false if the iteration was stopped early.
+  bool ForEach(absl::FunctionRef<bool(std::string_view)> fn);
+
+ private:
+  bool ForEach(size_t index, absl::FunctionRef<bool(std::string_view)> fn);
+  // Returns the result of the step at `index`, evaluating it on first use.
+  const KVSetView& Materialize(size_t index);
+
+  std::vector<PlanStep> steps_;
+  // The operation of each step, nullptr for lookups.
+  std::vector<const OpNode*> ops_;
+  std::vector<const ValueNode*> values_;
+  // The result of each step once materialized: the looked up set of a lookup
+  // or one of `computed_`.
+  std::vector<const KVSetView*> results_;
+  std::deque<KVSetView> computed_;
+};
+
+// Evaluates a plan over sorted sets of unsigned integers, see `EvalSorted`.
+// Looked up sets are borrowed, and the result of each operation is kept
+// until the evaluation is done, so that shared steps can refer to it.
+template <typename T>
+class ASTSortedVisitor {
+ public:
+  explicit ASTSortedVisitor(
+      absl::FunctionRef<absl::Span<const T>(std::string_view key)> lookup_fn)
+      : lookup_fn_(lookup_fn) {}
+  // Applies the operation to the results of the operand steps.
+  // Appends the result.
+  void Visit(const OpNode& node, const PlanStep& step);
+  // Appends the set `lookup_fn` returns for the node's key.
+  void Visit(const ValueNode& node, const PlanStep& step);
+  // Returns the result of the last step.
+  std::vector<T> TakeResult();
+
+ private:
+  absl::FunctionRef<absl::Span<const T>(std::string_view key)> lookup_fn_;
+  // The result of each step: a looked up set or one of `computed_`.
+  std::vector<absl::Span<const T>> results_;
+  std::deque<std::vector<T>> computed_;
+};
+
+// Computes the sketch of the result of a `Node` from the sketches of its sets.
+class ASTSketchVisitor {
+ public:
+  explicit ASTSketchVisitor(
+      absl::FunctionRef<ThetaSketch(std::string_view key)> sketch_fn)
+      : sketch_fn_(sketch_fn) {}
+  // Combines the sketches of both operands with the operation.
+  ThetaSketch Visit(const OpNode& node);
+  // Returns the sketch of the set of the node's key.
+  ThetaSketch Visit(const ValueNode& node);
+
+ private:
+  absl::FunctionRef<ThetaSketch(std::string_view key)> sketch_fn_;
 };
 
 // General purpose Vistor capable of returning a string representation of a Node
@@ -14,8 +14,14 @@
 
 #include "components/query/ast.h"
 
+#include <cstdint>
+#include <thread>
+#include <vector>
+
 #include "absl/container/flat_hash_map.h"
 #include "absl/container/flat_hash_set.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/span.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 
@@ -30,12 +36,13 @@ const absl::flat_hash_map<std::string, absl::flat_hash_set<std::string_view>>
         {"D", {"d", "e", "f"}},
 };
 
-absl::flat_hash_set<std::string_view> Lookup(std::string_view key) {
+const absl::flat_hash_set<std::string_view>& Lookup(std::string_view key) {
+  static const auto* kEmptySet = new absl::flat_hash_set<std::string_view>();
   const auto& it = kDb.find(key);
   if (it != kDb.end()) {
     return it->second;
   }
-  return {};
+  return *kEmptySet;
 }
 
 TEST(AstTest, Value) {
@@ -122,6 +129,338 @@ TEST(AstTest, All) {
   EXPECT_EQ(Eval(center), expected);
 }
 
+TEST(AstTest, AllCount) {
+  // (A-B) | (C&D) = {a, d, e}
+  std::unique_ptr<ValueNode> a = std::make_unique<ValueNode>(Lookup, "A");
+  std::unique_ptr<ValueNode> b = std::make_unique<ValueNode>(Lookup, "B");
+  std::unique_ptr<ValueNode> c = std::make_unique<ValueNode>(Lookup, "C");
+  std::unique_ptr<ValueNode> d = std::make_unique<ValueNode>(Lookup, "D");
+  std::unique_ptr<DifferenceNode> left =
+      std::make_unique<DifferenceNode>(std::move(a), std::move(b));
+  std::unique_ptr<IntersectionNode> right =
+      std::make_unique<IntersectionNode>(std::move(c), std::move(d));
+  UnionNode center(std::move(left), std::move(right));
+  EXPECT_EQ(EvalCount(center), 3);
+  EXPECT_EQ(EvalCount(*center.Left()), 1);
+  EXPECT_EQ(EvalCount(*center.Right()), 2);
+}
+
+TEST(AstTest, CountOfSharedCandidates) {
+  int lookups = 0;
+  auto counting_lookup = [&lookups](std::string_view key) -> const KVSetView& {
+    ++lookups;
+    return Lookup(key);
+  };
+  // ((A|B) & (B|C)) | (B-D) = {b, c, d} | {b, c} = {b, c, d}
+  auto a_or_b = std::make_unique<UnionNode>(
+      std::make_unique<ValueNode>(counting_lookup, "A"),
+      std::make_unique<ValueNode>(counting_lookup, "B"));
+  auto b_or_c = std::make_unique<UnionNode>(
+      std::make_unique<ValueNode>(counting_lookup, "B"),
+      std::make_unique<ValueNode>(counting_lookup, "C"));
+  auto b_minus_d = std::make_unique<DifferenceNode>(
+      std::make_unique<ValueNode>(counting_lookup, "B"),
+      std::make_unique<ValueNode>(counting_lookup, "D"));
+  UnionNode root(std::make_unique<IntersectionNode>(std::move(a_or_b),
+                                                    std::move(b_or_c)),
+                 std::move(b_minus_d));
+  EXPECT_EQ(EvalCount(root), 3);
+  EXPECT_EQ(lookups, 4);
+  EXPECT_EQ(EvalCount(*root.Left()), 3);
+  EXPECT_EQ(EvalCount(*root.Right()), 2);
+}
+
+TEST(AstTest, AllMembership) {
+  // (A-B) | (C&D) = {a, d, e}
+  std::unique_ptr<ValueNode> a = std::make_unique<ValueNode>(Lookup, "A");
+  std::unique_ptr<ValueNode> b = std::make_unique<ValueNode>(Lookup, "B");
+  std::unique_ptr<ValueNode> c = std::make_unique<ValueNode>(Lookup, "C");
+  std::unique_ptr<ValueNode> d = std::make_unique<ValueNode>(Lookup, "D");
+  std::unique_ptr<DifferenceNode> left =
+      std::make_unique<DifferenceNode>(std::move(a), std::move(b));
+  std::unique_ptr<IntersectionNode> right =
+      std::make_unique<IntersectionNode>(std::move(c), std::move(d));
+  UnionNode center(std::move(left), std::move(right));
+  std::vector<std::string_view> elements = {"a", "b", "c", "d",
+                                            "e", "f", "z"};
+  EXPECT_THAT(EvalMembership(center, elements),
+              testing::ElementsAre(true, false, false, true, true, false,
+                                   false));
+  EXPECT_TRUE(EvalMembership(center, {}).empty());
+}
+
+TEST(AstTest, AllSketch) {
+  // (A-B) | (C&D) = {a, d, e}
+  std::unique_ptr<ValueNode> a = std::make_unique<ValueNode>(Lookup, "A");
+  std::unique_ptr<ValueNode> b = std::make_unique<ValueNode>(Lookup, "B");
+  std::unique_ptr<ValueNode> c = std::make_unique<ValueNode>(Lookup, "C");
+  std::unique_ptr<ValueNode> d = std::make_unique<ValueNode>(Lookup, "D");
+  std::unique_ptr<DifferenceNode> left =
+      std::make_unique<DifferenceNode>(std::move(a), std::move(b));
+  std::unique_ptr<IntersectionNode> right =
+      std::make_unique<IntersectionNode>(std::move(c), std::move(d));
+  UnionNode center(std::move(left), std::move(right));
+  std::vector<std::string_view> keys;
+  const ThetaSketch sketch =
+      EvalSketch(center, [&keys](std::string_view key) {
+        keys.push_back(key);
+        ThetaSketch key_sketch;
+        for (const auto element : Lookup(key)) {
+          key_sketch.Update(element);
+        }
+        return key_sketch;
+      });
+  EXPECT_TRUE(sketch.IsExact());
+  EXPECT_EQ(sketch.Estimate(), 3);
+  EXPECT_THAT(keys, testing::UnorderedElementsAre("A", "B", "C", "D"));
+}
+
+TEST(AstTest, AllSorted) {
+  // (A-B) | (C&D) = {1, 4, 5}
+  const absl::flat_hash_map<std::string, std::vector<uint64_t>> db = {
+      {"A", {1, 2, 3}},
+      {"B", {2, 3, 4}},
+      {"C", {3, 4, 5}},
+      {"D", {4, 5, 6}},
+  };
+  std::unique_ptr<ValueNode> a = std::make_unique<ValueNode>(Lookup, "A");
+  std::unique_ptr<ValueNode> b = std::make_unique<ValueNode>(Lookup, "B");
+  std::unique_ptr<ValueNode> c = std::make_unique<ValueNode>(Lookup, "C");
+  std::unique_ptr<ValueNode> d = std::make_unique<ValueNode>(Lookup, "D");
+  std::unique_ptr<DifferenceNode> left =
+      std::make_unique<DifferenceNode>(std::move(a), std::move(b));
+  std::unique_ptr<IntersectionNode> right =
+      std::make_unique<IntersectionNode>(std::move(c), std::move(d));
+  UnionNode center(std::move(left), std::move(right));
+  const auto lookup = [&db](std::string_view key) {
+    return absl::MakeConstSpan(db.at(key));
+  };
+  EXPECT_THAT(EvalSorted<uint64_t>(center, lookup),
+              testing::ElementsAre(1, 4, 5));
+}
+
+TEST(AstTest, SortedValueAndMissingKey) {
+  const std::vector<uint32_t> a = {1, 7, 9};
+  const auto lookup = [&a](std::string_view key) {
+    return key == "A" ? absl::MakeConstSpan(a) : absl::Span<const uint32_t>();
+  };
+  ValueNode value(Lookup, "A");
+  EXPECT_THAT(EvalSorted<uint32_t>(value, lookup),
+              testing::ElementsAre(1, 7, 9));
+  std::unique_ptr<ValueNode> left = std::make_unique<ValueNode>(Lookup, "A");
+  std::unique_ptr<ValueNode> right = std::make_unique<ValueNode>(Lookup, "E");
+  IntersectionNode op(std::move(left), std::move(right));
+  EXPECT_TRUE(EvalSorted<uint32_t>(op, lookup).empty());
+}
+
+TEST(AstTest, SortedOperations) {
+  const std::vector<uint32_t> small = {5, 500, 9000};
+  std::vector<uint32_t> big;
+  for (uint32_t i = 0; i < 1000; i += 5) {
+    big.push_back(i);
+  }
+  // Small enough to be searched in the big operand.
+  EXPECT_THAT(SortedIntersection<uint32_t>(small, big),
+              testing::ElementsAre(5, 500));
+  EXPECT_THAT(SortedIntersection<uint32_t>(big, small),
+              testing::ElementsAre(5, 500));
+  EXPECT_EQ(SortedUnion<uint32_t>(small, big).size(), big.size() + 1);
+  EXPECT_THAT(SortedDifference<uint32_t>(small, big),
+              testing::ElementsAre(9000));
+  EXPECT_EQ(SortedDifference<uint32_t>(big, small).size(), big.size() - 2);
+  EXPECT_THAT(SortedIntersection<uint32_t>({1, 2, 3}, {2, 3, 4}),
+              testing::ElementsAre(2, 3));
+  EXPECT_THAT(SortedUnion<uint32_t>({1, 3}, {2, 3, 4}),
+              testing::ElementsAre(1, 2, 3, 4));
+  EXPECT_TRUE(SortedIntersection<uint32_t>({}, big).empty());
+}
+
+TEST(AstTest, AllForEach) {
+  // (A-B) | (C&D) = {a, d, e}
+  std::unique_ptr<ValueNode> a = std::make_unique<ValueNode>(Lookup, "A");
+  std::unique_ptr<ValueNode> b = std::make_unique<ValueNode>(Lookup, "B");
+  std::unique_ptr<ValueNode> c = std::make_unique<ValueNode>(Lookup, "C");
+  std::unique_ptr<ValueNode> d = std::make_unique<ValueNode>(Lookup, "D");
+  std::unique_ptr<DifferenceNode> left =
+      std::make_unique<DifferenceNode>(std::move(a), std::move(b));
+  std::unique_ptr<IntersectionNode> right =
+      std::make_unique<IntersectionNode>(std::move(c), std::move(d));
+  UnionNode center(std::move(left), std::move(right));
+  std::vector<std::string_view> elements;
+  EXPECT_TRUE(EvalForEach(center, [&elements](std::string_view element) {
+    elements.push_back(element);
+    return true;
+  }));
+  EXPECT_THAT(elements, testing::UnorderedElementsAre("a", "d", "e"));
+}
+
+TEST(AstTest, ForEachStopsEarly) {
+  std::unique_ptr<ValueNode> a = std::make_unique<ValueNode>(Lookup, "A");
+  std::unique_ptr<ValueNode> d = std::make_unique<ValueNode>(Lookup, "D");
+  UnionNode op(std::move(a), std::move(d));
+  int calls = 0;
+  EXPECT_FALSE(EvalForEach(op, [&calls](std::string_view element) {
+    ++calls;
+    return calls < 2;
+  }));
+  EXPECT_EQ(calls, 2);
+}
+
+TEST(AstTest, SharedSubexpressionsEvaluatedOnce) {
+  // (A&B) | ((B&A) - (A&B)) = {b, c}
+  absl::flat_hash_map<std::string, int> lookups;
+  auto counting_lookup = [&lookups](std::string_view key) -> const KVSetView& {
+    ++lookups[key];
+    return Lookup(key);
+  };
+  auto a_and_b = std::make_unique<IntersectionNode>(
+      std::make_unique<ValueNode>(counting_lookup, "A"),
+      std::make_unique<ValueNode>(counting_lookup, "B"));
+  auto b_and_a = std::make_unique<IntersectionNode>(
+      std::make_unique<ValueNode>(counting_lookup, "B"),
+      std::make_unique<ValueNode>(counting_lookup, "A"));
+  auto a_and_b_2 = std::make_unique<IntersectionNode>(
+      std::make_unique<ValueNode>(counting_lookup, "A"),
+      std::make_unique<ValueNode>(counting_lookup, "B"));
+  UnionNode center(std::move(a_and_b),
+                   std::make_unique<DifferenceNode>(std::move(b_and_a),
+                                                    std::move(a_and_b_2)));
+
+  std::vector<size_t> uses;
+  const auto plan = BuildPlan(center, uses);
+  // A, B, A&B, (A&B) - (A&B) and the union.
+  EXPECT_EQ(plan.size(), 5);
+  EXPECT_THAT(uses, testing::ElementsAre(1, 1, 3, 1, 1));
+
+  absl::flat_hash_set<std::string_view> expected = {"b", "c"};
+  EXPECT_EQ(Eval(center), expected);
+  EXPECT_THAT(lookups, testing::UnorderedElementsAre(testing::Pair("A", 1),
+                                                     testing::Pair("B", 1)));
+
+  lookups.clear();
+  EXPECT_THAT(EvalMembership(center, {"a", "b", "d"}),
+              testing::ElementsAre(false, true, false));
+  EXPECT_THAT(lookups, testing::UnorderedElementsAre(testing::Pair("A", 1),
+                                                     testing::Pair("B", 1)));
+
+  lookups.clear();
+  EXPECT_EQ(EvalCount(center), 2);
+  EXPECT_THAT(lookups, testing::UnorderedElementsAre(testing::Pair("A", 1),
+                                                     testing::Pair("B", 1)));
+
+  lookups.clear();
+  std::vector<std::string_view> elements;
+  EXPECT_TRUE(EvalForEach(center, [&elements](std::string_view element) {
+    elements.push_back(element);
+    return true;
+  }));
+  EXPECT_THAT(elements, testing::UnorderedElementsAre("b", "c"));
+  EXPECT_THAT(lookups, testing::UnorderedElementsAre(testing::Pair("A", 1),
+                                                     testing::Pair("B", 1)));
+}
+
+TEST(AstTest, DifferenceNotCommutedWhenShared) {
+  // (A-B) | (B-A) = {a, d}
+  std::unique_ptr<DifferenceNode> left = std::make_unique<DifferenceNode>(
+      std::make_unique<ValueNode>(Lookup, "A"),
+      std::make_unique<ValueNode>(Lookup, "B"));
+  std::unique_ptr<DifferenceNode> right = std::make_unique<DifferenceNode>(
+      std::make_unique<ValueNode>(Lookup, "B"),
+      std::make_unique<ValueNode>(Lookup, "A"));
+  UnionNode center(std::move(left), std::move(right));
+  absl::flat_hash_set<std::string_view> expected = {"a", "d"};
+  EXPECT_EQ(Eval(center), expected);
+}
+
+// (A-B) | ((C&D) | (A&B)) = {a, b, c, d, e}
+std::unique_ptr<Node> ParallelQuery() {
+  return std::make_unique<UnionNode>(
+      std::make_unique<DifferenceNode>(std::make_unique<ValueNode>(Lookup, "A"),
+                                       std::make_unique<ValueNode>(Lookup, "B")),
+      std::make_unique<UnionNode>(
+          std::make_unique<IntersectionNode>(
+              std::make_unique<ValueNode>(Lookup, "C"),
+              std::make_unique<ValueNode>(Lookup, "D")),
+          std::make_unique<IntersectionNode>(
+              std::make_unique<ValueNode>(Lookup, "A"),
+              std::make_unique<ValueNode>(Lookup, "B"))));
+}
+
+TEST(AstTest, ParallelEvalOnWorkerThreads) {
+  std::unique_ptr<Node> query = ParallelQuery();
+  absl::Mutex workers_mutex;
+  std::vector<std::thread> workers;
+  // Tasks are scheduled from worker threads too.
+  auto schedule = [&workers_mutex, &workers](absl::AnyInvocable<void()> task) {
+    absl::MutexLock lock(&workers_mutex);
+    workers.emplace_back(std::move(task));
+  };
+  absl::flat_hash_set<std::string_view> expected = {"a", "b", "c", "d", "e"};
+  EXPECT_EQ(ParallelEval(*query, schedule, 0), expected);
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  // Every operation with distinct operands forked its left operand.
+  EXPECT_EQ(workers.size(), 5);
+}
+
+TEST(AstTest, ParallelEvalRunsUnstartedTasksInline) {
+  std::unique_ptr<Node> query = ParallelQuery();
+  std::vector<absl::AnyInvocable<void()>> tasks;
+  auto schedule = [&tasks](absl::AnyInvocable<void()> task) {
+    tasks.push_back(std::move(task));
+  };
+  absl::flat_hash_set<std::string_view> expected = {"a", "b", "c", "d", "e"};
+  EXPECT_EQ(ParallelEval(*query, schedule, 0), expected);
+  // Tasks that start after their operand was evaluated do nothing.
+  EXPECT_EQ(tasks.size(), 5);
+  for (auto& task : tasks) {
+    task();
+  }
+}
+
+TEST(AstTest, ParallelEvalBelowThresholdDoesNotSchedule) {
+  std::unique_ptr<Node> query = ParallelQuery();
+  int scheduled = 0;
+  auto schedule = [&scheduled](absl::AnyInvocable<void()> task) {
+    ++scheduled;
+  };
+  absl::flat_hash_set<std::string_view> expected = {"a", "b", "c", "d", "e"};
+  // Each of the six lookups returns three elements.
+  EXPECT_EQ(ParallelEval(*query, schedule, 19), expected);
+  EXPECT_EQ(scheduled, 0);
+  // Only the root reaches the threshold.
+  EXPECT_EQ(ParallelEval(*query, schedule, 18), expected);
+  EXPECT_EQ(scheduled, 1);
+}
+
+TEST(AstTest, EvalWithStats) {
+  std::unique_ptr<ValueNode> a = std::make_unique<ValueNode>(Lookup, "A");
+  std::unique_ptr<ValueNode> b = std::make_unique<ValueNode>(Lookup, "B");
+  std::unique_ptr<ValueNode> c = std::make_unique<ValueNode>(Lookup, "C");
+  auto difference =
+      std::make_unique<DifferenceNode>(std::move(a), std::move(b));
+  IntersectionNode intersection(std::move(difference), std::move(c));
+  std::vector<PlanStepStats> stats;
+  EXPECT_EQ(EvalWithStats(intersection, stats), Eval(intersection));
+  ASSERT_EQ(stats.size(), 5);
+  EXPECT_EQ(stats[0].output_size, 3);
+  EXPECT_EQ(stats[2].left_size, 3);
+  EXPECT_EQ(stats[2].right_size, 3);
+  EXPECT_EQ(stats[2].output_size, 1);
+  EXPECT_EQ(stats[4].step.node, &intersection);
+  EXPECT_EQ(stats[4].output_size, 0);
+  for (auto& step_stats : stats) {
+    step_stats.duration = absl::Microseconds(1);
+  }
+  EXPECT_EQ(PlanStatsToString(stats),
+            "#0 A: 3 in 1us\n"
+            "#1 B: 3 in 1us\n"
+            "#2 #0 - #1: 3, 3 -> 1 in 1us\n"
+            "#3 C: 3 in 1us\n"
+            "#4 #2 & #3: 1, 3 -> 0 in 1us\n");
+}
+
 TEST(AstTest, ValueNodeKeys) {
   ValueNode v(Lookup, "A");
   EXPECT_THAT(v.Keys(), testing::UnorderedElementsAre("A"));
@@ -16,6 +16,7 @@
 
 #include <string_view>
 #include <utility>
+#include <vector>
 
 #include "absl/container/flat_hash_set.h"
 #include "absl/functional/bind_front.h"
@@ -23,12 +24,9 @@
 
 namespace kv_server {
 
-Driver::Driver(absl::AnyInvocable<absl::flat_hash_set<std::string_view>(
-                   std::string_view key) const>
-                   lookup_fn)
-    : lookup_fn_(std::move(lookup_fn)) {}
+Driver::Driver(LookupFn lookup_fn) : lookup_fn_(std::move(lookup_fn)) {}
 
-absl::flat_hash_set<std::string_view> Driver::Lookup(
+const absl::flat_hash_set<std::string_view>& Driver::Lookup(
     std::string_view key) const {
   return lookup_fn_(key);
 }
@@ -46,6 +44,96 @@ absl::StatusOr<absl::flat_hash_set<std::string_view>> Driver::GetResult()
   return Eval(*ast_);
 }
 
+absl::StatusOr<absl::flat_hash_set<std::string_view>>
+Driver::GetResultParallel(ScheduleFn schedule, size_t min_parallel_work) const {
+  if (!status_.ok()) {
+    return status_;
+  }
+  if (ast_ == nullptr) {
+    return absl::flat_hash_set<std::string_view>();
+  }
+  return ParallelEval(*ast_, std::move(schedule), min_parallel_work);
+}
+
+absl::StatusOr<absl::flat_hash_set<std::string_view>>
+Driver::GetResultWithStats(std::vector<PlanStepStats>& stats) const {
+  stats.clear();
+  if (!status_.ok()) {
+    return status_;
+  }
+  if (ast_ == nullptr) {
+    return absl::flat_hash_set<std::string_view>();
+  }
+  return EvalWithStats(*ast_, stats);
+}
+
+absl::Status Driver::ForEachResult(
+    absl::FunctionRef<bool(std::string_view)> fn) const {
+  if (!status_.ok()) {
+    return status_;
+  }
+  if (ast_ != nullptr) {
+    EvalForEach(*ast_, fn);
+  }
+  return absl::OkStatus();
+}
+
+absl::StatusOr<size_t> Driver::GetResultCount() const {
+  if (!status_.ok()) {
+    return status_;
+  }
+  if (ast_ == nullptr) {
+    return 0;
+  }
+  return EvalCount(*ast_);
+}
+
+absl::StatusOr<std::vector<bool>> Driver::GetResultMembership(
+    absl::Span<const std::string_view> elements) const {
+  if (!status_.ok()) {
+    return status_;
+  }
+  if (ast_ == nullptr) {
+    return std::vector<bool>(elements.size(), false);
+  }
+  return EvalMembership(*ast_, elements);
+}
+
+absl::StatusOr<double> Driver::GetApproximateResultCount(
+    absl::FunctionRef<ThetaSketch(std::string_view key)> sketch_fn) const {
+  if (!status_.ok()) {
+    return status_;
+  }
+  if (ast_ == nullptr) {
+    return 0;
+  }
+  return EvalSketch(*ast_, sketch_fn).Estimate();
+}
+
+absl::StatusOr<std::vector<uint32_t>> Driver::GetUInt32Result(
+    absl::FunctionRef<absl::Span<const uint32_t>(std::string_view key)>
+        lookup_fn) const {
+  if (!status_.ok()) {
+    return status_;
+  }
+  if (ast_ == nullptr) {
+    return std::vector<uint32_t>();
+  }
+  return EvalSorted<uint32_t>(*ast_, lookup_fn);
+}
+
+absl::StatusOr<std::vector<uint64_t>> Driver::GetUInt64Result(
+    absl::FunctionRef<absl::Span<const uint64_t>(std::string_view key)>
+        lookup_fn) const {
+  if (!status_.ok()) {
+    return status_;
+  }
+  if (ast_ == nullptr) {
+    return std::vector<uint64_t>();
+  }
+  return EvalSorted<uint64_t>(*ast_, lookup_fn);
+}
+
 void Driver::SetError(std::string error) {
   status_ = absl::InvalidArgumentError(std::move(error));
 }
@@ -17,14 +17,18 @@
 #ifndef COMPONENTS_QUERY_DRIVER_H_
 #define COMPONENTS_QUERY_DRIVER_H_
 
+#include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <string_view>
+#include <vector>
 
 #include "absl/container/flat_hash_set.h"
-#include "absl/functional/any_invocable.h"
+#include "absl/functional/function_ref.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
+#include "absl/types/span.h"
 #include "components/query/ast.h"
 
 namespace kv_server {
@@ -45,14 +49,55 @@ namespace kv_server {
 class Driver {
  public:
   // `lookup_fn` returns the set associated with the provided key.
-  // If no key is present, an empty set should be returned.
-  explicit Driver(absl::AnyInvocable<absl::flat_hash_set<std::string_view>(
-                      std::string_view key) const>
-                      lookup_fn);
+  // If no key is present, an empty set should be returned. The set must stay
+  // alive and unchanged while a result is computed, see `LookupFn`.
+  explicit Driver(LookupFn lookup_fn);
 
   // The result contains views of the data within the DB.
   absl::StatusOr<absl::flat_hash_set<std::string_view>> GetResult() const;
 
+  // Same result as `GetResult`, with independent subtrees evaluated
+  // concurrently through `schedule` once their estimated work reaches
+  // `min_parallel_work`. See `ParallelEval`.
+  absl::StatusOr<absl::flat_hash_set<std::string_view>> GetResultParallel(
+      ScheduleFn schedule, size_t min_parallel_work) const;
+
+  // Same result as `GetResult`. `stats` is set to the statistics of every
+  // step of the evaluation, see `EvalWithStats`.
+  absl::StatusOr<absl::flat_hash_set<std::string_view>> GetResultWithStats(
+      std::vector<PlanStepStats>& stats) const;
+
+  // Calls `fn` for each element `GetResult` would return, until `fn` returns
+  // false. Stopping early avoids building the rest of the result.
+  absl::Status ForEachResult(
+      absl::FunctionRef<bool(std::string_view)> fn) const;
+
+  // Returns the number of elements `GetResult` would return without
+  // materializing the result set.
+  absl::StatusOr<size_t> GetResultCount() const;
+
+  // Returns whether each of `elements` is in the set `GetResult` would
+  // return, in the same order, without materializing any set.
+  absl::StatusOr<std::vector<bool>> GetResultMembership(
+      absl::Span<const std::string_view> elements) const;
+
+  // Returns an estimate of the number of elements `GetResult` would return,
+  // computed from the sketches `sketch_fn` returns for the keys of the query
+  // without looking up any set. See `EvalSketch`.
+  absl::StatusOr<double> GetApproximateResultCount(
+      absl::FunctionRef<ThetaSketch(std::string_view key)> sketch_fn) const;
+
+  // Same elements as `GetResult`, for queries over sets of unsigned
+  // integers: `lookup_fn` returns the sorted elements of the set of each key
+  // and is used instead of the lookup function of the driver. The result is
+  // sorted. See `EvalSorted`.
+  absl::StatusOr<std::vector<uint32_t>> GetUInt32Result(
+      absl::FunctionRef<absl::Span<const uint32_t>(std::string_view key)>
+          lookup_fn) const;
+  absl::StatusOr<std::vector<uint64_t>> GetUInt64Result(
+      absl::FunctionRef<absl::Span<const uint64_t>(std::string_view key)>
+          lookup_fn) const;
+
   // Returns the the `Node` associated with `SetAst`
   // or nullptr if unset.
   const kv_server::Node* GetRootNode() const;
@@ -63,12 +108,11 @@ class Driver {
   void ClearError() { status_ = absl::OkStatus(); }
 
   // Looks up the set which contains a view of the DB data.
-  absl::flat_hash_set<std::string_view> Lookup(std::string_view key) const;
+  const absl::flat_hash_set<std::string_view>& Lookup(
+      std::string_view key) const;
 
  private:
-  absl::AnyInvocable<absl::flat_hash_set<std::string_view>(std::string_view key)
-                         const>
-      lookup_fn_;
+  LookupFn lookup_fn_;
   std::unique_ptr<kv_server::Node> ast_;
   absl::Status status_ = absl::OkStatus();
 };
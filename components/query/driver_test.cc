@@ -20,6 +20,7 @@
 #include "absl/container/flat_hash_map.h"
 #include "absl/container/flat_hash_set.h"
 #include "absl/synchronization/notification.h"
+#include "absl/types/span.h"
 #include "components/query/scanner.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
@@ -37,12 +38,12 @@ class DriverTest : public ::testing::Test {
     }
   }
 
-  absl::flat_hash_set<std::string_view> Lookup(std::string_view key) {
+  const absl::flat_hash_set<std::string_view>& Lookup(std::string_view key) {
     const auto& it = db_.find(key);
     if (it != db_.end()) {
       return it->second;
     }
-    return {};
+    return empty_set_;
   }
 
   void Parse(const std::string& query) {
@@ -54,6 +55,7 @@ class DriverTest : public ::testing::Test {
 
   std::unique_ptr<Driver> driver_;
   std::vector<Driver> drivers_;
+  const absl::flat_hash_set<std::string_view> empty_set_;
   const absl::flat_hash_map<std::string, absl::flat_hash_set<std::string_view>>
       db_ = {
           {"A", {"a", "b", "c"}},
@@ -158,6 +160,93 @@ TEST_F(DriverTest, Intersection) {
   EXPECT_THAT(*result, testing::UnorderedElementsAre("b", "c"));
 }
 
+TEST_F(DriverTest, ResultCount) {
+  Parse("(A-B) | (C&D)");
+  auto result = driver_->GetResultCount();
+  ASSERT_TRUE(result.ok());
+  EXPECT_EQ(*result, 3);
+
+  Driver empty_driver(
+      [this](std::string_view key) -> const KVSetView& { return empty_set_; });
+  result = empty_driver.GetResultCount();
+  ASSERT_TRUE(result.ok());
+  EXPECT_EQ(*result, 0);
+}
+
+TEST_F(DriverTest, ResultMembership) {
+  Parse("A - B");
+  std::vector<std::string_view> elements = {"a", "b", "z"};
+  auto result = driver_->GetResultMembership(elements);
+  ASSERT_TRUE(result.ok());
+  EXPECT_THAT(*result, testing::ElementsAre(true, false, false));
+
+  Parse("A A");
+  result = driver_->GetResultMembership(elements);
+  EXPECT_FALSE(result.ok());
+}
+
+TEST_F(DriverTest, ApproximateResultCount) {
+  const auto sketch_fn = [this](std::string_view key) {
+    ThetaSketch sketch;
+    for (const auto element : Lookup(key)) {
+      sketch.Update(element);
+    }
+    return sketch;
+  };
+  Parse("(A-B) | (C&D)");
+  auto result = driver_->GetApproximateResultCount(sketch_fn);
+  ASSERT_TRUE(result.ok());
+  EXPECT_EQ(*result, 3);
+
+  Parse("A A");
+  EXPECT_FALSE(driver_->GetApproximateResultCount(sketch_fn).ok());
+}
+
+TEST_F(DriverTest, UIntResults) {
+  const absl::flat_hash_map<std::string, std::vector<uint64_t>> db = {
+      {"A", {1, 2, 3}},
+      {"B", {2, 3, 4}},
+      {"C", {3, 4, 5}},
+  };
+  const auto lookup64 = [&db](std::string_view key) {
+    const auto it = db.find(key);
+    return it == db.end() ? absl::Span<const uint64_t>()
+                          : absl::MakeConstSpan(it->second);
+  };
+  Parse("(A-B) | (C&D) | (A&C)");
+  auto result = driver_->GetUInt64Result(lookup64);
+  ASSERT_TRUE(result.ok());
+  EXPECT_THAT(*result, testing::ElementsAre(1, 3));
+
+  const std::vector<uint32_t> a = {4, 5000000};
+  auto result32 = driver_->GetUInt32Result([&a](std::string_view key) {
+    return key == "A" ? absl::MakeConstSpan(a) : absl::Span<const uint32_t>();
+  });
+  ASSERT_TRUE(result32.ok());
+  EXPECT_THAT(*result32, testing::ElementsAre(4, 5000000));
+
+  Parse("A A");
+  EXPECT_FALSE(driver_->GetUInt64Result(lookup64).ok());
+}
+
+TEST_F(DriverTest, ResultWithStats) {
+  Parse("(A - B) | A");
+  std::vector<PlanStepStats> stats;
+  auto result = driver_->GetResultWithStats(stats);
+  ASSERT_TRUE(result.ok());
+  EXPECT_THAT(*result, testing::UnorderedElementsAre("a", "b", "c"));
+  // The two lookups of A share a step.
+  ASSERT_EQ(stats.size(), 4);
+  EXPECT_EQ(stats[3].step.node, driver_->GetRootNode());
+  EXPECT_EQ(stats[3].left_size, 3);
+  EXPECT_EQ(stats[3].right_size, 1);
+  EXPECT_EQ(stats[3].output_size, 3);
+
+  Parse("A A");
+  EXPECT_FALSE(driver_->GetResultWithStats(stats).ok());
+  EXPECT_TRUE(stats.empty());
+}
+
 TEST_F(DriverTest, OrderOfOperations) {
   Parse("A - B - C");
   auto result = driver_->GetResult();
@@ -0,0 +1,190 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "components/query/fast_parser.h"
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "absl/functional/bind_front.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+
+namespace kv_server {
+namespace {
+
+// Same message as bison's default syntax error.
+constexpr std::string_view kSyntaxError = "syntax error";
+
+// Matches `VAR_CHARS` in scanner.ll.
+bool IsVarChar(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || c == '_' || c == ':' || c == '.';
+}
+
+// Matches `OP_CHARS` in scanner.ll.
+bool IsOpChar(char c) {
+  return c == '|' || c == '&' || c == '-' || c == '+' || c == '=' || c == '/';
+}
+
+bool IsWhitespace(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+}  // namespace
+
+FastParser::Token FastParser::NextToken() {
+  while (pos_ < query_.size() && IsWhitespace(query_[pos_])) {
+    ++pos_;
+  }
+  if (pos_ == query_.size()) {
+    return {TokenType::kEnd, {}};
+  }
+  const size_t start = pos_;
+  const char c = query_[pos_++];
+  switch (c) {
+    case '(':
+      return {TokenType::kLParen, query_.substr(start, 1)};
+    case ')':
+      return {TokenType::kRParen, query_.substr(start, 1)};
+    case '|':
+      return {TokenType::kUnion, query_.substr(start, 1)};
+    case '&':
+      return {TokenType::kIntersection, query_.substr(start, 1)};
+    case '-':
+      return {TokenType::kDifference, query_.substr(start, 1)};
+    case '"': {
+      // A quoted key is a non-empty run of var and op chars followed by a
+      // closing quote. Otherwise the quote alone is an invalid token.
+      size_t end = pos_;
+      while (end < query_.size() &&
+             (IsVarChar(query_[end]) || IsOpChar(query_[end]))) {
+        ++end;
+      }
+      if (end == pos_ || end == query_.size() || query_[end] != '"') {
+        return {TokenType::kError, query_.substr(start, 1)};
+      }
+      pos_ = end + 1;
+      return {TokenType::kVar, query_.substr(start + 1, end - start - 1)};
+    }
+    default:
+      break;
+  }
+  if (!IsVarChar(c)) {
+    // flex hands a NUL character over as an empty C string.
+    return {TokenType::kError,
+            c == '\0' ? std::string_view() : query_.substr(start, 1)};
+  }
+  while (pos_ < query_.size() && IsVarChar(query_[pos_])) {
+    ++pos_;
+  }
+  // Keywords only match whole runs, since flex prefers the longest match.
+  const std::string_view text = query_.substr(start, pos_ - start);
+  if (absl::EqualsIgnoreCase(text, "UNION")) {
+    return {TokenType::kUnion, text};
+  }
+  if (absl::EqualsIgnoreCase(text, "INTERSECTION")) {
+    return {TokenType::kIntersection, text};
+  }
+  if (absl::EqualsIgnoreCase(text, "DIFFERENCE")) {
+    return {TokenType::kDifference, text};
+  }
+  return {TokenType::kVar, text};
+}
+
+bool FastParser::IsOperator() const {
+  return token_.type == TokenType::kUnion ||
+         token_.type == TokenType::kIntersection ||
+         token_.type == TokenType::kDifference;
+}
+
+std::unique_ptr<Node> FastParser::ParseTerm() {
+  switch (token_.type) {
+    case TokenType::kVar: {
+      auto node = std::make_unique<ValueNode>(
+          absl::bind_front(&Driver::Lookup, &driver_),
+          std::string(token_.text));
+      Advance();
+      return node;
+    }
+    case TokenType::kLParen: {
+      Advance();
+      auto node = ParseExp();
+      if (node == nullptr) {
+        return nullptr;
+      }
+      if (token_.type != TokenType::kRParen) {
+        driver_.SetError(std::string(kSyntaxError));
+        return nullptr;
+      }
+      Advance();
+      return node;
+    }
+    case TokenType::kError:
+      driver_.SetError(absl::StrCat("Invalid token: ", token_.text));
+      return nullptr;
+    default:
+      driver_.SetError(std::string(kSyntaxError));
+      return nullptr;
+  }
+}
+
+std::unique_ptr<Node> FastParser::ParseExp() {
+  auto left = ParseTerm();
+  while (left != nullptr && IsOperator()) {
+    const TokenType op = token_.type;
+    Advance();
+    auto right = ParseTerm();
+    if (right == nullptr) {
+      return nullptr;
+    }
+    switch (op) {
+      case TokenType::kUnion:
+        left = std::make_unique<UnionNode>(std::move(left), std::move(right));
+        break;
+      case TokenType::kIntersection:
+        left = std::make_unique<IntersectionNode>(std::move(left),
+                                                  std::move(right));
+        break;
+      default:
+        left =
+            std::make_unique<DifferenceNode>(std::move(left), std::move(right));
+        break;
+    }
+  }
+  return left;
+}
+
+int FastParser::parse() {
+  driver_.ClearError();
+  pos_ = 0;
+  Advance();
+  if (token_.type == TokenType::kEnd) {
+    return 0;
+  }
+  auto root = ParseExp();
+  if (root == nullptr) {
+    return 1;
+  }
+  if (token_.type != TokenType::kEnd) {
+    driver_.SetError(std::string(kSyntaxError));
+    return 1;
+  }
+  driver_.SetAst(std::move(root));
+  return 0;
+}
+
+}  // namespace kv_server
@@ -0,0 +1,83 @@
+/*
+ * Copyright 2023 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef COMPONENTS_QUERY_FAST_PARSER_H_
+#define COMPONENTS_QUERY_FAST_PARSER_H_
+
+#include <cstddef>
+#include <memory>
+#include <string_view>
+
+#include "components/query/ast.h"
+#include "components/query/driver.h"
+
+namespace kv_server {
+
+// Hand-written recursive-descent alternative to the flex scanner and bison
+// parser in scanner.ll and parser.yy. It accepts exactly the same grammar,
+// reports the same errors and produces the same AST, but tokenizes the query
+// in place: tokens are views into the query and no stream is involved, so
+// the only allocations are the AST nodes and their keys.
+// Typical usage:
+//   Driver driver(LookupFn);
+//   FastParser parse(driver, query);
+//   int parse_result = parse();
+//   auto result = driver.GetResult();
+// `query` must outlive the call to `parse`.
+class FastParser {
+ public:
+  FastParser(Driver& driver, std::string_view query)
+      : driver_(driver), query_(query) {}
+
+  // Parses the query and sets the resulting AST on the driver.
+  // Returns 0 on success, like `Parser::parse`. On failure, the driver's
+  // status holds the error.
+  int parse();
+  int operator()() { return parse(); }
+
+ private:
+  enum class TokenType {
+    kEnd,
+    kVar,
+    kUnion,
+    kIntersection,
+    kDifference,
+    kLParen,
+    kRParen,
+    kError,
+  };
+  struct Token {
+    TokenType type;
+    std::string_view text;
+  };
+
+  Token NextToken();
+  void Advance() { token_ = NextToken(); }
+  bool IsOperator() const;
+  // exp: term | exp OP exp | LPAREN exp RPAREN, with left associative
+  // operators of equal precedence.
+  std::unique_ptr<Node> ParseExp();
+  std::unique_ptr<Node> ParseTerm();
+
+  Driver& driver_;
+  std::string_view query_;
+  size_t pos_ = 0;
+  Token token_ = {TokenType::kEnd, {}};
+};
+
+}  // namespace kv_server
+
+#endif  // COMPONENTS_QUERY_FAST_PARSER_H_
@@ -0,0 +1,194 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "components/query/fast_parser.h"
+
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_set.h"
+#include "absl/strings/str_cat.h"
+#include "components/query/ast.h"
+#include "components/query/driver.h"
+#include "components/query/scanner.h"
+#include "gtest/gtest.h"
+
+namespace kv_server {
+namespace {
+
+const absl::flat_hash_set<std::string_view>& NoLookup(std::string_view key) {
+  static const auto* kEmptySet = new absl::flat_hash_set<std::string_view>();
+  return *kEmptySet;
+}
+
+// Renders the tree fully parenthesized so that associativity differences
+// show up in comparisons.
+class ASTRenderVisitor : public ASTStringVisitor {
+ public:
+  std::string Visit(const UnionNode& node) override {
+    return Render(node, "|");
+  }
+  std::string Visit(const DifferenceNode& node) override {
+    return Render(node, "-");
+  }
+  std::string Visit(const IntersectionNode& node) override {
+    return Render(node, "&");
+  }
+  std::string Visit(const ValueNode& node) override {
+    return std::string(*node.Keys().begin());
+  }
+
+ private:
+  std::string Render(const OpNode& node, std::string_view op) {
+    return absl::StrCat("(", node.Left()->Accept(*this), " ", op, " ",
+                        node.Right()->Accept(*this), ")");
+  }
+};
+
+struct ParseOutcome {
+  bool success;
+  absl::Status status;
+  std::string ast;
+};
+
+std::string Render(const Driver& driver) {
+  if (driver.GetRootNode() == nullptr) {
+    return "";
+  }
+  ASTRenderVisitor visitor;
+  return driver.GetRootNode()->Accept(visitor);
+}
+
+ParseOutcome ParseWithBison(const std::string& query) {
+  Driver driver(NoLookup);
+  std::istringstream stream(query);
+  Scanner scanner(stream);
+  Parser parse(driver, scanner);
+  const bool success = parse() == 0;
+  return {success, driver.GetResult().status(), Render(driver)};
+}
+
+ParseOutcome ParseWithFastParser(const std::string& query) {
+  Driver driver(NoLookup);
+  FastParser parse(driver, query);
+  const bool success = parse() == 0;
+  return {success, driver.GetResult().status(), Render(driver)};
+}
+
+void ExpectSameOutcome(const std::string& query) {
+  const ParseOutcome expected = ParseWithBison(query);
+  const ParseOutcome actual = ParseWithFastParser(query);
+  EXPECT_EQ(actual.success, expected.success) << "query: " << query;
+  EXPECT_EQ(actual.status, expected.status) << "query: " << query;
+  EXPECT_EQ(actual.ast, expected.ast) << "query: " << query;
+}
+
+TEST(FastParserTest, EmptyQuery) {
+  const ParseOutcome outcome = ParseWithFastParser("  \t\n");
+  EXPECT_TRUE(outcome.success);
+  EXPECT_TRUE(outcome.status.ok());
+  EXPECT_EQ(outcome.ast, "");
+}
+
+TEST(FastParserTest, LeftAssociativeOperators) {
+  const ParseOutcome outcome = ParseWithFastParser("A | B & C - D");
+  EXPECT_TRUE(outcome.success);
+  EXPECT_EQ(outcome.ast, "(((A | B) & C) - D)");
+}
+
+TEST(FastParserTest, KeywordsAndParentheses) {
+  const ParseOutcome outcome =
+      ParseWithFastParser("a UNION (b intersection c) Difference d");
+  EXPECT_TRUE(outcome.success);
+  EXPECT_EQ(outcome.ast, "((a | (b & c)) - d)");
+}
+
+TEST(FastParserTest, QuotedKeys) {
+  const ParseOutcome outcome = ParseWithFastParser(R"("a-b" | "UNION")");
+  EXPECT_TRUE(outcome.success);
+  EXPECT_EQ(outcome.ast, "(a-b | UNION)");
+}
+
+TEST(FastParserTest, InvalidToken) {
+  const ParseOutcome outcome = ParseWithFastParser("A | !");
+  EXPECT_FALSE(outcome.success);
+  EXPECT_EQ(outcome.status, absl::InvalidArgumentError("Invalid token: !"));
+  EXPECT_EQ(outcome.ast, "");
+}
+
+TEST(FastParserTest, SyntaxError) {
+  const ParseOutcome outcome = ParseWithFastParser("(A | B");
+  EXPECT_FALSE(outcome.success);
+  EXPECT_EQ(outcome.status.code(), absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(outcome.ast, "");
+}
+
+TEST(FastParserTest, MatchesBisonOnFixedQueries) {
+  const std::vector<std::string> queries = {
+      "",
+      "A",
+      "A B",
+      "A |",
+      "| A",
+      "()",
+      "(A)",
+      "((A))",
+      "(A | B) & (C - D)",
+      "A - (B - C)",
+      "A)",
+      "A ?",
+      "? A",
+      "\"\"",
+      "\"A",
+      "\"A|B\"",
+      "\"A B\"",
+      "UNIONS | a.b:c_d",
+      std::string("A\0B", 3),
+      std::string("A | \0", 5),
+  };
+  for (const std::string& query : queries) {
+    ExpectSameOutcome(query);
+  }
+}
+
+// Differential test: random token soups, mostly but not always well formed,
+// must parse the same way with both parsers.
+TEST(FastParserTest, MatchesBisonOnRandomQueries) {
+  const std::vector<std::string> tokens = {
+      "A",     "bb",   "c.d",  "e_f:1",        "union", "UNION",
+      "Intersection",  "DIFFERENCE",   "|",     "&",     "-",
+      "(",     ")",    "\"x-y\"",      "\"\"",  "\"",    "?",
+      "!",     "+",    " ",    "\t",           "\n",
+  };
+  std::mt19937 rng(42);
+  std::uniform_int_distribution<size_t> length(0, 12);
+  std::uniform_int_distribution<size_t> token(0, tokens.size() - 1);
+  std::bernoulli_distribution separate(0.8);
+  for (int i = 0; i < 5000; i++) {
+    std::string query;
+    const size_t num_tokens = length(rng);
+    for (size_t j = 0; j < num_tokens; j++) {
+      if (j > 0 && separate(rng)) {
+        query += ' ';
+      }
+      query += tokens[token(rng)];
+    }
+    ExpectSameOutcome(query);
+  }
+}
+
+}  // namespace
+}  // namespace kv_server
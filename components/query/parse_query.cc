@@ -0,0 +1,41 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "components/query/parse_query.h"
+
+#include <sstream>
+#include <string>
+
+#include "absl/flags/flag.h"
+#include "components/query/fast_parser.h"
+#include "components/query/scanner.h"
+
+ABSL_FLAG(bool, use_fast_query_parser, false,
+          "Parse queries with the hand-written parser instead of the flex "
+          "and bison generated one.");
+
+namespace kv_server {
+
+int ParseQuery(Driver& driver, std::string_view query) {
+  if (absl::GetFlag(FLAGS_use_fast_query_parser)) {
+    FastParser parse(driver, query);
+    return parse();
+  }
+  std::istringstream stream{std::string(query)};
+  Scanner scanner(stream);
+  Parser parse(driver, scanner);
+  return parse();
+}
+
+}  // namespace kv_server
@@ -0,0 +1,37 @@
+/*
+ * Copyright 2023 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef COMPONENTS_QUERY_PARSE_QUERY_H_
+#define COMPONENTS_QUERY_PARSE_QUERY_H_
+
+#include <string_view>
+
+#include "absl/flags/declare.h"
+#include "components/query/driver.h"
+
+ABSL_DECLARE_FLAG(bool, use_fast_query_parser);
+
+namespace kv_server {
+
+// Parses `query` into `driver` with either the bison generated parser or,
+// when --use_fast_query_parser is set, the `FastParser`.
+// Returns 0 on success, like `Parser::parse`.
+int ParseQuery(Driver& driver, std::string_view query);
+
+}  // namespace kv_server
+
+#endif  // COMPONENTS_QUERY_PARSE_QUERY_H_
@@ -26,10 +26,12 @@
 namespace kv_server {
 namespace {
 
-absl::flat_hash_set<std::string_view> NeverUsedLookup(std::string_view key) {
+const absl::flat_hash_set<std::string_view>& NeverUsedLookup(
+    std::string_view key) {
   // Should never be called
   assert(0);
-  return {};
+  static const auto* kEmptySet = new absl::flat_hash_set<std::string_view>();
+  return *kEmptySet;
 }
 
 TEST(ScannerTest, Empty) {
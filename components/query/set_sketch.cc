@@ -0,0 +1,125 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "components/query/set_sketch.h"
+
+#include <algorithm>
+#include <iterator>
+
+namespace kv_server {
+namespace {
+
+// 2^64, the size of the hash space.
+constexpr double kHashSpace = 18446744073709551616.0;
+
+// FNV-1a followed by the MurmurHash3 finalizer, which spreads the hashes
+// uniformly. Unlike `absl::Hash`, the result does not depend on the process,
+// which sketches built on different servers rely on.
+uint64_t HashElement(std::string_view element) {
+  uint64_t hash = 14695981039346656037ull;
+  for (const char c : element) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 1099511628211ull;
+  }
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdull;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ull;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+}  // namespace
+
+ThetaSketch ThetaSketch::Create(size_t nominal_entries, uint64_t theta,
+                                absl::Span<const uint64_t> hashes) {
+  ThetaSketch sketch(nominal_entries);
+  sketch.theta_ = theta;
+  for (const uint64_t hash : hashes) {
+    if (hash < theta) {
+      sketch.hashes_.insert(hash);
+    }
+  }
+  sketch.Trim();
+  return sketch;
+}
+
+void ThetaSketch::Update(std::string_view element) {
+  const uint64_t hash = HashElement(element);
+  if (hash >= theta_) {
+    return;
+  }
+  hashes_.insert(hash);
+  Trim();
+}
+
+bool ThetaSketch::Remove(std::string_view element) {
+  const uint64_t hash = HashElement(element);
+  if (IsExact()) {
+    hashes_.erase(hash);
+    return true;
+  }
+  // Elements hashed above `theta_` do not affect the retained hashes, while
+  // removing a retained one would require the smallest dropped hash.
+  return hash > theta_;
+}
+
+double ThetaSketch::Estimate() const {
+  if (IsExact()) {
+    return hashes_.size();
+  }
+  return hashes_.size() * (kHashSpace / theta_);
+}
+
+ThetaSketch ThetaSketch::Combine(const ThetaSketch& left,
+                                 const ThetaSketch& right,
+                                 absl::FunctionRef<bool(bool, bool)> contains) {
+  ThetaSketch result(std::min(left.nominal_entries_, right.nominal_entries_));
+  // Both operands retain every hash of their set below the smaller theta, so
+  // the membership of those hashes in the result is known exactly.
+  result.theta_ = std::min(left.theta_, right.theta_);
+  auto left_itr = left.hashes_.begin();
+  const auto left_end = left.hashes_.lower_bound(result.theta_);
+  auto right_itr = right.hashes_.begin();
+  const auto right_end = right.hashes_.lower_bound(result.theta_);
+  while (left_itr != left_end || right_itr != right_end) {
+    const uint64_t hash =
+        left_itr == left_end     ? *right_itr
+        : right_itr == right_end ? *left_itr
+                                 : std::min(*left_itr, *right_itr);
+    const bool in_left = left_itr != left_end && *left_itr == hash;
+    const bool in_right = right_itr != right_end && *right_itr == hash;
+    if (in_left) {
+      ++left_itr;
+    }
+    if (in_right) {
+      ++right_itr;
+    }
+    if (contains(in_left, in_right)) {
+      result.hashes_.insert(result.hashes_.end(), hash);
+    }
+  }
+  result.Trim();
+  return result;
+}
+
+void ThetaSketch::Trim() {
+  while (hashes_.size() > nominal_entries_) {
+    const auto largest = std::prev(hashes_.end());
+    theta_ = *largest;
+    hashes_.erase(largest);
+  }
+}
+
+}  // namespace kv_server
@@ -0,0 +1,93 @@
+/*
+ * Copyright 2023 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef COMPONENTS_QUERY_SET_SKETCH_H_
+#define COMPONENTS_QUERY_SET_SKETCH_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string_view>
+
+#include "absl/container/btree_set.h"
+#include "absl/functional/function_ref.h"
+#include "absl/types/span.h"
+
+namespace kv_server {
+
+// Theta sketch of a set of strings: the hashes of the elements below a
+// threshold `theta`, which is lowered so that at most `nominal_entries`
+// hashes are retained. The number of elements is estimated from how densely
+// the retained hashes fill `[0, theta)`, with a relative error of about
+// `1 / sqrt(nominal_entries)`, and is exact while fewer elements were added.
+//
+// Sketches of different sets can be combined into a sketch of their union,
+// intersection or difference, so the size of a query result can be estimated
+// without reading the sets. Elements are hashed the same way in every
+// process, so sketches built on different servers can be combined.
+class ThetaSketch {
+ public:
+  static constexpr size_t kDefaultNominalEntries = 1024;
+
+  explicit ThetaSketch(size_t nominal_entries = kDefaultNominalEntries)
+      : nominal_entries_(nominal_entries) {}
+
+  // Recreates a sketch from the parts returned by the accessors below.
+  // Hashes at or above `theta` are dropped.
+  static ThetaSketch Create(size_t nominal_entries, uint64_t theta,
+                            absl::Span<const uint64_t> hashes);
+
+  // Adds `element` to the sketched set.
+  void Update(std::string_view element);
+
+  // Removes `element` from the sketched set, if that can be done without
+  // knowing the other elements, i.e. if its hash is not retained or no hash
+  // was ever dropped. Returns false if the sketch has to be rebuilt from the
+  // remaining elements instead.
+  bool Remove(std::string_view element);
+
+  // Returns the estimated number of elements of the sketched set.
+  double Estimate() const;
+
+  // Returns whether the estimate is the exact number of elements.
+  bool IsExact() const { return theta_ == kMaxTheta; }
+
+  // Returns the sketch of the result of a set operation over the sets of
+  // `left` and `right`, where `contains` computes whether an element is in
+  // the result given whether it is in either operand, e.g. `OpContains` of a
+  // query operation.
+  static ThetaSketch Combine(const ThetaSketch& left, const ThetaSketch& right,
+                             absl::FunctionRef<bool(bool, bool)> contains);
+
+  size_t nominal_entries() const { return nominal_entries_; }
+  uint64_t theta() const { return theta_; }
+  const absl::btree_set<uint64_t>& hashes() const { return hashes_; }
+
+ private:
+  static constexpr uint64_t kMaxTheta = std::numeric_limits<uint64_t>::max();
+
+  // Drops the largest hashes until at most `nominal_entries_` are retained.
+  void Trim();
+
+  size_t nominal_entries_;
+  // Only hashes below `theta_` are retained.
+  uint64_t theta_ = kMaxTheta;
+  absl::btree_set<uint64_t> hashes_;
+};
+
+}  // namespace kv_server
+
+#endif  // COMPONENTS_QUERY_SET_SKETCH_H_
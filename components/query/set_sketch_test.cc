@@ -0,0 +1,122 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "components/query/set_sketch.h"
+
+#include <string>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace kv_server {
+namespace {
+
+// Returns the sketch of the elements `e<begin>` to `e<end - 1>`.
+ThetaSketch MakeSketch(int begin, int end, size_t nominal_entries) {
+  ThetaSketch sketch(nominal_entries);
+  for (int i = begin; i < end; i++) {
+    sketch.Update(absl::StrCat("e", i));
+  }
+  return sketch;
+}
+
+bool InUnion(bool in_left, bool in_right) { return in_left || in_right; }
+bool InIntersection(bool in_left, bool in_right) {
+  return in_left && in_right;
+}
+bool InDifference(bool in_left, bool in_right) { return in_left && !in_right; }
+
+TEST(ThetaSketchTest, ExactForSmallSets) {
+  ThetaSketch sketch;
+  sketch.Update("a");
+  sketch.Update("b");
+  sketch.Update("a");
+  EXPECT_TRUE(sketch.IsExact());
+  EXPECT_EQ(sketch.Estimate(), 2);
+
+  ThetaSketch other;
+  other.Update("b");
+  other.Update("c");
+  EXPECT_EQ(ThetaSketch::Combine(sketch, other, InUnion).Estimate(), 3);
+  EXPECT_EQ(ThetaSketch::Combine(sketch, other, InIntersection).Estimate(), 1);
+  EXPECT_EQ(ThetaSketch::Combine(sketch, other, InDifference).Estimate(), 1);
+}
+
+TEST(ThetaSketchTest, EstimatesLargeSets) {
+  const ThetaSketch sketch = MakeSketch(0, 100'000, 1024);
+  EXPECT_FALSE(sketch.IsExact());
+  EXPECT_EQ(sketch.hashes().size(), 1024);
+  EXPECT_NEAR(sketch.Estimate(), 100'000, 10'000);
+}
+
+TEST(ThetaSketchTest, EstimatesSetOperations) {
+  // Overlapping ranges of 60'000 elements with 20'000 elements in common.
+  const ThetaSketch left = MakeSketch(0, 60'000, 4096);
+  const ThetaSketch right = MakeSketch(40'000, 100'000, 4096);
+  EXPECT_NEAR(ThetaSketch::Combine(left, right, InUnion).Estimate(), 100'000,
+              10'000);
+  EXPECT_NEAR(ThetaSketch::Combine(left, right, InIntersection).Estimate(),
+              20'000, 3'000);
+  EXPECT_NEAR(ThetaSketch::Combine(left, right, InDifference).Estimate(),
+              40'000, 4'000);
+}
+
+TEST(ThetaSketchTest, UnionOfSplitSetsMatchesSketchOfWholeSet) {
+  const ThetaSketch whole = MakeSketch(0, 10'000, 256);
+  const ThetaSketch merged = ThetaSketch::Combine(
+      MakeSketch(0, 5'000, 256), MakeSketch(5'000, 10'000, 256), InUnion);
+  EXPECT_EQ(merged.theta(), whole.theta());
+  EXPECT_EQ(merged.hashes(), whole.hashes());
+}
+
+TEST(ThetaSketchTest, RemovesElementsThatDoNotAffectRetainedHashes) {
+  ThetaSketch exact;
+  exact.Update("a");
+  exact.Update("b");
+  EXPECT_TRUE(exact.Remove("a"));
+  EXPECT_TRUE(exact.Remove("z"));
+  EXPECT_EQ(exact.Estimate(), 1);
+
+  const ThetaSketch sketch = MakeSketch(0, 1'000, 16);
+  int rebuilds = 0;
+  for (int i = 0; i < 1'000; i++) {
+    ThetaSketch copy = sketch;
+    if (!copy.Remove(absl::StrCat("e", i))) {
+      ++rebuilds;
+    } else {
+      EXPECT_EQ(copy.hashes(), sketch.hashes());
+    }
+  }
+  // The retained hashes and the smallest dropped one, which is `theta`.
+  EXPECT_EQ(rebuilds, 17);
+}
+
+TEST(ThetaSketchTest, CreateFromParts) {
+  const ThetaSketch sketch = MakeSketch(0, 1'000, 64);
+  const std::vector<uint64_t> hashes(sketch.hashes().begin(),
+                                     sketch.hashes().end());
+  const ThetaSketch created =
+      ThetaSketch::Create(sketch.nominal_entries(), sketch.theta(), hashes);
+  EXPECT_EQ(created.theta(), sketch.theta());
+  EXPECT_EQ(created.hashes(), sketch.hashes());
+  EXPECT_EQ(created.Estimate(), sketch.Estimate());
+
+  // Hashes that are not below `theta` are dropped.
+  EXPECT_EQ(ThetaSketch::Create(64, hashes[10], hashes).hashes().size(), 10);
+}
+
+}  // namespace
+}  // namespace kv_server
@@ -17,9 +17,14 @@
 #ifndef COMPONENTS_QUERY_SETS_H_
 #define COMPONENTS_QUERY_SETS_H_
 
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
 #include <utility>
+#include <vector>
 
 #include "absl/container/flat_hash_set.h"
+#include "absl/types/span.h"
 
 namespace kv_server {
 template <typename T>
@@ -51,5 +56,130 @@ absl::flat_hash_set<T> Difference(absl::flat_hash_set<T>&& left,
   return std::move(left);
 }
 
+// The *View functions below return the same result as the functions above,
+// but only read their operands, so that operands can be shared.
+template <typename T>
+absl::flat_hash_set<T> UnionView(const absl::flat_hash_set<T>& left,
+                                 const absl::flat_hash_set<T>& right) {
+  absl::flat_hash_set<T> result;
+  result.reserve(std::max(left.size(), right.size()));
+  result.insert(left.begin(), left.end());
+  result.insert(right.begin(), right.end());
+  return result;
+}
+
+template <typename T>
+absl::flat_hash_set<T> IntersectionView(const absl::flat_hash_set<T>& left,
+                                        const absl::flat_hash_set<T>& right) {
+  const auto& small = left.size() <= right.size() ? left : right;
+  const auto& big = left.size() <= right.size() ? right : left;
+  absl::flat_hash_set<T> result;
+  for (const auto& elem : small) {
+    if (big.contains(elem)) {
+      result.insert(elem);
+    }
+  }
+  return result;
+}
+
+template <typename T>
+absl::flat_hash_set<T> DifferenceView(const absl::flat_hash_set<T>& left,
+                                      const absl::flat_hash_set<T>& right) {
+  absl::flat_hash_set<T> result;
+  for (const auto& elem : left) {
+    if (!right.contains(elem)) {
+      result.insert(elem);
+    }
+  }
+  return result;
+}
+
+// The *Count functions below return the size of the corresponding operation's
+// result without materializing it.
+template <typename T>
+size_t UnionCount(const absl::flat_hash_set<T>& left,
+                  const absl::flat_hash_set<T>& right) {
+  const auto& small = left.size() <= right.size() ? left : right;
+  const auto& big = left.size() <= right.size() ? right : left;
+  size_t count = big.size();
+  for (const auto& elem : small) {
+    if (!big.contains(elem)) {
+      ++count;
+    }
+  }
+  return count;
+}
+
+template <typename T>
+size_t IntersectionCount(const absl::flat_hash_set<T>& left,
+                         const absl::flat_hash_set<T>& right) {
+  const auto& small = left.size() <= right.size() ? left : right;
+  const auto& big = left.size() <= right.size() ? right : left;
+  size_t count = 0;
+  for (const auto& elem : small) {
+    if (big.contains(elem)) {
+      ++count;
+    }
+  }
+  return count;
+}
+
+template <typename T>
+size_t DifferenceCount(const absl::flat_hash_set<T>& left,
+                       const absl::flat_hash_set<T>& right) {
+  return left.size() - IntersectionCount(left, right);
+}
+
+// The Sorted* functions below compute the operations over sets of unsigned
+// integers held in sorted arrays without duplicates, and return the result in
+// the same form. They only read their operands and run in linear time,
+// without hashing.
+template <typename T>
+std::vector<T> SortedUnion(absl::Span<const T> left,
+                           absl::Span<const T> right) {
+  std::vector<T> result;
+  result.reserve(left.size() + right.size());
+  std::set_union(left.begin(), left.end(), right.begin(), right.end(),
+                 std::back_inserter(result));
+  return result;
+}
+
+template <typename T>
+std::vector<T> SortedIntersection(absl::Span<const T> left,
+                                  absl::Span<const T> right) {
+  const auto small = left.size() <= right.size() ? left : right;
+  const auto big = left.size() <= right.size() ? right : left;
+  std::vector<T> result;
+  result.reserve(small.size());
+  // Binary search the elements of a much smaller operand, skipping the
+  // elements of the bigger one that come before them.
+  if (small.size() * 16 < big.size()) {
+    auto big_itr = big.begin();
+    for (const T elem : small) {
+      big_itr = std::lower_bound(big_itr, big.end(), elem);
+      if (big_itr == big.end()) {
+        break;
+      }
+      if (*big_itr == elem) {
+        result.push_back(elem);
+      }
+    }
+    return result;
+  }
+  std::set_intersection(small.begin(), small.end(), big.begin(), big.end(),
+                        std::back_inserter(result));
+  return result;
+}
+
+template <typename T>
+std::vector<T> SortedDifference(absl::Span<const T> left,
+                                absl::Span<const T> right) {
+  std::vector<T> result;
+  result.reserve(left.size());
+  std::set_difference(left.begin(), left.end(), right.begin(), right.end(),
+                      std::back_inserter(result));
+  return result;
+}
+
 }  // namespace kv_server
 #endif  // COMPONENTS_QUERY_SETS_H_
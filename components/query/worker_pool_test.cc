@@ -0,0 +1,64 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "components/query/worker_pool.h"
+
+#include <atomic>
+#include <thread>
+
+#include "absl/synchronization/blocking_counter.h"
+#include "gtest/gtest.h"
+
+namespace kv_server {
+namespace {
+
+TEST(WorkerPoolTest, RunsTasksOnWorkers) {
+  WorkerPool pool(2);
+  absl::BlockingCounter done(10);
+  std::atomic<int> on_caller = 0;
+  const std::thread::id caller = std::this_thread::get_id();
+  for (int i = 0; i < 10; i++) {
+    pool.Schedule([&done, &on_caller, caller]() {
+      if (std::this_thread::get_id() == caller) {
+        ++on_caller;
+      }
+      done.DecrementCount();
+    });
+  }
+  done.Wait();
+  EXPECT_EQ(on_caller, 0);
+}
+
+TEST(WorkerPoolTest, TasksScheduleTasks) {
+  WorkerPool pool(1);
+  absl::BlockingCounter done(1);
+  pool.Schedule([&pool, &done]() {
+    pool.Schedule([&done]() { done.DecrementCount(); });
+  });
+  done.Wait();
+}
+
+TEST(WorkerPoolTest, DestructionRunsQueuedTasks) {
+  std::atomic<int> runs = 0;
+  {
+    WorkerPool pool(1);
+    for (int i = 0; i < 100; i++) {
+      pool.Schedule([&runs]() { ++runs; });
+    }
+  }
+  EXPECT_EQ(runs, 100);
+}
+
+}  // namespace
+}  // namespace kv_server
@@ -0,0 +1,98 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "components/sharding/replica_client.h"
+
+#include <utility>
+
+#include "absl/time/clock.h"
+
+namespace kv_server {
+namespace {
+
+// Weight of the latest request in the moving averages.
+constexpr double kMovingAverageWeight = 0.2;
+// How much a replica that fails every request costs more than a healthy one.
+constexpr double kErrorRatePenalty = 10;
+constexpr int kMaxConsecutiveErrors = 5;
+constexpr absl::Duration kEjectionCooldown = absl::Seconds(10);
+
+}  // namespace
+
+ReplicaClient::ReplicaClient(std::unique_ptr<RemoteLookupClient> client)
+    : client_(std::move(client)) {}
+
+absl::StatusOr<InternalLookupResponse> ReplicaClient::GetValues(
+    std::string_view serialized_message, int32_t padding_length) const {
+  outstanding_requests_++;
+  const absl::Time start = absl::Now();
+  auto response = client_->GetValues(serialized_message, padding_length);
+  OnResponse(absl::Now() - start, response.status());
+  return response;
+}
+
+absl::AnyInvocable<void()> ReplicaClient::GetValuesAsync(
+    std::string_view serialized_message, int32_t padding_length,
+    absl::AnyInvocable<void(absl::StatusOr<InternalLookupResponse>) &&>
+        callback) const {
+  outstanding_requests_++;
+  return client_->GetValuesAsync(
+      serialized_message, padding_length,
+      [this, start = absl::Now(), callback = std::move(callback)](
+          absl::StatusOr<InternalLookupResponse> response) mutable {
+        OnResponse(absl::Now() - start, response.status());
+        std::move(callback)(std::move(response));
+      });
+}
+
+std::string_view ReplicaClient::GetIpAddress() const {
+  return client_->GetIpAddress();
+}
+
+double ReplicaClient::GetCost() const {
+  absl::ReaderMutexLock lock(&mutex_);
+  // One is added so that replicas without requests yet are still ranked by
+  // their outstanding requests.
+  return (latency_micros_ + 1) * (outstanding_requests_ + 1) *
+         (1 + kErrorRatePenalty * error_rate_);
+}
+
+bool ReplicaClient::IsEjected(absl::Time now) const {
+  absl::ReaderMutexLock lock(&mutex_);
+  return now < ejected_until_;
+}
+
+void ReplicaClient::OnResponse(absl::Duration latency,
+                               const absl::Status& status) const {
+  outstanding_requests_--;
+  if (absl::IsCancelled(status)) {
+    // Cancelled by the caller, e.g. because another replica answered first,
+    // so neither its latency nor its outcome says anything about the replica.
+    return;
+  }
+  absl::MutexLock lock(&mutex_);
+  if (status.ok()) {
+    latency_micros_ += kMovingAverageWeight *
+                       (absl::ToDoubleMicroseconds(latency) - latency_micros_);
+    error_rate_ -= kMovingAverageWeight * error_rate_;
+    consecutive_errors_ = 0;
+    return;
+  }
+  error_rate_ += kMovingAverageWeight * (1 - error_rate_);
+  if (++consecutive_errors_ >= kMaxConsecutiveErrors) {
+    ejected_until_ = absl::Now() + kEjectionCooldown;
+  }
+}
+
+}  // namespace kv_server
@@ -0,0 +1,74 @@
+/*
+ * Copyright 2023 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef COMPONENTS_SHARDING_REPLICA_CLIENT_H_
+#define COMPONENTS_SHARDING_REPLICA_CLIENT_H_
+
+#include <atomic>
+#include <memory>
+#include <string_view>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/functional/any_invocable.h"
+#include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "components/internal_server/remote_lookup_client.h"
+
+namespace kv_server {
+
+// Decorates the client of a shard replica to track the latency, outstanding
+// requests and errors of the replica, by which ShardManager chooses between
+// replicas. ReplicaClient is thread safe.
+class ReplicaClient : public RemoteLookupClient {
+ public:
+  explicit ReplicaClient(std::unique_ptr<RemoteLookupClient> client);
+
+  absl::StatusOr<InternalLookupResponse> GetValues(
+      std::string_view serialized_message,
+      int32_t padding_length) const override;
+  absl::AnyInvocable<void()> GetValuesAsync(
+      std::string_view serialized_message, int32_t padding_length,
+      absl::AnyInvocable<void(absl::StatusOr<InternalLookupResponse>) &&>
+          callback) const override;
+  std::string_view GetIpAddress() const override;
+
+  // Returns the expected cost of sending a request to the replica, which grows
+  // with the moving average of its latency, its outstanding requests and the
+  // moving average of its error rate.
+  double GetCost() const;
+
+  // Returns true if the replica failed too many requests in a row and the
+  // cooldown after its last failure has not passed yet. Once it has, the
+  // replica is chosen again, but another failure ejects it right away.
+  bool IsEjected(absl::Time now) const;
+
+ private:
+  void OnResponse(absl::Duration latency, const absl::Status& status) const;
+
+  const std::unique_ptr<RemoteLookupClient> client_;
+  mutable std::atomic<int64_t> outstanding_requests_ = 0;
+  mutable absl::Mutex mutex_;
+  mutable double latency_micros_ ABSL_GUARDED_BY(mutex_) = 0;
+  mutable double error_rate_ ABSL_GUARDED_BY(mutex_) = 0;
+  mutable int consecutive_errors_ ABSL_GUARDED_BY(mutex_) = 0;
+  mutable absl::Time ejected_until_ ABSL_GUARDED_BY(mutex_) =
+      absl::InfinitePast();
+};
+
+}  // namespace kv_server
+
+#endif  // COMPONENTS_SHARDING_REPLICA_CLIENT_H_
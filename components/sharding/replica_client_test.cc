@@ -0,0 +1,118 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "components/sharding/replica_client.h"
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "absl/time/clock.h"
+#include "components/internal_server/mocks.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace kv_server {
+namespace {
+
+using testing::_;
+using testing::Return;
+
+// Holds on to the callbacks of its requests until they are completed.
+class PendingRemoteLookupClient : public MockRemoteLookupClient {
+ public:
+  absl::AnyInvocable<void()> GetValuesAsync(
+      std::string_view serialized_message, int32_t padding_length,
+      absl::AnyInvocable<void(absl::StatusOr<InternalLookupResponse>) &&>
+          callback) const override {
+    callbacks_.push_back(std::move(callback));
+    return [] {};
+  }
+
+  void Complete(absl::StatusOr<InternalLookupResponse> response) {
+    for (auto& callback : callbacks_) {
+      std::move(callback)(response);
+    }
+    callbacks_.clear();
+  }
+
+ private:
+  mutable std::vector<
+      absl::AnyInvocable<void(absl::StatusOr<InternalLookupResponse>) &&>>
+      callbacks_;
+};
+
+TEST(ReplicaClientTest, CostGrowsWithOutstandingRequests) {
+  auto client = std::make_unique<PendingRemoteLookupClient>();
+  auto& pending_client = *client;
+  ReplicaClient replica_client(std::move(client));
+  const double idle_cost = replica_client.GetCost();
+  replica_client.GetValuesAsync("", 0,
+                                [](absl::StatusOr<InternalLookupResponse>) {});
+  EXPECT_GT(replica_client.GetCost(), idle_cost);
+  pending_client.Complete(InternalLookupResponse());
+}
+
+TEST(ReplicaClientTest, CostGrowsWithErrors) {
+  auto client = std::make_unique<MockRemoteLookupClient>();
+  EXPECT_CALL(*client, GetValues(_, _))
+      .WillOnce(Return(absl::UnavailableError("unavailable")));
+  ReplicaClient replica_client(std::move(client));
+  const double healthy_cost = replica_client.GetCost();
+  EXPECT_FALSE(replica_client.GetValues("", 0).ok());
+  EXPECT_GT(replica_client.GetCost(), healthy_cost);
+}
+
+TEST(ReplicaClientTest, CancelledRequestsAreNotErrors) {
+  auto client = std::make_unique<PendingRemoteLookupClient>();
+  auto& pending_client = *client;
+  ReplicaClient replica_client(std::move(client));
+  const double idle_cost = replica_client.GetCost();
+  replica_client.GetValuesAsync("", 0,
+                                [](absl::StatusOr<InternalLookupResponse>) {});
+  pending_client.Complete(absl::CancelledError("cancelled"));
+  EXPECT_EQ(replica_client.GetCost(), idle_cost);
+}
+
+TEST(ReplicaClientTest, EjectedAfterConsecutiveErrorsUntilCooldown) {
+  auto client = std::make_unique<MockRemoteLookupClient>();
+  EXPECT_CALL(*client, GetValues(_, _))
+      .WillRepeatedly(Return(absl::UnavailableError("unavailable")));
+  ReplicaClient replica_client(std::move(client));
+  for (int i = 0; i < 4; i++) {
+    EXPECT_FALSE(replica_client.GetValues("", 0).ok());
+  }
+  EXPECT_FALSE(replica_client.IsEjected(absl::Now()));
+  EXPECT_FALSE(replica_client.GetValues("", 0).ok());
+  EXPECT_TRUE(replica_client.IsEjected(absl::Now()));
+  EXPECT_FALSE(replica_client.IsEjected(absl::Now() + absl::Minutes(1)));
+}
+
+TEST(ReplicaClientTest, SuccessResetsConsecutiveErrors) {
+  auto client = std::make_unique<MockRemoteLookupClient>();
+  EXPECT_CALL(*client, GetValues(_, _))
+      .WillOnce(Return(absl::UnavailableError("unavailable")))
+      .WillOnce(Return(absl::UnavailableError("unavailable")))
+      .WillOnce(Return(absl::UnavailableError("unavailable")))
+      .WillOnce(Return(absl::UnavailableError("unavailable")))
+      .WillOnce(Return(InternalLookupResponse()))
+      .WillOnce(Return(absl::UnavailableError("unavailable")));
+  ReplicaClient replica_client(std::move(client));
+  for (int i = 0; i < 6; i++) {
+    replica_client.GetValues("", 0).IgnoreError();
+  }
+  EXPECT_FALSE(replica_client.IsEjected(absl::Now()));
+}
+
+}  // namespace
+}  // namespace kv_server
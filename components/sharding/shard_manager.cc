@@ -24,24 +24,52 @@
 
 #include "absl/base/thread_annotations.h"
 #include "absl/container/flat_hash_map.h"
+#include "absl/flags/flag.h"
+#include "absl/strings/str_cat.h"
 #include "absl/strings/str_format.h"
 #include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "components/internal_server/batching_remote_lookup_client.h"
+#include "components/sharding/replica_client.h"
+
+ABSL_FLAG(absl::Duration, remote_lookup_batch_window, absl::ZeroDuration(),
+          "How long requests to a remote shard replica are collected to be "
+          "sent as a single request, e.g. 500us. 0 disables batching.");
+ABSL_FLAG(int64_t, remote_lookup_batch_max_keys, 1000,
+          "Maximum number of keys of a batch of requests to a remote shard "
+          "replica, after which it is sent without waiting for the rest of "
+          "the window. Only used with --remote_lookup_batch_window.");
+ABSL_FLAG(int32_t, shard_circuit_breaker_failures, 0,
+          "Number of consecutive failed requests to a remote shard after "
+          "which its circuit breaker opens: the lookups stop sending requests "
+          "to the shard, and fail its keys right away, until a probe request "
+          "succeeds. 0 disables the circuit breakers.");
+ABSL_FLAG(absl::Duration, shard_circuit_breaker_cooldown, absl::Seconds(5),
+          "Time between the probe requests to a remote shard whose circuit "
+          "breaker is open. Only used with --shard_circuit_breaker_failures.");
 
 namespace kv_server {
 namespace {
 
+constexpr char kShardCircuitBreakerOpen[] = "ShardCircuitBreakerOpen";
+const std::vector<double> kCircuitBreakerOpenBucketBoundaries = {0.5};
+
 class RandomGeneratorImpl : public RandomGenerator {
  public:
   RandomGeneratorImpl() : generator_{rand_dev_()} {}
 
   int64_t Get(int64_t upper_bound) {
     std::uniform_int_distribution<int> distr(0, upper_bound - 1);
+    absl::MutexLock lock(&mutex_);
     return distr(generator_);
   }
 
  private:
   std::random_device rand_dev_;
-  std::mt19937 generator_;
+  // Replicas are picked concurrently under a shared lock.
+  absl::Mutex mutex_;
+  std::mt19937 generator_ ABSL_GUARDED_BY(mutex_);
 };
 
 class ShardManagerImpl : public ShardManager {
@@ -53,7 +81,17 @@ class ShardManagerImpl : public ShardManager {
       std::unique_ptr<RandomGenerator> random_generator)
       : num_shards_{num_shards},
         client_factory_{client_factory},
-        random_generator_{std::move(random_generator)} {}
+        random_generator_{std::move(random_generator)} {
+    const int32_t circuit_breaker_failures =
+        absl::GetFlag(FLAGS_shard_circuit_breaker_failures);
+    if (circuit_breaker_failures > 0) {
+      for (int32_t shard_num = 0; shard_num < num_shards; shard_num++) {
+        circuit_breakers_.push_back(std::make_unique<CircuitBreaker>(
+            circuit_breaker_failures,
+            absl::GetFlag(FLAGS_shard_circuit_breaker_cooldown)));
+      }
+    }
+  }
 
   // taking in a set to exclude duplicates.
   // set doesn't have an O(1) lookup --> converting to vector.
@@ -71,7 +109,11 @@ class ShardManagerImpl : public ShardManager {
         if (key_iter != remote_lookup_clients_.end()) {
           continue;
         }
-        remote_lookup_clients_.insert({ip, client_factory_(ip)});
+        auto client = client_factory_(ip);
+        remote_lookup_clients_.insert(
+            {ip, client == nullptr
+                     ? nullptr
+                     : std::make_unique<ReplicaClient>(std::move(client))});
       }
       cluster_mappings_vector.emplace_back(std::move(vc));
     }
@@ -84,31 +126,87 @@ class ShardManagerImpl : public ShardManager {
         cluster_mappings_.size() != num_shards_) {
       return nullptr;
     }
-    const auto& shard_replicas = cluster_mappings_[shard_num];
-    if (shard_replicas.size() == 0) {
+    return PickReplica(cluster_mappings_[shard_num], /*excluded=*/nullptr);
+  }
+
+  RemoteLookupClient* GetOtherReplica(
+      int64_t shard_num, const RemoteLookupClient& client) const override {
+    absl::ReaderMutexLock lock(&mutex_);
+    if (shard_num < 0 || shard_num >= num_shards_ ||
+        cluster_mappings_.size() != num_shards_) {
       return nullptr;
     }
-    const auto replica_idx = random_generator_->Get(shard_replicas.size());
-    const auto& ip_address = shard_replicas[replica_idx];
-    const auto key_iter = remote_lookup_clients_.find(ip_address);
-    if (key_iter == remote_lookup_clients_.end()) {
+    return PickReplica(cluster_mappings_[shard_num], &client);
+  }
+
+  CircuitBreaker* GetCircuitBreaker(int64_t shard_num) const override {
+    if (shard_num < 0 || shard_num >= circuit_breakers_.size()) {
       return nullptr;
-    } else {
-      return key_iter->second.get();
     }
+    return circuit_breakers_[shard_num].get();
   }
 
+  bool HasCircuitBreakers() const { return !circuit_breakers_.empty(); }
+
  private:
+  // Picks the cheaper of two random replicas other than `excluded`, by the
+  // power of two choices, which spreads the load by latency and outstanding
+  // requests without the herding of always picking the cheapest replica.
+  // Ejected replicas are only picked if all other replicas are ejected too.
+  RemoteLookupClient* PickReplica(
+      const std::vector<std::string>& shard_replicas,
+      const RemoteLookupClient* excluded) const
+      ABSL_SHARED_LOCKS_REQUIRED(mutex_) {
+    const absl::Time now = absl::Now();
+    std::vector<ReplicaClient*> candidates;
+    std::vector<ReplicaClient*> ejected_candidates;
+    candidates.reserve(shard_replicas.size());
+    for (const auto& ip_address : shard_replicas) {
+      const auto key_iter = remote_lookup_clients_.find(ip_address);
+      if (key_iter == remote_lookup_clients_.end() ||
+          key_iter->second == nullptr || key_iter->second.get() == excluded) {
+        continue;
+      }
+      if (key_iter->second->IsEjected(now)) {
+        ejected_candidates.push_back(key_iter->second.get());
+      } else {
+        candidates.push_back(key_iter->second.get());
+      }
+    }
+    if (candidates.empty()) {
+      candidates = std::move(ejected_candidates);
+    }
+    if (candidates.empty()) {
+      return nullptr;
+    }
+    if (candidates.size() == 1) {
+      return candidates[0];
+    }
+    const auto first_idx = random_generator_->Get(candidates.size());
+    auto second_idx = random_generator_->Get(candidates.size() - 1);
+    if (second_idx >= first_idx) {
+      second_idx++;
+    }
+    return candidates[second_idx]->GetCost() <
+                   candidates[first_idx]->GetCost()
+               ? candidates[second_idx]
+               : candidates[first_idx];
+  }
+
   mutable absl::Mutex mutex_;
   // (idx) shard id -> set of ip_addresses
   std::vector<std::vector<std::string>> cluster_mappings_
       ABSL_GUARDED_BY(mutex_);
-  absl::flat_hash_map<std::string, std::unique_ptr<RemoteLookupClient>>
+  // Replicas that were ever in the pool, so that their state survives
+  // updates of the mapping.
+  absl::flat_hash_map<std::string, std::unique_ptr<ReplicaClient>>
       remote_lookup_clients_ ABSL_GUARDED_BY(mutex_);
   int32_t num_shards_;
   std::function<std::unique_ptr<RemoteLookupClient>(const std::string& ip)>
       client_factory_;
   std::unique_ptr<RandomGenerator> random_generator_;
+  // One per shard, or none if the circuit breakers are disabled.
+  std::vector<std::unique_ptr<CircuitBreaker>> circuit_breakers_;
 };
 
 absl::Status ValidateMapping(
@@ -136,6 +234,10 @@ absl::Status ValidateMapping(
 
 }  // namespace
 
+std::string GetCircuitBreakerOpenMetricName(int64_t shard_num) {
+  return absl::StrCat(kShardCircuitBreakerOpen, shard_num);
+}
+
 absl::StatusOr<std::unique_ptr<ShardManager>> ShardManager::Create(
     int32_t num_shards,
     privacy_sandbox::server_common::KeyFetcherManagerInterface&
@@ -149,10 +251,28 @@ absl::StatusOr<std::unique_ptr<ShardManager>> ShardManager::Create(
   auto shard_manager = std::make_unique<ShardManagerImpl>(
       cluster_mappings.size(),
       [&key_fetcher_manager, &metrics_recorder](const std::string& ip) {
-        return RemoteLookupClient::Create(ip, key_fetcher_manager,
-                                          metrics_recorder);
+        auto client = RemoteLookupClient::Create(ip, key_fetcher_manager,
+                                                 metrics_recorder);
+        const absl::Duration batch_window =
+            absl::GetFlag(FLAGS_remote_lookup_batch_window);
+        if (batch_window <= absl::ZeroDuration()) {
+          return client;
+        }
+        return CreateBatchingRemoteLookupClient(
+            std::move(client), batch_window,
+            absl::GetFlag(FLAGS_remote_lookup_batch_max_keys),
+            metrics_recorder);
       },
       std::make_unique<RandomGeneratorImpl>());
+  if (shard_manager->HasCircuitBreakers()) {
+    for (int32_t shard_num = 0; shard_num < num_shards; shard_num++) {
+      metrics_recorder.RegisterHistogram(
+          GetCircuitBreakerOpenMetricName(shard_num),
+          absl::StrFormat("Whether the circuit breaker of shard %d is open",
+                          shard_num),
+          "state", kCircuitBreakerOpenBucketBoundaries);
+    }
+  }
   shard_manager->InsertBatch(std::move(cluster_mappings));
   return shard_manager;
 }
@@ -24,6 +24,7 @@
 #include <vector>
 
 #include "absl/container/flat_hash_set.h"
+#include "components/internal_server/circuit_breaker.h"
 #include "components/internal_server/remote_lookup_client.h"
 #include "src/cpp/telemetry/metrics_recorder.h"
 #include "src/cpp/telemetry/telemetry.h"
@@ -39,8 +40,12 @@ class RandomGenerator {
 
 // This class allows communication between a UDF server and data servers.
 // A mapping from a shard number to a set of ip addresses should be inserted
-// periodically. The class allows to retreive a RemoteLookupClient assigned to a
-// random ip address from the provided pool. ShardManager is thread safe.
+// periodically. The class allows to retreive a RemoteLookupClient assigned to
+// an ip address from the provided pool, picked by the latency, outstanding
+// requests and errors of the replicas. Replicas that fail repeatedly are left
+// out for a while. With `--shard_circuit_breaker_failures`, each shard has a
+// circuit breaker shared by all the lookups of the process. ShardManager is
+// thread safe.
 class ShardManager {
  public:
   virtual ~ShardManager() = default;
@@ -52,6 +57,14 @@ class ShardManager {
   // Given the shard number, get a remote lookup client for one of the replicas
   // in the pool.
   virtual RemoteLookupClient* Get(int64_t shard_num) const = 0;
+  // Given the shard number, get a remote lookup client for one of the replicas
+  // in the pool other than the one of `client`, e.g. to send a request there
+  // as well. Returns nullptr if the shard has no other replica.
+  virtual RemoteLookupClient* GetOtherReplica(
+      int64_t shard_num, const RemoteLookupClient& client) const = 0;
+  // Given the shard number, get the circuit breaker of the shard. Returns
+  // nullptr if the circuit breakers are disabled.
+  virtual CircuitBreaker* GetCircuitBreaker(int64_t shard_num) const = 0;
   static absl::StatusOr<std::unique_ptr<ShardManager>> Create(
       int32_t num_shards,
       privacy_sandbox::server_common::KeyFetcherManagerInterface&
@@ -65,5 +78,9 @@ class ShardManager {
       std::function<std::unique_ptr<RemoteLookupClient>(const std::string& ip)>
           client_factory);
 };
+
+// Name of the histogram of the state of the circuit breaker of `shard_num`,
+// recorded whenever a lookup checks it: 1 if it is open, 0 otherwise.
+std::string GetCircuitBreakerOpenMetricName(int64_t shard_num);
 }  // namespace kv_server
 #endif  // COMPONENTS_SHARDING_SHARD_MANAGER_H_
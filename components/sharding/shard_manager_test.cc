@@ -18,13 +18,19 @@
 #include <utility>
 #include <vector>
 
+#include "absl/flags/declare.h"
+#include "absl/flags/flag.h"
+#include "absl/flags/reflection.h"
 #include "components/internal_server/constants.h"
+#include "components/internal_server/mocks.h"
 #include "components/sharding/mocks.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "src/cpp/encryption/key_fetcher/src/fake_key_fetcher_manager.h"
 #include "src/cpp/telemetry/mocks.h"
 
+ABSL_DECLARE_FLAG(int32_t, shard_circuit_breaker_failures);
+
 namespace kv_server {
 namespace {
 
@@ -118,9 +124,13 @@ TEST_F(ShardManagerTest, InsertMissingReplicasRetrieveSuccess) {
 TEST_F(ShardManagerTest, InsertRetrieveTwoVersions) {
   auto random_generator = std::make_unique<MockRandomGenerator>();
   MockMetricsRecorder mock_metrics_recorder_;
+  // Each pick draws two replicas, and picks the first one of two equally
+  // cheap replicas.
   EXPECT_CALL(*random_generator, Get(testing::_))
       .WillOnce([]() { return 0; })
-      .WillOnce([]() { return 1; });
+      .WillOnce([]() { return 0; })
+      .WillOnce([]() { return 1; })
+      .WillOnce([]() { return 0; });
   std::string instance_id_1 = "some_ip_1";
   std::string instance_id_2 = "some_ip_2";
   std::vector<absl::flat_hash_set<std::string>> cluster_mappings;
@@ -147,5 +157,119 @@ TEST_F(ShardManagerTest, InsertRetrieveTwoVersions) {
   EXPECT_EQ(etalon, result);
 }
 
+TEST_F(ShardManagerTest, GetSkipsFailingReplica) {
+  auto random_generator = std::make_unique<MockRandomGenerator>();
+  EXPECT_CALL(*random_generator, Get(testing::_))
+      .WillRepeatedly(testing::Return(0));
+  std::vector<absl::flat_hash_set<std::string>> cluster_mappings;
+  cluster_mappings.push_back({"some_ip_1", "some_ip_2"});
+  for (int i = 0; i < 3; i++) {
+    cluster_mappings.push_back({"some_ip_3"});
+  }
+  auto shard_manager = ShardManager::Create(
+      4, std::move(cluster_mappings), std::move(random_generator),
+      [](const std::string& ip) {
+        auto client = std::make_unique<MockRemoteLookupClient>();
+        EXPECT_CALL(*client, GetValues(testing::_, testing::_))
+            .WillRepeatedly(
+                testing::Return(absl::UnavailableError("unavailable")));
+        return client;
+      });
+  ASSERT_TRUE(shard_manager.ok());
+  RemoteLookupClient* failing_client = (*shard_manager)->Get(0);
+  ASSERT_NE(failing_client, nullptr);
+  for (int i = 0; i < 5; i++) {
+    EXPECT_FALSE(failing_client->GetValues("", 0).ok());
+  }
+  for (int i = 0; i < 5; i++) {
+    EXPECT_NE((*shard_manager)->Get(0), failing_client);
+  }
+}
+
+TEST_F(ShardManagerTest, GetOtherReplicaSkipsReplica) {
+  auto random_generator = std::make_unique<MockRandomGenerator>();
+  EXPECT_CALL(*random_generator, Get(testing::_))
+      .WillRepeatedly(testing::Return(0));
+  std::vector<absl::flat_hash_set<std::string>> cluster_mappings;
+  cluster_mappings.push_back({"some_ip_1", "some_ip_2"});
+  for (int i = 0; i < 3; i++) {
+    cluster_mappings.push_back({"some_ip_3"});
+  }
+  auto& fake_key_fetcher_manager = fake_key_fetcher_manager_;
+  auto& mock_metrics_recorder = mock_metrics_recorder_;
+  auto client_factory = [&fake_key_fetcher_manager,
+                         &mock_metrics_recorder](const std::string& ip) {
+    return RemoteLookupClient::Create(ip, fake_key_fetcher_manager,
+                                      mock_metrics_recorder);
+  };
+  auto shard_manager =
+      ShardManager::Create(4, std::move(cluster_mappings),
+                           std::move(random_generator), client_factory);
+  ASSERT_TRUE(shard_manager.ok());
+  // Whichever replica is picked first, the other one is picked next.
+  const RemoteLookupClient* client = (*shard_manager)->Get(0);
+  ASSERT_NE(client, nullptr);
+  const RemoteLookupClient* other_client =
+      (*shard_manager)->GetOtherReplica(0, *client);
+  ASSERT_NE(other_client, nullptr);
+  EXPECT_NE(client->GetIpAddress(), other_client->GetIpAddress());
+  EXPECT_EQ((*shard_manager)->GetOtherReplica(0, *other_client), client);
+}
+
+TEST_F(ShardManagerTest, GetOtherReplicaSingleReplicaReturnsNull) {
+  int32_t num_shards = 4;
+  std::vector<absl::flat_hash_set<std::string>> cluster_mappings;
+  for (int i = 0; i < num_shards; i++) {
+    cluster_mappings.push_back({"some_ip"});
+  }
+  auto shard_manager =
+      ShardManager::Create(num_shards, fake_key_fetcher_manager_,
+                           std::move(cluster_mappings), mock_metrics_recorder_);
+  ASSERT_TRUE(shard_manager.ok());
+  const RemoteLookupClient* client = (*shard_manager)->Get(0);
+  ASSERT_NE(client, nullptr);
+  EXPECT_EQ((*shard_manager)->GetOtherReplica(0, *client), nullptr);
+}
+
+TEST_F(ShardManagerTest, CircuitBreakersDisabledByDefault) {
+  int32_t num_shards = 4;
+  std::vector<absl::flat_hash_set<std::string>> cluster_mappings;
+  for (int i = 0; i < num_shards; i++) {
+    cluster_mappings.push_back({"some_ip"});
+  }
+  auto shard_manager =
+      ShardManager::Create(num_shards, fake_key_fetcher_manager_,
+                           std::move(cluster_mappings), mock_metrics_recorder_);
+  ASSERT_TRUE(shard_manager.ok());
+  EXPECT_EQ((*shard_manager)->GetCircuitBreaker(0), nullptr);
+}
+
+TEST_F(ShardManagerTest, CircuitBreakerPerShard) {
+  absl::FlagSaver flag_saver;
+  absl::SetFlag(&FLAGS_shard_circuit_breaker_failures, 1);
+  int32_t num_shards = 4;
+  std::vector<absl::flat_hash_set<std::string>> cluster_mappings;
+  for (int i = 0; i < num_shards; i++) {
+    cluster_mappings.push_back({"some_ip"});
+  }
+  EXPECT_CALL(mock_metrics_recorder_,
+              RegisterHistogram(testing::StartsWith("ShardCircuitBreakerOpen"),
+                                testing::_, testing::_, testing::_))
+      .Times(num_shards);
+  auto shard_manager =
+      ShardManager::Create(num_shards, fake_key_fetcher_manager_,
+                           std::move(cluster_mappings), mock_metrics_recorder_);
+  ASSERT_TRUE(shard_manager.ok());
+  CircuitBreaker* circuit_breaker = (*shard_manager)->GetCircuitBreaker(1);
+  ASSERT_NE(circuit_breaker, nullptr);
+  EXPECT_EQ((*shard_manager)->GetCircuitBreaker(1), circuit_breaker);
+  EXPECT_NE((*shard_manager)->GetCircuitBreaker(2), circuit_breaker);
+  EXPECT_EQ((*shard_manager)->GetCircuitBreaker(num_shards), nullptr);
+  // A failure through the breaker stops the requests to the shard for every
+  // caller of the shard manager.
+  EXPECT_TRUE(circuit_breaker->RecordFailure(absl::Now()));
+  EXPECT_TRUE((*shard_manager)->GetCircuitBreaker(1)->IsOpen(absl::Now()));
+}
+
 }  // namespace
 }  // namespace kv_server
@@ -159,6 +159,85 @@ inline constexpr privacy_sandbox::server_common::metrics::Definition<
                           "Number of lookup failures in the sharded lookup",
                           kCounterDPUpperBound, kCounterDPLowerBound);
 
+inline constexpr privacy_sandbox::server_common::metrics::Definition<
+    int, privacy_sandbox::server_common::metrics::Privacy::kImpacting,
+    privacy_sandbox::server_common::metrics::Instrument::kUpDownCounter>
+    kShardedLookupShardRequest(
+        "ShardedLookupShardRequest",
+        "Number of requests sent to remote shards in the sharded lookup",
+        kCounterDPUpperBound, kCounterDPLowerBound);
+
+inline constexpr privacy_sandbox::server_common::metrics::Definition<
+    int, privacy_sandbox::server_common::metrics::Privacy::kImpacting,
+    privacy_sandbox::server_common::metrics::Instrument::kUpDownCounter>
+    kShardedLookupHedgedRequest(
+        "ShardedLookupHedgedRequest",
+        "Number of remote shard requests also sent to another replica "
+        "because they were slow",
+        kCounterDPUpperBound, kCounterDPLowerBound);
+
+inline constexpr privacy_sandbox::server_common::metrics::Definition<
+    int, privacy_sandbox::server_common::metrics::Privacy::kImpacting,
+    privacy_sandbox::server_common::metrics::Instrument::kUpDownCounter>
+    kShardedLookupHedgeWin(
+        "ShardedLookupHedgeWin",
+        "Number of hedged remote shard requests answered first by the other "
+        "replica",
+        kCounterDPUpperBound, kCounterDPLowerBound);
+
+inline constexpr privacy_sandbox::server_common::metrics::Definition<
+    int, privacy_sandbox::server_common::metrics::Privacy::kImpacting,
+    privacy_sandbox::server_common::metrics::Instrument::kUpDownCounter>
+    kShardedLookupShardTimeout(
+        "ShardedLookupShardTimeout",
+        "Number of remote shard requests cancelled because the shard did not "
+        "respond before the deadline of the lookup",
+        kCounterDPUpperBound, kCounterDPLowerBound);
+
+inline constexpr privacy_sandbox::server_common::metrics::Definition<
+    int, privacy_sandbox::server_common::metrics::Privacy::kImpacting,
+    privacy_sandbox::server_common::metrics::Instrument::kUpDownCounter>
+    kShardedLookupCircuitOpened(
+        "ShardedLookupCircuitOpened",
+        "Number of times the circuit breaker of a remote shard opened after "
+        "consecutive failures",
+        kCounterDPUpperBound, kCounterDPLowerBound);
+
+inline constexpr privacy_sandbox::server_common::metrics::Definition<
+    int, privacy_sandbox::server_common::metrics::Privacy::kImpacting,
+    privacy_sandbox::server_common::metrics::Instrument::kUpDownCounter>
+    kShardedLookupCircuitRejected(
+        "ShardedLookupCircuitRejected",
+        "Number of remote shard requests not sent because the circuit breaker "
+        "of the shard was open",
+        kCounterDPUpperBound, kCounterDPLowerBound);
+
+inline constexpr privacy_sandbox::server_common::metrics::Definition<
+    int, privacy_sandbox::server_common::metrics::Privacy::kImpacting,
+    privacy_sandbox::server_common::metrics::Instrument::kUpDownCounter>
+    kShardedLookupPartialResult(
+        "ShardedLookupPartialResult",
+        "Number of remote shard failures that a lookup returned partial "
+        "results for",
+        kCounterDPUpperBound, kCounterDPLowerBound);
+
+inline constexpr privacy_sandbox::server_common::metrics::Definition<
+    int, privacy_sandbox::server_common::metrics::Privacy::kImpacting,
+    privacy_sandbox::server_common::metrics::Instrument::kUpDownCounter>
+    kShardedLookupNearCacheHit(
+        "ShardedLookupNearCacheHit",
+        "Number of sharded lookups that found results in the near cache",
+        kCounterDPUpperBound, kCounterDPLowerBound);
+
+inline constexpr privacy_sandbox::server_common::metrics::Definition<
+    int, privacy_sandbox::server_common::metrics::Privacy::kImpacting,
+    privacy_sandbox::server_common::metrics::Instrument::kUpDownCounter>
+    kShardedLookupNearCacheMiss(
+        "ShardedLookupNearCacheMiss",
+        "Number of sharded lookups that looked up keys missing from the near "
+        "cache on the shards",
+        kCounterDPUpperBound, kCounterDPLowerBound);
+
 inline constexpr privacy_sandbox::server_common::metrics::Definition<
     int, privacy_sandbox::server_common::metrics::Privacy::kImpacting,
     privacy_sandbox::server_common::metrics::Instrument::kUpDownCounter>
@@ -374,6 +453,11 @@ inline constexpr const privacy_sandbox::server_common::metrics::DefinitionName*
         &kLookupClientMissing, &kShardedLookupServerRequestFailed,
         &kShardedLookupServerKeyCollisionOnCollection,
         &kLookupFuturesCreationFailure, &kShardedLookupFailure,
+        &kShardedLookupShardRequest, &kShardedLookupHedgedRequest,
+        &kShardedLookupHedgeWin, &kShardedLookupShardTimeout,
+        &kShardedLookupCircuitOpened, &kShardedLookupCircuitRejected,
+        &kShardedLookupPartialResult, &kShardedLookupNearCacheHit,
+        &kShardedLookupNearCacheMiss,
         &kRemoteClientEncryptionFailure, &kRemoteClientSecureLookupFailure,
         &kRemoteClientDecryptionFailure, &kInternalClientDecryptionFailure,
         &kInternalClientUnpaddingRequestError,
@@ -0,0 +1,45 @@
+/*
+ * Copyright 2023 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "components/tools/benchmarks/allocation_counter.h"
+
+#include <cstdlib>
+#include <new>
+
+namespace kv_server::benchmark {
+namespace {
+
+// Counted per thread, so that the threads writing to the cache in the
+// background do not show up in the counts of the benchmarked threads.
+thread_local int64_t allocation_count = 0;
+
+}  // namespace
+
+int64_t GetThreadAllocationCount() { return allocation_count; }
+
+}  // namespace kv_server::benchmark
+
+void* operator new(std::size_t size) {
+  ++kv_server::benchmark::allocation_count;
+  if (void* ptr = std::malloc(size == 0 ? 1 : size)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
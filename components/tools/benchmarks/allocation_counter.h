@@ -0,0 +1,31 @@
+/*
+ * Copyright 2023 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef COMPONENTS_TOOLS_BENCHMARKS_ALLOCATION_COUNTER_H_
+#define COMPONENTS_TOOLS_BENCHMARKS_ALLOCATION_COUNTER_H_
+
+#include <cstdint>
+
+namespace kv_server::benchmark {
+
+// Returns the number of heap allocations made through the global
+// `operator new` by the calling thread so far. The count is only kept in
+// binaries that link `:allocation_counter`, which replaces `operator new`.
+int64_t GetThreadAllocationCount();
+
+}  // namespace kv_server::benchmark
+
+#endif  // COMPONENTS_TOOLS_BENCHMARKS_ALLOCATION_COUNTER_H_
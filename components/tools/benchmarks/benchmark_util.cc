@@ -17,6 +17,7 @@
 #include "components/tools/benchmarks/benchmark_util.h"
 
 #include <string>
+#include <string_view>
 #include <utility>
 #include <vector>
 
@@ -61,8 +62,21 @@ std::string GenerateRandomString(const int64_t char_count) {
   return std::string(char_count, 'A' + (std::rand() % 15));
 }
 
+namespace {
+
+uint64_t GenerateRandomUInt64() {
+  return (static_cast<uint64_t>(std::rand()) << 32) ^ std::rand();
+}
+
+}  // namespace
+
 absl::Status WriteRecords(int64_t num_records, const int64_t record_size,
-                          std::iostream& output_stream) {
+                          std::iostream& output_stream, Value value_type) {
+  if (value_type != Value::String && value_type != Value::StringSet &&
+      value_type != Value::UInt32Set && value_type != Value::UInt64Set) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Unsupported value type: ", EnumNameValue(value_type)));
+  }
   auto record_writer = DeltaRecordStreamWriter<>::Create(
       output_stream, DeltaRecordWriter::Options{});
   if (!record_writer.ok()) {
@@ -70,13 +84,40 @@ absl::Status WriteRecords(int64_t num_records, const int64_t record_size,
   }
   while (num_records > 0) {
     const std::string key = absl::StrCat("foo", num_records);
-    const std::string value = GenerateRandomString(record_size);
+    std::string value;
+    std::vector<std::string> string_elements;
+    std::vector<std::string_view> string_set;
+    std::vector<uint32_t> uint32_set;
+    std::vector<uint64_t> uint64_set;
     auto kv_mutation_record = KeyValueMutationRecordStruct{
         .mutation_type = KeyValueMutationType::Update,
         .logical_commit_time = absl::ToUnixSeconds(absl::Now()),
         .key = key,
-        .value = value,
     };
+    switch (value_type) {
+      case Value::StringSet:
+        for (int64_t i = 0; i < record_size; i++) {
+          string_elements.push_back(absl::StrCat(GenerateRandomUInt64()));
+        }
+        string_set.assign(string_elements.begin(), string_elements.end());
+        kv_mutation_record.value = string_set;
+        break;
+      case Value::UInt32Set:
+        for (int64_t i = 0; i < record_size; i++) {
+          uint32_set.push_back(static_cast<uint32_t>(GenerateRandomUInt64()));
+        }
+        kv_mutation_record.value = uint32_set;
+        break;
+      case Value::UInt64Set:
+        for (int64_t i = 0; i < record_size; i++) {
+          uint64_set.push_back(GenerateRandomUInt64());
+        }
+        kv_mutation_record.value = uint64_set;
+        break;
+      default:
+        value = GenerateRandomString(record_size);
+        kv_mutation_record.value = value;
+    }
     auto status = (*record_writer)
                       ->WriteRecord(DataRecordStruct{
                           .record = std::move(kv_mutation_record)});
@@ -24,6 +24,7 @@
 
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
+#include "public/data_loading/data_loading_generated.h"
 
 namespace kv_server::benchmark {
 
@@ -48,9 +49,13 @@ class AsyncTask {
 // Generates a random string with `char_count` characters.
 std::string GenerateRandomString(const int64_t char_count);
 
-// Write num_records, each with a size of record_size, to output_stream.
+// Write num_records, each with a size of record_size, to output_stream. For
+// set value types, record_size is the number of elements of each set. The
+// elements of string sets are random numbers in decimal, like the elements of
+// numeric sets once loaded.
 absl::Status WriteRecords(int64_t num_records, int64_t record_size,
-                          std::iostream& output_stream);
+                          std::iostream& output_stream,
+                          Value value_type = Value::String);
 
 // Parses a numeric string list into a vector of int64 elements.
 absl::StatusOr<std::vector<int64_t>> ParseInt64List(
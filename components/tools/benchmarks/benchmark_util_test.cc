@@ -69,5 +69,36 @@ TEST(BenchmarkUtilTest, VerifyWriteRecords) {
   EXPECT_TRUE(status.ok()) << status;
 }
 
+TEST(BenchmarkUtilTest, VerifyWriteNumericSetRecords) {
+  std::stringstream data_stream;
+  int64_t num_records = 100;
+  int64_t record_size = 64;
+  auto status =
+      WriteRecords(num_records, record_size, data_stream, Value::UInt64Set);
+  EXPECT_TRUE(status.ok()) << status;
+  DeltaRecordStreamReader record_reader(data_stream);
+  testing::MockFunction<absl::Status(DataRecordStruct)> record_callback;
+  EXPECT_CALL(record_callback, Call)
+      .Times(num_records)
+      .WillRepeatedly([record_size](DataRecordStruct data_record) {
+        if (std::holds_alternative<KeyValueMutationRecordStruct>(
+                data_record.record)) {
+          auto kv_record =
+              std::get<KeyValueMutationRecordStruct>(data_record.record);
+          EXPECT_EQ(std::get<std::vector<uint64_t>>(kv_record.value).size(),
+                    record_size);
+        }
+        return absl::OkStatus();
+      });
+  status = record_reader.ReadRecords(record_callback.AsStdFunction());
+  EXPECT_TRUE(status.ok()) << status;
+}
+
+TEST(BenchmarkUtilTest, VerifyWriteRecordsFailsWithUnsupportedValueType) {
+  std::stringstream data_stream;
+  auto status = WriteRecords(1, 1, data_stream, Value::NONE);
+  EXPECT_EQ(status.code(), absl::StatusCode::kInvalidArgument) << status;
+}
+
 }  // namespace
 }  // namespace kv_server::benchmark
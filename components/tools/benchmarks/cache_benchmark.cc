@@ -31,6 +31,9 @@
 #include "components/data_server/cache/cache.h"
 #include "components/data_server/cache/key_value_cache.h"
 #include "components/data_server/cache/noop_key_value_cache.h"
+#include "components/internal_server/local_lookup.h"
+#include "components/internal_server/lookup.h"
+#include "components/tools/benchmarks/allocation_counter.h"
 #include "components/tools/benchmarks/benchmark_util.h"
 #include "glog/logging.h"
 #include "src/cpp/telemetry/metrics_recorder.h"
@@ -68,6 +71,7 @@ namespace {
 
 using kv_server::benchmark::AsyncTask;
 using kv_server::benchmark::GenerateRandomString;
+using kv_server::benchmark::GetThreadAllocationCount;
 using kv_server::benchmark::ParseInt64List;
 using privacy_sandbox::server_common::MetricsRecorder;
 using privacy_sandbox::server_common::TelemetryProvider;
@@ -86,6 +90,10 @@ constexpr std::string_view kNoOpCacheGetKeyValueSetFmt =
     "BM_NoOpCache_GetKeyValueSet/qz:%d/sqz:%d/rz:%d/cw:%d";
 constexpr std::string_view kLockBasedCacheGetKeyValueSetFmt =
     "BM_LockBasedCache_GetKeyValueSet/qz:%d/sqz:%d/rz:%d/cw:%d";
+constexpr std::string_view kLocalLookupGetKeyValuesFmt =
+    "BM_LocalLookup_GetKeyValues/qz:%d/rz:%d/cw:%d";
+constexpr std::string_view kLocalLookupGetKeyValueSetFmt =
+    "BM_LocalLookup_GetKeyValueSet/qz:%d/sqz:%d/rz:%d/cw:%d";
 
 constexpr std::string_view kNoOpCacheUpdateKeyValueFmt =
     "BM_NoOpCache_UpdateKeyValue/ksz:%d/rz:%d/cr:%d";
@@ -98,6 +106,7 @@ constexpr std::string_view kLockBasedCacheUpdateKeyValueSetFmt =
 
 constexpr std::string_view kReadsPerSec = "Reads/s";
 constexpr std::string_view kWritesPerSec = "Writes/s";
+constexpr std::string_view kAllocsPerRead = "Allocs/read";
 
 Cache* GetNoOpCache() {
   static auto* const cache = NoOpKeyValueCache::Create().release();
@@ -109,6 +118,13 @@ Cache* GetLockBasedCache(MetricsRecorder& metrics_recorder) {
   return cache;
 }
 
+Lookup* GetLocalLookup(MetricsRecorder& metrics_recorder) {
+  static auto* const lookup =
+      CreateLocalLookup(*GetLockBasedCache(metrics_recorder), metrics_recorder)
+          .release();
+  return lookup;
+}
+
 std::atomic<int64_t>& GetLogicalTimestamp() {
   static auto* const timestamp = new std::atomic<int64_t>(0);
   return *timestamp;
@@ -155,8 +171,16 @@ struct BenchmarkArgs {
   int64_t keyspace_size = 1;
   int64_t concurrent_tasks = 1;
   Cache* cache = GetNoOpCache();
+  Lookup* lookup = nullptr;
 };
 
+// Records the average number of heap allocations made by the benchmarked
+// threads for each read.
+void SetAllocsPerRead(::benchmark::State& state, int64_t allocations) {
+  state.counters[std::string(kAllocsPerRead)] = ::benchmark::Counter(
+      allocations, ::benchmark::Counter::kAvgIterations);
+}
+
 void BM_GetKeyValuePairs(::benchmark::State& state, BenchmarkArgs args) {
   uint seed = args.concurrent_tasks;
   std::vector<AsyncTask> writer_tasks;
@@ -173,9 +197,11 @@ void BM_GetKeyValuePairs(::benchmark::State& state, BenchmarkArgs args) {
   }
   auto keys = GetKeys(args.query_size);
   auto keys_view = ToContainerView<absl::flat_hash_set<std::string_view>>(keys);
+  const int64_t allocations = GetThreadAllocationCount();
   for (auto _ : state) {
     ::benchmark::DoNotOptimize(args.cache->GetKeyValuePairs(keys_view));
   }
+  SetAllocsPerRead(state, GetThreadAllocationCount() - allocations);
   state.counters[std::string(kReadsPerSec)] =
       ::benchmark::Counter(state.iterations(), ::benchmark::Counter::kIsRate);
 }
@@ -199,9 +225,68 @@ void BM_GetKeyValueSet(::benchmark::State& state, BenchmarkArgs args) {
   }
   auto keys = GetKeys(args.query_size);
   auto keys_view = ToContainerView<absl::flat_hash_set<std::string_view>>(keys);
+  const int64_t allocations = GetThreadAllocationCount();
   for (auto _ : state) {
     ::benchmark::DoNotOptimize(args.cache->GetKeyValueSet(keys_view));
   }
+  SetAllocsPerRead(state, GetThreadAllocationCount() - allocations);
+  state.counters[std::string(kReadsPerSec)] =
+      ::benchmark::Counter(state.iterations(), ::benchmark::Counter::kIsRate);
+}
+
+// Benchmarks `Lookup::GetKeyValues`, which also builds the lookup response
+// from the values read from the cache.
+void BM_LookupGetKeyValues(::benchmark::State& state, BenchmarkArgs args) {
+  uint seed = args.concurrent_tasks;
+  std::vector<AsyncTask> writer_tasks;
+  if (state.thread_index() == 0 && args.concurrent_tasks > 0) {
+    auto num_writers = args.concurrent_tasks;
+    writer_tasks.reserve(num_writers);
+    while (num_writers-- > 0) {
+      writer_tasks.emplace_back(
+          [args, &seed, value = GenerateRandomString(args.record_size)]() {
+            auto key = std::to_string(rand_r(&seed) % args.query_size);
+            args.cache->UpdateKeyValue(key, value, ++GetLogicalTimestamp());
+          });
+    }
+  }
+  auto keys = GetKeys(args.query_size);
+  auto keys_view = ToContainerView<absl::flat_hash_set<std::string_view>>(keys);
+  const int64_t allocations = GetThreadAllocationCount();
+  for (auto _ : state) {
+    ::benchmark::DoNotOptimize(args.lookup->GetKeyValues(keys_view));
+  }
+  SetAllocsPerRead(state, GetThreadAllocationCount() - allocations);
+  state.counters[std::string(kReadsPerSec)] =
+      ::benchmark::Counter(state.iterations(), ::benchmark::Counter::kIsRate);
+}
+
+// Benchmarks `Lookup::GetKeyValueSet`, which also builds the lookup response
+// from the sets read from the cache.
+void BM_LookupGetKeyValueSet(::benchmark::State& state, BenchmarkArgs args) {
+  uint seed = args.concurrent_tasks;
+  std::vector<AsyncTask> writer_tasks;
+  if (state.thread_index() == 0 && args.concurrent_tasks > 0) {
+    auto num_writers = args.concurrent_tasks;
+    writer_tasks.reserve(num_writers);
+    while (num_writers-- > 0) {
+      writer_tasks.emplace_back([args, &seed,
+                                 set_query = GetSetQuery(args.set_query_size,
+                                                         args.record_size)]() {
+        auto key = std::to_string(rand_r(&seed) % args.query_size);
+        auto view = ToContainerView<std::vector<std::string_view>>(set_query);
+        args.cache->UpdateKeyValueSet(key, absl::MakeSpan(view),
+                                      ++GetLogicalTimestamp());
+      });
+    }
+  }
+  auto keys = GetKeys(args.query_size);
+  auto keys_view = ToContainerView<absl::flat_hash_set<std::string_view>>(keys);
+  const int64_t allocations = GetThreadAllocationCount();
+  for (auto _ : state) {
+    ::benchmark::DoNotOptimize(args.lookup->GetKeyValueSet(keys_view));
+  }
+  SetAllocsPerRead(state, GetThreadAllocationCount() - allocations);
   state.counters[std::string(kReadsPerSec)] =
       ::benchmark::Counter(state.iterations(), ::benchmark::Counter::kIsRate);
 }
@@ -291,6 +376,11 @@ void RegisterReadBenchmarks(MetricsRecorder& metrics_recorder) {
             absl::StrFormat(kLockBasedCacheGetKeyValuePairsFmt, query_size,
                             record_size, num_writers),
             args, BM_GetKeyValuePairs);
+        args.lookup = GetLocalLookup(metrics_recorder);
+        ::kv_server::RegisterBenchmark(
+            absl::StrFormat(kLocalLookupGetKeyValuesFmt, query_size,
+                            record_size, num_writers),
+            args, BM_LookupGetKeyValues);
         for (auto set_query_size : set_query_sizes.value()) {
           args.set_query_size = set_query_size;
           args.cache = GetNoOpCache();
@@ -303,6 +393,10 @@ void RegisterReadBenchmarks(MetricsRecorder& metrics_recorder) {
               absl::StrFormat(kLockBasedCacheGetKeyValueSetFmt, query_size,
                               set_query_size, record_size, num_writers),
               args, BM_GetKeyValueSet);
+          ::kv_server::RegisterBenchmark(
+              absl::StrFormat(kLocalLookupGetKeyValueSetFmt, query_size,
+                              set_query_size, record_size, num_writers),
+              args, BM_LookupGetKeyValueSet);
         }
       }
     }
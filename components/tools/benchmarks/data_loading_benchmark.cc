@@ -17,8 +17,12 @@
 #include <array>
 #include <chrono>
 #include <memory>
+#include <optional>
 #include <sstream>
+#include <string>
+#include <string_view>
 #include <thread>
+#include <vector>
 
 #include "absl/container/flat_hash_map.h"
 #include "absl/flags/flag.h"
@@ -52,7 +56,10 @@ ABSL_FLAG(int64_t, num_records, 100'000,
           "is true.");
 ABSL_FLAG(int64_t, record_size, 10 * 1024,
           "Size of reach record in data file when '--create_input_file' "
-          "is true.");
+          "is true. For sets, the number of elements of each record.");
+ABSL_FLAG(std::string, record_value_type, "string",
+          "Value type of the records in data file when '--create_input_file' "
+          "is true. One of: string, string_set, uint32_set, uint64_set.");
 ABSL_FLAG(std::vector<std::string>, args_reader_worker_threads,
           std::vector<std::string>({"16"}),
           "A list of num of worker threads to use for concurrent reading.");
@@ -184,6 +191,22 @@ void RegisterBenchmarks(MetricsRecorder& metrics_recorder) {
   }
 }
 
+std::optional<Value> ParseValueType(std::string_view value_type) {
+  if (value_type == "string") {
+    return Value::String;
+  }
+  if (value_type == "string_set") {
+    return Value::StringSet;
+  }
+  if (value_type == "uint32_set") {
+    return Value::UInt32Set;
+  }
+  if (value_type == "uint64_set") {
+    return Value::UInt64Set;
+  }
+  return std::nullopt;
+}
+
 absl::Status ApplyUpdateMutation(const KeyValueMutationRecord& record,
                                  Cache& cache) {
   if (record.value_type() == Value::String) {
@@ -198,6 +221,18 @@ absl::Status ApplyUpdateMutation(const KeyValueMutationRecord& record,
                             record.logical_commit_time());
     return absl::OkStatus();
   }
+  if (record.value_type() == Value::UInt32Set) {
+    cache.UpdateKeyValueUInt32Set(record.key()->string_view(),
+                                  GetRecordValue<std::vector<uint32_t>>(record),
+                                  record.logical_commit_time());
+    return absl::OkStatus();
+  }
+  if (record.value_type() == Value::UInt64Set) {
+    cache.UpdateKeyValueUInt64Set(record.key()->string_view(),
+                                  GetRecordValue<std::vector<uint64_t>>(record),
+                                  record.logical_commit_time());
+    return absl::OkStatus();
+  }
   return absl::InvalidArgumentError(
       absl::StrCat("Record with key: ", record.key()->string_view(),
                    " has unsupported value type: ", record.value_type()));
@@ -215,6 +250,18 @@ absl::Status ApplyDeleteMutation(const KeyValueMutationRecord& record,
                             record.logical_commit_time());
     return absl::OkStatus();
   }
+  if (record.value_type() == Value::UInt32Set) {
+    cache.DeleteValuesInUInt32Set(record.key()->string_view(),
+                                  GetRecordValue<std::vector<uint32_t>>(record),
+                                  record.logical_commit_time());
+    return absl::OkStatus();
+  }
+  if (record.value_type() == Value::UInt64Set) {
+    cache.DeleteValuesInUInt64Set(record.key()->string_view(),
+                                  GetRecordValue<std::vector<uint64_t>>(record),
+                                  record.logical_commit_time());
+    return absl::OkStatus();
+  }
   return absl::InvalidArgumentError(
       absl::StrCat("Record with key: ", record.key()->string_view(),
                    " has unsupported value type: ", record.value_type()));
@@ -298,6 +345,7 @@ void BM_LoadDataIntoCache(benchmark::State& state, BenchmarkArgs args,
 //    --create_input_file \
 //    --num_records=1000000 \
 //    --record_size=1000 \
+//    --record_value_type=string \
 //    --args_client_max_range_mb=8 \
 //    --args_client_max_connections=64 \
 //    --args_reader_worker_threads=16,32,64
@@ -314,6 +362,13 @@ int main(int argc, char** argv) {
     LOG(ERROR) << "Flag '--filename' must be not empty.";
     return -1;
   }
+  const auto value_type =
+      ParseValueType(absl::GetFlag(FLAGS_record_value_type));
+  if (!value_type.has_value()) {
+    LOG(ERROR) << "Flag '--record_value_type' has unsupported value: "
+               << absl::GetFlag(FLAGS_record_value_type);
+    return -1;
+  }
   auto noop_metrics_recorder =
       TelemetryProvider::GetInstance().CreateMetricsRecorder();
 
@@ -327,7 +382,8 @@ int main(int argc, char** argv) {
     std::stringstream data_stream;
     if (auto status =
             WriteRecords(absl::GetFlag(FLAGS_num_records),
-                         absl::GetFlag(FLAGS_record_size), data_stream);
+                         absl::GetFlag(FLAGS_record_size), data_stream,
+                         *value_type);
         !status.ok()) {
       LOG(ERROR) << "Failed to write records for data file. " << status;
       return -1;
@@ -0,0 +1,460 @@
+/*
+ * Copyright 2023 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <functional>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/functional/any_invocable.h"
+#include "absl/functional/bind_front.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "benchmark/benchmark.h"
+#include "components/query/ast.h"
+#include "components/query/driver.h"
+#include "components/query/fast_parser.h"
+#include "components/query/scanner.h"
+#include "components/query/sets.h"
+#include "components/query/worker_pool.h"
+#include "components/tools/benchmarks/benchmark_util.h"
+#include "glog/logging.h"
+
+ABSL_FLAG(std::vector<std::string>, query_terms,
+          std::vector<std::string>({"1", "10", "100"}),
+          "Number of keys in each benchmarked query.");
+ABSL_FLAG(std::vector<std::string>, key_size, std::vector<std::string>({"8"}),
+          "Byte size of each key in the benchmarked queries.");
+ABSL_FLAG(std::vector<std::string>, eval_terms,
+          std::vector<std::string>({"16"}),
+          "Number of sets in each evaluated query.");
+ABSL_FLAG(std::vector<std::string>, set_size,
+          std::vector<std::string>({"10", "100", "1000", "10000"}),
+          "Number of elements in each set of the evaluated queries.");
+ABSL_FLAG(std::vector<std::string>, overlap,
+          std::vector<std::string>({"0", "50", "90"}),
+          "Percentage of the elements of each set of the evaluated queries "
+          "that are also in the next set.");
+ABSL_FLAG(std::vector<std::string>, query_shape,
+          std::vector<std::string>({"mixed", "deep", "wide"}),
+          "Shapes of the evaluated queries: mixed is a balanced tree "
+          "alternating unions and intersections, deep a left-deep chain "
+          "cycling through all operators and wide a balanced tree of "
+          "unions.");
+ABSL_FLAG(std::vector<std::string>, min_parallel_work,
+          std::vector<std::string>({"1000", "10000", "100000"}),
+          "Work thresholds at which parallel evaluation forks subtrees.");
+ABSL_FLAG(int64_t, eval_workers, 4,
+          "Number of worker threads for parallel evaluation.");
+ABSL_FLAG(int64_t, iterations, -1,
+          "Number of iterations to run each benchmark.");
+
+namespace kv_server {
+namespace {
+
+using kv_server::benchmark::GenerateRandomString;
+using kv_server::benchmark::ParseInt64List;
+
+// Format variables used to generate benchmark names.
+//
+// => qt - query terms, i.e., number of keys in the query.
+// => kz - key size, i.e., byte size of each key in the query.
+constexpr std::string_view kBisonParseFmt = "BM_BisonParser_Parse/qt:%d/kz:%d";
+constexpr std::string_view kFastParseFmt = "BM_FastParser_Parse/qt:%d/kz:%d";
+// => et - eval terms, i.e., number of sets in the query.
+// => sz - set size, i.e., number of elements in each set.
+// => ov - overlap, i.e., percentage of each set shared with the next one.
+// => sh - shape of the query.
+// => mpw - min parallel work, i.e., threshold to fork subtrees at.
+constexpr std::string_view kPlanFmt = "BM_Plan/et:%d/sh:%s";
+constexpr std::string_view kEvalFmt = "BM_Eval/et:%d/sz:%d/ov:%d/sh:%s";
+constexpr std::string_view kParallelEvalFmt =
+    "BM_ParallelEval/et:%d/sz:%d/ov:%d/sh:%s/mpw:%d";
+constexpr std::string_view kSetOpFmt = "BM_%s/sz:%d/ov:%d";
+
+constexpr std::string_view kQueriesPerSec = "Queries/s";
+constexpr std::string_view kBytesPerSec = "Bytes/s";
+constexpr std::string_view kElementsPerSec = "Elements/s";
+
+const absl::flat_hash_set<std::string_view>& NoOpLookup(std::string_view key) {
+  static const auto* kEmptySet = new absl::flat_hash_set<std::string_view>();
+  return *kEmptySet;
+}
+
+// Builds a query such as `k0 | (k1 & k2) - k3 ...` exercising every
+// operator, parentheses and both the plain and quoted key forms.
+std::string GetQuery(int64_t num_terms, int64_t key_size) {
+  constexpr std::string_view kOps[] = {" | ", " & ", " - ", " UNION "};
+  std::string query;
+  for (int64_t i = 0; i < num_terms; i++) {
+    if (i > 0) {
+      absl::StrAppend(&query, kOps[i % 4]);
+    }
+    // Generated keys are plain letters, so quoting them is always valid.
+    const bool quoted = i % 3 == 2;
+    const bool open = i % 5 == 1 && i + 1 < num_terms;
+    const bool close = i % 5 == 2;
+    absl::StrAppend(&query, open ? "(" : "", quoted ? "\"" : "",
+                    GenerateRandomString(key_size), quoted ? "\"" : "",
+                    close ? ")" : "");
+  }
+  return query;
+}
+
+WorkerPool& GetWorkerPool() {
+  static auto* const pool =
+      new WorkerPool(absl::GetFlag(FLAGS_eval_workers));
+  return *pool;
+}
+
+// Sets of `set_size` elements, each sharing `overlap` percent of its
+// elements with the next one.
+absl::flat_hash_map<std::string, std::vector<std::string>> GetSets(
+    int64_t num_sets, int64_t set_size, int64_t overlap) {
+  const int64_t stride = set_size - set_size * overlap / 100;
+  absl::flat_hash_map<std::string, std::vector<std::string>> sets;
+  for (int64_t i = 0; i < num_sets; i++) {
+    auto& set = sets[absl::StrCat("set", i)];
+    set.reserve(set_size);
+    for (int64_t j = 0; j < set_size; j++) {
+      set.push_back(absl::StrCat(i * stride + j));
+    }
+  }
+  return sets;
+}
+
+std::unique_ptr<Node> GetValueNode(const Driver& driver, int64_t set) {
+  return std::make_unique<ValueNode>(absl::bind_front(&Driver::Lookup, &driver),
+                                     absl::StrCat("set", set));
+}
+
+// Builds a balanced tree over the sets `first` to `last`. With
+// `alternate_ops`, unions and intersections alternate by depth, otherwise
+// every operation is a union.
+std::unique_ptr<Node> GetBalancedQuery(const Driver& driver, int64_t first,
+                                       int64_t last, bool alternate_ops,
+                                       int64_t depth = 0) {
+  if (first == last) {
+    return GetValueNode(driver, first);
+  }
+  const int64_t middle = first + (last - first) / 2;
+  auto left = GetBalancedQuery(driver, first, middle, alternate_ops, depth + 1);
+  auto right =
+      GetBalancedQuery(driver, middle + 1, last, alternate_ops, depth + 1);
+  if (!alternate_ops || depth % 2 == 0) {
+    return std::make_unique<UnionNode>(std::move(left), std::move(right));
+  }
+  return std::make_unique<IntersectionNode>(std::move(left), std::move(right));
+}
+
+// Builds `((set0 | set1) & set2) - set3 ...`, cycling through the operators.
+std::unique_ptr<Node> GetDeepQuery(const Driver& driver, int64_t num_sets) {
+  std::unique_ptr<Node> query = GetValueNode(driver, 0);
+  for (int64_t i = 1; i < num_sets; i++) {
+    auto right = GetValueNode(driver, i);
+    switch (i % 3) {
+      case 1:
+        query = std::make_unique<UnionNode>(std::move(query), std::move(right));
+        break;
+      case 2:
+        query = std::make_unique<IntersectionNode>(std::move(query),
+                                                   std::move(right));
+        break;
+      default:
+        query = std::make_unique<DifferenceNode>(std::move(query),
+                                                 std::move(right));
+    }
+  }
+  return query;
+}
+
+std::unique_ptr<Node> GetEvalQuery(const Driver& driver, int64_t num_sets,
+                                   std::string_view shape) {
+  if (shape == "deep") {
+    return GetDeepQuery(driver, num_sets);
+  }
+  return GetBalancedQuery(driver, 0, num_sets - 1,
+                          /*alternate_ops=*/shape != "wide");
+}
+
+struct BenchmarkArgs {
+  int64_t query_terms = 1;
+  int64_t key_size = 1;
+  int64_t eval_terms = 1;
+  int64_t set_size = 1;
+  int64_t overlap = 0;
+  std::string query_shape;
+  int64_t min_parallel_work = 0;
+  bool parallel = false;
+};
+
+void BM_BisonParse(::benchmark::State& state, BenchmarkArgs args) {
+  const std::string query = GetQuery(args.query_terms, args.key_size);
+  for (auto _ : state) {
+    Driver driver(NoOpLookup);
+    std::istringstream stream(query);
+    Scanner scanner(stream);
+    Parser parse(driver, scanner);
+    ::benchmark::DoNotOptimize(parse());
+  }
+  state.counters[std::string(kQueriesPerSec)] =
+      ::benchmark::Counter(state.iterations(), ::benchmark::Counter::kIsRate);
+  state.counters[std::string(kBytesPerSec)] = ::benchmark::Counter(
+      state.iterations() * query.size(), ::benchmark::Counter::kIsRate);
+}
+
+void BM_FastParse(::benchmark::State& state, BenchmarkArgs args) {
+  const std::string query = GetQuery(args.query_terms, args.key_size);
+  for (auto _ : state) {
+    Driver driver(NoOpLookup);
+    FastParser parse(driver, query);
+    ::benchmark::DoNotOptimize(parse());
+  }
+  state.counters[std::string(kQueriesPerSec)] =
+      ::benchmark::Counter(state.iterations(), ::benchmark::Counter::kIsRate);
+  state.counters[std::string(kBytesPerSec)] = ::benchmark::Counter(
+      state.iterations() * query.size(), ::benchmark::Counter::kIsRate);
+}
+
+void BM_Plan(::benchmark::State& state, BenchmarkArgs args) {
+  Driver driver(NoOpLookup);
+  driver.SetAst(GetEvalQuery(driver, args.eval_terms, args.query_shape));
+  std::vector<size_t> uses;
+  for (auto _ : state) {
+    ::benchmark::DoNotOptimize(BuildPlan(*driver.GetRootNode(), uses));
+  }
+  state.counters[std::string(kQueriesPerSec)] =
+      ::benchmark::Counter(state.iterations(), ::benchmark::Counter::kIsRate);
+}
+
+void BM_Eval(::benchmark::State& state, BenchmarkArgs args) {
+  const auto sets = GetSets(args.eval_terms, args.set_size, args.overlap);
+  // The driver borrows the looked up sets, like it does from the cache.
+  absl::flat_hash_map<std::string, absl::flat_hash_set<std::string_view>>
+      set_views;
+  for (const auto& [key, set] : sets) {
+    set_views.emplace(key, absl::flat_hash_set<std::string_view>(set.begin(),
+                                                                  set.end()));
+  }
+  Driver driver([&set_views](std::string_view key)
+                    -> const absl::flat_hash_set<std::string_view>& {
+    return set_views.find(key)->second;
+  });
+  driver.SetAst(GetEvalQuery(driver, args.eval_terms, args.query_shape));
+  auto schedule = [](absl::AnyInvocable<void()> task) {
+    GetWorkerPool().Schedule(std::move(task));
+  };
+  for (auto _ : state) {
+    if (args.parallel) {
+      ::benchmark::DoNotOptimize(
+          driver.GetResultParallel(schedule, args.min_parallel_work));
+    } else {
+      ::benchmark::DoNotOptimize(driver.GetResult());
+    }
+  }
+  state.counters[std::string(kQueriesPerSec)] =
+      ::benchmark::Counter(state.iterations(), ::benchmark::Counter::kIsRate);
+  state.counters[std::string(kElementsPerSec)] = ::benchmark::Counter(
+      state.iterations() * args.eval_terms * args.set_size,
+      ::benchmark::Counter::kIsRate);
+}
+
+using KVSet = absl::flat_hash_set<std::string_view>;
+
+// Benchmarks a set kernel of `sets.h` that consumes its operands. Copying the
+// operands is excluded from the measurement.
+void BM_SetOp(::benchmark::State& state, BenchmarkArgs args,
+              KVSet (*op)(KVSet&&, KVSet&&)) {
+  const auto sets = GetSets(2, args.set_size, args.overlap);
+  const auto& left_values = sets.at("set0");
+  const auto& right_values = sets.at("set1");
+  const KVSet left(left_values.begin(), left_values.end());
+  const KVSet right(right_values.begin(), right_values.end());
+  for (auto _ : state) {
+    state.PauseTiming();
+    KVSet left_copy = left;
+    KVSet right_copy = right;
+    state.ResumeTiming();
+    ::benchmark::DoNotOptimize(op(std::move(left_copy), std::move(right_copy)));
+  }
+  state.counters[std::string(kElementsPerSec)] = ::benchmark::Counter(
+      state.iterations() * 2 * args.set_size, ::benchmark::Counter::kIsRate);
+}
+
+// Benchmarks a set kernel of `sets.h` that only reads its operands.
+template <typename Result>
+void BM_SetViewOp(::benchmark::State& state, BenchmarkArgs args,
+                  Result (*op)(const KVSet&, const KVSet&)) {
+  const auto sets = GetSets(2, args.set_size, args.overlap);
+  const auto& left_values = sets.at("set0");
+  const auto& right_values = sets.at("set1");
+  const KVSet left(left_values.begin(), left_values.end());
+  const KVSet right(right_values.begin(), right_values.end());
+  for (auto _ : state) {
+    ::benchmark::DoNotOptimize(op(left, right));
+  }
+  state.counters[std::string(kElementsPerSec)] = ::benchmark::Counter(
+      state.iterations() * 2 * args.set_size, ::benchmark::Counter::kIsRate);
+}
+
+// Registers a function to benchmark.
+void RegisterBenchmark(
+    std::string name, BenchmarkArgs args,
+    std::function<void(::benchmark::State&, BenchmarkArgs)> benchmark) {
+  auto b =
+      ::benchmark::RegisterBenchmark(name.c_str(), benchmark, std::move(args));
+  if (absl::GetFlag(FLAGS_iterations) > 0) {
+    b->Iterations(absl::GetFlag(FLAGS_iterations));
+  }
+}
+
+void RegisterParseBenchmarks() {
+  auto query_terms = ParseInt64List(absl::GetFlag(FLAGS_query_terms));
+  auto key_sizes = ParseInt64List(absl::GetFlag(FLAGS_key_size));
+  for (auto num_terms : query_terms.value()) {
+    for (auto key_size : key_sizes.value()) {
+      auto args = BenchmarkArgs{
+          .query_terms = num_terms,
+          .key_size = key_size,
+      };
+      ::kv_server::RegisterBenchmark(
+          absl::StrFormat(kBisonParseFmt, num_terms, key_size), args,
+          BM_BisonParse);
+      ::kv_server::RegisterBenchmark(
+          absl::StrFormat(kFastParseFmt, num_terms, key_size), args,
+          BM_FastParse);
+    }
+  }
+}
+
+void RegisterEvalBenchmarks() {
+  auto eval_terms = ParseInt64List(absl::GetFlag(FLAGS_eval_terms));
+  auto set_sizes = ParseInt64List(absl::GetFlag(FLAGS_set_size));
+  auto overlaps = ParseInt64List(absl::GetFlag(FLAGS_overlap));
+  auto min_parallel_works =
+      ParseInt64List(absl::GetFlag(FLAGS_min_parallel_work));
+  const auto query_shapes = absl::GetFlag(FLAGS_query_shape);
+  for (auto num_terms : eval_terms.value()) {
+    for (const auto& shape : query_shapes) {
+      auto args = BenchmarkArgs{
+          .eval_terms = num_terms,
+          .query_shape = shape,
+      };
+      ::kv_server::RegisterBenchmark(
+          absl::StrFormat(kPlanFmt, num_terms, shape), args, BM_Plan);
+      for (auto set_size : set_sizes.value()) {
+        args.set_size = set_size;
+        for (auto overlap : overlaps.value()) {
+          args.overlap = overlap;
+          args.parallel = false;
+          ::kv_server::RegisterBenchmark(
+              absl::StrFormat(kEvalFmt, num_terms, set_size, overlap, shape),
+              args, BM_Eval);
+          args.parallel = true;
+          for (auto min_parallel_work : min_parallel_works.value()) {
+            args.min_parallel_work = min_parallel_work;
+            ::kv_server::RegisterBenchmark(
+                absl::StrFormat(kParallelEvalFmt, num_terms, set_size, overlap,
+                                shape, min_parallel_work),
+                args, BM_Eval);
+          }
+        }
+      }
+    }
+  }
+}
+
+void RegisterSetOpBenchmarks() {
+  auto set_sizes = ParseInt64List(absl::GetFlag(FLAGS_set_size));
+  auto overlaps = ParseInt64List(absl::GetFlag(FLAGS_overlap));
+  for (auto set_size : set_sizes.value()) {
+    for (auto overlap : overlaps.value()) {
+      auto args = BenchmarkArgs{
+          .set_size = set_size,
+          .overlap = overlap,
+      };
+      auto register_op = [&](std::string_view name, auto benchmark) {
+        ::kv_server::RegisterBenchmark(
+            absl::StrFormat(kSetOpFmt, name, set_size, overlap), args,
+            benchmark);
+      };
+      register_op("Union", [](::benchmark::State& state, BenchmarkArgs args) {
+        BM_SetOp(state, std::move(args), Union<std::string_view>);
+      });
+      register_op(
+          "Intersection", [](::benchmark::State& state, BenchmarkArgs args) {
+            BM_SetOp(state, std::move(args), Intersection<std::string_view>);
+          });
+      register_op("Difference",
+                  [](::benchmark::State& state, BenchmarkArgs args) {
+                    BM_SetOp(state, std::move(args),
+                             Difference<std::string_view>);
+                  });
+      register_op("UnionView",
+                  [](::benchmark::State& state, BenchmarkArgs args) {
+                    BM_SetViewOp(state, std::move(args),
+                                 UnionView<std::string_view>);
+                  });
+      register_op("IntersectionView",
+                  [](::benchmark::State& state, BenchmarkArgs args) {
+                    BM_SetViewOp(state, std::move(args),
+                                 IntersectionView<std::string_view>);
+                  });
+      register_op("DifferenceView",
+                  [](::benchmark::State& state, BenchmarkArgs args) {
+                    BM_SetViewOp(state, std::move(args),
+                                 DifferenceView<std::string_view>);
+                  });
+      register_op("IntersectionCount",
+                  [](::benchmark::State& state, BenchmarkArgs args) {
+                    BM_SetViewOp(state, std::move(args),
+                                 IntersectionCount<std::string_view>);
+                  });
+    }
+  }
+}
+
+}  // namespace
+}  // namespace kv_server
+
+// Microbenchmarks for query parsing, planning and evaluation, and for the set
+// kernels of `sets.h` on their own. The crossover of sequential and parallel
+// evaluation shows as the smallest set size at which BM_ParallelEval beats
+// BM_Eval. Use --benchmark_filter to run a subset, e.g. "BM_.*View" for the
+// set kernels. Sample run:
+//
+//  GLOG_logtostderr=1 bazel run -c opt \
+//    //components/tools/benchmarks:query_benchmark \
+//    --//:instance=local \
+//    --//:platform=local -- \
+//    --benchmark_counters_tabular=true
+int main(int argc, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  ::benchmark::Initialize(&argc, argv);
+  absl::ParseCommandLine(argc, argv);
+  ::kv_server::RegisterParseBenchmarks();
+  ::kv_server::RegisterEvalBenchmarks();
+  ::kv_server::RegisterSetOpBenchmarks();
+  ::benchmark::RunSpecifiedBenchmarks();
+  ::benchmark::Shutdown();
+  return 0;
+}
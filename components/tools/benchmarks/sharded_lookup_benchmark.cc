@@ -0,0 +1,285 @@
+/*
+ * Copyright 2023 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_set.h"
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/functional/any_invocable.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_format.h"
+#include "absl/time/time.h"
+#include "benchmark/benchmark.h"
+#include "components/data_server/cache/noop_key_value_cache.h"
+#include "components/internal_server/local_lookup.h"
+#include "components/internal_server/lookup.h"
+#include "components/internal_server/near_cache.h"
+#include "components/internal_server/remote_lookup_client.h"
+#include "components/internal_server/sharded_lookup.h"
+#include "components/sharding/shard_manager.h"
+#include "components/tools/benchmarks/benchmark_util.h"
+#include "glog/logging.h"
+#include "src/cpp/telemetry/metrics_recorder.h"
+#include "src/cpp/telemetry/telemetry_provider.h"
+
+ABSL_FLAG(std::vector<std::string>, num_shards, std::vector<std::string>({"4"}),
+          "Number of shards that the keys are spread over.");
+ABSL_FLAG(std::vector<std::string>, query_size, std::vector<std::string>({"1"}),
+          "Number of keys that we want to look up in each iteration.");
+ABSL_FLAG(std::vector<std::string>, keyspace_size,
+          std::vector<std::string>({"1000"}),
+          "Size of the keyspace that we want to select keys to look up from.");
+ABSL_FLAG(std::vector<std::string>, near_cache_capacity,
+          std::vector<std::string>({"0", "100", "1000"}),
+          "Capacities of the near cache. 0 means no near cache.");
+ABSL_FLAG(absl::Duration, near_cache_ttl, absl::Minutes(1),
+          "How long the near cache keeps the results of remote shards.");
+ABSL_FLAG(int64_t, iterations, -1,
+          "Number of iterations to run each benchmark.");
+
+namespace kv_server {
+namespace {
+
+using kv_server::benchmark::ParseInt64List;
+using privacy_sandbox::server_common::MetricsRecorder;
+using privacy_sandbox::server_common::TelemetryProvider;
+
+// Format variables used to generate benchmark names.
+//
+// => ns - number of shards.
+// => qz - query size, i.e., number of keys looked up in each iteration.
+// => ksz - keyspace size, i.e., number of keys that are looked up.
+// => ncc - near cache capacity, 0 if there's no near cache.
+constexpr std::string_view kShardedLookupGetKeyValuesFmt =
+    "BM_ShardedLookup_GetKeyValues/ns:%d/qz:%d/ksz:%d/ncc:%d";
+constexpr std::string_view kShardedLookupGetKeyValueSetFmt =
+    "BM_ShardedLookup_GetKeyValueSet/ns:%d/qz:%d/ksz:%d/ncc:%d";
+
+constexpr std::string_view kReadsPerSec = "Reads/s";
+constexpr std::string_view kRemoteCallsPerRead = "RemoteCalls/read";
+
+// Answers every request right away, with a value or set for each key, and
+// counts the requests, so that only the remote calls are measured rather than
+// the network.
+class CountingRemoteLookupClient : public RemoteLookupClient {
+ public:
+  explicit CountingRemoteLookupClient(std::string ip_address)
+      : ip_address_(std::move(ip_address)) {}
+
+  absl::StatusOr<InternalLookupResponse> GetValues(
+      std::string_view serialized_message,
+      int32_t padding_length) const override {
+    GetRemoteCalls()++;
+    InternalLookupRequest request;
+    if (!request.ParseFromString(std::string(serialized_message))) {
+      return absl::InvalidArgumentError("Failed parsing the request.");
+    }
+    InternalLookupResponse response;
+    for (const auto& key : request.keys()) {
+      auto& result = (*response.mutable_kv_pairs())[key];
+      if (request.lookup_sets()) {
+        result.mutable_keyset_values()->add_values(key);
+      } else {
+        result.set_value(key);
+      }
+    }
+    return response;
+  }
+
+  absl::AnyInvocable<void()> GetValuesAsync(
+      std::string_view serialized_message, int32_t padding_length,
+      absl::AnyInvocable<void(absl::StatusOr<InternalLookupResponse>) &&>
+          callback) const override {
+    std::move(callback)(GetValues(serialized_message, padding_length));
+    return []() {};
+  }
+
+  std::string_view GetIpAddress() const override { return ip_address_; }
+
+  static std::atomic<int64_t>& GetRemoteCalls() {
+    static auto* const remote_calls = new std::atomic<int64_t>(0);
+    return *remote_calls;
+  }
+
+ private:
+  const std::string ip_address_;
+};
+
+class FirstReplicaGenerator : public RandomGenerator {
+ public:
+  int64_t Get(int64_t upper_bound) override { return 0; }
+};
+
+struct BenchmarkArgs {
+  int64_t num_shards = 1;
+  int64_t query_size = 1;
+  int64_t keyspace_size = 1;
+  int64_t near_cache_capacity = 0;
+  MetricsRecorder* metrics_recorder = nullptr;
+};
+
+// Owns a sharded lookup over counting remote shards, and the near cache it
+// uses, if any. The local shard is empty.
+class ShardedLookupFixture {
+ public:
+  explicit ShardedLookupFixture(const BenchmarkArgs& args)
+      : cache_(NoOpKeyValueCache::Create()),
+        local_lookup_(CreateLocalLookup(*cache_, *args.metrics_recorder)) {
+    std::vector<absl::flat_hash_set<std::string>> cluster_mappings;
+    for (int64_t shard_num = 0; shard_num < args.num_shards; shard_num++) {
+      cluster_mappings.push_back({std::to_string(shard_num)});
+    }
+    shard_manager_ = std::move(
+        ShardManager::Create(args.num_shards, cluster_mappings,
+                             std::make_unique<FirstReplicaGenerator>(),
+                             [](const std::string& ip) {
+                               return std::make_unique<
+                                   CountingRemoteLookupClient>(ip);
+                             })
+            .value());
+    if (args.near_cache_capacity > 0) {
+      near_cache_ = std::make_unique<NearCache>(
+          args.near_cache_capacity, absl::GetFlag(FLAGS_near_cache_ttl));
+    }
+    lookup_ = CreateShardedLookup(*local_lookup_, args.num_shards,
+                                  /*current_shard_num=*/0, *shard_manager_,
+                                  *args.metrics_recorder, near_cache_.get());
+  }
+
+  const Lookup& lookup() const { return *lookup_; }
+
+ private:
+  std::unique_ptr<Cache> cache_;
+  std::unique_ptr<Lookup> local_lookup_;
+  std::unique_ptr<ShardManager> shard_manager_;
+  std::unique_ptr<NearCache> near_cache_;
+  std::unique_ptr<Lookup> lookup_;
+};
+
+// Looks up `query_size` random keys of the keyspace in each iteration with
+// `lookup_fn`, and records how many remote calls were made for each read.
+void BM_ShardedLookup(
+    ::benchmark::State& state, BenchmarkArgs args,
+    std::function<void(const Lookup&,
+                       const absl::flat_hash_set<std::string_view>&)>
+        lookup_fn) {
+  ShardedLookupFixture fixture(args);
+  uint seed = args.query_size;
+  std::vector<std::string> keys(args.query_size);
+  absl::flat_hash_set<std::string_view> keys_view;
+  auto& remote_calls = CountingRemoteLookupClient::GetRemoteCalls();
+  const int64_t remote_calls_before = remote_calls;
+  for (auto _ : state) {
+    keys_view.clear();
+    for (auto& key : keys) {
+      key = std::to_string(rand_r(&seed) % args.keyspace_size);
+      keys_view.insert(key);
+    }
+    lookup_fn(fixture.lookup(), keys_view);
+  }
+  state.counters[std::string(kRemoteCallsPerRead)] =
+      ::benchmark::Counter(remote_calls - remote_calls_before,
+                           ::benchmark::Counter::kAvgIterations);
+  state.counters[std::string(kReadsPerSec)] =
+      ::benchmark::Counter(state.iterations(), ::benchmark::Counter::kIsRate);
+}
+
+void BM_GetKeyValues(::benchmark::State& state, BenchmarkArgs args) {
+  BM_ShardedLookup(state, args,
+                   [](const Lookup& lookup,
+                      const absl::flat_hash_set<std::string_view>& keys) {
+                     ::benchmark::DoNotOptimize(lookup.GetKeyValues(keys));
+                   });
+}
+
+void BM_GetKeyValueSet(::benchmark::State& state, BenchmarkArgs args) {
+  BM_ShardedLookup(state, args,
+                   [](const Lookup& lookup,
+                      const absl::flat_hash_set<std::string_view>& keys) {
+                     ::benchmark::DoNotOptimize(lookup.GetKeyValueSet(keys));
+                   });
+}
+
+// Registers a function to benchmark.
+void RegisterBenchmark(
+    std::string name, BenchmarkArgs args,
+    std::function<void(::benchmark::State&, BenchmarkArgs)> benchmark) {
+  auto b =
+      ::benchmark::RegisterBenchmark(name.c_str(), benchmark, std::move(args));
+  if (absl::GetFlag(FLAGS_iterations) > 0) {
+    b->Iterations(absl::GetFlag(FLAGS_iterations));
+  }
+}
+
+void RegisterBenchmarks(MetricsRecorder& metrics_recorder) {
+  auto num_shards_list = ParseInt64List(absl::GetFlag(FLAGS_num_shards));
+  auto query_sizes = ParseInt64List(absl::GetFlag(FLAGS_query_size));
+  auto keyspace_sizes = ParseInt64List(absl::GetFlag(FLAGS_keyspace_size));
+  auto near_cache_capacities =
+      ParseInt64List(absl::GetFlag(FLAGS_near_cache_capacity));
+  for (auto num_shards : num_shards_list.value()) {
+    for (auto query_size : query_sizes.value()) {
+      for (auto keyspace_size : keyspace_sizes.value()) {
+        for (auto capacity : near_cache_capacities.value()) {
+          auto args = BenchmarkArgs{
+              .num_shards = num_shards,
+              .query_size = query_size,
+              .keyspace_size = keyspace_size,
+              .near_cache_capacity = capacity,
+              .metrics_recorder = &metrics_recorder,
+          };
+          ::kv_server::RegisterBenchmark(
+              absl::StrFormat(kShardedLookupGetKeyValuesFmt, num_shards,
+                              query_size, keyspace_size, capacity),
+              args, BM_GetKeyValues);
+          ::kv_server::RegisterBenchmark(
+              absl::StrFormat(kShardedLookupGetKeyValueSetFmt, num_shards,
+                              query_size, keyspace_size, capacity),
+              args, BM_GetKeyValueSet);
+        }
+      }
+    }
+  }
+}
+
+}  // namespace
+}  // namespace kv_server
+
+// Measures how many remote calls ShardedLookup makes for each read, with and
+// without a near cache, over shards that answer right away. Sample run:
+//
+//  GLOG_logtostderr=1 bazel run -c opt \
+//    //components/tools/benchmarks:sharded_lookup_benchmark \
+//    --//:instance=local \
+//    --//:platform=local -- \
+//    --benchmark_counters_tabular=true --keyspace_size=1000,100000
+int main(int argc, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  ::benchmark::Initialize(&argc, argv);
+  absl::ParseCommandLine(argc, argv);
+  auto noop_metrics_recorder =
+      ::kv_server::TelemetryProvider::GetInstance().CreateMetricsRecorder();
+  ::kv_server::RegisterBenchmarks(*noop_metrics_recorder);
+  ::benchmark::RunSpecifiedBenchmarks();
+  ::benchmark::Shutdown();
+  return 0;
+}
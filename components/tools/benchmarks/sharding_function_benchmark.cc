@@ -0,0 +1,128 @@
+/*
+ * Copyright 2023 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/strings/str_format.h"
+#include "benchmark/benchmark.h"
+#include "components/tools/benchmarks/benchmark_util.h"
+#include "glog/logging.h"
+#include "public/sharding/sharding_function.h"
+
+ABSL_FLAG(std::vector<std::string>, key_size,
+          std::vector<std::string>({"16", "64", "256"}),
+          "Sizes of the keys that are assigned to shards.");
+ABSL_FLAG(std::vector<std::string>, num_shards, std::vector<std::string>({"4"}),
+          "Number of shards that the keys are assigned to.");
+ABSL_FLAG(int64_t, num_keys, 1000,
+          "Number of distinct keys that are assigned in turn.");
+ABSL_FLAG(int64_t, iterations, -1,
+          "Number of iterations to run each benchmark.");
+
+namespace kv_server {
+namespace {
+
+using kv_server::benchmark::GenerateRandomString;
+using kv_server::benchmark::ParseInt64List;
+
+// Format variables used to generate benchmark names.
+//
+// => kz - key size, i.e., byte size of each key.
+// => ns - number of shards.
+constexpr std::string_view kSha256GetShardNumForKeyFmt =
+    "BM_Sha256_GetShardNumForKey/kz:%d/ns:%d";
+constexpr std::string_view kSipHashGetShardNumForKeyFmt =
+    "BM_SipHash_GetShardNumForKey/kz:%d/ns:%d";
+
+constexpr std::string_view kKeysPerSec = "Keys/s";
+
+struct BenchmarkArgs {
+  int64_t key_size = 1;
+  int64_t num_shards = 1;
+  ShardingFunction::Version version = ShardingFunction::Version::kSha256;
+};
+
+void BM_GetShardNumForKey(::benchmark::State& state, BenchmarkArgs args) {
+  const ShardingFunction sharding_function(/*seed=*/"", args.version);
+  std::vector<std::string> keys;
+  keys.reserve(absl::GetFlag(FLAGS_num_keys));
+  for (int64_t i = 0; i < absl::GetFlag(FLAGS_num_keys); i++) {
+    keys.push_back(GenerateRandomString(args.key_size));
+  }
+  size_t key_index = 0;
+  for (auto _ : state) {
+    ::benchmark::DoNotOptimize(
+        sharding_function.GetShardNumForKey(keys[key_index], args.num_shards));
+    if (++key_index == keys.size()) {
+      key_index = 0;
+    }
+  }
+  state.counters[std::string(kKeysPerSec)] =
+      ::benchmark::Counter(state.iterations(), ::benchmark::Counter::kIsRate);
+}
+
+void RegisterBenchmark(std::string name, BenchmarkArgs args) {
+  auto b = ::benchmark::RegisterBenchmark(name.c_str(), BM_GetShardNumForKey,
+                                          std::move(args));
+  if (absl::GetFlag(FLAGS_iterations) > 0) {
+    b->Iterations(absl::GetFlag(FLAGS_iterations));
+  }
+}
+
+void RegisterBenchmarks() {
+  auto key_sizes = ParseInt64List(absl::GetFlag(FLAGS_key_size));
+  auto num_shards_list = ParseInt64List(absl::GetFlag(FLAGS_num_shards));
+  for (auto key_size : key_sizes.value()) {
+    for (auto num_shards : num_shards_list.value()) {
+      auto args = BenchmarkArgs{
+          .key_size = key_size,
+          .num_shards = num_shards,
+          .version = ShardingFunction::Version::kSha256,
+      };
+      ::kv_server::RegisterBenchmark(
+          absl::StrFormat(kSha256GetShardNumForKeyFmt, key_size, num_shards),
+          args);
+      args.version = ShardingFunction::Version::kSipHash;
+      ::kv_server::RegisterBenchmark(
+          absl::StrFormat(kSipHashGetShardNumForKeyFmt, key_size, num_shards),
+          args);
+    }
+  }
+}
+
+}  // namespace
+}  // namespace kv_server
+
+// Measures the per key cost of each version of the sharding function. Sample
+// run:
+//
+//  GLOG_logtostderr=1 bazel run -c opt \
+//    //components/tools/benchmarks:sharding_function_benchmark \
+//    --//:instance=local \
+//    --//:platform=local -- \
+//    --benchmark_counters_tabular=true
+int main(int argc, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  ::benchmark::Initialize(&argc, argv);
+  absl::ParseCommandLine(argc, argv);
+  ::kv_server::RegisterBenchmarks();
+  ::benchmark::RunSpecifiedBenchmarks();
+  ::benchmark::Shutdown();
+  return 0;
+}
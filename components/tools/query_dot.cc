@@ -93,5 +93,32 @@ void QueryDotWriter::WriteAst(std::string_view query, const Node& node) {
                         "\n}\n");
 }
 
+void QueryDotWriter::WritePlanStats(std::string_view query,
+                                    absl::Span<const PlanStepStats> stats) {
+  ASTNameVisitor name_visitor;
+  std::string body;
+  for (size_t i = 0; i < stats.size(); i++) {
+    const PlanStepStats& step_stats = stats[i];
+    const Node& node = *step_stats.step.node;
+    std::string label = node.Accept(name_visitor);
+    if (step_stats.step.left == PlanStep::kNoOperand) {
+      absl::StrAppend(&label, " ", ToString(node.Keys()), "\\n");
+    } else {
+      absl::StrAppend(&label, "\\n", step_stats.left_size, ", ",
+                      step_stats.right_size, " -> ");
+    }
+    absl::StrAppend(&label, step_stats.output_size, " in ",
+                    absl::FormatDuration(step_stats.duration));
+    absl::StrAppend(&body, "Step", i, " [label=\"", label, "\"]\n");
+    if (step_stats.step.left != PlanStep::kNoOperand) {
+      absl::StrAppend(&body, "Step", i, " -> Step", step_stats.step.left,
+                      "\nStep", i, " -> Step", step_stats.step.right, "\n");
+    }
+  }
+  const std::string title = absl::StrCat(
+      "labelloc=\"t\"\nlabel=\"Plan for Query: ", query, "\"\n");
+  file_ << absl::StrCat("digraph {\n", title, body, "\n}\n");
+}
+
 void QueryDotWriter::Flush() { file_.flush(); }
 }  // namespace kv_server::query_toy
@@ -24,6 +24,7 @@
 #include <vector>
 
 #include "absl/strings/str_join.h"
+#include "absl/types/span.h"
 #include "components/query/ast.h"
 
 namespace kv_server::query_toy {
@@ -33,6 +34,10 @@ class QueryDotWriter {
   ~QueryDotWriter() { file_.close(); }
   // Outputs the dot representation of the AST node to the output path.
   void WriteAst(const std::string_view query, const Node& node);
+  // Outputs the dot representation of the evaluation plan of the query,
+  // each step labeled with its statistics from `EvalWithStats`.
+  void WritePlanStats(std::string_view query,
+                      absl::Span<const PlanStepStats> stats);
   void Flush();
 
  private:
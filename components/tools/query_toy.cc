@@ -17,13 +17,21 @@
 // results in: [a,b,c,d]
 // Alternatively you can run in interactive, allowing to query multiple times.
 // bazel run components/tools:query_toy
+// With --analyze, the time spent parsing and in each step of the evaluation is
+// output instead, ex: --query="A UNION B" --analyze results in:
+// Parse: 12us
+// #0 A: 3 in 1.5us
+// #1 B: 3 in 1us
+// #2 #0 | #1: 3, 3 -> 4 in 2us
 
 #include <signal.h>
 
 #include <iostream>
-#include <sstream>
+#include <optional>
 #include <string>
 #include <string_view>
+#include <utility>
+#include <vector>
 
 #include "absl/container/flat_hash_map.h"
 #include "absl/container/flat_hash_set.h"
@@ -31,8 +39,11 @@
 #include "absl/flags/parse.h"
 #include "absl/flags/usage.h"
 #include "absl/strings/str_join.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "components/query/ast.h"
 #include "components/query/driver.h"
-#include "components/query/scanner.h"
+#include "components/query/parse_query.h"
 #include "components/tools/query_dot.h"
 
 ABSL_FLAG(std::string, query, "",
@@ -47,6 +58,12 @@ ABSL_FLAG(
     "Output is written to the provided, which can then be visualized.  See "
     "https://graphviz.org/ for details.");
 
+ABSL_FLAG(bool, analyze, false,
+          "When set outputs how long parsing and each step of the "
+          "evaluation took, and the sizes of the sets they consumed and "
+          "produced, instead of the result. With --dot_path, outputs the "
+          "evaluation plan labeled with the same statistics.");
+
 absl::flat_hash_map<std::string, absl::flat_hash_set<std::string>> kDb = {
     {"A", {"a", "b", "c"}},
     {"B", {"b", "c", "d"}},
@@ -88,10 +105,7 @@ absl::flat_hash_set<std::string_view> ToView(
 
 absl::StatusOr<absl::flat_hash_set<std::string_view>> Parse(
     kv_server::Driver& driver, std::string query) {
-  std::istringstream stream(query);
-  kv_server::Scanner scanner(stream);
-  kv_server::Parser parse(driver, scanner);
-  int parse_result = parse();
+  int parse_result = kv_server::ParseQuery(driver, query);
   auto result = driver.GetResult();
   if (parse_result && result.ok()) {
     std::cerr << "Unexpected failed parse result with an OK query result.";
@@ -99,10 +113,19 @@ absl::StatusOr<absl::flat_hash_set<std::string_view>> Parse(
   return result;
 }
 
-absl::flat_hash_set<std::string_view> Lookup(std::string_view key) {
-  const auto& it = kDb.find(key);
-  if (it != kDb.end()) {
-    return ToView(it->second);
+const absl::flat_hash_set<std::string_view>& Lookup(std::string_view key) {
+  // Views of the sets of `kDb`, which the driver borrows.
+  static const auto* const kDbViews = [] {
+    auto* views = new absl::flat_hash_map<
+        std::string, absl::flat_hash_set<std::string_view>>();
+    for (const auto& [db_key, values] : kDb) {
+      views->emplace(db_key, ToView(values));
+    }
+    return views;
+  }();
+  const auto& it = kDbViews->find(key);
+  if (it != kDbViews->end()) {
+    return it->second;
   }
   return kEmptySet;
 }
@@ -116,6 +139,41 @@ void ProcessQuery(kv_server::Driver& driver, std::string query) {
   std::cout << kv_server::query_toy::ToString(result.value()) << std::endl;
 }
 
+// Outputs the statistics of parsing and evaluating the query, and writes the
+// annotated plan to `dot_writer` if set.
+void AnalyzeQuery(
+    kv_server::Driver& driver, std::string query,
+    std::optional<kv_server::query_toy::QueryDotWriter>& dot_writer) {
+  const absl::Time start = absl::Now();
+  kv_server::ParseQuery(driver, query);
+  const absl::Duration parse_duration = absl::Now() - start;
+  std::vector<kv_server::PlanStepStats> stats;
+  const auto result = driver.GetResultWithStats(stats);
+  if (!result.ok()) {
+    std::cout << result.status() << std::endl;
+    return;
+  }
+  std::cout << "Parse: " << absl::FormatDuration(parse_duration) << std::endl
+            << kv_server::PlanStatsToString(stats);
+  if (dot_writer) {
+    dot_writer->WritePlanStats(query, stats);
+    dot_writer->Flush();
+  }
+}
+
+void RunQuery(kv_server::Driver& driver, std::string query,
+              std::optional<kv_server::query_toy::QueryDotWriter>& dot_writer) {
+  if (absl::GetFlag(FLAGS_analyze)) {
+    AnalyzeQuery(driver, std::move(query), dot_writer);
+    return;
+  }
+  ProcessQuery(driver, query);
+  if (dot_writer && driver.GetRootNode()) {
+    dot_writer->WriteAst(query, *driver.GetRootNode());
+    dot_writer->Flush();
+  }
+}
+
 void PromptForQuery(
     kv_server::Driver& driver,
     std::optional<kv_server::query_toy::QueryDotWriter>& dot_writer) {
@@ -123,11 +181,7 @@ void PromptForQuery(
     std::cout << ">> ";
     std::string query;
     std::getline(std::cin, query);
-    ProcessQuery(driver, query);
-    if (dot_writer && driver.GetRootNode()) {
-      dot_writer->WriteAst(query, *driver.GetRootNode());
-      dot_writer->Flush();
-    }
+    RunQuery(driver, std::move(query), dot_writer);
   }
 }
 
@@ -146,10 +200,7 @@ int main(int argc, char* argv[]) {
           ? std::make_optional<kv_server::query_toy::QueryDotWriter>(*dot_path)
           : std::nullopt;
   if (!query.empty()) {
-    ProcessQuery(driver, query);
-    if (dot_writer && driver.GetRootNode()) {
-      dot_writer->WriteAst(query, *driver.GetRootNode());
-    }
+    RunQuery(driver, query, dot_writer);
     return 0;
   }
   signal(SIGINT, SignalHandler);
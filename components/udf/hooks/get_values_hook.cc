@@ -27,6 +27,7 @@
 #include "components/internal_server/local_lookup.h"
 #include "components/internal_server/lookup.pb.h"
 #include "glog/logging.h"
+#include "google/protobuf/arena.h"
 #include "google/protobuf/util/json_util.h"
 #include "nlohmann/json.hpp"
 #include "public/udf/binary_get_values.pb.h"
@@ -64,22 +65,29 @@ void SetStatusAsBytes(absl::StatusCode code, std::string_view message,
   SetBinaryGetValuesAsBytes(binary_response, io);
 }
 
-void SetOutputAsBytes(const InternalLookupResponse& response,
+// `response` is consumed, so that the values are moved rather than copied
+// into the binary response, which only lives until it is serialized.
+void SetOutputAsBytes(InternalLookupResponse& response,
                       FunctionBindingIoProto& io) {
-  BinaryGetValuesResponse binary_response;
-  for (auto&& [k, v] : response.kv_pairs()) {
-    Value value;
+  google::protobuf::Arena arena;
+  auto* binary_response =
+      google::protobuf::Arena::CreateMessage<BinaryGetValuesResponse>(&arena);
+  auto& binary_kv_pairs = *binary_response->mutable_kv_pairs();
+  for (auto& [k, v] : *response.mutable_kv_pairs()) {
+    Value& value = binary_kv_pairs[k];
     if (v.has_status()) {
-      *value.mutable_status() =
-          GetStatus(v.status().code(), v.status().message());
+      auto* status = value.mutable_status();
+      status->set_code(v.status().code());
+      status->set_message(v.status().message());
     }
     if (v.has_value()) {
-      value.set_data(v.value());
+      value.set_data(std::move(*v.mutable_value()));
     }
-    (*binary_response.mutable_kv_pairs())[k] = std::move(value);
   }
-  *binary_response.mutable_status() = GetStatus(0, kOkStatusMessage);
-  SetBinaryGetValuesAsBytes(binary_response, io);
+  auto* status = binary_response->mutable_status();
+  status->set_code(0);
+  status->set_message(kOkStatusMessage);
+  SetBinaryGetValuesAsBytes(*binary_response, io);
 }
 
 void SetStatusAsString(absl::StatusCode code, std::string_view message,
@@ -160,7 +168,7 @@ class GetValuesHookImpl : public GetValuesHook {
       return;
     }
 
-    SetOutput(response_or_status.value(), io);
+    SetOutput(*response_or_status, io);
     VLOG(9) << "getValues result: " << io.DebugString();
   }
 
@@ -174,8 +182,7 @@ class GetValuesHookImpl : public GetValuesHook {
     }
   }
 
-  void SetOutput(const InternalLookupResponse& response,
-                 FunctionBindingIoProto& io) {
+  void SetOutput(InternalLookupResponse& response, FunctionBindingIoProto& io) {
     if (output_type_ == OutputType::kString) {
       SetOutputAsString(response, io);
     } else {
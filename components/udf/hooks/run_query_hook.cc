@@ -14,14 +14,19 @@
 
 #include "components/udf/hooks/run_query_hook.h"
 
+#include <cstdint>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <tuple>
 #include <utility>
 #include <vector>
 
 #include "absl/functional/any_invocable.h"
+#include "absl/status/status.h"
 #include "absl/status/statusor.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
 #include "components/internal_server/lookup.h"
 #include "glog/logging.h"
 #include "nlohmann/json.hpp"
@@ -51,19 +56,31 @@ class RunQueryHookImpl : public RunQueryHook {
     }
 
     VLOG(9) << "runQuery request: " << io.DebugString();
-    if (!io.has_input_string()) {
+    absl::StatusOr<InternalRunQueryResponse> response_or_status;
+    if (io.has_input_string()) {
+      VLOG(9) << "Calling internal run query client";
+      response_or_status = lookup_->RunQuery(io.input_string());
+    } else if (io.has_input_map_of_string()) {
+      auto request = ToRunQueryRequest(io.input_map_of_string().data());
+      if (!request.ok()) {
+        nlohmann::json status;
+        status["code"] = request.status().code();
+        status["message"] = request.status().message();
+        io.mutable_output_list_of_string()->add_data(status.dump());
+        VLOG(1) << "runQuery result: " << io.DebugString();
+        return;
+      }
+      VLOG(9) << "Calling internal run query client with options";
+      response_or_status = lookup_->ExecuteQuery(*request);
+    } else {
       nlohmann::json status;
       status["code"] = absl::StatusCode::kInvalidArgument;
-      status["message"] = "runQuery input must be a string";
+      status["message"] = "runQuery input must be a string or a map of options";
       io.mutable_output_list_of_string()->add_data(status.dump());
       VLOG(1) << "runQuery result: " << io.DebugString();
       return;
     }
 
-    VLOG(9) << "Calling internal run query client";
-    absl::StatusOr<InternalRunQueryResponse> response_or_status =
-        lookup_->RunQuery(io.input_string());
-
     if (!response_or_status.ok()) {
       LOG(ERROR) << "Internal run query returned error: "
                  << response_or_status.status();
@@ -78,7 +95,211 @@ class RunQueryHookImpl : public RunQueryHook {
     VLOG(9) << "runQuery result: " << io.DebugString();
   }
 
+  void Count(FunctionBindingIoProto& io) {
+    if (!CheckInitialized("runQueryCount", io)) {
+      return;
+    }
+    VLOG(9) << "runQueryCount request: " << io.DebugString();
+    if (!io.has_input_string()) {
+      SetStatus(
+          absl::InvalidArgumentError("runQueryCount input must be a string"),
+          io);
+      return;
+    }
+    InternalRunQueryRequest request;
+    request.set_query(io.input_string());
+    request.set_result_mode(RunQueryResultMode::COUNT);
+    const auto response_or_status = lookup_->ExecuteQuery(request);
+    if (!response_or_status.ok()) {
+      LOG(ERROR) << "Internal run query count returned error: "
+                 << response_or_status.status();
+      SetStatus(response_or_status.status(), io);
+      return;
+    }
+    nlohmann::json result;
+    result["count"] = response_or_status->count();
+    io.set_output_string(result.dump());
+    VLOG(9) << "runQueryCount result: " << io.DebugString();
+  }
+
+  void Contains(FunctionBindingIoProto& io) {
+    if (!CheckInitialized("runQueryContains", io)) {
+      return;
+    }
+    VLOG(9) << "runQueryContains request: " << io.DebugString();
+    if (!io.has_input_list_of_string() ||
+        io.input_list_of_string().data().empty()) {
+      SetStatus(absl::InvalidArgumentError(
+                    "runQueryContains input must be a list of strings "
+                    "starting with the query"),
+                io);
+      return;
+    }
+    const auto& input = io.input_list_of_string().data();
+    InternalRunQueryRequest request;
+    request.set_query(input[0]);
+    request.set_result_mode(RunQueryResultMode::MEMBERSHIP);
+    request.mutable_candidates()->Assign(input.begin() + 1, input.end());
+    const auto response_or_status = lookup_->ExecuteQuery(request);
+    if (!response_or_status.ok()) {
+      LOG(ERROR) << "Internal run query membership returned error: "
+                 << response_or_status.status();
+      SetStatus(response_or_status.status(), io);
+      return;
+    }
+    nlohmann::json result = nlohmann::json::array();
+    for (bool is_member : response_or_status->is_member()) {
+      result.push_back(is_member);
+    }
+    io.set_output_string(result.dump());
+    VLOG(9) << "runQueryContains result: " << io.DebugString();
+  }
+
+  void SetContains(FunctionBindingIoProto& io) {
+    if (!CheckInitialized("setContains", io)) {
+      return;
+    }
+    VLOG(9) << "setContains request: " << io.DebugString();
+    if (!io.has_input_list_of_string() ||
+        io.input_list_of_string().data().empty()) {
+      SetStatus(absl::InvalidArgumentError(
+                    "setContains input must be a list of strings starting "
+                    "with the set key"),
+                io);
+      return;
+    }
+    const auto& input = io.input_list_of_string().data();
+    const std::vector<std::string_view> candidates(input.begin() + 1,
+                                                   input.end());
+    const auto response_or_status =
+        lookup_->GetKeyValueSetMembership(input[0], candidates);
+    if (!response_or_status.ok()) {
+      LOG(ERROR) << "Internal set membership lookup returned error: "
+                 << response_or_status.status();
+      SetStatus(response_or_status.status(), io);
+      return;
+    }
+    const auto result = response_or_status->kv_pairs().find(input[0]);
+    if (result == response_or_status->kv_pairs().end() ||
+        !result->second.has_keyset_membership()) {
+      SetStatus(absl::InternalError("Set membership lookup failed"), io);
+      return;
+    }
+    nlohmann::json output = nlohmann::json::array();
+    for (bool is_member : result->second.keyset_membership().is_member()) {
+      output.push_back(is_member);
+    }
+    io.set_output_string(output.dump());
+    VLOG(9) << "setContains result: " << io.DebugString();
+  }
+
+  void RunQueries(FunctionBindingIoProto& io) {
+    if (!CheckInitialized("runQueries", io)) {
+      return;
+    }
+    VLOG(9) << "runQueries request: " << io.DebugString();
+    if (!io.has_input_list_of_string()) {
+      SetStatus(absl::InvalidArgumentError(
+                    "runQueries input must be a list of strings"),
+                io);
+      return;
+    }
+    InternalRunQueriesRequest request;
+    for (const auto& query : io.input_list_of_string().data()) {
+      request.add_queries()->set_query(query);
+    }
+    const auto response_or_status = lookup_->RunQueries(request);
+    if (!response_or_status.ok()) {
+      LOG(ERROR) << "Internal run queries returned error: "
+                 << response_or_status.status();
+      SetStatus(response_or_status.status(), io);
+      return;
+    }
+    nlohmann::json results = nlohmann::json::array();
+    for (const auto& result : response_or_status->results()) {
+      if (result.has_status()) {
+        VLOG(1) << "runQueries query failed: " << result.status().message();
+        nlohmann::json status;
+        status["code"] = result.status().code();
+        status["message"] = result.status().message();
+        results.push_back(std::move(status));
+        continue;
+      }
+      nlohmann::json elements = nlohmann::json::array();
+      for (const auto& element : result.response().elements()) {
+        elements.push_back(element);
+      }
+      results.push_back(std::move(elements));
+    }
+    io.set_output_string(results.dump());
+    VLOG(9) << "runQueries result: " << io.DebugString();
+  }
+
  private:
+  // Builds a request from the options a UDF passes as a map: `query`
+  // (required), `limit`, `offset`, `pageToken` and `ordered`. For ordered
+  // results the token of the next page is the last element of the current
+  // one, and a page shorter than `limit` is the last one.
+  static absl::StatusOr<InternalRunQueryRequest> ToRunQueryRequest(
+      const google::protobuf::Map<std::string, std::string>& options) {
+    InternalRunQueryRequest request;
+    const auto query = options.find("query");
+    if (query == options.end()) {
+      return absl::InvalidArgumentError("runQuery options must have a query");
+    }
+    request.set_query(query->second);
+    if (const auto limit = options.find("limit"); limit != options.end()) {
+      uint64_t value;
+      if (!absl::SimpleAtoi(limit->second, &value)) {
+        return absl::InvalidArgumentError(
+            "runQuery limit must be a non-negative integer");
+      }
+      request.set_limit(value);
+    }
+    if (const auto offset = options.find("offset"); offset != options.end()) {
+      uint64_t value;
+      if (!absl::SimpleAtoi(offset->second, &value)) {
+        return absl::InvalidArgumentError(
+            "runQuery offset must be a non-negative integer");
+      }
+      request.set_offset(value);
+    }
+    if (const auto page_token = options.find("pageToken");
+        page_token != options.end()) {
+      request.set_page_token(page_token->second);
+    }
+    if (const auto ordered = options.find("ordered");
+        ordered != options.end()) {
+      bool value;
+      if (!absl::SimpleAtob(ordered->second, &value)) {
+        return absl::InvalidArgumentError("runQuery ordered must be a boolean");
+      }
+      request.set_ordered(value);
+    }
+    return request;
+  }
+
+  bool CheckInitialized(std::string_view hook_name,
+                        FunctionBindingIoProto& io) const {
+    if (lookup_ != nullptr) {
+      return true;
+    }
+    SetStatus(absl::InternalError(
+                  absl::StrCat(hook_name, " has not been initialized yet")),
+              io);
+    LOG(ERROR) << hook_name
+               << " hook is not initialized properly: lookup is nullptr";
+    return false;
+  }
+
+  static void SetStatus(const absl::Status& status,
+                        FunctionBindingIoProto& io) {
+    nlohmann::json json_status;
+    json_status["code"] = status.code();
+    json_status["message"] = status.message();
+    io.set_output_string(json_status.dump());
+  }
+
   // `lookup_` is initialized separately, since its dependencies create threads.
   // Lazy load is used to ensure that it only happens after Roma forks.
   std::unique_ptr<Lookup> lookup_;
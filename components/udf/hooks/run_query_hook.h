@@ -40,10 +40,40 @@ class RunQueryHook {
   virtual void FinishInit(std::unique_ptr<Lookup> lookup) = 0;
 
   // This is registered with v8 and is exposed to the UDF. Internally, it calls
-  // the internal query client.
+  // the internal query client. The input is either the query string or a map
+  // of options: `query`, `limit`, `offset`, `pageToken` and `ordered`.
   virtual void operator()(
       google::scp::roma::proto::FunctionBindingIoProto& io) = 0;
 
+  // Exposed to the UDF as `runQueryCount`. Takes the query as
+  // `input_string` and sets `output_string` to `{"count":N}`, where N is the
+  // size of the result set. The result set itself is never materialized.
+  virtual void Count(google::scp::roma::proto::FunctionBindingIoProto& io) = 0;
+
+  // Exposed to the UDF as `runQueryContains`. Takes `[query, candidate...]`
+  // as `input_list_of_string` and sets `output_string` to a JSON array with
+  // one boolean per candidate, in order, telling whether the candidate is in
+  // the result set.
+  virtual void Contains(
+      google::scp::roma::proto::FunctionBindingIoProto& io) = 0;
+
+  // Exposed to the UDF as `setContains`. Takes `[key, candidate...]` as
+  // `input_list_of_string` and sets `output_string` to a JSON array with one
+  // boolean per candidate, in order, telling whether the candidate is in the
+  // set of `key`. Unlike `runQueryContains` with a single key, only the
+  // candidates are looked up, so the cost does not depend on the set size.
+  virtual void SetContains(
+      google::scp::roma::proto::FunctionBindingIoProto& io) = 0;
+
+  // Exposed to the UDF as `runQueries`. Takes the queries as
+  // `input_list_of_string` and sets `output_string` to a JSON array with the
+  // elements of each query's result, in order. All sets referenced by the
+  // queries are fetched once. A query that fails yields its status instead,
+  // as a `{"code":N,"message":"..."}` object, so that it can not be mistaken
+  // for an empty result.
+  virtual void RunQueries(
+      google::scp::roma::proto::FunctionBindingIoProto& io) = 0;
+
   static std::unique_ptr<RunQueryHook> Create();
 };
 
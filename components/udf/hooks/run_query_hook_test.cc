@@ -25,6 +25,7 @@
 #include "gmock/gmock.h"
 #include "google/protobuf/text_format.h"
 #include "gtest/gtest.h"
+#include "public/test_util/proto_matcher.h"
 
 namespace kv_server {
 namespace {
@@ -81,7 +82,185 @@ TEST(GetValuesHookTest, InputIsNotString) {
   EXPECT_THAT(
       io.output_list_of_string().data(),
       UnorderedElementsAreArray(
-          {R"({"code":3,"message":"runQuery input must be a string"})"}));
+          {R"({"code":3,"message":"runQuery input must be a string or a map of options"})"}));
+}
+
+TEST(RunQueryHookTest, OptionsSuccessfullyProcessesValue) {
+  InternalRunQueryResponse run_query_response;
+  TextFormat::ParseFromString(
+      R"pb(elements: "a" elements: "b" next_page_token: "b")pb",
+      &run_query_response);
+  auto mock_lookup = std::make_unique<MockLookup>();
+  InternalRunQueryRequest expected_request;
+  TextFormat::ParseFromString(
+      R"pb(query: "Q" limit: 2 offset: 1 page_token: "0" ordered: true)pb",
+      &expected_request);
+  EXPECT_CALL(*mock_lookup, ExecuteQuery(EqualsProto(expected_request)))
+      .WillOnce(Return(run_query_response));
+
+  FunctionBindingIoProto io;
+  TextFormat::ParseFromString(R"pb(input_map_of_string {
+                                     data { key: "query" value: "Q" }
+                                     data { key: "limit" value: "2" }
+                                     data { key: "offset" value: "1" }
+                                     data { key: "pageToken" value: "0" }
+                                     data { key: "ordered" value: "true" }
+                                   })pb",
+                              &io);
+  auto run_query_hook = RunQueryHook::Create();
+  run_query_hook->FinishInit(std::move(mock_lookup));
+  (*run_query_hook)(io);
+  EXPECT_THAT(io.output_list_of_string().data(),
+              testing::ElementsAre("a", "b"));
+}
+
+TEST(RunQueryHookTest, OptionsInvalidLimit) {
+  auto mock_lookup = std::make_unique<MockLookup>();
+
+  FunctionBindingIoProto io;
+  TextFormat::ParseFromString(R"pb(input_map_of_string {
+                                     data { key: "query" value: "Q" }
+                                     data { key: "limit" value: "-1" }
+                                   })pb",
+                              &io);
+  auto run_query_hook = RunQueryHook::Create();
+  run_query_hook->FinishInit(std::move(mock_lookup));
+  (*run_query_hook)(io);
+  EXPECT_THAT(
+      io.output_list_of_string().data(),
+      UnorderedElementsAreArray(
+          {R"({"code":3,"message":"runQuery limit must be a non-negative integer"})"}));
+}
+
+TEST(RunQueryHookTest, RunQueriesSuccessfullyProcessesValue) {
+  InternalRunQueriesResponse run_queries_response;
+  TextFormat::ParseFromString(
+      R"pb(results { response { elements: "a" elements: "b" } }
+           results { status { code: 3 message: "Parsing failure." } }
+           results { response {} })pb",
+      &run_queries_response);
+  auto mock_lookup = std::make_unique<MockLookup>();
+  InternalRunQueriesRequest expected_request;
+  TextFormat::ParseFromString(
+      R"pb(queries { query: "A" } queries { query: "B|" } queries { query: "C" })pb",
+      &expected_request);
+  EXPECT_CALL(*mock_lookup, RunQueries(EqualsProto(expected_request)))
+      .WillOnce(Return(run_queries_response));
+
+  FunctionBindingIoProto io;
+  TextFormat::ParseFromString(
+      R"pb(input_list_of_string { data: "A" data: "B|" data: "C" })pb", &io);
+  auto run_query_hook = RunQueryHook::Create();
+  run_query_hook->FinishInit(std::move(mock_lookup));
+  run_query_hook->RunQueries(io);
+  EXPECT_EQ(io.output_string(),
+            R"([["a","b"],{"code":3,"message":"Parsing failure."},[]])");
+}
+
+TEST(RunQueryHookTest, CountSuccessfullyProcessesValue) {
+  InternalRunQueryResponse run_query_response;
+  run_query_response.set_count(2);
+  auto mock_lookup = std::make_unique<MockLookup>();
+  InternalRunQueryRequest expected_request;
+  TextFormat::ParseFromString(R"pb(query: "Q" result_mode: COUNT)pb",
+                              &expected_request);
+  EXPECT_CALL(*mock_lookup, ExecuteQuery(EqualsProto(expected_request)))
+      .WillOnce(Return(run_query_response));
+
+  FunctionBindingIoProto io;
+  TextFormat::ParseFromString(R"pb(input_string: "Q")pb", &io);
+  auto run_query_hook = RunQueryHook::Create();
+  run_query_hook->FinishInit(std::move(mock_lookup));
+  run_query_hook->Count(io);
+  EXPECT_EQ(io.output_string(), R"({"count":2})");
+}
+
+TEST(RunQueryHookTest, CountInputIsNotString) {
+  auto mock_lookup = std::make_unique<MockLookup>();
+
+  FunctionBindingIoProto io;
+  TextFormat::ParseFromString(R"pb(input_list_of_string { data: "key1" })pb",
+                              &io);
+  auto run_query_hook = RunQueryHook::Create();
+  run_query_hook->FinishInit(std::move(mock_lookup));
+  run_query_hook->Count(io);
+
+  EXPECT_EQ(io.output_string(),
+            R"({"code":3,"message":"runQueryCount input must be a string"})");
+}
+
+TEST(RunQueryHookTest, ContainsSuccessfullyProcessesValue) {
+  InternalRunQueryResponse run_query_response;
+  TextFormat::ParseFromString(R"pb(is_member: true is_member: false)pb",
+                              &run_query_response);
+  auto mock_lookup = std::make_unique<MockLookup>();
+  InternalRunQueryRequest expected_request;
+  TextFormat::ParseFromString(
+      R"pb(query: "Q" result_mode: MEMBERSHIP candidates: "a" candidates: "b")pb",
+      &expected_request);
+  EXPECT_CALL(*mock_lookup, ExecuteQuery(EqualsProto(expected_request)))
+      .WillOnce(Return(run_query_response));
+
+  FunctionBindingIoProto io;
+  TextFormat::ParseFromString(
+      R"pb(input_list_of_string { data: "Q" data: "a" data: "b" })pb", &io);
+  auto run_query_hook = RunQueryHook::Create();
+  run_query_hook->FinishInit(std::move(mock_lookup));
+  run_query_hook->Contains(io);
+  EXPECT_EQ(io.output_string(), "[true,false]");
+}
+
+TEST(RunQueryHookTest, ContainsClientReturnsError) {
+  auto mock_lookup = std::make_unique<MockLookup>();
+  EXPECT_CALL(*mock_lookup, ExecuteQuery(_))
+      .WillOnce(Return(absl::UnknownError("Some error")));
+
+  FunctionBindingIoProto io;
+  TextFormat::ParseFromString(R"pb(input_list_of_string { data: "Q" })pb",
+                              &io);
+  auto run_query_hook = RunQueryHook::Create();
+  run_query_hook->FinishInit(std::move(mock_lookup));
+  run_query_hook->Contains(io);
+  EXPECT_EQ(io.output_string(), R"({"code":2,"message":"Some error"})");
+}
+
+TEST(RunQueryHookTest, SetContainsSuccessfullyProcessesValue) {
+  InternalLookupResponse lookup_response;
+  TextFormat::ParseFromString(R"pb(kv_pairs {
+                                     key: "K"
+                                     value {
+                                       keyset_membership {
+                                         is_member: false
+                                         is_member: true
+                                       }
+                                     }
+                                   })pb",
+                              &lookup_response);
+  auto mock_lookup = std::make_unique<MockLookup>();
+  EXPECT_CALL(*mock_lookup, GetKeyValueSetMembership(
+                                "K", testing::ElementsAre("a", "b")))
+      .WillOnce(Return(lookup_response));
+
+  FunctionBindingIoProto io;
+  TextFormat::ParseFromString(
+      R"pb(input_list_of_string { data: "K" data: "a" data: "b" })pb", &io);
+  auto run_query_hook = RunQueryHook::Create();
+  run_query_hook->FinishInit(std::move(mock_lookup));
+  run_query_hook->SetContains(io);
+  EXPECT_EQ(io.output_string(), "[false,true]");
+}
+
+TEST(RunQueryHookTest, SetContainsInputIsEmpty) {
+  auto mock_lookup = std::make_unique<MockLookup>();
+  EXPECT_CALL(*mock_lookup, GetKeyValueSetMembership(_, _)).Times(0);
+
+  FunctionBindingIoProto io;
+  auto run_query_hook = RunQueryHook::Create();
+  run_query_hook->FinishInit(std::move(mock_lookup));
+  run_query_hook->SetContains(io);
+  EXPECT_EQ(io.output_string(),
+            R"({"code":3,"message":"setContains input must be a list of )"
+            R"(strings starting with the set key"})");
 }
 
 }  // namespace
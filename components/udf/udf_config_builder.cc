@@ -38,6 +38,10 @@ using google::scp::roma::proto::FunctionBindingIoProto;
 constexpr char kStringGetValuesHookJsName[] = "getValues";
 constexpr char kBinaryGetValuesHookJsName[] = "getValuesBinary";
 constexpr char kRunQueryHookJsName[] = "runQuery";
+constexpr char kRunQueryCountHookJsName[] = "runQueryCount";
+constexpr char kRunQueryContainsHookJsName[] = "runQueryContains";
+constexpr char kSetContainsHookJsName[] = "setContains";
+constexpr char kRunQueriesHookJsName[] = "runQueries";
 constexpr char kLoggingHookJsName[] = "logMessage";
 
 std::unique_ptr<FunctionBindingObjectV2> GetValuesFunctionObject(
@@ -72,6 +76,44 @@ UdfConfigBuilder& UdfConfigBuilder::RegisterRunQueryHook(
   run_query_function_object->function =
       [&run_query_hook](FunctionBindingIoProto& in) { run_query_hook(in); };
   config_.RegisterFunctionBinding(std::move(run_query_function_object));
+
+  auto run_query_count_function_object =
+      std::make_unique<FunctionBindingObjectV2>();
+  run_query_count_function_object->function_name = kRunQueryCountHookJsName;
+  run_query_count_function_object->function =
+      [&run_query_hook](FunctionBindingIoProto& in) {
+        run_query_hook.Count(in);
+      };
+  config_.RegisterFunctionBinding(std::move(run_query_count_function_object));
+
+  auto run_query_contains_function_object =
+      std::make_unique<FunctionBindingObjectV2>();
+  run_query_contains_function_object->function_name =
+      kRunQueryContainsHookJsName;
+  run_query_contains_function_object->function =
+      [&run_query_hook](FunctionBindingIoProto& in) {
+        run_query_hook.Contains(in);
+      };
+  config_.RegisterFunctionBinding(
+      std::move(run_query_contains_function_object));
+
+  auto set_contains_function_object =
+      std::make_unique<FunctionBindingObjectV2>();
+  set_contains_function_object->function_name = kSetContainsHookJsName;
+  set_contains_function_object->function =
+      [&run_query_hook](FunctionBindingIoProto& in) {
+        run_query_hook.SetContains(in);
+      };
+  config_.RegisterFunctionBinding(std::move(set_contains_function_object));
+
+  auto run_queries_function_object =
+      std::make_unique<FunctionBindingObjectV2>();
+  run_queries_function_object->function_name = kRunQueriesHookJsName;
+  run_queries_function_object->function =
+      [&run_query_hook](FunctionBindingIoProto& in) {
+        run_query_hook.RunQueries(in);
+      };
+  config_.RegisterFunctionBinding(std::move(run_queries_function_object));
   return *this;
 }
 
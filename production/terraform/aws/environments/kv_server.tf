@@ -75,7 +75,8 @@ module "kv_server" {
   s3client_max_range_bytes = var.s3client_max_range_bytes
 
   # Variables related to sharding.
-  num_shards = var.num_shards
+  num_shards                = var.num_shards
+  sharding_function_version = var.sharding_function_version
 
   # Variables related to UDF exeuction.
   udf_num_workers = var.udf_num_workers
@@ -192,6 +192,12 @@ variable "num_shards" {
   type        = number
 }
 
+variable "sharding_function_version" {
+  description = "Version of the function that assigns keys to shards, 0 for SHA256 and 1 for SipHash."
+  type        = number
+  default     = 0
+}
+
 variable "udf_num_workers" {
   description = "Total number of workers for UDF execution."
   type        = number
@@ -193,6 +193,12 @@ variable "num_shards" {
   type        = number
 }
 
+variable "sharding_function_version" {
+  description = "Version of the function that assigns keys to shards."
+  type        = number
+  default     = 0
+}
+
 variable "udf_num_workers" {
   description = "Number of workers for UDF execution."
   type        = number
@@ -114,6 +114,13 @@ resource "aws_ssm_parameter" "num_shards_parameter" {
   overwrite = true
 }
 
+resource "aws_ssm_parameter" "sharding_function_version_parameter" {
+  name      = "${var.service}-${var.environment}-sharding-function-version"
+  type      = "String"
+  value     = var.sharding_function_version_parameter_value
+  overwrite = true
+}
+
 resource "aws_ssm_parameter" "udf_num_workers_parameter" {
   name      = "${var.service}-${var.environment}-udf-num-workers"
   type      = "String"
@@ -74,6 +74,10 @@ output "num_shards_parameter_arn" {
   value = aws_ssm_parameter.num_shards_parameter.arn
 }
 
+output "sharding_function_version_parameter_arn" {
+  value = aws_ssm_parameter.sharding_function_version_parameter.arn
+}
+
 output "udf_num_workers_parameter_arn" {
   value = aws_ssm_parameter.udf_num_workers_parameter.arn
 }
@@ -84,6 +84,11 @@ variable "num_shards_parameter_value" {
   type        = number
 }
 
+variable "sharding_function_version_parameter_value" {
+  description = "Version of the function that assigns keys to shards."
+  type        = number
+}
+
 variable "udf_num_workers_parameter_value" {
   description = "Total number of workers for UDF execution."
   type        = number
@@ -68,6 +68,7 @@ module "kv_server" {
     realtime-updater-num-threads              = var.realtime_updater_num_threads
     data-loading-num-threads                  = var.data_loading_num_threads
     num-shards                                = var.num_shards
+    sharding-function-version                 = var.sharding_function_version
     udf-num-workers                           = var.udf_num_workers
     route-v1-to-v2                            = var.route_v1_to_v2
     use-real-coordinators                     = var.use_real_coordinators
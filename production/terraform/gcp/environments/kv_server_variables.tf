@@ -131,6 +131,12 @@ variable "num_shards" {
   description = "Total number of shards."
 }
 
+variable "sharding_function_version" {
+  type        = number
+  default     = 0
+  description = "Version of the function that assigns keys to shards, 0 for SHA256 and 1 for SipHash."
+}
+
 variable "udf_num_workers" {
   type        = number
   description = "Number of workers for UDF execution."
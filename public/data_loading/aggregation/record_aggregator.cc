@@ -297,6 +297,29 @@ RecordAggregator::MergeSetValueIfRecordExists(
   return merged_values_list;
 }
 
+template <typename ElementT>
+absl::StatusOr<std::vector<ElementT>>
+RecordAggregator::MergeNumericSetValueIfRecordExists(
+    int64_t record_key, const std::vector<ElementT>& values) {
+  absl::flat_hash_set<ElementT> merged_values_set(values.begin(),
+                                                  values.end());
+  auto status = ReadRecord(
+      record_key,
+      [&merged_values_set](KeyValueMutationRecordStruct existing_record) {
+        if (const auto* existing_values =
+                std::get_if<std::vector<ElementT>>(&existing_record.value)) {
+          merged_values_set.insert(existing_values->begin(),
+                                   existing_values->end());
+        }
+        return absl::OkStatus();
+      });
+  if (!status.ok()) {
+    return status;
+  }
+  return std::vector<ElementT>(merged_values_set.begin(),
+                               merged_values_set.end());
+}
+
 absl::Status RecordAggregator::InsertOrUpdateRecord(
     int64_t record_key, const KeyValueMutationRecordStruct& record) {
   if (absl::Status status = ValidateRecord(record); !status.ok()) {
@@ -314,6 +337,24 @@ absl::Status RecordAggregator::InsertOrUpdateRecord(
     mutable_record.value =
         std::vector<std::string_view>(values.begin(), values.end());
   }
+  if (auto* uint32_values =
+          std::get_if<std::vector<uint32_t>>(&mutable_record.value)) {
+    auto maybe_values =
+        MergeNumericSetValueIfRecordExists(record_key, *uint32_values);
+    if (!maybe_values.ok()) {
+      return maybe_values.status();
+    }
+    *uint32_values = std::move(*maybe_values);
+  }
+  if (auto* uint64_values =
+          std::get_if<std::vector<uint64_t>>(&mutable_record.value)) {
+    auto maybe_values =
+        MergeNumericSetValueIfRecordExists(record_key, *uint64_values);
+    if (!maybe_values.ok()) {
+      return maybe_values.status();
+    }
+    *uint64_values = std::move(*maybe_values);
+  }
   sqlite3_stmt* insert_stmt;
   if (absl::Status status =
           PrepareStatement(kInsertRecordSql, &insert_stmt, db_.get());
@@ -133,6 +133,9 @@ class RecordAggregator {
 
   absl::StatusOr<std::vector<std::string>> MergeSetValueIfRecordExists(
       int64_t record_key, const KeyValueMutationRecordStruct& record);
+  template <typename ElementT>
+  absl::StatusOr<std::vector<ElementT>> MergeNumericSetValueIfRecordExists(
+      int64_t record_key, const std::vector<ElementT>& values);
 
   std::unique_ptr<sqlite3, DbDeleter> db_;
 };
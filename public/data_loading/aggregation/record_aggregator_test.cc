@@ -402,5 +402,29 @@ TEST_P(RecordAggregatorTest, ValidateAggregatingRecordsWithSetValues) {
       (*record_aggregator)->ReadRecords(record_callback.AsStdFunction()).ok());
 }
 
+TEST_P(RecordAggregatorTest, ValidateAggregatingRecordsWithNumericSetValues) {
+  auto record_aggregator = RecordAggregatorTest::CreateAggregator();
+  auto status = (*record_aggregator)->DeleteRecords();
+  EXPECT_TRUE(status.ok()) << status;
+  testing::MockFunction<absl::Status(KeyValueMutationRecordStruct)>
+      record_callback;
+  auto record1 = GetDeltaRecord("key1", std::vector<uint64_t>{1, 2, 3});
+  status = (*record_aggregator)
+               ->InsertOrUpdateRecord(GetRecordKey(record1), record1);
+  EXPECT_TRUE(status.ok()) << status;
+  auto record2 = GetDeltaRecord("key1", std::vector<uint64_t>{3, 4});
+  status = (*record_aggregator)
+               ->InsertOrUpdateRecord(GetRecordKey(record2), record2);
+  EXPECT_TRUE(status.ok()) << status;
+  EXPECT_CALL(record_callback, Call)
+      .WillOnce([](KeyValueMutationRecordStruct record) {
+        EXPECT_THAT(std::get<std::vector<uint64_t>>(record.value),
+                    testing::UnorderedElementsAre(1, 2, 3, 4));
+        return absl::OkStatus();
+      });
+  EXPECT_TRUE(
+      (*record_aggregator)->ReadRecords(record_callback.AsStdFunction()).ok());
+}
+
 }  // namespace
 }  // namespace kv_server
@@ -49,6 +49,22 @@ absl::StatusOr<KeyValueMutationType> GetDeltaMutationType(
       absl::StrCat("Unknown mutation type:", mutation_type));
 }
 
+template <typename ElementT>
+absl::StatusOr<std::vector<ElementT>> GetNumericSetValue(
+    const std::vector<std::string>& set_value) {
+  std::vector<ElementT> result;
+  result.reserve(set_value.size());
+  for (const auto& element : set_value) {
+    if (ElementT number; absl::SimpleAtoi(element, &number)) {
+      result.push_back(number);
+    } else {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "Cannot convert set value: ", element, " to a number."));
+    }
+  }
+  return result;
+}
+
 absl::StatusOr<KeyValueMutationRecordValueT> GetRecordValue(
     const riegeli::CsvRecord& csv_record, std::string_view value,
     const std::vector<std::string>& set_value) {
@@ -59,6 +75,12 @@ absl::StatusOr<KeyValueMutationRecordValueT> GetRecordValue(
   if (kValueTypeStringSet == type) {
     return std::vector<std::string_view>(set_value.begin(), set_value.end());
   }
+  if (kValueTypeUInt32Set == type) {
+    return GetNumericSetValue<uint32_t>(set_value);
+  }
+  if (kValueTypeUInt64Set == type) {
+    return GetNumericSetValue<uint64_t>(set_value);
+  }
   return absl::InvalidArgumentError(
       absl::StrCat("Value type: ", type, " is not supported"));
 }
@@ -171,6 +193,10 @@ absl::StatusOr<std::vector<std::string>> MaybeGetSetValue(
     const riegeli::CsvRecord& csv_record, char value_separator,
     const CsvEncoding& csv_encoding) {
   auto type = absl::AsciiStrToLower(csv_record[kValueTypeColumn]);
+  if (kValueTypeUInt32Set == type || kValueTypeUInt64Set == type) {
+    // Numbers are never encoded.
+    return absl::StrSplit(csv_record[kValueColumn], value_separator);
+  }
   if (kValueTypeStringSet != type) {
     return std::vector<std::string>();
   }
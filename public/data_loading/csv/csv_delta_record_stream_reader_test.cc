@@ -16,7 +16,9 @@
 
 #include "public/data_loading/csv/csv_delta_record_stream_reader.h"
 
+#include <limits>
 #include <sstream>
+#include <vector>
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
@@ -108,6 +110,47 @@ TEST(CsvDeltaRecordStreamReaderTest,
   EXPECT_EQ(status.code(), absl::StatusCode::kInvalidArgument) << status;
 }
 
+TEST(CsvDeltaRecordStreamReaderTest,
+     ValidateReadingAndWriting_KVMutation_NumericSetValues_Success) {
+  std::stringstream string_stream;
+  CsvDeltaRecordStreamWriter record_writer(string_stream);
+  std::vector<DataRecordStruct> expected = {
+      GetDataRecord(GetKVMutationRecord(std::vector<uint32_t>{1, 2, 3})),
+      GetDataRecord(GetKVMutationRecord(
+          std::vector<uint64_t>{1, std::numeric_limits<uint64_t>::max()})),
+  };
+  for (const auto& record : expected) {
+    EXPECT_TRUE(record_writer.WriteRecord(record).ok());
+  }
+  EXPECT_TRUE(record_writer.Flush().ok());
+  CsvDeltaRecordStreamReader record_reader(string_stream);
+  std::vector<DataRecordStruct> actual;
+  EXPECT_TRUE(record_reader
+                  .ReadRecords([&actual](DataRecordStruct record) {
+                    actual.push_back(record);
+                    return absl::OkStatus();
+                  })
+                  .ok());
+  EXPECT_EQ(actual, expected);
+}
+
+TEST(CsvDeltaRecordStreamReaderTest,
+     ValidateReadingCsvRecords_KVMutation_InvalidNumericSetValue_Failure) {
+  const char invalid_data[] =
+      R"csv(key,value,value_type,mutation_type,logical_commit_time
+  key,1|4294967296,uint32_set,Update,1)csv";
+  std::stringstream csv_stream;
+  csv_stream.str(invalid_data);
+  CsvDeltaRecordStreamReader record_reader(csv_stream);
+  absl::Status status = record_reader.ReadRecords(
+      [](const DataRecordStruct&) { return absl::OkStatus(); });
+  EXPECT_FALSE(status.ok()) << status;
+  EXPECT_STREQ(std::string(status.message()).c_str(),
+               "Cannot convert set value: 4294967296 to a number.")
+      << status;
+  EXPECT_EQ(status.code(), absl::StatusCode::kInvalidArgument) << status;
+}
+
 TEST(CsvDeltaRecordStreamReaderTest,
      ValidateReadingCsvRecords_KVMutation_InvalidTimestamps_Failure) {
   const char invalid_data[] =
@@ -50,6 +50,20 @@ ValueUnion BuildValueUnion(const KeyValueMutationRecordValueT& value,
               .value = CreateStringSet(builder, values_offset).Union(),
           };
         }
+        if constexpr (std::is_same_v<VariantT, std::vector<uint32_t>>) {
+          auto values_offset = builder.CreateVector(arg);
+          return ValueUnion{
+              .value_type = Value::UInt32Set,
+              .value = CreateUInt32Set(builder, values_offset).Union(),
+          };
+        }
+        if constexpr (std::is_same_v<VariantT, std::vector<uint64_t>>) {
+          auto values_offset = builder.CreateVector(arg);
+          return ValueUnion{
+              .value_type = Value::UInt64Set,
+              .value = CreateUInt64Set(builder, values_offset).Union(),
+          };
+        }
         if constexpr (std::is_same_v<VariantT, std::monostate>) {
           return ValueUnion{
               .value_type = Value::NONE,
@@ -148,6 +162,16 @@ absl::Status ValidateValue(const KeyValueMutationRecord& kv_mutation_record) {
        kv_mutation_record.value_as_StringSet()->value() == nullptr)) {
     return absl::InvalidArgumentError("StringSet value not set.");
   }
+  if (kv_mutation_record.value_type() == Value::UInt32Set &&
+      (kv_mutation_record.value_as_UInt32Set() == nullptr ||
+       kv_mutation_record.value_as_UInt32Set()->value() == nullptr)) {
+    return absl::InvalidArgumentError("UInt32Set value not set.");
+  }
+  if (kv_mutation_record.value_type() == Value::UInt64Set &&
+      (kv_mutation_record.value_as_UInt64Set() == nullptr ||
+       kv_mutation_record.value_as_UInt64Set()->value() == nullptr)) {
+    return absl::InvalidArgumentError("UInt64Set value not set.");
+  }
   return absl::OkStatus();
 }
 
@@ -202,6 +226,12 @@ KeyValueMutationRecordValueT GetRecordStructValue(
   if (fbs_record.value_type() == Value::StringSet) {
     value = GetRecordValue<std::vector<std::string_view>>(fbs_record);
   }
+  if (fbs_record.value_type() == Value::UInt32Set) {
+    value = GetRecordValue<std::vector<uint32_t>>(fbs_record);
+  }
+  if (fbs_record.value_type() == Value::UInt64Set) {
+    value = GetRecordValue<std::vector<uint64_t>>(fbs_record);
+  }
   return value;
 }
 
@@ -372,6 +402,18 @@ std::vector<std::string_view> GetRecordValue(
   return values;
 }
 
+template <>
+std::vector<uint32_t> GetRecordValue(const KeyValueMutationRecord& record) {
+  const auto* values = record.value_as_UInt32Set()->value();
+  return std::vector<uint32_t>(values->begin(), values->end());
+}
+
+template <>
+std::vector<uint64_t> GetRecordValue(const KeyValueMutationRecord& record) {
+  const auto* values = record.value_as_UInt64Set()->value();
+  return std::vector<uint64_t>(values->begin(), values->end());
+}
+
 template <>
 KeyValueMutationRecordStruct GetTypedRecordStruct(
     const DataRecord& data_record) {
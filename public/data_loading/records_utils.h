@@ -17,6 +17,7 @@
 #ifndef PUBLIC_DATA_LOADING_RECORDS_UTILS_H_
 #define PUBLIC_DATA_LOADING_RECORDS_UTILS_H_
 
+#include <cstdint>
 #include <string>
 #include <string_view>
 #include <utility>
@@ -39,7 +40,8 @@ enum class CsvEncoding : int { kPlaintext, kBase64 };
 
 using KeyValueMutationRecordValueT =
     std::variant<std::monostate, std::string_view,
-                 std::vector<std::string_view>>;
+                 std::vector<std::string_view>, std::vector<uint32_t>,
+                 std::vector<uint64_t>>;
 
 struct KeyValueMutationRecordStruct {
   KeyValueMutationType mutation_type;
@@ -156,6 +158,10 @@ std::string_view GetRecordValue(const KeyValueMutationRecord& record);
 template <>
 std::vector<std::string_view> GetRecordValue(
     const KeyValueMutationRecord& record);
+template <>
+std::vector<uint32_t> GetRecordValue(const KeyValueMutationRecord& record);
+template <>
+std::vector<uint64_t> GetRecordValue(const KeyValueMutationRecord& record);
 
 // Utility function to get the union record set on the `data_record`. Must
 // be called after checking the type of the union record using
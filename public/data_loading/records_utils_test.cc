@@ -129,6 +129,16 @@ void ExpectEqual(const KeyValueMutationRecordStruct& record,
                 testing::ContainerEq(
                     GetRecordValue<std::vector<std::string_view>>(fbs_record)));
   }
+  if (fbs_record.value_type() == Value::UInt32Set) {
+    EXPECT_THAT(std::get<std::vector<uint32_t>>(record.value),
+                testing::ContainerEq(
+                    GetRecordValue<std::vector<uint32_t>>(fbs_record)));
+  }
+  if (fbs_record.value_type() == Value::UInt64Set) {
+    EXPECT_THAT(std::get<std::vector<uint64_t>>(record.value),
+                testing::ContainerEq(
+                    GetRecordValue<std::vector<uint64_t>>(fbs_record)));
+  }
 }
 
 void ExpectEqual(const UserDefinedFunctionsConfigStruct& record,
@@ -164,7 +174,10 @@ void ExpectEqual(const DataRecordStruct& record, const DataRecord& fbs_record) {
 INSTANTIATE_TEST_SUITE_P(RecordValueType, RecordValueTest,
                          testing::Values("value1",
                                          std::vector<std::string_view>{
-                                             "value1", "value2"}));
+                                             "value1", "value2"},
+                                         std::vector<uint32_t>{1, 2},
+                                         std::vector<uint64_t>{
+                                             1, uint64_t{1} << 40}));
 TEST_P(RecordValueTest, DeserializeRecord_ToFbsRecord_Success) {
   auto record = GetKeyValueMutationRecord(GetValue());
   testing::MockFunction<absl::Status(const KeyValueMutationRecord&)>
@@ -330,6 +343,30 @@ TEST(
   EXPECT_EQ(status.message(), "StringSet value not set.");
 }
 
+TEST(
+    DataRecordTest,
+    DeserializeDataRecord_ToFbsRecord_KVMutation_UInt32SetValueNotSet_Failure) {
+  flatbuffers::FlatBufferBuilder builder;
+  const auto kv_mutation_fbs = CreateKeyValueMutationRecordDirect(
+      builder,
+      /*mutation_type=*/KeyValueMutationType::Update,
+      /*logical_commit_time=*/0,
+      /*key=*/"key",
+      /*value_type=*/Value::UInt32Set,
+      /*value=*/CreateUInt32SetDirect(builder).Union());
+  const auto data_record_fbs =
+      CreateDataRecord(builder, /*record_type=*/Record::KeyValueMutationRecord,
+                       kv_mutation_fbs.Union());
+  builder.Finish(data_record_fbs);
+
+  testing::MockFunction<absl::Status(const DataRecord&)> record_callback;
+  EXPECT_CALL(record_callback, Call).Times(0);
+  auto status = DeserializeDataRecord(ToStringView(builder),
+                                      record_callback.AsStdFunction());
+  EXPECT_FALSE(status.ok()) << status;
+  EXPECT_EQ(status.message(), "UInt32Set value not set.");
+}
+
 TEST(DataRecordTest, DeserializeDataRecord_ToFbsRecord_UdfConfig_Success) {
   auto data_record_struct = GetDataRecord(GetUdfConfigStruct());
   testing::MockFunction<absl::Status(const DataRecord&)> record_callback;
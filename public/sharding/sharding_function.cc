@@ -16,13 +16,55 @@
 
 #include "public/sharding/sharding_function.h"
 
+#include "absl/numeric/int128.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "openssl/sha.h"
+#include "openssl/siphash.h"
+
 namespace kv_server {
+namespace {
+
+uint64_t LoadLittleEndian64(const uint8_t* bytes) {
+  uint64_t value = 0;
+  for (int i = 7; i >= 0; i--) {
+    value = (value << 8) | bytes[i];
+  }
+  return value;
+}
+
+}  // namespace
 
-ShardingFunction::ShardingFunction(std::string seed)
-    : hash_function_(std::move(seed)) {}
+ShardingFunction::ShardingFunction(std::string seed, Version version)
+    : version_(version), hash_function_(seed) {
+  uint8_t digest[SHA256_DIGEST_LENGTH];
+  SHA256(reinterpret_cast<const uint8_t*>(seed.data()), seed.size(), digest);
+  siphash_key_[0] = LoadLittleEndian64(digest);
+  siphash_key_[1] = LoadLittleEndian64(digest + 8);
+}
+
+absl::StatusOr<ShardingFunction::Version> ShardingFunction::GetVersion(
+    int32_t version_number) {
+  const auto version = static_cast<Version>(version_number);
+  switch (version) {
+    case Version::kSha256:
+    case Version::kSipHash:
+      return version;
+  }
+  return absl::InvalidArgumentError(
+      absl::StrCat("Unknown sharding function version: ", version_number));
+}
 
 int ShardingFunction::GetShardNumForKey(std::string_view key,
                                         int num_shards) const {
+  if (version_ == Version::kSipHash) {
+    const uint64_t hash =
+        SIPHASH_24(siphash_key_, reinterpret_cast<const uint8_t*>(key.data()),
+                   key.size());
+    // Scales the hash down to [0, num_shards), which is cheaper than a mod.
+    return absl::Uint128High64(absl::uint128(hash) *
+                               static_cast<uint64_t>(num_shards));
+  }
   return hash_function_(key, num_shards);
 }
 
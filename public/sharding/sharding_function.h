@@ -17,22 +17,49 @@
 #ifndef PUBLIC_SHARDING_SHARDING_FUNCTION_H_
 #define PUBLIC_SHARDING_SHARDING_FUNCTION_H_
 
+#include <cstdint>
 #include <string>
 #include <string_view>
 
+#include "absl/status/statusor.h"
 #include "pir/hashing/sha256_hash_family.h"
 
 namespace kv_server {
 
 // Sharding function to assign different keys to shard numbers within the range
 // [0, `num_shards`).
+//
+// Keys must be assigned to the same shards by the data files, the realtime
+// updates and every server, so all of them must use the same version and seed.
 class ShardingFunction {
  public:
-  explicit ShardingFunction(std::string seed);
+  // The numbers are stored in the file metadata and the server parameters, so
+  // they must never change.
+  enum class Version : int32_t {
+    // SHA256 of the key, mod the number of shards. Files that don't record a
+    // version were sharded with it.
+    kSha256 = 0,
+    // SipHash-2-4 of the key, keyed with the SHA256 of the seed. Much cheaper
+    // per key than `kSha256`. The seed is not a secret: anyone who knows it
+    // can tell the shard of a key.
+    kSipHash = 1,
+  };
+
+  explicit ShardingFunction(std::string seed,
+                            Version version = Version::kSha256);
+
+  // Returns the version with the given number, which is an error for
+  // versions that this build doesn't know of.
+  static absl::StatusOr<Version> GetVersion(int32_t version_number);
+
   int GetShardNumForKey(std::string_view key, int num_shards) const;
 
+  Version version() const { return version_; }
+
  private:
+  Version version_;
   distributed_point_functions::SHA256HashFunction hash_function_;
+  uint64_t siphash_key_[2];
 };
 
 }  // namespace kv_server
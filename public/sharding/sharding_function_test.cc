@@ -16,6 +16,9 @@
 
 #include "public/sharding/sharding_function.h"
 
+#include <string>
+#include <vector>
+
 #include "gtest/gtest.h"
 
 namespace kv_server {
@@ -28,5 +31,41 @@ TEST(ShardingFunctionTest, VerifyAssigningKeysToShards) {
   EXPECT_EQ(1, func.GetShardNumForKey("key3", 7));
 }
 
+TEST(ShardingFunctionTest, VerifyAssigningKeysToShardsWithSipHash) {
+  ShardingFunction func("", ShardingFunction::Version::kSipHash);
+  EXPECT_EQ(0, func.GetShardNumForKey("key1", 7));
+  EXPECT_EQ(6, func.GetShardNumForKey("key2", 7));
+  EXPECT_EQ(2, func.GetShardNumForKey("key3", 7));
+}
+
+TEST(ShardingFunctionTest, SipHashDependsOnSeed) {
+  ShardingFunction func("seed", ShardingFunction::Version::kSipHash);
+  EXPECT_EQ(3, func.GetShardNumForKey("key1", 7));
+  EXPECT_EQ(1, func.GetShardNumForKey("key2", 7));
+  EXPECT_EQ(2, func.GetShardNumForKey("key3", 7));
+}
+
+TEST(ShardingFunctionTest, SipHashSpreadsKeysEvenly) {
+  ShardingFunction func("", ShardingFunction::Version::kSipHash);
+  constexpr int kNumShards = 8;
+  constexpr int kNumKeys = 80000;
+  std::vector<int> keys_per_shard(kNumShards);
+  for (int i = 0; i < kNumKeys; i++) {
+    keys_per_shard[func.GetShardNumForKey(std::to_string(i), kNumShards)]++;
+  }
+  for (int num_keys : keys_per_shard) {
+    EXPECT_NEAR(num_keys, kNumKeys / kNumShards, kNumKeys / kNumShards / 20);
+  }
+}
+
+TEST(ShardingFunctionTest, GetVersion) {
+  EXPECT_EQ(ShardingFunction::GetVersion(0).value(),
+            ShardingFunction::Version::kSha256);
+  EXPECT_EQ(ShardingFunction::GetVersion(1).value(),
+            ShardingFunction::Version::kSipHash);
+  EXPECT_FALSE(ShardingFunction::GetVersion(2).ok());
+  EXPECT_FALSE(ShardingFunction::GetVersion(-1).ok());
+}
+
 }  // namespace
 }  // namespace kv_server
@@ -35,6 +35,9 @@ ABSL_FLAG(std::string, output_dir, "", "Output file directory");
 ABSL_FLAG(int, num_records, 5, "Number of records to generate");
 ABSL_FLAG(int, num_shards, 1, "Number of shards");
 ABSL_FLAG(int, shard_number, 0, "Shard number");
+ABSL_FLAG(int, sharding_function_version, 0,
+          "Version of the sharding function, 0 for SHA256 and 1 for SipHash. "
+          "Must match the sharding-function-version of the servers.");
 ABSL_FLAG(int64_t, timestamp, absl::ToUnixMicros(absl::Now()),
           "Record timestamp");
 ABSL_FLAG(bool, generate_set_record, false,
@@ -46,23 +49,31 @@ using kv_server::DataRecordStruct;
 using kv_server::KeyValueMutationRecordStruct;
 using kv_server::KeyValueMutationType;
 using kv_server::KVFileMetadata;
+using kv_server::ShardingFunction;
 using kv_server::ShardingMetadata;
 using kv_server::ToDeltaFileName;
 using kv_server::ToFlatBufferBuilder;
 using kv_server::ToStringView;
 
+ShardingFunction GetShardingFunction() {
+  const auto version = ShardingFunction::GetVersion(
+      absl::GetFlag(FLAGS_sharding_function_version));
+  CHECK(version.ok()) << version.status();
+  return ShardingFunction(/*seed=*/"", *version);
+}
+
 void WriteKeyValueRecords(std::string_view key, int value_size,
                           riegeli::RecordWriterBase& writer) {
   const int repetition = absl::GetFlag(FLAGS_num_records);
   int64_t timestamp = absl::GetFlag(FLAGS_timestamp);
   const int64_t num_shards = absl::GetFlag(FLAGS_num_shards);
   const int64_t current_shard_number = absl::GetFlag(FLAGS_shard_number);
+  const ShardingFunction sharding_func = GetShardingFunction();
   std::string query(" ");
   for (int i = 0; i < repetition; ++i) {
     const std::string value(value_size, 'A' + (i % 50));
     const std::string actual_key = absl::StrCat(key, i);
     if (num_shards > 1) {
-      kv_server::ShardingFunction sharding_func("");
       auto shard_number =
           sharding_func.GetShardNumForKey(actual_key, num_shards);
       if (shard_number != current_shard_number) {
@@ -116,6 +127,8 @@ KVFileMetadata GetKVFileMetadata() {
     const int shard_number = absl::GetFlag(FLAGS_shard_number);
     ShardingMetadata sharding_metadata;
     sharding_metadata.set_shard_num(shard_number);
+    sharding_metadata.set_sharding_function_version(
+        absl::GetFlag(FLAGS_sharding_function_version));
     *file_metadata.mutable_sharding_metadata() = sharding_metadata;
   }
   return file_metadata;